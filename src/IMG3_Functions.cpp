@@ -70,7 +70,8 @@ static uint8_t * MapFileToMemory( const char *fileName, uint32_t *fileSize, uint
 		*mapSize = *fileSize;
 	}
 
-	data = (uint8_t *) mmap( NULL, *mapSize, PROT_READ, MAP_PRIVATE, fd, 0 );
+	/* The mapping is private, so callers may patch it in place without the change ever reaching the file. */
+	data = (uint8_t *) mmap( NULL, *mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
 	if ( data == MAP_FAILED ) {
 		PRINT_SYSTEM_ERROR();
 		close( fd );
@@ -93,6 +94,94 @@ static void UnmapFileFromMemory( uint8_t *data, uint32_t mapSize )
 	}
 }
 
+/*! \fn		uint8_t * LoadIMG3File( IMG3_ZipInterface *zip, const char *archiveFileName, const char *fileName, uint32_t *fileSize, uint32_t *mapSize )
+	\brief	Brings an img3 file into private, writable memory: straight out of the archive when zip is given, otherwise by mapping the file.
+	\param	zip				(Input)		The interface that analyzed the archive, or NULL when fileName is a plain file.
+	\param	archiveFileName	(Input)		The name of the archive holding the member.
+	\param	fileName		(Input)		The name of the member, or of the plain file.
+	\param	fileSize		(Output)	The size of the file.
+	\param	mapSize			(Output)	The size of the memory holding the file, to be passed to ReleaseIMG3File.
+*/
+
+static uint8_t * LoadIMG3File( IMG3_ZipInterface *zip, const char *archiveFileName, const char *fileName, uint32_t *fileSize, uint32_t *mapSize )
+{
+	uint8_t *data;
+	size_t length, size;
+
+	if ( zip == NULL )
+		return MapFileToMemory( fileName, fileSize, mapSize );
+
+	if ( zip->ExtractFileToMemory( archiveFileName, fileName, &data, &length, &size ) != 0 )
+		return NULL;
+	*fileSize = (uint32_t) length;
+	*mapSize = (uint32_t) size;
+	return data;
+}
+
+static void ReleaseIMG3File( IMG3_ZipInterface *zip, uint8_t *data, uint32_t mapSize )
+{
+	if ( zip == NULL )
+		UnmapFileFromMemory( data, mapSize );
+	else
+		IMG3_ZipInterface::ReleaseFileMemory( data, mapSize );
+}
+
+/*! \fn		int32_t RepackArchive( IMG3_ZipInterface *zip, const char *archiveFileName, const char *outputFileName, list< ZIP_Replacement > *replacements )
+	\brief	Writes a copy of the archive, named <name>_repacked<extension>, in which the given members are replaced.  Every other member is copied
+			still compressed, so only the replaced ones cost any compression time.
+	\param	zip				(Input)		The interface that analyzed the archive.
+	\param	archiveFileName	(Input)		The name of the archive.
+	\param	outputFileName	(Input)		The name the patched members themselves were written to, which the copy must not replace.
+	\param	replacements	(Input)		The members to replace and their new contents.
+*/
+
+static int32_t RepackArchive( IMG3_ZipInterface *zip, const char *archiveFileName, const char *outputFileName, list< ZIP_Replacement > *replacements )
+{
+	list< ZIP_Replacement >::iterator replacementIt;
+	ZIP_Replacement *replacementArray;
+	const char *extension, *slash;
+	char repackedFileName[ 2049 ];
+	uint32_t count = 0;
+	int32_t result;
+
+	/* Keep the extension, so firmware.ipsw becomes firmware_repacked.ipsw.  The patched kernel goes to <archive>_patched, so the two
+		names never meet, but an explicit output name could still be anything. */
+	extension = strrchr( archiveFileName, '.' );
+	slash = strrchr( archiveFileName, '/' );
+	if ( extension == NULL || ( slash != NULL && extension < slash ) )
+		extension = archiveFileName + strlen( archiveFileName );
+	snprintf( repackedFileName, 2048, "%.*s_repacked%s", (int)( extension - archiveFileName ), archiveFileName, extension );
+	if ( strcmp( repackedFileName, outputFileName ) == 0 ) {
+		fprintf( stderr, "%s: not repacking the archive over the patched kernel in %s.\n", __FUNCTION__, outputFileName );
+		return -1;
+	}
+
+	replacementArray = new ZIP_Replacement[ replacements->size() + 1 ];
+	for ( replacementIt = replacements->begin(); replacementIt != replacements->end(); ++replacementIt )
+		replacementArray[ count++ ] = *replacementIt;
+
+	fprintf( stdout, "Repacking archive into %s...\r\n", repackedFileName );
+	result = zip->RewriteArchive( archiveFileName, repackedFileName, replacementArray, count );
+	if ( result == 0 )
+		fprintf( stdout, "Repacked archive written to %s.\n", repackedFileName );
+	delete[]( replacementArray );
+	return result;
+}
+
+/*! \fn		void ConfigureIndexCache( IMG3_ZipInterface *zip )
+	\brief	Enables central directory index sidecars when IMG3_INDEX_CACHE is set: to a directory holding them, or to an empty string to keep each one next to its archive.
+	\param	zip	(Input)	The interface about to analyze an archive.
+*/
+
+static void ConfigureIndexCache( IMG3_ZipInterface *zip )
+{
+	const char *directory = getenv( "IMG3_INDEX_CACHE" );
+
+	if ( directory == NULL )
+		return;
+	zip->SetIndexCache( 1, ( directory[0] != '\0' ) ? directory : NULL );
+}
+
 static int32_t WriteDataToFile( const char *fileName, uint8_t *data, uint32_t dataLength )
 {
 	FILE *outputFile;
@@ -118,6 +207,72 @@ static int32_t WriteDataToFile( const char *fileName, uint8_t *data, uint32_t da
 	return 0;
 }
 
+/*! \fn		IMG3_LzssInterface_Index * OpenLZSSIndex( IMG3_LzssInterface *lzss, uint8_t *data, const char *indexFileName )
+	\brief	Loads the checkpoint index cached next to a compressed stream, so it can be decompressed on every core.
+	\param	lzss			(Input)	The interface that will decompress the stream.
+	\param	data			(Input)	The compressed stream, starting with its header.
+	\param	indexFileName	(Input)	The name of the sidecar file; may be NULL.
+*/
+
+static IMG3_LzssInterface_Index * OpenLZSSIndex( IMG3_LzssInterface *lzss, uint8_t *data, const char *indexFileName )
+{
+	IMG3_LzssInterface_CompressionHeader *header = (IMG3_LzssInterface_CompressionHeader *) data;
+	IMG3_LzssInterface_Index *index = NULL;
+
+	lzss->SetThreadCount( 0 );
+	if ( indexFileName == NULL || access( indexFileName, R_OK ) != 0 )
+		return NULL;
+	if ( lzss->LzssLoadIndex( indexFileName, &index ) != 0 )
+		return NULL;
+
+	// A sidecar left behind by a different stream is ignored here and rebuilt once the stream is decoded.
+	if ( index->checksum != ntohl( header->checksum ) || index->length_uncompressed != ntohl( header->length_uncompressed ) ||
+		 index->length_compressed != ntohl( header->length_compressed ) ) {
+		lzss->LzssFreeIndex( index );
+		return NULL;
+	}
+
+	fprintf( stdout, "Using decompression index %s...\r\n", indexFileName );
+	lzss->SetDecompressIndex( index );
+	return index;
+}
+
+/*! \fn		void CloseLZSSIndex( IMG3_LzssInterface *lzss, IMG3_LzssInterface_Index *index, uint8_t *data, size_t length, uint8_t *plaintext, size_t plainLength, const char *indexFileName )
+	\brief	Releases an index loaded by OpenLZSSIndex, or caches a new one if the stream had none or its checkpoints didn't line up with the stream.
+	\param	lzss			(Input)	The interface that decompressed the stream.
+	\param	index			(Input)	The index returned by OpenLZSSIndex; may be NULL.
+	\param	data			(Input)	The compressed stream, starting with its header.
+	\param	length			(Input)	The length of the compressed stream.
+	\param	plaintext		(Input)	The decompressed data, or NULL if decompression failed.
+	\param	plainLength		(Input)	The length of the decompressed data.
+	\param	indexFileName	(Input)	The name of the sidecar file; may be NULL.
+*/
+
+static void CloseLZSSIndex( IMG3_LzssInterface *lzss, IMG3_LzssInterface_Index *index, uint8_t *data, size_t length, uint8_t *plaintext, size_t plainLength, const char *indexFileName )
+{
+	int32_t verifyPolicy;
+
+	lzss->SetDecompressIndex( NULL );
+	// A sidecar whose header matched but which the decoder had to abandon is corrupt, so it is replaced like a missing one.
+	if ( index != NULL && lzss->GetThreadCount() > 1 && !lzss->DecompressIndexUsed() ) {
+		lzss->LzssFreeIndex( index );
+		index = NULL;
+	}
+	if ( index == NULL && indexFileName != NULL && plaintext != NULL ) {
+		// The data was checked while it was decoded, and walking the tokens against it is far cheaper than decoding again.
+		verifyPolicy = lzss->GetVerifyPolicy();
+		lzss->SetVerifyPolicy( IMG3_LZSS_VERIFY_IGNORE );
+		if ( lzss->LzssBuildIndex( data, length, plaintext, plainLength, 0, &index ) != 0 ) {
+			lzss->SetVerifyPolicy( verifyPolicy );
+			return;
+		}
+		lzss->SetVerifyPolicy( verifyPolicy );
+		fprintf( stdout, "Caching decompression index in %s...\r\n", indexFileName );
+		lzss->LzssSaveIndex( index, indexFileName );
+	}
+	lzss->LzssFreeIndex( index );
+}
+
 static uint8_t * 
 EncryptIMG3Data( uint8_t *data, uint32_t length, char *deviceName, char *deviceVersion, char *section, uint8_t compress, uint8_t **encryptedData, uint32_t *encryptedLength ) 
 {
@@ -136,9 +291,14 @@ EncryptIMG3Data( uint8_t *data, uint32_t length, char *deviceName, char *deviceV
 
 	if ( compress == 1 ) {
 		fprintf( stdout, "Compressing 0x%08x bytes of data...\r\n", length );
+		/* The optimal parse keeps the recompressed kernel as close as possible to the size of Apple's original. */
+		lzss.SetMatchFinder( IMG3_LZSS_ENGINE_HASH_CHAIN );
+		lzss.SetCompressionLevel( IMG3_LZSS_LEVEL_OPTIMAL );
+		lzss.SetThreadCount( 0 );
 		if ( lzss.LzssCompress( data, (size_t) length, &dataToEncrypt, &compressedLength) != 0) {
 			goto EncryptIMG3Data_return;
 		}
+		lzss.PrintCompressionStats( stdout );
 		length = compressedLength;
 	} else {
 		dataToEncrypt = data;
@@ -179,10 +339,11 @@ EncryptIMG3Data_return:
 }
 
 static uint8_t * 
-DecryptIMG3Data( uint8_t *data, uint32_t length, char *deviceName, char *deviceVersion, char *section, uint8_t **decryptedData, uint32_t *decryptedLength ) 
+DecryptIMG3Data( uint8_t *data, uint32_t length, char *deviceName, char *deviceVersion, char *section, uint8_t decompress, const char *indexFileName, uint8_t **decryptedData, uint32_t *decryptedLength ) 
 {
 	IMG3_OpensslInterface openssl;
 	IMG3_LzssInterface lzss;
+	IMG3_LzssInterface_Index *index;
 	IMG3_Sqlite3 sq;
 	char *key = NULL, *iv = NULL;
 	uint8_t *dataToDecrypt = NULL, *decompressedData = NULL;
@@ -240,10 +401,15 @@ DecryptIMG3Data( uint8_t *data, uint32_t length, char *deviceName, char *deviceV
 	if ( openssl.DecryptData(dataToDecrypt, *decryptedLength, decryptedData) )
 		goto DecryptIMG3File_free_data;
 
-	if ( lzss.IsFileCompressed( *decryptedData ) == 0 ) {
+	if ( decompress == 1 && lzss.IsFileCompressed( *decryptedData ) == 0 ) {
 		fprintf( stdout, "Data appears to be compressed.  Decompressing 0x%08x bytes to data...\r\n", length );
-		if ( lzss.LzssDecompress( *decryptedData, (size_t) *decryptedLength, &decompressedData, &decompressedLength ) ) 
+		lzss.SetVerifyPolicy( IMG3_LZSS_VERIFY_WARN );
+		index = OpenLZSSIndex( &lzss, *decryptedData, indexFileName );
+		if ( lzss.LzssDecompress( *decryptedData, (size_t) *decryptedLength, &decompressedData, &decompressedLength ) ) {
+			CloseLZSSIndex( &lzss, index, *decryptedData, (size_t) *decryptedLength, NULL, 0, NULL );
 			goto DecryptIMG3File_free_decrypted;
+		}
+		CloseLZSSIndex( &lzss, index, *decryptedData, (size_t) *decryptedLength, decompressedData, decompressedLength, indexFileName );
 		
 	//	delete ( *decryptedData );
 		*decryptedData = decompressedData;
@@ -275,6 +441,7 @@ int32_t ListArchiveFiles( char *archiveFileName )
 
 	ASSERT_RET( archiveFileName, -1 );
 
+	ConfigureIndexCache( &zip );
 	files = zip.AnalyzeFile( archiveFileName );
 	if (files == NULL) 
 		return -1;
@@ -288,19 +455,47 @@ int32_t ListArchiveFiles( char *archiveFileName )
 	return 0;
 }
 
-int32_t ExtractFileFromArchive( char *archiveFileName, char *section )
+int32_t ExtractFileFromArchive( char *archiveFileName, char *section, list< char * > *includes, list< char * > *excludes )
 {
 	IMG3_ZipInterface zip;
+	IMG3_ZipSelector selector;
 	list< char * > *files;
 	list< char * >::iterator fileIt;
+	bool usePatterns;
 
 	ASSERT_RET( archiveFileName, -1 );
 
+	// Every pattern is compiled once, before the archive is touched, so a bad one fails fast.  A
+	// section keeps selecting what it selects on its own; includes add to it and excludes remove from it.
+	usePatterns = false;
+	if ( includes != NULL ) {
+		for ( fileIt = includes->begin(); fileIt != includes->end(); ++fileIt ) {
+			if ( selector.Include( *fileIt ) != 0 )
+				return -1;
+			usePatterns = true;
+		}
+	}
+	if ( excludes != NULL ) {
+		for ( fileIt = excludes->begin(); fileIt != excludes->end(); ++fileIt ) {
+			if ( selector.Exclude( *fileIt ) != 0 )
+				return -1;
+			usePatterns = true;
+		}
+	}
+
+	ConfigureIndexCache( &zip );
 	files = zip.AnalyzeFile( archiveFileName );
 	if ( files == NULL )
 		return -1;
 
-	if (section != NULL )
+	zip.SetThreadCount( 0 );
+	if ( usePatterns ) {
+		files = zip.ExtractFiles( archiveFileName, &selector, section );
+		if ( files == NULL || files->empty() )
+			fprintf( stderr, "%s: no files in %s match the given patterns.\n", __FUNCTION__, archiveFileName );
+		if ( files != NULL )
+			delete( files );
+	} else if (section != NULL )
 		zip.ExtractFiles( archiveFileName, section );
 	else
 		zip.ExtractAllFiles( archiveFileName );
@@ -353,18 +548,30 @@ UpdateIMG3Database_return:
 	return -1;
 }
 
-int32_t PatchKernelFile( char *archiveFileName, char *outputFileName, char *patchFileName, char *deviceName, char *deviceVersion ) {
-	IMG3_ZipInterface zip;
+int32_t PatchKernelFile( char *archiveFileName, char *outputFileName, char *patchFileName, char *deviceName, char *deviceVersion, uint8_t repack ) {
+	IMG3_ZipInterface zip, *archive = NULL;
 	IMG3_FileInterface fileInterface;
+	IMG3_LzssInterface lzss;
 	list< char * > *files, *extractedFiles;
 	list< char * >::iterator fileIt;
+	list< IMG3_LzssInterface_Patch > patches;
+	list< IMG3_LzssInterface_Patch >::iterator patchIt;
+	list< uint32_t > originals;
+	list< ZIP_Replacement > replacements;
+	list< ZIP_Replacement >::iterator replacementIt;
+	list< uint32_t > replacementMaps;
+	list< uint32_t >::iterator mapIt;
+	ZIP_Replacement replacement;
 	char section[] = "kernelcache";
-	uint8_t allocatedList = 0;
+	uint8_t allocatedList = 0, compressed = 0;
 	uint8_t *patchFileData = NULL, *data = NULL, *encryptedData = NULL, *decryptedData = NULL, *reencryptedData = NULL;
+	uint8_t *kernelData = NULL, *recompressedData = NULL;
 	uint32_t fileSize, mapSize;
 	FILE *output = NULL, *patchFile = NULL;	
 	uint32_t encryptedLength, decryptedLength, reencryptedLength;
+	size_t kernelLength, recompressedLength;
 	char lineBuffer[ 128 ];
+	char generatedFileName[ 2049 ];
 
 	ASSERT_RET( archiveFileName, -1 );
 	ASSERT_RET( patchFileName, -1 );
@@ -373,6 +580,7 @@ int32_t PatchKernelFile( char *archiveFileName, char *outputFileName, char *patc
 
 	/* First step: scan the archive provided for files that match the section kernelcache. */
 	fprintf( stdout, "Scanning archive %s for %s files...\r\n", archiveFileName, section );
+	ConfigureIndexCache( &zip );
 	files = zip.AnalyzeFile( archiveFileName );
 	if ( files == NULL ) {
 		/* The file may not be a zip archive.  For instance, the user may have provided an actual kernelcache file rather than
@@ -388,21 +596,22 @@ int32_t PatchKernelFile( char *archiveFileName, char *outputFileName, char *patc
 		allocatedList = 1;
 		extractedFiles->push_back( archiveFileName );
 	} else {
-		fprintf( stdout, "Extracting all files for section %s...\r\n", section );
-		extractedFiles = zip.ExtractFiles( archiveFileName, section );
+		/* Matching members are extracted straight into memory one at a time, so nothing is written next to the archive. */
+		extractedFiles = zip.MatchFiles( section );
 		if ( extractedFiles == NULL )
 			goto PatchKernelFile_close_patch;
+		allocatedList = 1;
+		archive = &zip;
+	}
+
+	if ( outputFileName == NULL ) {
+		snprintf( generatedFileName, 2048, "%s_patched", archiveFileName );
+		outputFileName = generatedFileName;
 	}
 
 	/* Once we have our list of matching files, go through them one at a time applying the patches. */
 	for ( fileIt = extractedFiles->begin(); fileIt != extractedFiles->end(); ++fileIt ) {
-		if ( outputFileName != NULL ) {
-			output = fopen( outputFileName, "wb" );
-		} else {
-			char generatedFileName[ 2049 ];
-			snprintf( generatedFileName, 2048, "%s_patched", archiveFileName );
-			output = fopen( generatedFileName, "wb" );
-		}
+		output = fopen( outputFileName, "wb" );
 		if ( output == NULL ) {
 			PRINT_SYSTEM_ERROR();
 			goto PatchKernelFile_return;
@@ -414,81 +623,116 @@ int32_t PatchKernelFile( char *archiveFileName, char *outputFileName, char *patc
 			goto PatchKernelFile_close_output;
 		}
 
-		fprintf( stdout, "Memory mapping the file %s in prep for decryption...\r\n", *fileIt );
+		fprintf( stdout, "Loading the file %s into memory in prep for decryption...\r\n", *fileIt );
 
-		/* Before patching each file, map it to memory. */
-		data = MapFileToMemory( *fileIt, &fileSize, &mapSize );
+		/* Before patching each file, load it into memory.  The memory is private to this process, so it is patched in place
+			without altering the original. */
+		data = LoadIMG3File( archive, archiveFileName, *fileIt, &fileSize, &mapSize );
 		if ( data == NULL )
 			goto PatchKernelFile_delete_list;
-
-		/* Since the original file is mapped to memory, we don't want to alter it.  Just make a copy. */
-		patchFileData = new uint8_t[ mapSize ];
-		if (patchFileData == NULL ) {
-			PRINT_SYSTEM_ERROR();
-			goto PatchKernelFile_unmap_file;
-		}
-
-		memset( patchFileData, 0, mapSize );
-		memcpy( patchFileData, data, fileSize );
+		patchFileData = data;
 
 		/* Scan the file looking for the 'DATA' tag. */
 		fprintf( stdout, "Retrieving data section...\r\n" );
 		if ( fileInterface.ParseFile( patchFileData, fileSize ) )
 			goto PatchKernelFile_unmap_file;
 
-		//TBD: Fix this call
-		//encryptedData = fileInterface.GetSectionData( IMG3_DATA );
+		encryptedData = fileInterface.GetSectionData( IMG3_DATA );
 		if (encryptedData == NULL )
 			goto PatchKernelFile_unmap_file;
 
-		//TBD: Fix this call
-		//encryptedLength = fileInterface.GetSectionLength(IMG3_DATA);
+		encryptedLength = fileInterface.GetSectionDataLength( IMG3_DATA );
 		if (encryptedLength == 0) {
 			goto PatchKernelFile_unmap_file;
 		}
 		
-		/* Once we have the location of the data section, decrypt it and copy it's contents into decryptedData. */
-		DecryptIMG3Data( encryptedData, encryptedLength, deviceName, deviceVersion, section, &decryptedData, &decryptedLength );
+		/* Once we have the location of the data section, decrypt it and copy it's contents into decryptedData.  The data is
+			left compressed so that only the parts around the patches have to be recompressed afterwards. */
+		DecryptIMG3Data( encryptedData, encryptedLength, deviceName, deviceVersion, section, 0, NULL, &decryptedData, &decryptedLength );
 		if ( decryptedData == NULL ) 
 			goto PatchKernelFile_unmap_file;
 
+		compressed = ( lzss.IsFileCompressed( decryptedData ) == 0 );
+		if ( compressed ) {
+			fprintf( stdout, "Decompressing kernel...\r\n" );
+			lzss.SetVerifyPolicy( IMG3_LZSS_VERIFY_WARN );
+			if ( lzss.LzssDecompress( decryptedData, (size_t) decryptedLength, &kernelData, &kernelLength ) )
+				goto PatchKernelFile_delete_decrypted;
+		} else {
+			kernelData = decryptedData;
+			kernelLength = decryptedLength;
+		}
+
 		fprintf( stdout, "Patching kernel...\r\n" );
 
 		/* Then, one line at a time, apply our patches. */
 		while (fgets(lineBuffer, 128, patchFile) != NULL) {
 			uint32_t patchAddress, patchValue;
 			uint32_t *tempPtr;
+			IMG3_LzssInterface_Patch patch;
 			
 			/* The patch file should consist of two items per line: <patch_address> <patch_value>
 				fgets will typically read a blank line at the end, so if we don't get two values from the line, just break out. */
 			if ( sscanf(lineBuffer, "%x %x", &patchAddress, &patchValue) < 2 )
 				break;
-			if (patchAddress > decryptedLength) {
+			if (kernelLength < sizeof(uint32_t) || patchAddress > kernelLength - sizeof(uint32_t)) {
 				fprintf(stdout,"The patch at address 0x%08x appears to be outside the file.\n", patchAddress);
 				continue;
 			}
 			printf("Applying patch at address 0x%08x with value 0x%08x...\n", patchAddress, patchValue);
-			tempPtr = (uint32_t *)(decryptedData + patchAddress);
+			tempPtr = (uint32_t *)(kernelData + patchAddress);
+
+			/* Remember what was there so the checksum can be updated without rescanning the kernel. */
+			originals.push_back( *tempPtr );
+			patch.offset = patchAddress;
+			patch.length = sizeof(uint32_t);
+			patch.original = (uint8_t *)&originals.back();
+			patches.push_back( patch );
+
 			*tempPtr = patchValue;
 		}
 
-		fprintf( stdout, "Recompressing and encrypting data...\r\n" );
+		if ( compressed ) {
+			IMG3_LzssInterface_Patch *patchList;
+			uint32_t patchCount = 0;
 
-		/* Once we've patched the kernel, we need to recompress and reencrypt it. */
-		EncryptIMG3Data( decryptedData, decryptedLength, deviceName, deviceVersion, section, 1, &reencryptedData, &reencryptedLength );
+			patchList = new IMG3_LzssInterface_Patch[ patches.size() + 1 ];
+			if ( patchList == NULL ) {
+				PRINT_SYSTEM_ERROR();
+				goto PatchKernelFile_delete_kernel;
+			}
+			for ( patchIt = patches.begin(); patchIt != patches.end(); ++patchIt )
+				patchList[ patchCount++ ] = *patchIt;
+
+			/* Only the tokens around each patch are recompressed; the rest of Apple's original stream is kept as is.  The result
+				is sized to fill the original DATA section exactly, so it can be written back in place. */
+			fprintf( stdout, "Recompressing patched regions...\r\n" );
+			lzss.SetMatchFinder( IMG3_LZSS_ENGINE_HASH_CHAIN );
+			lzss.SetCompressionLevel( IMG3_LZSS_LEVEL_OPTIMAL );
+			if ( lzss.LzssRecompressToSize( decryptedData, (size_t) decryptedLength, kernelData, kernelLength, patchList, patchCount,
+											&recompressedData, &recompressedLength ) ) {
+				delete[]( patchList );
+				goto PatchKernelFile_delete_kernel;
+			}
+			delete[]( patchList );
+			lzss.PrintCompressionStats( stdout );
+		} else {
+			recompressedData = kernelData;
+			recompressedLength = kernelLength;
+		}
+
+		fprintf( stdout, "Encrypting data...\r\n" );
+
+		/* Once we've patched the kernel, we need to reencrypt it. */
+		EncryptIMG3Data( recompressedData, recompressedLength, deviceName, deviceVersion, section, 0, &reencryptedData, &reencryptedLength );
 		if ( reencryptedData == NULL )
-			goto PatchKernelFile_delete_decrypted;
-		/* If all we've done is overwrite values in the kernel, our size should be the same. */
-//		if ( encryptedLength != reencryptedLength ) {
-//			fprintf( stdout, "Reencrypted data length is different.  Looks like we'll need to add support for this.\r\n" );
-//			delete( reencryptedData );
-//			delete( decryptedData );
-//			UnmapFileFromMemory( data, mapSize );
-//			fclose( patchFile );
-//			fclose( output );
-//			continue;
-//			goto PatchKernelFile_delete_reencrypted;
-//		}
+			goto PatchKernelFile_delete_recompressed;
+		/* The recompressed stream fills exactly the space of the original, so the DATA section can be overwritten in place
+			without moving anything that follows it. */
+		if ( reencryptedLength != decryptedLength ) {
+			fprintf( stderr, "Reencrypted data length 0x%08x doesn't match the original 0x%08x.\r\n", reencryptedLength, decryptedLength );
+			goto PatchKernelFile_delete_reencrypted;
+		}
 
 		/* Overwrite the existing data section with our patched version. */
 		memcpy(encryptedData, reencryptedData, reencryptedLength );
@@ -501,24 +745,54 @@ int32_t PatchKernelFile( char *archiveFileName, char *outputFileName, char *patc
 		fprintf(stdout, "All data successfully written to file.\n");
 		fclose( output );
 		fclose( patchFile );
-		UnmapFileFromMemory( data, mapSize );
+		/* When asked to, members patched out of an archive are kept in memory until the archive has been repacked with them. */
+		if ( repack && archive != NULL ) {
+			replacement.fileName = *fileIt;
+			replacement.data = patchFileData;
+			replacement.length = fileSize;
+			replacements.push_back( replacement );
+			replacementMaps.push_back( mapSize );
+		} else {
+			ReleaseIMG3File( archive, data, mapSize );
+		}
+		if ( compressed ) {
+			delete[]( recompressedData );
+			delete[]( kernelData );
+		}
 		delete( decryptedData );
 		delete( reencryptedData );
 		decryptedData = NULL;
+		kernelData = NULL;
+		recompressedData = NULL;
 		reencryptedData = NULL;
+		patches.clear();
+		originals.clear();
 	}
 	if ( allocatedList == 1 )
 		delete( extractedFiles );
+
+	if ( !replacements.empty() && RepackArchive( archive, archiveFileName, outputFileName, &replacements ) != 0 )
+		goto PatchKernelFile_return;
+	for ( replacementIt = replacements.begin(), mapIt = replacementMaps.begin(); replacementIt != replacements.end(); ++replacementIt, ++mapIt )
+		ReleaseIMG3File( archive, (uint8_t *) replacementIt->data, *mapIt );
 	return 0;
 
 PatchKernelFile_delete_reencrypted:
 	delete( reencryptedData );
 
+PatchKernelFile_delete_recompressed:
+	if ( compressed )
+		delete[]( recompressedData );
+
+PatchKernelFile_delete_kernel:
+	if ( compressed )
+		delete[]( kernelData );
+
 PatchKernelFile_delete_decrypted:
 	delete( decryptedData );
 
 PatchKernelFile_unmap_file:
-	UnmapFileFromMemory( data, mapSize );
+	ReleaseIMG3File( archive, data, mapSize );
 
 PatchKernelFile_delete_list:
 	if ( allocatedList == 1 ) {
@@ -533,19 +807,22 @@ PatchKernelFile_close_output:
 	fclose( output );
 
 PatchKernelFile_return:
+	for ( replacementIt = replacements.begin(), mapIt = replacementMaps.begin(); replacementIt != replacements.end(); ++replacementIt, ++mapIt )
+		ReleaseIMG3File( archive, (uint8_t *) replacementIt->data, *mapIt );
 	return -1;
 }
 
 int32_t DecryptIMG3File( char *archiveFileName, char *outputFileName, char *deviceName, char *deviceVersion, char *section )
 {
-	IMG3_ZipInterface zip;
+	IMG3_ZipInterface zip, *archive = NULL;
 	IMG3_FileInterface fileInterface;
 	IMG3_FileSection *fileSection;
 	IMG3_FileSection dummySection;
 	list< char * > *files, *extractedFiles;
 	list< char * >::iterator fileIt;	
 	uint8_t *data = NULL, *encryptedData = NULL, *decryptedData = NULL;
-	uint32_t fileSize, mapSize, encryptedDataLength, decryptedLength;
+	uint32_t fileSize, mapSize, encryptedDataLength, decryptedLength, indexLength;
+	char *indexFileName;
 	uint8_t allocatedList = 0;
 
 	ASSERT_RET( archiveFileName, -1 );
@@ -554,6 +831,7 @@ int32_t DecryptIMG3File( char *archiveFileName, char *outputFileName, char *devi
 	ASSERT_RET( section, -1 );
 
 	fprintf( stdout, "Analyzing archive file %s...\r\n", archiveFileName );
+	ConfigureIndexCache( &zip );
 	files = zip.AnalyzeFile( archiveFileName );
 	if ( files == NULL ) {
 		if ( zip.GetError() != ZIP_ERROR_NOT_A_ZIP_FILE )
@@ -566,14 +844,17 @@ int32_t DecryptIMG3File( char *archiveFileName, char *outputFileName, char *devi
 		allocatedList = 1;
 		extractedFiles->push_back( archiveFileName );
 	} else {
-		fprintf( stdout, "Extracting all files for section %s...\r\n", section );
-		extractedFiles = zip.ExtractFiles( archiveFileName, section );
+		extractedFiles = zip.MatchFiles( section );
+		if ( extractedFiles == NULL )
+			goto DecryptIMG3File_return;
+		allocatedList = 1;
+		archive = &zip;
 	}
 
 	for ( fileIt = extractedFiles->begin(); fileIt != extractedFiles->end(); ++fileIt ) {
-		fprintf( stdout, "Memory mapping the file %s in prep for decryption...\r\n", *fileIt );
+		fprintf( stdout, "Loading the file %s into memory in prep for decryption...\r\n", *fileIt );
 
-		data = MapFileToMemory( *fileIt, &fileSize, &mapSize );
+		data = LoadIMG3File( archive, archiveFileName, *fileIt, &fileSize, &mapSize );
 		if ( data == NULL )
 			goto DecryptIMG3File_delete_list;
 
@@ -592,9 +873,22 @@ int32_t DecryptIMG3File( char *archiveFileName, char *outputFileName, char *devi
 		if ( encryptedDataLength == 0 )
 			goto DecryptIMG3File_unmap_file;
 
-		WriteDataToFile( "data_section.bin", encryptedData, encryptedDataLength );
+		// Compressed sections are decoded on every core once a checkpoint index has been cached next to the file.  Members
+		// never reach the disk, so their index is cached next to the archive under the member's base name instead.
+		if ( archive != NULL ) {
+			const char *baseName = strrchr( *fileIt, '/' );
 
-		DecryptIMG3Data( encryptedData, encryptedDataLength, deviceName, deviceVersion, section, &decryptedData, &decryptedLength );
+			baseName = ( baseName != NULL ) ? baseName + 1 : *fileIt;
+			indexLength = strlen( archiveFileName ) + strlen( baseName ) + strlen( "..lzidx" ) + 1;
+			indexFileName = new char[ indexLength ];
+			snprintf( indexFileName, indexLength, "%s.%s.lzidx", archiveFileName, baseName );
+		} else {
+			indexLength = strlen( *fileIt ) + strlen( ".lzidx" ) + 1;
+			indexFileName = new char[ indexLength ];
+			snprintf( indexFileName, indexLength, "%s.lzidx", *fileIt );
+		}
+		DecryptIMG3Data( encryptedData, encryptedDataLength, deviceName, deviceVersion, section, 1, indexFileName, &decryptedData, &decryptedLength );
+		delete[]( indexFileName );
 		if (decryptedData == NULL )
 			goto DecryptIMG3File_unmap_file;
 
@@ -616,7 +910,7 @@ int32_t DecryptIMG3File( char *archiveFileName, char *outputFileName, char *devi
 
 		delete( decryptedData );
 		decryptedData = NULL;
-		UnmapFileFromMemory( data, mapSize );
+		ReleaseIMG3File( archive, data, mapSize );
 	}
 	if ( allocatedList == 1 )
 		delete( extractedFiles );
@@ -626,7 +920,7 @@ DecryptIMG3File_delete_decrypted:
 	delete( decryptedData );
 
 DecryptIMG3File_unmap_file:
-	UnmapFileFromMemory( data, mapSize );
+	ReleaseIMG3File( archive, data, mapSize );
 
 DecryptIMG3File_delete_list:
 	if ( allocatedList == 1 )
@@ -657,12 +951,14 @@ void ParseIMG3File( char *fileName )
 int32_t DecompressLZSSFile( char *fileName )
 {
 	IMG3_LzssInterface lzss;
-	uint32_t fileSize, mapSize, decompressedLength;
-	uint8_t *data = NULL;
-	uint8_t *decompressedData = NULL;
-	char *outputFileName;
+	IMG3_LzssInterface_Index *index;
+	uint32_t fileSize, mapSize;
+	size_t decompressedLength;
+	uint8_t *data = NULL, *decompressedData;
+	char *outputFileName, *indexFileName;
 	uint32_t strLength;
-
+	int outputFd;
+	int32_t result = -1;
 
 	data = MapFileToMemory( fileName, &fileSize, &mapSize );
 	if( data == NULL ) {
@@ -670,12 +966,10 @@ int32_t DecompressLZSSFile( char *fileName )
 		return -1;
 	}
 
-	if ( lzss.IsFileCompressed( data ) == 0 ) {
-		fprintf( stdout, "Data appears to be compressed.  Decompressing 0x%08x bytes to data...\r\n", fileSize );
-		if ( lzss.LzssDecompress( data, (size_t) fileSize, &decompressedData, &decompressedLength ) ) {
-			UnmapFileFromMemory( data, mapSize );
-			return -1;
-		}
+	if ( lzss.IsFileCompressed( data ) != 0 ) {
+		fprintf( stderr, "File %s is not LZSS compressed.\r\n", fileName );
+		UnmapFileFromMemory( data, mapSize );
+		return -1;
 	}
 
 	strLength = strlen( fileName ) + strlen( "_decompressed" ) + 1;
@@ -686,9 +980,46 @@ int32_t DecompressLZSSFile( char *fileName )
 		return -1;
 	}
 	snprintf( outputFileName, strLength, "%s_decompressed", fileName );
-	WriteDataToFile( outputFileName, decompressedData, decompressedLength );
-	delete ( outputFileName );
 
+	// Repeat decodes split the stream across every core using the checkpoints cached by the first one.
+	strLength = strlen( fileName ) + strlen( ".lzidx" ) + 1;
+	indexFileName = new char[ strLength ];
+	snprintf( indexFileName, strLength, "%s.lzidx", fileName );
+	index = OpenLZSSIndex( &lzss, data, indexFileName );
+
+	/* The output file is mapped and decompressed into directly, so the data never passes through a heap buffer. */
+	outputFd = open( outputFileName, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+	if ( outputFd == -1 ) {
+		PRINT_SYSTEM_ERROR();
+		CloseLZSSIndex( &lzss, index, data, (size_t) fileSize, NULL, 0, NULL );
+		goto DecompressLZSSFile_free_names;
+	}
+
+	fprintf( stdout, "Data appears to be compressed.  Decompressing 0x%08x bytes to file %s...\r\n", fileSize, outputFileName );
+	if ( lzss.LzssDecompressToFile( data, (size_t) fileSize, outputFd, &decompressedLength ) ) {
+		CloseLZSSIndex( &lzss, index, data, (size_t) fileSize, NULL, 0, NULL );
+		goto DecompressLZSSFile_close_output;
+	}
+	fprintf( stdout, "Wrote 0x%08x bytes of data.\r\n", (uint32_t) decompressedLength );
+
+	// The output is still in the page cache, so reading it back to build the index costs no I/O.
+	decompressedData = NULL;
+	if ( index == NULL && decompressedLength != 0 ) {
+		decompressedData = (uint8_t *) mmap( NULL, decompressedLength, PROT_READ, MAP_SHARED, outputFd, 0 );
+		if ( decompressedData == MAP_FAILED )
+			decompressedData = NULL;
+	}
+	CloseLZSSIndex( &lzss, index, data, (size_t) fileSize, decompressedData, decompressedLength, indexFileName );
+	if ( decompressedData != NULL )
+		munmap( decompressedData, decompressedLength );
+	result = 0;
+
+DecompressLZSSFile_close_output:
+	close( outputFd );
+
+DecompressLZSSFile_free_names:
+	delete[]( indexFileName );
+	delete[]( outputFileName );
 	UnmapFileFromMemory( data, mapSize );
-	return 0;
+	return result;
 }
@@ -27,6 +27,9 @@ char *deviceVersion = NULL;
 char *archiveFileName = NULL;
 char *patchFileName = NULL;
 char *section = NULL;
+list<char *> includePatterns;
+list<char *> excludePatterns;
+uint8_t repackArchive = 0;
 
 char img3SupportedFiles[][30] = {
 		"AppleLogo",
@@ -66,11 +69,13 @@ void PrintUsage(char *progName, char *command) {
 		fprintf(stdout, "Standard commands:\n");
 		fprintf(stdout, "extract\t\tlist\t\tdec\t\tupdate\t\tpatch\n\n");
 		fprintf(stdout,	"For more information on each, enter the command and use '-h'.\n\n");
+		fprintf(stdout,	"Set IMG3_INDEX_CACHE to a directory to cache archive listings there, or to an empty string to\n");
+		fprintf(stdout,	"cache them next to each archive.\n\n");
 		return;
 	}
 	if (strcmp(command, "extract") == 0) {
 		fprintf(stdout,	"%s extract command: extracts one, or all, sections of an img3 archive.\n",	progName);
-		fprintf(stdout, "Syntax: %s %s -s <section> img3_file\n\n", progName, command);
+		fprintf(stdout, "Syntax: %s %s -s <section> -i <pattern> -x <pattern> img3_file\n\n", progName, command);
 		fprintf(stdout, "Options:\n");
 		fprintf(stdout,	"-s\tSpecifies the specific area that should be extracted from the archive.  The currently\n");
 		fprintf(stdout, "\tsupported areas include the following:\n");
@@ -91,6 +96,12 @@ void PrintUsage(char *progName, char *command) {
 		fprintf(stdout, "\t\tKernelCache\n");
 		fprintf(stdout,	"\tAll areas are case-insensitive.  If this parameter is left blank, all files will be \n");
 		fprintf(stdout, "\textracted from the archive.\n");
+		fprintf(stdout,	"-i\tExtracts the files matching a pattern as well.  May be given more than once.  Patterns\n");
+		fprintf(stdout,	"\tcontaining *, ? or [ are globs, matched against the file name alone unless they contain\n");
+		fprintf(stdout,	"\ta /, where ** also matches across directories.  Prefix a pattern with re: for an extended\n");
+		fprintf(stdout,	"\tregular expression, glob: or section: to force either of the other kinds.\n");
+		fprintf(stdout,	"-x\tSkips the files matching a pattern, whatever else selects them.  May be given more than\n");
+		fprintf(stdout,	"\tonce.  All patterns are case-insensitive.\n");
 	} else if (strcmp(command, "list") == 0) {
 		fprintf(stdout,	"%s list command: list all files contained within the img3 archive.\n",	progName);
 		fprintf(stdout, "Syntax: %s %s img3_file\n\n", progName, command);
@@ -161,7 +172,8 @@ void PrintUsage(char *progName, char *command) {
 		fprintf(stdout, "\t\trequired to enter it.\n" );
 	} else if (strcmp(command, "patch") == 0) {
 		fprintf(stdout,	"%s patch command: patches the kernel section within an img3 archive.\n", progName);
-		fprintf(stdout,	"Syntax: %s %s -d <device> -v <version> patch_file img3_file\n\n",	progName, command);
+		fprintf(stdout,	"The patched kernel is written to <img3_file>_patched.\n");
+		fprintf(stdout,	"Syntax: %s %s -d <device> -v <version> -r patch_file img3_file\n\n",	progName, command);
 		fprintf(stdout, "Options:\n");
 		fprintf(stdout,	"-d\tSpecifies the device that the img3 file references.  Currently supported devices include:\n");
 		fprintf(stdout, "\t\tAppleTV\n");
@@ -182,6 +194,10 @@ void PrintUsage(char *progName, char *command) {
 		fprintf(stdout, "\town risk!\n");
 		fprintf(stdout,	"-v\tSpecifies the version of firmware the img3 archive represents.  As with the device, if this\n");
 		fprintf(stdout,	"\toption is not specified, the program will attempt to determine it based upon the file name.\n");
+		fprintf(stdout,	"-r\tWhen img3_file is a firmware archive, also writes a copy of it with the patched kernel in place.\n");
+		fprintf(stdout,	"\tThe copy is named after the archive with _repacked before its extension, so Firmware.ipsw\n");
+		fprintf(stdout,	"\tbecomes Firmware_repacked.ipsw.  Only the kernel is recompressed; every other member is copied\n");
+		fprintf(stdout,	"\tunchanged.\n");
 	} else {
 		fprintf(stdout, "Unknown command entered: %s.\n", command);
 	}
@@ -513,10 +529,7 @@ int32_t ParseArguments(int argc, char *argv[]) {
 			PrintUsage(argv[0], argv[1]);
 			return -1;
 		}
-		for (index = 2; index < 4; index++) {
-			if (index + 1 >= argc) {
-				break;
-			}
+		for (index = 2; index < argc - 1; index++) {
 			if (strcmp(argv[index], "-s") == 0) {
 				count = strlen(argv[++index]);
 				section = new char[count + 1];
@@ -529,6 +542,10 @@ int32_t ParseArguments(int argc, char *argv[]) {
 					section[strIndex] = tolower(section[strIndex]);
 				}
 				section[count] = '\0';
+			} else if (strcmp(argv[index], "-i") == 0 && index + 2 < argc) {
+				includePatterns.push_back(argv[++index]);
+			} else if (strcmp(argv[index], "-x") == 0 && index + 2 < argc) {
+				excludePatterns.push_back(argv[++index]);
 			} else if (strcmp(argv[index], "-h") == 0) {
 				PrintUsage(argv[0], argv[1]);
 				return -1;
@@ -576,6 +593,8 @@ int32_t ParseArguments(int argc, char *argv[]) {
 				}
 				strncpy(deviceVersion, argv[index], count);
 				deviceVersion[count] = '\0';
+			} else if (strcmp(argv[index], "-r") == 0 && index + 2 < argc) {
+				repackArchive = 1;
 			}
 		}
 
@@ -734,14 +753,14 @@ int main( int argc, char *argv[] ) {
 		ListArchiveFiles( archiveFileName );
 		break;
 	case EXTRACT_FILE: 
-		ExtractFileFromArchive( archiveFileName, section );
+		ExtractFileFromArchive( archiveFileName, section, &includePatterns, &excludePatterns );
 		break;
 	case UPDATE_IMG3_DATABASE: 
 		UpdateIMG3Database( archiveFileName, deviceName, deviceVersion, deviceBuild );
 		break;
 	case PATCH_KERNEL: 
 		fprintf( stdout, "Patching with file: %s.\n", patchFileName );
-		PatchKernelFile( archiveFileName, NULL, patchFileName, deviceName, deviceVersion );
+		PatchKernelFile( archiveFileName, NULL, patchFileName, deviceName, deviceVersion, repackArchive );
 		break;
 	case PARSE_FILE:
 		fprintf( stdout, "Parsing file: %s.\n", archiveFileName );
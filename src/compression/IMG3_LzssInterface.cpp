@@ -6,15 +6,36 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <arpa/inet.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include "IMG3_LzssInterface.h"
 #include "IMG3_defines.h"
 
+static inline int32_t LzssNextToken(struct lzss_token_cursor *tc);
+
 /*! \fn 	IMG3_LzssInterface()
 	\brief	Constructor for IMG3_LzssInterface class
 */
 
 IMG3_LzssInterface::IMG3_LzssInterface() {
+	errorCode = IMG3_LZSS_ERROR_NONE;
+	engine = IMG3_LZSS_ENGINE_BINARY_TREE;
+	level = IMG3_LZSS_LEVEL_LAZY;
+	encodeState = NULL;
+	memset(&context, 0, sizeof(context));
+	workerContexts = NULL;
+	threadCount = 1;
+	memset(&stats, 0, sizeof(stats));
+	verifyPolicy = IMG3_LZSS_VERIFY_IGNORE;
+	decodeIndex = NULL;
+	decodeIndexUsed = 0;
 }
 
 /*! \fn		~IMG3_LzssInterface()
@@ -22,6 +43,80 @@ IMG3_LzssInterface::IMG3_LzssInterface() {
 */
 
 IMG3_LzssInterface::~IMG3_LzssInterface() {
+	if ( encodeState != NULL )
+		delete( encodeState );
+	FreeContext( &context );
+	SetThreadCount( 1 );
+}
+
+/*! \fn		int32_t SetMatchFinder( int32_t newEngine )
+	\brief	Publically available routine for selecting the match finder used during compression
+	\param	newEngine IMG3_LZSS_ENGINE_BINARY_TREE or IMG3_LZSS_ENGINE_HASH_CHAIN
+*/
+
+int32_t IMG3_LzssInterface::SetMatchFinder(int32_t newEngine)
+{
+	if ( newEngine != IMG3_LZSS_ENGINE_BINARY_TREE && newEngine != IMG3_LZSS_ENGINE_HASH_CHAIN ) {
+		errorCode = IMG3_LZSS_ERROR_INVALID_ENGINE;
+		PRINT_CLASS_ERROR( "unknown match finder engine" );
+		return -1;
+	}
+	engine = newEngine;
+	return 0;
+}
+
+/*! \fn		int32_t SetCompressionLevel( int32_t newLevel )
+	\brief	Publically available routine for selecting how hard the hash-chain engine searches for matches
+	\param	newLevel IMG3_LZSS_LEVEL_FAST, IMG3_LZSS_LEVEL_LAZY or IMG3_LZSS_LEVEL_OPTIMAL
+*/
+
+int32_t IMG3_LzssInterface::SetCompressionLevel(int32_t newLevel)
+{
+	if ( newLevel != IMG3_LZSS_LEVEL_FAST && newLevel != IMG3_LZSS_LEVEL_LAZY && newLevel != IMG3_LZSS_LEVEL_OPTIMAL ) {
+		errorCode = IMG3_LZSS_ERROR_INVALID_LEVEL;
+		PRINT_CLASS_ERROR( "unknown compression level" );
+		return -1;
+	}
+	level = newLevel;
+	return 0;
+}
+
+/*! \fn		int32_t SetVerifyPolicy( int32_t newPolicy )
+	\brief	Publically available routine for choosing how LzssDecompress treats the header checksum
+	\param	newPolicy IMG3_LZSS_VERIFY_IGNORE, IMG3_LZSS_VERIFY_WARN or IMG3_LZSS_VERIFY_FAIL
+*/
+
+int32_t IMG3_LzssInterface::SetVerifyPolicy(int32_t newPolicy)
+{
+	if ( newPolicy != IMG3_LZSS_VERIFY_IGNORE && newPolicy != IMG3_LZSS_VERIFY_WARN && newPolicy != IMG3_LZSS_VERIFY_FAIL ) {
+		errorCode = IMG3_LZSS_ERROR_INVALID_POLICY;
+		PRINT_CLASS_ERROR( "unknown verification policy" );
+		return -1;
+	}
+	verifyPolicy = newPolicy;
+	return 0;
+}
+
+/*! \fn		void PrintCompressionStats( FILE *stream )
+	\brief	Publically available routine for reporting the size and throughput of the last compression
+	\param	stream the stream to print the report to
+*/
+
+void IMG3_LzssInterface::PrintCompressionStats(FILE *stream)
+{
+	double ratio = 0.0, rate = 0.0;
+
+	if ( stream == NULL )
+		return;
+
+	if ( stats.input_bytes != 0 )
+		ratio = 100.0 * stats.output_bytes / stats.input_bytes;
+	if ( stats.seconds > 0.0 )
+		rate = stats.input_bytes / stats.seconds / 1048576.0;
+
+	fprintf( stream, "Compressed 0x%08llx bytes to 0x%08llx bytes (%.2f%%) in %.3f seconds (%.1f MB/s).\r\n",
+			(unsigned long long) stats.input_bytes, (unsigned long long) stats.output_bytes, ratio, stats.seconds, rate );
+	fprintf( stream, "\t%llu literals, %llu matches.\r\n", (unsigned long long) stats.literals, (unsigned long long) stats.matches );
 }
 
 /*! \fn		int32_t LzssDecompress( uint8_t *inbuff, size_t insize, uint8_t **outbuff, size_t *outsize )
@@ -35,26 +130,16 @@ IMG3_LzssInterface::~IMG3_LzssInterface() {
 int32_t IMG3_LzssInterface::LzssDecompress(uint8_t *inbuff, size_t insize, uint8_t **outbuff, size_t *outsize)
 {
 	IMG3_LzssInterface_CompressionHeader *header;
-	uint32_t checksum;
 
 	CLASS_VALIDATE_PARAMETER( inbuff, -1 );
 	CLASS_VALIDATE_PARAMETER( outbuff, -1 );
 	CLASS_VALIDATE_PARAMETER( outsize, -1 );
 
-	if (insize < sizeof(IMG3_LzssInterface_CompressionHeader)) {
-		errorCode = IMG3_LZSS_ERROR_INPUT_TOO_SMALL;
-		PRINT_CLASS_ERROR( "input size too small to hold lzss header" );
+	if (CheckHeader(inbuff, insize) == -1)
 		return -1;
-	}
 
 	header = (IMG3_LzssInterface_CompressionHeader *)inbuff;
 
-	if (IsFileCompressed(inbuff) == -1) {
-		errorCode = IMG3_LZSS_ERROR_FILE_IS_NOT_COMPRESSED;
-		PRINT_CLASS_ERROR( "file is not compressed" );
-		return -1;
-	}
-
 	*outsize = ntohl(header->length_uncompressed);
 	*outbuff = new uint8_t[*outsize];
 	if (*outbuff == NULL) {
@@ -63,218 +148,1503 @@ int32_t IMG3_LzssInterface::LzssDecompress(uint8_t *inbuff, size_t insize, uint8
 		return -1;
 	}
 
-	Decompress((uint8_t *)*outbuff, (uint8_t *)(header+1), ntohl(header->length_compressed));
+	if (DecompressInto(inbuff, *outbuff) == -1) {
+		delete[]( *outbuff );
+		*outbuff = NULL;
+		*outsize = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/*! \fn		int32_t LzssDecompress( uint8_t *inbuff, size_t insize, uint8_t *outbuff, size_t outsize, size_t *written )
+	\brief	Publically available LZSS decompression routine writing into a buffer owned by the caller
+	\param	inbuff pointer to the buffer containing the data to be decompressed
+	\param	insize length of the inbuff in bytes
+	\param	outbuff pointer to a buffer to store the decompressed data
+	\param	outsize length of the outbuff in bytes
+	\param	written address of a size_t variable in which to store the length of the decompressed data
+*/
 
-	checksum = lzadler32(*outbuff, *outsize);
-	if (ntohl(header->checksum) != checksum) {
-#ifdef IMG3_DEBUG
-		errorCode = IMG3_LZSS_ERROR_CHECKSUM_MISMATCH;
-		PRINT_CLASS_ERROR( "header checksum does not match calculated checksum" );
-#endif
+int32_t IMG3_LzssInterface::LzssDecompress(uint8_t *inbuff, size_t insize, uint8_t *outbuff, size_t outsize, size_t *written)
+{
+	IMG3_LzssInterface_CompressionHeader *header;
+
+	CLASS_VALIDATE_PARAMETER( inbuff, -1 );
+	CLASS_VALIDATE_PARAMETER( written, -1 );
+
+	if (CheckHeader(inbuff, insize) == -1)
+		return -1;
+
+	header = (IMG3_LzssInterface_CompressionHeader *)inbuff;
+	*written = ntohl(header->length_uncompressed);
+	if (*written > outsize) {
+		errorCode = IMG3_LZSS_ERROR_OUTPUT_TOO_SMALL;
+		PRINT_CLASS_ERROR( "output buffer too small to hold the decompressed data" );
+		return -1;
 	}
+	if (*written != 0)
+		CLASS_VALIDATE_PARAMETER( outbuff, -1 );
 
-	return 0;
+	return DecompressInto(inbuff, outbuff);
 }
 
-/*! \fn		int32_t LzssCompress( uint8_t *inbuff, size_t insize, uint8_t **outbuff, size_t *outsize )
-	\brief	Publically available LZSS compression routine
-	\param	inbuff pointer to the buffer containing the data to be compressed
+/*! \fn		int32_t LzssDecompressToFile( uint8_t *inbuff, size_t insize, int fd, size_t *outsize )
+	\brief	Publically available LZSS decompression routine writing straight into a file
+	\param	inbuff pointer to the buffer containing the data to be decompressed
 	\param	insize length of the inbuff in bytes
-	\param	outbuff address of a pointer to a buffer to store the compressed data; buffer will be automatically allocated by the function
-	\param	outsize address of a size_t variable in which to store the length of outbuff
+	\param	fd descriptor of a file opened for reading and writing
+	\param	outsize address of a size_t variable in which to store the length of the decompressed data
+
+	The file is sized with ftruncate and mapped shared, so the decoder writes into the page cache and
+	no copy of the output is made on the heap or passed through write.
 */
 
-int32_t IMG3_LzssInterface::LzssCompress(uint8_t *inbuff, size_t insize, uint8_t **outbuff, size_t *outsize)
+int32_t IMG3_LzssInterface::LzssDecompressToFile(uint8_t *inbuff, size_t insize, int fd, size_t *outsize)
 {
 	IMG3_LzssInterface_CompressionHeader *header;
-	uintptr_t outend;
-	uint8_t *curPtr;
-	uint32_t bytesCompressed = 0, bytesToCompress = insize;
+	uint8_t *map;
+	int flags = MAP_SHARED;
+	int32_t result;
 
 	CLASS_VALIDATE_PARAMETER( inbuff, -1 );
-	CLASS_VALIDATE_PARAMETER( outbuff, -1 );
 	CLASS_VALIDATE_PARAMETER( outsize, -1 );
 
-	if ( insize < sizeof(IMG3_LzssInterface_CompressionHeader) ) {
-		errorCode = IMG3_LZSS_ERROR_INPUT_TOO_SMALL;
-		PRINT_CLASS_ERROR( "input size too small to hold lzss header" );
+	if (CheckHeader(inbuff, insize) == -1)
+		return -1;
+
+	header = (IMG3_LzssInterface_CompressionHeader *)inbuff;
+	*outsize = ntohl(header->length_uncompressed);
+
+	if (ftruncate(fd, *outsize) == -1) {
+		errorCode = errno;
+		PRINT_SYSTEM_ERROR();
 		return -1;
 	}
+	if (*outsize == 0)
+		return 0;
 
-	*outsize = insize * 2 + sizeof(IMG3_LzssInterface_CompressionHeader);
-	*outbuff = new uint8_t[*outsize];
-	if (outbuff == NULL) {
+#ifdef MAP_POPULATE
+	/* Every page is about to be written, so fault them all in up front. */
+	flags |= MAP_POPULATE;
+#endif
+	map = (uint8_t *) mmap(NULL, *outsize, PROT_READ | PROT_WRITE, flags, fd, 0);
+	if (map == MAP_FAILED) {
 		errorCode = errno;
 		PRINT_SYSTEM_ERROR();
 		return -1;
 	}
 
-	header = (IMG3_LzssInterface_CompressionHeader *)*outbuff;
+	result = DecompressInto(inbuff, map);
+	munmap(map, *outsize);
 
-	outend = (uintptr_t)Compress((uint8_t *)(header + 1), *outsize, inbuff, insize);
-	if (outend == 0) {
-		errorCode = IMG3_LZSS_ERROR_COMPRESSION_FAILED;
-		PRINT_CLASS_ERROR( "compression failed" );
-		return -1;
-	}	
+	/* Don't leave data that failed verification behind. */
+	if (result == -1 && ftruncate(fd, 0) == -1)
+		PRINT_SYSTEM_ERROR();
+	return result;
+}
 
-	*outsize = outend - (uintptr_t)*outbuff;
-	if (*outsize % 16)
-		*outsize += 16 - (*outsize % 16);
+/*! \fn		int32_t DecompressInto( uint8_t *inbuff, uint8_t *outbuff )
+	\brief	Private method decompressing a stream with a validated header into a buffer of length_uncompressed bytes
+	\param	inbuff pointer to the buffer containing the compressed data
+	\param	outbuff pointer to the buffer to store the decompressed data
 
-	header->signature = htonl(IMG3_LZSSINTERFACE_COMP_SIGNATURE);
-	header->compression_type = htonl(IMG3_LZSSINTERFACE_LZSS_SIGNATURE);
-	header->checksum = htonl(lzadler32(inbuff, insize));
-	header->length_uncompressed = htonl(insize);
-	header->length_compressed = htonl(outend - (uintptr_t)(header + 1));
-	memset(header->padding,0,sizeof(header->padding));
+	The checksum is verified according to the verification policy.  Returns -1 only when the
+	policy is IMG3_LZSS_VERIFY_FAIL and the data doesn't match the header.  With a decompression
+	index for this stream and more than one thread the stream is decoded by DecompressParallel,
+	falling back to a serial decode if any segment doesn't line up with the index.
+*/
+
+int32_t IMG3_LzssInterface::DecompressInto(uint8_t *inbuff, uint8_t *outbuff)
+{
+	IMG3_LzssInterface_CompressionHeader *header;
+	uint32_t checksum, length, outsize, written;
+
+	header = (IMG3_LzssInterface_CompressionHeader *)inbuff;
+	length = ntohl(header->length_compressed);
+	outsize = ntohl(header->length_uncompressed);
+
+	decodeIndexUsed = 0;
+	if (decodeIndex != NULL && threadCount > 1 && IndexMatches(header, decodeIndex) == 0 &&
+		DecompressParallel(inbuff, outbuff, (verifyPolicy == IMG3_LZSS_VERIFY_IGNORE) ? NULL : &checksum) == 0) {
+		decodeIndexUsed = 1;
+		written = outsize;
+	} else if (verifyPolicy == IMG3_LZSS_VERIFY_IGNORE) {
+		DecompressFast(outbuff, outsize, (uint8_t *)(header+1), length);
+		return 0;
+	} else {
+		written = DecompressVerify(outbuff, outsize, (uint8_t *)(header+1), length, &checksum);
+	}
+
+	if (verifyPolicy == IMG3_LZSS_VERIFY_IGNORE)
+		return 0;
+	if (written != outsize || ntohl(header->checksum) != checksum) {
+		errorCode = IMG3_LZSS_ERROR_CHECKSUM_MISMATCH;
+		PRINT_CLASS_ERROR( "header checksum does not match calculated checksum" );
+		if (verifyPolicy == IMG3_LZSS_VERIFY_FAIL)
+			return -1;
+	}
 
 	return 0;
 }
 
-/*! \fn		int32_t IsFileCompressed( uint8_t *inbuff )
-	\brief	Publically available routine for determining if data is compressed
-	\param	inbuff pointer to the buffer containing possible compressed data
+/*! \fn		int32_t CheckHeader( uint8_t *inbuff, size_t insize )
+	\brief	Private method validating the compression header in front of a compressed stream
+	\param	inbuff pointer to the buffer containing the compressed data
+	\param	insize length of the inbuff in bytes
 */
 
-int32_t IMG3_LzssInterface::IsFileCompressed(uint8_t *inbuff)
+int32_t IMG3_LzssInterface::CheckHeader(uint8_t *inbuff, size_t insize)
 {
 	IMG3_LzssInterface_CompressionHeader *header;
 
-	CLASS_VALIDATE_PARAMETER(inbuff, -1);
+	if (insize < sizeof(IMG3_LzssInterface_CompressionHeader)) {
+		errorCode = IMG3_LZSS_ERROR_INPUT_TOO_SMALL;
+		PRINT_CLASS_ERROR( "input size too small to hold lzss header" );
+		return -1;
+	}
 
 	header = (IMG3_LzssInterface_CompressionHeader *)inbuff;
 
-	header = (IMG3_LzssInterface_CompressionHeader *)inbuff;
+	if (IsFileCompressed(inbuff) == -1) {
+		errorCode = IMG3_LZSS_ERROR_FILE_IS_NOT_COMPRESSED;
+		PRINT_CLASS_ERROR( "file is not compressed" );
+		return -1;
+	}
 
-	if (ntohl(header->signature) != IMG3_LZSSINTERFACE_COMP_SIGNATURE && ntohl(header->compression_type) != IMG3_LZSSINTERFACE_LZSS_SIGNATURE) {
-		errorCode = IMG3_LZSS_ERROR_FILE_NOT_A_LZSS_FILE;
-		PRINT_CLASS_ERROR( "file not a valid lzss archive" );
+	if (ntohl(header->length_compressed) > insize - sizeof(IMG3_LzssInterface_CompressionHeader)) {
+		errorCode = IMG3_LZSS_ERROR_INPUT_TOO_SMALL;
+		PRINT_CLASS_ERROR( "compressed length runs past the end of the input" );
 		return -1;
 	}
 	return 0;
 }
 
-/*!	\fn		uint32_t lzadler32( uint8_t *buf, int32_t len )
-	\brief	Private function for computing the adler32 checksum of the provided data
-	\param	buf pointer to the data on which to perform the checksum
-	\param  len size of buf buffer in bytes
+/*! \fn		int32_t IndexMatches( IMG3_LzssInterface_CompressionHeader *header, IMG3_LzssInterface_Index *index )
+	\brief	Private method checking that a checkpoint index describes the stream behind a header
+	\param	header pointer to the compression header of the stream
+	\param	index checkpoint index to check
+
+	Returns zero if the index has checkpoints and its header fields match; otherwise, it returns -1.
 */
 
-uint32_t IMG3_LzssInterface::lzadler32(uint8_t *buf, int32_t len)
+int32_t IMG3_LzssInterface::IndexMatches(IMG3_LzssInterface_CompressionHeader *header, IMG3_LzssInterface_Index *index)
 {
-	unsigned long s1 = 1;
-	unsigned long s2 = 0;
-	int k;
-
-	for ( k = 0; k < len; k++ )
-	{
-		s1 = (s1 + buf[k]) % 65521;
-		s2 = (s2 + s1) % 65521;
-	}
-	
-	return (s2 << 16) | s1;
+	if (index->count == 0 || index->checksum != ntohl(header->checksum) ||
+		index->length_uncompressed != ntohl(header->length_uncompressed) ||
+		index->length_compressed != ntohl(header->length_compressed))
+		return -1;
+	return 0;
 }
 
-/*!	\fn	int Decompress( uint8_t *dst, uint8_t *src, uint32_t srclen
-	\brief	Private decompression method for performing LZSS decompression
-	\param	dst pointer to a buffer to store the result of the decompression
-	\param	src pointer to the buffer containing the data to be decompressed
-	\param	srclen size of src buffer in bytes
+/*! \fn		int32_t LzssBuildIndex( uint8_t *inbuff, size_t insize, uint32_t spacing, IMG3_LzssInterface_Index **index )
+	\brief	Publically available routine for building a checkpoint index of a compressed stream
+	\param	inbuff pointer to the buffer containing the compressed data
+	\param	insize length of the inbuff in bytes
+	\param	spacing number of decompressed bytes between checkpoints; zero for the default
+	\param	index address of a pointer in which to store the index; it will be automatically allocated by the function
+
+	The stream is decoded once through a sliding buffer only one window and one interval in size,
+	and before every interval the decoder state and the window behind it are recorded.  The
+	checksum is verified according to the verification policy.
 */
 
-uint32_t IMG3_LzssInterface::Decompress(uint8_t *dst, uint8_t *src, uint32_t srclen)
+int32_t IMG3_LzssInterface::LzssBuildIndex(uint8_t *inbuff, size_t insize, uint32_t spacing, IMG3_LzssInterface_Index **index)
 {
-	/* ring buffer of size N, with extra F-1 bytes to aid string comparison */
-	uint8_t text_buf[IMG3_LZSSINTERFACE_N + IMG3_LZSSINTERFACE_F - 1];
-	uint8_t *dststart = dst;
-	uint8_t *srcend = src + srclen;
-	int i, j, k, r, c;
-	unsigned int flags;
+	IMG3_LzssInterface_CompressionHeader *header;
+	IMG3_LzssInterface_Index *ip = NULL;
+	IMG3_LzssInterface_Checkpoint *cp;
+	struct lzss_decode_state ds;
+	uint8_t *stream, *buffer = NULL, *done;
+	uint32_t capacity, adler = 1, total = 0, k;
+	int32_t status;
+
+	CLASS_VALIDATE_PARAMETER( inbuff, -1 );
+	CLASS_VALIDATE_PARAMETER( index, -1 );
+
+	if (spacing == 0)
+		spacing = IMG3_LZSSINTERFACE_INDEX_SPACING;
+	if (spacing < IMG3_LZSSINTERFACE_N) {
+		errorCode = IMG3_LZSS_ERROR_INVALID_INDEX;
+		PRINT_CLASS_ERROR( "checkpoint spacing smaller than the window" );
+		return -1;
+	}
+
+	if (CheckHeader(inbuff, insize) == -1)
+		return -1;
+
+	header = (IMG3_LzssInterface_CompressionHeader *)inbuff;
+	stream = (uint8_t *)(header+1);
+
+	ip = new IMG3_LzssInterface_Index;
+	buffer = new uint8_t[IMG3_LZSSINTERFACE_N + spacing + IMG3_LZSSINTERFACE_FAST_MARGIN];
+	capacity = ntohl(header->length_uncompressed) / spacing + 2;
+	ip->checkpoints = new IMG3_LzssInterface_Checkpoint[capacity];
+	ip->checksum = ntohl(header->checksum);
+	ip->length_uncompressed = ntohl(header->length_uncompressed);
+	ip->length_compressed = ntohl(header->length_compressed);
+	ip->spacing = spacing;
+	ip->count = 0;
+
+	/* The window in front of the first byte is the reference decoder's initial ring buffer. */
+	InitDecodeState(&ds, buffer + IMG3_LZSSINTERFACE_N, spacing + IMG3_LZSSINTERFACE_FAST_MARGIN, stream, ip->length_compressed);
+	for (k = 0; k < IMG3_LZSSINTERFACE_N; k++)
+		IMG3_LzssAppleCodec::HistoryByte(&ds, buffer + k, buffer + k);
+	ds.histstart = buffer;
 
-	dst = dststart;
-	srcend = src + srclen;
-	for (i = 0; i < IMG3_LZSSINTERFACE_N - IMG3_LZSSINTERFACE_F; i++)
-		text_buf[i] = ' ';
-	r = IMG3_LZSSINTERFACE_N - IMG3_LZSSINTERFACE_F;
-	flags = 0;
 	for ( ; ; ) {
-		if (((flags >>= 1) & 0x100) == 0) {
-			if (src < srcend) c = *src++; else break;
-			flags = c | 0xFF00;  /* uses higher byte cleverly */
-		}  /* to count eight */
-		if (flags & 1) {
-			if (src < srcend) c = *src++; else break;
-			*dst++ = c;
-			text_buf[r++] = c;
-			r &= (IMG3_LZSSINTERFACE_N - 1);
-		} else {
-			if (src < srcend) i = *src++; else break;
-			if (src < srcend) j = *src++; else break;
-			i |= ((j & 0xF0) << 4);
-			j = (j & 0x0F) + IMG3_LZSSINTERFACE_THRESHOLD;
-			for (k = 0; k <= j; k++) {
-				c = text_buf[(i + k) & (IMG3_LZSSINTERFACE_N - 1)];
-				*dst++ = c;
-				text_buf[r++] = c;
-				r &= (IMG3_LZSSINTERFACE_N - 1);
-			}
+		if (ip->count == capacity) {
+			errorCode = IMG3_LZSS_ERROR_CORRUPT_STREAM;
+			PRINT_CLASS_ERROR( "stream decompresses to more than the header length" );
+			goto LzssBuildIndex_free;
+		}
+		cp = &ip->checkpoints[ip->count++];
+		cp->input_offset = ds.src - stream;
+		cp->output_offset = total;
+		cp->flags = ds.flags;
+		memcpy(cp->window, ds.dst - IMG3_LZSSINTERFACE_N, IMG3_LZSSINTERFACE_N);
+
+		done = ds.dst;
+		ds.dststop = ds.dst + spacing;
+		status = DecodeTokens(&ds);
+		if (status == -1) {
+			errorCode = IMG3_LZSS_ERROR_CORRUPT_STREAM;
+			PRINT_CLASS_ERROR( "back reference before the start of the stream" );
+			goto LzssBuildIndex_free;
 		}
+		if (verifyPolicy != IMG3_LZSS_VERIFY_IGNORE)
+			adler = lzadler32_update(adler, done, ds.dst - done);
+		total += ds.dst - done;
+		if (status == IMG3_LZSS_DECODE_INPUT_END || ds.dst == done)
+			break;
+
+		/* Slide the last window's worth of output to the front for the next interval. */
+		memmove(buffer, ds.dst - IMG3_LZSSINTERFACE_N, IMG3_LZSSINTERFACE_N);
+		ds.outbase = total;
+		ds.dst = ds.dstbase;
 	}
 
-	return dst - dststart;
+	if (verifyPolicy != IMG3_LZSS_VERIFY_IGNORE && (total != ip->length_uncompressed || adler != ip->checksum)) {
+		errorCode = IMG3_LZSS_ERROR_CHECKSUM_MISMATCH;
+		PRINT_CLASS_ERROR( "header checksum does not match calculated checksum" );
+		if (verifyPolicy == IMG3_LZSS_VERIFY_FAIL)
+			goto LzssBuildIndex_free;
+	}
+
+	delete[]( buffer );
+	*index = ip;
+	return 0;
+
+LzssBuildIndex_free:
+	delete[]( buffer );
+	LzssFreeIndex( ip );
+	return -1;
 }
 
-/*! \fn		uint8_t * Compress( uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen )
-	\brief	Private compression method for performing LZSS compression
-	\param	dst pointer to a buffer to store the result of the compression
-	\param	dstlen size in bytes of the dst buffer
-	\param	src pointer to the buffer containing the data to be compressed
-	\param 	srclen size in bytes of the src buffer
+/*! \fn		int32_t LzssBuildIndex( uint8_t *inbuff, size_t insize, uint8_t *plaintext, size_t plainsize, uint32_t spacing, IMG3_LzssInterface_Index **index )
+	\brief	Publically available routine for building a checkpoint index from a stream and its decompressed data
+	\param	inbuff pointer to the buffer containing the compressed data
+	\param	insize length of the inbuff in bytes
+	\param	plaintext pointer to the data the stream decompresses to
+	\param	plainsize length of the plaintext in bytes
+	\param	spacing number of decompressed bytes between checkpoints; zero for the default
+	\param	index address of a pointer in which to store the index; it will be automatically allocated by the function
+
+	The token stream is stepped through without decoding it, since only the flag bits and match
+	lengths are needed to track the output offset, and every window is copied straight out of the
+	plaintext.  Whole groups that end before the next checkpoint are skipped in one step; near a
+	checkpoint a token cursor finds the first token boundary at or past it.
 */
 
-uint8_t * IMG3_LzssInterface::Compress(uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen)
+int32_t IMG3_LzssInterface::LzssBuildIndex(uint8_t *inbuff, size_t insize, uint8_t *plaintext, size_t plainsize, uint32_t spacing, IMG3_LzssInterface_Index **index)
 {
-	/* Encoding state, mostly tree but some current match stuff */
-	struct encode_state *sp;
+	IMG3_LzssInterface_CompressionHeader *header;
+	IMG3_LzssInterface_Index *ip = NULL;
+	IMG3_LzssInterface_Checkpoint *cp;
+	struct lzss_token_cursor tc;
+	uint8_t *stream;
+	uint32_t capacity, next = 0, c, k;
+	int64_t logical;
 
-	int i, c, len, r, s, last_match_length, code_buf_ptr;
-	uint8_t code_buf[17], mask;
-	uint8_t *srcend = src + srclen;
-	uint8_t *dstend = dst + dstlen;
+	CLASS_VALIDATE_PARAMETER( inbuff, -1 );
+	CLASS_VALIDATE_PARAMETER( index, -1 );
 
-	/* initialize trees */
-	sp = new struct encode_state;
-	InitState(sp);
+	if (spacing == 0)
+		spacing = IMG3_LZSSINTERFACE_INDEX_SPACING;
+	if (spacing < IMG3_LZSSINTERFACE_N) {
+		errorCode = IMG3_LZSS_ERROR_INVALID_INDEX;
+		PRINT_CLASS_ERROR( "checkpoint spacing smaller than the window" );
+		return -1;
+	}
 
-	/*
-	 * code_buf[1..16] saves eight units of code, and code_buf[0] works
-	 * as eight flags, "1" representing that the unit is an unencoded
-	 * letter (1 byte), "" a position-and-length pair (2 bytes).
-	 * Thus, eight units require at most 16 bytes of code.
-	 */
-	code_buf[0] = 0;
-	code_buf_ptr = mask = 1;
+	if (CheckHeader(inbuff, insize) == -1)
+		return -1;
 
-	/* Clear the buffer with any character that will appear often. */
-	s = 0; r = IMG3_LZSSINTERFACE_N - IMG3_LZSSINTERFACE_F;
+	header = (IMG3_LzssInterface_CompressionHeader *)inbuff;
+	stream = (uint8_t *)(header+1);
 
-	/* Read F bytes into the last F bytes of the buffer */
-	for (len = 0; len < IMG3_LZSSINTERFACE_F && src < srcend; len++)
-		sp->text_buf[r + len] = *src++;
-	if (!len) {
-		delete(sp);
-		return NULL; /* text of size zero */
+	if (plainsize != ntohl(header->length_uncompressed)) {
+		errorCode = IMG3_LZSS_ERROR_INVALID_RANGE;
+		PRINT_CLASS_ERROR( "plaintext length does not match the header" );
+		return -1;
 	}
-	/*
-	 * Insert the F strings, each of which begins with one or more
-	 * 'space' characters.  Note the order in which these strings are
-	 * inserted.  This way, degenerate trees will be less likely to occur.
-	 */
-	for (i = 1; i <= IMG3_LZSSINTERFACE_F; i++)
-		InsertNode(sp, r - i);
+	if (plainsize != 0)
+		CLASS_VALIDATE_PARAMETER( plaintext, -1 );
 
-	/*
+	if (verifyPolicy != IMG3_LZSS_VERIFY_IGNORE && lzadler32(plaintext, plainsize) != ntohl(header->checksum)) {
+		errorCode = IMG3_LZSS_ERROR_CHECKSUM_MISMATCH;
+		PRINT_CLASS_ERROR( "header checksum does not match calculated checksum" );
+		if (verifyPolicy == IMG3_LZSS_VERIFY_FAIL)
+			return -1;
+	}
+
+	ip = new IMG3_LzssInterface_Index;
+	capacity = plainsize / spacing + 2;
+	ip->checkpoints = new IMG3_LzssInterface_Checkpoint[capacity];
+	ip->checksum = ntohl(header->checksum);
+	ip->length_uncompressed = plainsize;
+	ip->length_compressed = ntohl(header->length_compressed);
+	ip->spacing = spacing;
+	ip->count = 0;
+
+	tc.group = stream;
+	tc.token = stream + 1;
+	tc.end = stream + ip->length_compressed;
+	tc.bit = 0;
+	tc.output = 0;
+
+	for ( ; ; ) {
+		while (tc.bit == 0 && tc.end - tc.group >= 1 + 2 * 8 && tc.output + 8 * IMG3_LZSSINTERFACE_F < next) {
+			c = *tc.group++;
+			if (c == 0xFF) {
+				tc.group += 8;
+				tc.output += 8;
+			} else {
+				for (k = 0; k < 8; k++, c >>= 1) {
+					if (c & 1) {
+						tc.group++;
+						tc.output++;
+					} else {
+						tc.output += IMG3_LzssAppleCodec::MatchLength(tc.group);
+						tc.group += 2;
+					}
+				}
+			}
+			tc.token = tc.group + 1;
+		}
+		if (tc.output >= next) {
+			if (ip->count == capacity)
+				goto LzssBuildIndex_corrupt;
+			cp = &ip->checkpoints[ip->count++];
+			cp->output_offset = tc.output;
+			/* Mid-group, the decoder holds the flag byte shifted past the tokens already decoded. */
+			if (tc.bit == 0) {
+				cp->input_offset = tc.group - stream;
+				cp->flags = 0;
+			} else {
+				cp->input_offset = tc.token - stream;
+				cp->flags = (*tc.group | 0xFF00) >> (tc.bit - 1);
+			}
+			if (tc.output >= IMG3_LZSSINTERFACE_N) {
+				memcpy(cp->window, plaintext + tc.output - IMG3_LZSSINTERFACE_N, IMG3_LZSSINTERFACE_N);
+			} else {
+				for (k = 0; k < IMG3_LZSSINTERFACE_N; k++) {
+					logical = (int64_t) tc.output - IMG3_LZSSINTERFACE_N + k;
+					cp->window[k] = (logical >= 0) ? plaintext[logical] : IMG3_LzssAppleCodec::PrehistoryByte(logical);
+				}
+			}
+			next = tc.output + spacing;
+		}
+		if (tc.output >= plainsize)
+			break;
+		if (LzssNextToken(&tc) == -1)
+			goto LzssBuildIndex_corrupt;
+	}
+	if (tc.output != plainsize)
+		goto LzssBuildIndex_corrupt;
+
+	*index = ip;
+	return 0;
+
+LzssBuildIndex_corrupt:
+	errorCode = IMG3_LZSS_ERROR_CORRUPT_STREAM;
+	PRINT_CLASS_ERROR( "stream does not decompress to the header length" );
+	LzssFreeIndex( ip );
+	return -1;
+}
+
+/*! \fn		int32_t LzssDecompressRange( uint8_t *inbuff, size_t insize, IMG3_LzssInterface_Index *index, size_t offset, size_t length, uint8_t *outbuff )
+	\brief	Publically available routine for decompressing part of a stream from its nearest checkpoint
+	\param	inbuff pointer to the buffer containing the compressed data
+	\param	insize length of the inbuff in bytes
+	\param	index checkpoint index built for this stream by LzssBuildIndex or LzssLoadIndex
+	\param	offset offset of the first decompressed byte wanted
+	\param	length number of decompressed bytes wanted
+	\param	outbuff pointer to a buffer of at least length bytes in which to store them
+*/
+
+int32_t IMG3_LzssInterface::LzssDecompressRange(uint8_t *inbuff, size_t insize, IMG3_LzssInterface_Index *index, size_t offset, size_t length, uint8_t *outbuff)
+{
+	IMG3_LzssInterface_CompressionHeader *header;
+	IMG3_LzssInterface_Checkpoint *cp;
+	struct lzss_decode_state ds;
+	uint8_t *stream, *buffer;
+	uint32_t lo, hi, mid, need;
+	int32_t status;
+
+	CLASS_VALIDATE_PARAMETER( inbuff, -1 );
+	CLASS_VALIDATE_PARAMETER( index, -1 );
+	CLASS_VALIDATE_PARAMETER( outbuff, -1 );
+
+	if (CheckHeader(inbuff, insize) == -1)
+		return -1;
+
+	header = (IMG3_LzssInterface_CompressionHeader *)inbuff;
+	stream = (uint8_t *)(header+1);
+
+	if (IndexMatches(header, index) == -1) {
+		errorCode = IMG3_LZSS_ERROR_INVALID_INDEX;
+		PRINT_CLASS_ERROR( "index was not built for this stream" );
+		return -1;
+	}
+	if (offset > index->length_uncompressed || length > index->length_uncompressed - offset) {
+		errorCode = IMG3_LZSS_ERROR_INVALID_RANGE;
+		PRINT_CLASS_ERROR( "range runs past the end of the decompressed data" );
+		return -1;
+	}
+	if (length == 0)
+		return 0;
+
+	/* Find the last checkpoint at or before offset. */
+	lo = 0;
+	hi = index->count - 1;
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		if (index->checkpoints[mid].output_offset <= offset)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	cp = &index->checkpoints[lo];
+
+	need = offset + length - cp->output_offset;
+	buffer = new uint8_t[IMG3_LZSSINTERFACE_N + need + IMG3_LZSSINTERFACE_FAST_MARGIN];
+	memcpy(buffer, cp->window, IMG3_LZSSINTERFACE_N);
+
+	InitDecodeState(&ds, buffer + IMG3_LZSSINTERFACE_N, need + IMG3_LZSSINTERFACE_FAST_MARGIN,
+			stream + cp->input_offset, index->length_compressed - cp->input_offset);
+	ds.dststop = ds.dst + need;
+	ds.histstart = buffer;
+	ds.outbase = cp->output_offset;
+	ds.flags = cp->flags;
+
+	status = DecodeTokens(&ds);
+	if (status == -1 || ds.dst < ds.dststop) {
+		errorCode = IMG3_LZSS_ERROR_CORRUPT_STREAM;
+		PRINT_CLASS_ERROR( "stream ended before the requested range" );
+		delete[]( buffer );
+		return -1;
+	}
+
+	memcpy(outbuff, ds.dstbase + (offset - cp->output_offset), length);
+	delete[]( buffer );
+	return 0;
+}
+
+/*! \fn		int32_t LzssSaveIndex( IMG3_LzssInterface_Index *index, const char *fileName )
+	\brief	Publically available routine for writing a checkpoint index to a sidecar file
+	\param	index checkpoint index to write
+	\param	fileName name of the file to create
+*/
+
+int32_t IMG3_LzssInterface::LzssSaveIndex(IMG3_LzssInterface_Index *index, const char *fileName)
+{
+	IMG3_LzssInterface_Checkpoint *cp;
+	uint32_t fields[ 7 ];
+	FILE *outputFile;
+	uint32_t i;
+
+	CLASS_VALIDATE_PARAMETER( index, -1 );
+	CLASS_VALIDATE_PARAMETER( fileName, -1 );
+
+	outputFile = fopen( fileName, "wb" );
+	if ( outputFile == NULL ) {
+		errorCode = errno;
+		PRINT_SYSTEM_ERROR();
+		return -1;
+	}
+
+	fields[0] = htonl(IMG3_LZSSINTERFACE_INDEX_SIGNATURE);
+	fields[1] = htonl(IMG3_LZSSINTERFACE_INDEX_VERSION);
+	fields[2] = htonl(index->checksum);
+	fields[3] = htonl(index->length_uncompressed);
+	fields[4] = htonl(index->length_compressed);
+	fields[5] = htonl(index->spacing);
+	fields[6] = htonl(index->count);
+	if ( fwrite( fields, sizeof(fields), 1, outputFile ) != 1 )
+		goto LzssSaveIndex_error;
+
+	for (i = 0; i < index->count; i++) {
+		cp = &index->checkpoints[i];
+		fields[0] = htonl(cp->input_offset);
+		fields[1] = htonl(cp->output_offset);
+		fields[2] = htonl(cp->flags);
+		if ( fwrite( fields, sizeof(uint32_t), 3, outputFile ) != 3 ||
+			 fwrite( cp->window, IMG3_LZSSINTERFACE_N, 1, outputFile ) != 1 )
+			goto LzssSaveIndex_error;
+	}
+
+	if ( fclose( outputFile ) != 0 ) {
+		errorCode = errno;
+		PRINT_SYSTEM_ERROR();
+		return -1;
+	}
+	return 0;
+
+LzssSaveIndex_error:
+	errorCode = errno;
+	PRINT_SYSTEM_ERROR();
+	fclose( outputFile );
+	return -1;
+}
+
+/*! \fn		int32_t LzssLoadIndex( const char *fileName, IMG3_LzssInterface_Index **index )
+	\brief	Publically available routine for reading a checkpoint index from a sidecar file
+	\param	fileName name of the file written by LzssSaveIndex
+	\param	index address of a pointer in which to store the index; it will be automatically allocated by the function
+*/
+
+int32_t IMG3_LzssInterface::LzssLoadIndex(const char *fileName, IMG3_LzssInterface_Index **index)
+{
+	IMG3_LzssInterface_Index *ip = NULL;
+	IMG3_LzssInterface_Checkpoint *cp;
+	uint32_t fields[ 7 ];
+	FILE *inputFile;
+	uint32_t i;
+
+	CLASS_VALIDATE_PARAMETER( fileName, -1 );
+	CLASS_VALIDATE_PARAMETER( index, -1 );
+
+	inputFile = fopen( fileName, "rb" );
+	if ( inputFile == NULL ) {
+		errorCode = errno;
+		PRINT_SYSTEM_ERROR();
+		return -1;
+	}
+
+	if ( fread( fields, sizeof(fields), 1, inputFile ) != 1 ||
+		 ntohl(fields[0]) != IMG3_LZSSINTERFACE_INDEX_SIGNATURE || ntohl(fields[1]) != IMG3_LZSSINTERFACE_INDEX_VERSION ||
+		 ntohl(fields[6]) == 0 || ntohl(fields[6]) > ntohl(fields[3]) / IMG3_LZSSINTERFACE_N + 2 )
+		goto LzssLoadIndex_invalid;
+
+	ip = new IMG3_LzssInterface_Index;
+	ip->checksum = ntohl(fields[2]);
+	ip->length_uncompressed = ntohl(fields[3]);
+	ip->length_compressed = ntohl(fields[4]);
+	ip->spacing = ntohl(fields[5]);
+	ip->count = ntohl(fields[6]);
+	ip->checkpoints = new IMG3_LzssInterface_Checkpoint[ip->count];
+
+	for (i = 0; i < ip->count; i++) {
+		cp = &ip->checkpoints[i];
+		if ( fread( fields, sizeof(uint32_t), 3, inputFile ) != 3 ||
+			 fread( cp->window, IMG3_LZSSINTERFACE_N, 1, inputFile ) != 1 )
+			goto LzssLoadIndex_invalid;
+		cp->input_offset = ntohl(fields[0]);
+		cp->output_offset = ntohl(fields[1]);
+		cp->flags = ntohl(fields[2]);
+		if ( cp->input_offset > ip->length_compressed || cp->output_offset > ip->length_uncompressed ||
+			 (i > 0 && cp->output_offset < ip->checkpoints[i-1].output_offset) )
+			goto LzssLoadIndex_invalid;
+	}
+
+	fclose( inputFile );
+	*index = ip;
+	return 0;
+
+LzssLoadIndex_invalid:
+	errorCode = IMG3_LZSS_ERROR_INVALID_INDEX;
+	PRINT_CLASS_ERROR( "file is not a valid lzss index" );
+	fclose( inputFile );
+	LzssFreeIndex( ip );
+	return -1;
+}
+
+/*! \fn		void LzssFreeIndex( IMG3_LzssInterface_Index *index )
+	\brief	Publically available routine for releasing a checkpoint index
+	\param	index checkpoint index to release; may be NULL
+*/
+
+void IMG3_LzssInterface::LzssFreeIndex(IMG3_LzssInterface_Index *index)
+{
+	if ( index == NULL )
+		return;
+	delete[]( index->checkpoints );
+	delete( index );
+}
+
+/*! \fn		int32_t LzssCompress( uint8_t *inbuff, size_t insize, uint8_t **outbuff, size_t *outsize )
+	\brief	Publically available LZSS compression routine
+	\param	inbuff pointer to the buffer containing the data to be compressed
+	\param	insize length of the inbuff in bytes
+	\param	outbuff address of a pointer to a buffer to store the compressed data; buffer will be automatically allocated by the function
+	\param	outsize address of a size_t variable in which to store the length of outbuff
+*/
+
+int32_t IMG3_LzssInterface::LzssCompress(uint8_t *inbuff, size_t insize, uint8_t **outbuff, size_t *outsize)
+{
+	IMG3_LzssInterface_CompressionHeader *header;
+	struct timespec start, finish;
+	uint32_t checksum = 0;
+	int32_t parallel;
+	uintptr_t outend;
+	uint8_t *curPtr;
+	uint32_t bytesCompressed = 0, bytesToCompress = insize;
+
+	CLASS_VALIDATE_PARAMETER( inbuff, -1 );
+	CLASS_VALIDATE_PARAMETER( outbuff, -1 );
+	CLASS_VALIDATE_PARAMETER( outsize, -1 );
+
+	if ( insize < sizeof(IMG3_LzssInterface_CompressionHeader) ) {
+		errorCode = IMG3_LZSS_ERROR_INPUT_TOO_SMALL;
+		PRINT_CLASS_ERROR( "input size too small to hold lzss header" );
+		return -1;
+	}
+
+	*outsize = IMG3_LZSSINTERFACE_BOUND(insize);
+	*outbuff = new uint8_t[*outsize];
+	if (outbuff == NULL) {
+		errorCode = errno;
+		PRINT_SYSTEM_ERROR();
+		return -1;
+	}
+
+	header = (IMG3_LzssInterface_CompressionHeader *)*outbuff;
+
+	memset(&stats, 0, sizeof(stats));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* Inputs that fit in a single block gain nothing from threads. */
+	parallel = ( engine == IMG3_LZSS_ENGINE_HASH_CHAIN && threadCount > 1 && insize > IMG3_LZSSINTERFACE_PARALLEL_BLOCK_SIZE );
+	if ( parallel )
+		outend = (uintptr_t)CompressParallel((uint8_t *)(header + 1), *outsize - sizeof(*header), inbuff, insize, &checksum);
+	else if ( engine == IMG3_LZSS_ENGINE_HASH_CHAIN )
+		outend = (uintptr_t)CompressHashChain((uint8_t *)(header + 1), *outsize - sizeof(*header), inbuff, insize);
+	else
+		outend = (uintptr_t)Compress((uint8_t *)(header + 1), *outsize - sizeof(*header), inbuff, insize);
+	if (outend == 0) {
+		errorCode = IMG3_LZSS_ERROR_COMPRESSION_FAILED;
+		PRINT_CLASS_ERROR( "compression failed" );
+		return -1;
+	}	
+
+	*outsize = outend - (uintptr_t)*outbuff;
+	if (*outsize % 16)
+		*outsize += 16 - (*outsize % 16);
+	memset((uint8_t *)outend, 0, *outsize - (outend - (uintptr_t)*outbuff));
+
+	header->signature = htonl(IMG3_LZSSINTERFACE_COMP_SIGNATURE);
+	header->compression_type = htonl(IMG3_LZSSINTERFACE_LZSS_SIGNATURE);
+	if ( !parallel )
+		checksum = lzadler32(inbuff, insize);
+	header->checksum = htonl(checksum);
+	header->length_uncompressed = htonl(insize);
+	header->length_compressed = htonl(outend - (uintptr_t)(header + 1));
+	memset(header->padding,0,sizeof(header->padding));
+
+	clock_gettime(CLOCK_MONOTONIC, &finish);
+	stats.input_bytes = insize;
+	stats.output_bytes = outend - (uintptr_t)(header + 1);
+	stats.seconds = (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec) / 1e9;
+
+	return 0;
+}
+
+/*! \fn		int LzssComparePatches( const void *a, const void *b )
+	\brief	qsort comparator ordering modified ranges by offset
+*/
+
+static int LzssComparePatches(const void *a, const void *b)
+{
+	const IMG3_LzssInterface_Patch *pa = (const IMG3_LzssInterface_Patch *)a;
+	const IMG3_LzssInterface_Patch *pb = (const IMG3_LzssInterface_Patch *)b;
+
+	if (pa->offset != pb->offset)
+		return (pa->offset < pb->offset) ? -1 : 1;
+	return 0;
+}
+
+/*! \fn		int32_t LzssRecompress( uint8_t *inbuff, size_t insize, uint8_t *plaintext, size_t plainsize, IMG3_LzssInterface_Patch *patches, uint32_t count, uint8_t **outbuff, size_t *outsize )
+	\brief	Publically available routine for recompressing data after parts of it were modified
+	\param	inbuff pointer to the buffer containing the original compressed data
+	\param	insize length of the inbuff in bytes
+	\param	plaintext pointer to the modified decompressed data
+	\param	plainsize length of the plaintext in bytes; must match the original
+	\param	patches array of modified ranges
+	\param	count number of entries in patches
+	\param	outbuff address of a pointer to a buffer to store the compressed data; buffer will be automatically allocated by the function
+	\param	outsize address of a size_t variable in which to store the length of outbuff
+*/
+
+int32_t IMG3_LzssInterface::LzssRecompress(uint8_t *inbuff, size_t insize, uint8_t *plaintext, size_t plainsize,
+										   IMG3_LzssInterface_Patch *patches, uint32_t count, uint8_t **outbuff, size_t *outsize)
+{
+	IMG3_LzssInterface_CompressionHeader *header;
+	IMG3_LzssInterface_Patch *ranges;
+	size_t dstlen, length;
+
+	CLASS_VALIDATE_PARAMETER( outbuff, -1 );
+	CLASS_VALIDATE_PARAMETER( outsize, -1 );
+
+	ranges = SortPatches(inbuff, insize, plaintext, plainsize, patches, &count);
+	if (ranges == NULL)
+		return -1;
+
+	header = (IMG3_LzssInterface_CompressionHeader *)inbuff;
+	dstlen = RecompressBound(inbuff, plainsize, ranges, count, IMG3_LZSSINTERFACE_N);
+	*outbuff = new uint8_t[dstlen];
+	if (*outbuff == NULL) {
+		errorCode = errno;
+		PRINT_SYSTEM_ERROR();
+		delete[]( ranges );
+		return -1;
+	}
+
+	if (RecompressStream(inbuff, plaintext, plainsize, ranges, count, IMG3_LZSSINTERFACE_N, NULL, *outbuff, dstlen, &length) == -1) {
+		delete[]( *outbuff );
+		*outbuff = NULL;
+		delete[]( ranges );
+		return -1;
+	}
+
+	*outsize = sizeof(*header) + length;
+	if (*outsize % 16)
+		*outsize += 16 - (*outsize % 16);
+	memset(*outbuff + sizeof(*header) + length, 0, *outsize - sizeof(*header) - length);
+	((IMG3_LzssInterface_CompressionHeader *)*outbuff)->checksum =
+		htonl(PatchChecksum(ntohl(header->checksum), plaintext, plainsize, ranges, count));
+
+	delete[]( ranges );
+	return 0;
+}
+
+/*! \fn		int32_t LzssRecompressToSize( uint8_t *inbuff, size_t insize, uint8_t *plaintext, size_t plainsize, IMG3_LzssInterface_Patch *patches, uint32_t count, uint8_t **outbuff, size_t *outsize )
+	\brief	Publically available routine for recompressing modified data into exactly the space of the original stream
+	\param	inbuff pointer to the buffer containing the original compressed data
+	\param	insize length of the inbuff in bytes, which is also the length of the output
+	\param	plaintext pointer to the modified decompressed data
+	\param	plainsize length of the plaintext in bytes; must match the original
+	\param	patches array of modified ranges
+	\param	count number of entries in patches
+	\param	outbuff address of a pointer to a buffer to store the compressed data; buffer will be automatically allocated by the function
+	\param	outsize address of a size_t variable in which to store the length of outbuff
+
+	The modified ranges are first recompressed as LzssRecompress does.  While the result doesn't
+	fit, the distance recompressed past each range is multiplied by eight, replacing more of the
+	original parse with the current compression level's, up to the whole stream.  A result that
+	only fits thanks to the padding is widened too, up to IMG3_LZSSINTERFACE_EXACT_REACH.  Once it fits, a
+	second pass splits matches in the recompressed ranges to grow the stream back to the original
+	compressed length.  Tokens are added eight at a time, so every range keeps its alignment and
+	the original tail is still copied as is.  Whatever can't be made up this way is left as zero
+	padding after the stream.
+*/
+
+int32_t IMG3_LzssInterface::LzssRecompressToSize(uint8_t *inbuff, size_t insize, uint8_t *plaintext, size_t plainsize,
+												 IMG3_LzssInterface_Patch *patches, uint32_t count, uint8_t **outbuff, size_t *outsize)
+{
+	IMG3_LzssInterface_CompressionHeader *header;
+	IMG3_LzssInterface_Patch *ranges;
+	size_t dstlen, length, original, space;
+	uint32_t reach, pad;
+
+	CLASS_VALIDATE_PARAMETER( outbuff, -1 );
+	CLASS_VALIDATE_PARAMETER( outsize, -1 );
+
+	ranges = SortPatches(inbuff, insize, plaintext, plainsize, patches, &count);
+	if (ranges == NULL)
+		return -1;
+
+	header = (IMG3_LzssInterface_CompressionHeader *)inbuff;
+	original = ntohl(header->length_compressed);
+	space = insize - sizeof(*header);
+	*outbuff = NULL;
+
+	for (reach = IMG3_LZSSINTERFACE_N; ; reach = (reach > plainsize / 8) ? plainsize : reach * 8) {
+		delete[]( *outbuff );
+		dstlen = RecompressBound(inbuff, plainsize, ranges, count, reach);
+		if (dstlen < insize)
+			dstlen = insize;
+		*outbuff = new uint8_t[dstlen];
+		if (*outbuff == NULL) {
+			errorCode = errno;
+			PRINT_SYSTEM_ERROR();
+			goto LzssRecompressToSize_free_ranges;
+		}
+		if (RecompressStream(inbuff, plaintext, plainsize, ranges, count, reach, NULL, *outbuff, dstlen, &length) == -1)
+			goto LzssRecompressToSize_free_output;
+		/* Overshooting into the padding is fine, but within a bounded reach it's worth trying to get under the original. */
+		if (length <= original || (length <= space && reach >= IMG3_LZSSINTERFACE_EXACT_REACH))
+			break;
+		if (reach >= plainsize) {
+			if (length <= space)
+				break;
+			errorCode = IMG3_LZSS_ERROR_TARGET_TOO_SMALL;
+			PRINT_CLASS_ERROR( "modified data doesn't compress into the space of the original" );
+			goto LzssRecompressToSize_free_output;
+		}
+	}
+
+	/* The parse is deterministic, so the second pass reproduces the first plus the padding tokens. */
+	if (length < original) {
+		pad = original - length;
+		if (RecompressStream(inbuff, plaintext, plainsize, ranges, count, reach, &pad, *outbuff, dstlen, &length) == -1)
+			goto LzssRecompressToSize_free_output;
+	}
+
+	*outsize = insize;
+	memset(*outbuff + sizeof(*header) + length, 0, space - length);
+	((IMG3_LzssInterface_CompressionHeader *)*outbuff)->checksum =
+		htonl(PatchChecksum(ntohl(header->checksum), plaintext, plainsize, ranges, count));
+
+	delete[]( ranges );
+	return 0;
+
+LzssRecompressToSize_free_output:
+	delete[]( *outbuff );
+	*outbuff = NULL;
+
+LzssRecompressToSize_free_ranges:
+	delete[]( ranges );
+	return -1;
+}
+
+/*! \fn		IMG3_LzssInterface_Patch * SortPatches( uint8_t *inbuff, size_t insize, uint8_t *plaintext, size_t plainsize, IMG3_LzssInterface_Patch *patches, uint32_t *count )
+	\brief	Private method validating a recompression request and sorting its modified ranges
+	\param	inbuff pointer to the buffer containing the original compressed data
+	\param	insize length of the inbuff in bytes
+	\param	plaintext pointer to the modified decompressed data
+	\param	plainsize length of the plaintext in bytes
+	\param	patches array of modified ranges
+	\param	count address of the number of entries in patches; updated to the number of non-empty ranges
+
+	Returns a new array holding the non-empty ranges in offset order, which the caller must
+	delete[], or NULL on error.
+*/
+
+IMG3_LzssInterface_Patch * IMG3_LzssInterface::SortPatches(uint8_t *inbuff, size_t insize, uint8_t *plaintext, size_t plainsize,
+														   IMG3_LzssInterface_Patch *patches, uint32_t *count)
+{
+	IMG3_LzssInterface_CompressionHeader *header;
+	IMG3_LzssInterface_Patch *ranges;
+	uint32_t i, r;
+
+	CLASS_VALIDATE_PARAMETER( inbuff, NULL );
+	CLASS_VALIDATE_PARAMETER( plaintext, NULL );
+	if ( *count != 0 )
+		CLASS_VALIDATE_PARAMETER( patches, NULL );
+
+	if (CheckHeader(inbuff, insize) == -1)
+		return NULL;
+
+	header = (IMG3_LzssInterface_CompressionHeader *)inbuff;
+	if (plainsize != ntohl(header->length_uncompressed)) {
+		errorCode = IMG3_LZSS_ERROR_INVALID_RANGE;
+		PRINT_CLASS_ERROR( "modified data is not the length of the original" );
+		return NULL;
+	}
+
+	ranges = new IMG3_LzssInterface_Patch[*count + 1];
+	if (ranges == NULL) {
+		errorCode = errno;
+		PRINT_SYSTEM_ERROR();
+		return NULL;
+	}
+	for (i = 0, r = 0; i < *count; i++) {
+		if (patches[i].offset > plainsize || patches[i].length > plainsize - patches[i].offset) {
+			errorCode = IMG3_LZSS_ERROR_INVALID_RANGE;
+			PRINT_CLASS_ERROR( "modified range runs past the end of the data" );
+			delete[]( ranges );
+			return NULL;
+		}
+		if (patches[i].length != 0)
+			ranges[r++] = patches[i];
+	}
+	qsort(ranges, r, sizeof(*ranges), LzssComparePatches);
+	*count = r;
+	return ranges;
+}
+
+/*! \fn		size_t RecompressBound( uint8_t *inbuff, size_t plainsize, IMG3_LzssInterface_Patch *ranges, uint32_t count, uint32_t reach )
+	\brief	Private method returning the largest stream RecompressStream can produce, header included
+	\param	inbuff pointer to the buffer containing the original compressed data
+	\param	plainsize length of the decompressed data in bytes
+	\param	ranges the sorted modified ranges
+	\param	count number of entries in ranges
+	\param	reach minimum number of bytes recompressed past each range
+*/
+
+size_t IMG3_LzssInterface::RecompressBound(uint8_t *inbuff, size_t plainsize, IMG3_LzssInterface_Patch *ranges, uint32_t count, uint32_t reach)
+{
+	IMG3_LzssInterface_CompressionHeader *header = (IMG3_LzssInterface_CompressionHeader *)inbuff;
+	uint64_t k = 0;
+	uint32_t i;
+
+	/* The original stream plus every recompressed byte sent as a literal. */
+	for (i = 0; i < count; i++)
+		k += (uint64_t) ranges[i].length + reach + 8 * IMG3_LZSSINTERFACE_F;
+	if (k > plainsize)
+		k = plainsize;
+	return sizeof(*header) + ntohl(header->length_compressed) + IMG3_LZSSINTERFACE_BOUND(k);
+}
+
+/*! \fn		int32_t RecompressStream( uint8_t *inbuff, uint8_t *plaintext, size_t plainsize, IMG3_LzssInterface_Patch *ranges, uint32_t count, uint32_t reach, uint32_t *pad, uint8_t *outbuff, size_t outlen, size_t *length )
+	\brief	Private method splicing recompressed ranges into the original token stream
+	\param	inbuff pointer to the buffer containing the original compressed data, with a validated header
+	\param	plaintext pointer to the modified decompressed data
+	\param	plainsize length of the plaintext in bytes
+	\param	ranges the sorted modified ranges
+	\param	count number of entries in ranges
+	\param	reach minimum number of bytes recompressed past each range; at least N
+	\param	pad address of the number of bytes to grow the stream by, updated to what remains; may be NULL
+	\param	outbuff pointer to the buffer receiving the header and the token stream
+	\param	outlen length of the outbuff in bytes
+	\param	length address of a size_t variable in which to store the length of the token stream
+
+	The original token stream is walked without being decoded.  Each group of modified ranges is
+	recompressed from the original token covering its first byte up to a sync point: the first
+	original flag byte at least reach bytes past the last modified byte.  No original token past
+	that point can refer to a modified byte, so once the recompressed tokens are aligned to end
+	on a flag byte boundary, the original groups from the sync point on are copied as is.  Ranges
+	that start before the sync point of the previous one are recompressed together with it.  The
+	header is copied with the new compressed length; the checksum is left to the caller.
+*/
+
+int32_t IMG3_LzssInterface::RecompressStream(uint8_t *inbuff, uint8_t *plaintext, size_t plainsize, IMG3_LzssInterface_Patch *ranges,
+											 uint32_t count, uint32_t reach, uint32_t *pad, uint8_t *outbuff, size_t outlen, size_t *length)
+{
+	IMG3_LzssInterface_CompressionHeader *header, *outheader;
+	struct lzss_token_cursor tc, prior;
+	struct lzss_emit_state es;
+	struct timespec start, finish;
+	uint32_t r, first, last, limit, added;
+	uint8_t *stream, *streamend, *copied, *before;
+
+	memset(&stats, 0, sizeof(stats));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	header = (IMG3_LzssInterface_CompressionHeader *)inbuff;
+	outheader = (IMG3_LzssInterface_CompressionHeader *)outbuff;
+	memcpy(outheader, header, sizeof(*header));
+
+	stream = (uint8_t *)(header + 1);
+	streamend = stream + ntohl(header->length_compressed);
+	tc.group = stream;
+	tc.token = stream + 1;
+	tc.end = streamend;
+	tc.bit = 0;
+	tc.output = 0;
+	copied = stream;
+
+	InitContext(&context);
+	InitEmitState(&es, (uint8_t *)(outheader + 1), outlen - sizeof(*outheader), 0);
+
+	for (r = 0; r < count; ) {
+		/* Carry the original tokens over up to the one covering the first modified byte. */
+		first = ranges[r].offset;
+		for ( ; ; ) {
+			prior = tc;
+			if (LzssNextToken(&tc) == -1)
+				goto RecompressStream_corrupt;
+			if (tc.output > first) {
+				tc = prior;
+				break;
+			}
+		}
+		if (CopyStream(&es, copied, tc.group - copied) != 0 || AppendStream(&es, tc.group, tc.token - tc.group) != 0)
+			goto RecompressStream_overflow;
+		es.pos = tc.output;
+		first = tc.output;
+
+		/* Find the sync point, taking in every range that starts before it. */
+		last = ranges[r].offset + ranges[r].length;
+		limit = (reach >= plainsize - last) ? plainsize : last + reach;
+		for (r++; ; r++) {
+			while (tc.output < plainsize && (tc.bit != 0 || tc.output < limit))
+				if (LzssNextToken(&tc) == -1)
+					goto RecompressStream_corrupt;
+			if (tc.output > plainsize)
+				goto RecompressStream_corrupt;
+			if (r == count || ranges[r].offset >= tc.output)
+				break;
+			if (ranges[r].offset + ranges[r].length > last) {
+				last = ranges[r].offset + ranges[r].length;
+				limit = (reach >= plainsize - last) ? plainsize : last + reach;
+			}
+		}
+
+		/* An unaligned range still decodes correctly; the tail is then regrouped by AppendStream. */
+		before = es.dst;
+		added = (pad != NULL) ? *pad : 0;
+		if (CompressRange(&context, &es, plaintext, first, tc.output, (tc.output != plainsize), (pad != NULL) ? &added : NULL) < 0)
+			goto RecompressStream_overflow;
+		if (pad != NULL)
+			*pad -= added;
+		copied = (tc.output == plainsize) ? streamend : tc.group;
+		stats.input_bytes += tc.output - first;
+		stats.output_bytes += es.dst - before;
+	}
+
+	if (CopyStream(&es, copied, streamend - copied) != 0 || FlushEmitState(&es) != 0)
+		goto RecompressStream_overflow;
+
+	*length = es.dst - (uint8_t *)(outheader + 1);
+	outheader->length_compressed = htonl(*length);
+
+	clock_gettime(CLOCK_MONOTONIC, &finish);
+	stats.literals = es.literals;
+	stats.matches = es.matches;
+	stats.seconds = (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec) / 1e9;
+	return 0;
+
+RecompressStream_corrupt:
+	errorCode = IMG3_LZSS_ERROR_CORRUPT_STREAM;
+	PRINT_CLASS_ERROR( "token stream does not match the uncompressed length" );
+	return -1;
+
+RecompressStream_overflow:
+	errorCode = IMG3_LZSS_ERROR_COMPRESSION_FAILED;
+	PRINT_CLASS_ERROR( "compression failed" );
+	return -1;
+}
+
+/*! \fn		uint32_t PatchChecksum( uint32_t checksum, uint8_t *plaintext, size_t plainsize, IMG3_LzssInterface_Patch *ranges, uint32_t count )
+	\brief	Private method computing the checksum of modified data from the checksum of the original
+	\param	checksum adler32 checksum of the original data
+	\param	plaintext pointer to the modified data
+	\param	plainsize length of the plaintext in bytes
+	\param	ranges the sorted modified ranges
+	\param	count number of entries in ranges
+
+	Each modified byte at offset k adds its difference d to the low sum and (len-k)*d to the high
+	sum.  That needs the original bytes, so if a range lacks them or two ranges overlap the whole
+	plaintext is checksummed instead.
+*/
+
+uint32_t IMG3_LzssInterface::PatchChecksum(uint32_t checksum, uint8_t *plaintext, size_t plainsize, IMG3_LzssInterface_Patch *ranges, uint32_t count)
+{
+	unsigned long sum1, sum2, delta;
+	uint32_t i, k;
+
+	for (i = 0; i < count; i++) {
+		if (ranges[i].original == NULL || (i != 0 && ranges[i].offset < ranges[i-1].offset + ranges[i-1].length))
+			return lzadler32(plaintext, plainsize);
+	}
+
+	sum1 = checksum & 0xFFFF;
+	sum2 = (checksum >> 16) & 0xFFFF;
+	for (i = 0; i < count; i++) {
+		for (k = 0; k < ranges[i].length; k++) {
+			delta = (IMG3_LZSSINTERFACE_BASE + plaintext[ranges[i].offset + k] - ranges[i].original[k]) % IMG3_LZSSINTERFACE_BASE;
+			sum1 = (sum1 + delta) % IMG3_LZSSINTERFACE_BASE;
+			sum2 = (sum2 + ((plainsize - ranges[i].offset - k) % IMG3_LZSSINTERFACE_BASE) * delta) % IMG3_LZSSINTERFACE_BASE;
+		}
+	}
+	return (sum2 << 16) | sum1;
+}
+
+/*! \fn		int32_t IsFileCompressed( uint8_t *inbuff )
+	\brief	Publically available routine for determining if data is compressed
+	\param	inbuff pointer to the buffer containing possible compressed data
+*/
+
+int32_t IMG3_LzssInterface::IsFileCompressed(uint8_t *inbuff)
+{
+	IMG3_LzssInterface_CompressionHeader *header;
+
+	CLASS_VALIDATE_PARAMETER(inbuff, -1);
+
+	header = (IMG3_LzssInterface_CompressionHeader *)inbuff;
+
+	header = (IMG3_LzssInterface_CompressionHeader *)inbuff;
+
+	if (ntohl(header->signature) != IMG3_LZSSINTERFACE_COMP_SIGNATURE && ntohl(header->compression_type) != IMG3_LZSSINTERFACE_LZSS_SIGNATURE) {
+		errorCode = IMG3_LZSS_ERROR_FILE_NOT_A_LZSS_FILE;
+		PRINT_CLASS_ERROR( "file not a valid lzss archive" );
+		return -1;
+	}
+	return 0;
+}
+
+/*!	\fn		uint32_t LzssAdler32Scalar( uint32_t adler, const uint8_t *buf, size_t len )
+	\brief	Portable adler32 kernel that only reduces the sums once every NMAX bytes
+	\param	adler running checksum to continue from
+	\param	buf pointer to the data on which to perform the checksum
+	\param	len size of buf buffer in bytes
+*/
+
+static uint32_t LzssAdler32Scalar(uint32_t adler, const uint8_t *buf, size_t len)
+{
+	unsigned long s1 = adler & 0xFFFF;
+	unsigned long s2 = (adler >> 16) & 0xFFFF;
+	size_t n;
+
+	while (len > 0) {
+		n = len < IMG3_LZSSINTERFACE_NMAX ? len : IMG3_LZSSINTERFACE_NMAX;
+		len -= n;
+		while (n >= 8) {
+			s1 += buf[0]; s2 += s1;
+			s1 += buf[1]; s2 += s1;
+			s1 += buf[2]; s2 += s1;
+			s1 += buf[3]; s2 += s1;
+			s1 += buf[4]; s2 += s1;
+			s1 += buf[5]; s2 += s1;
+			s1 += buf[6]; s2 += s1;
+			s1 += buf[7]; s2 += s1;
+			buf += 8;
+			n -= 8;
+		}
+		while (n--) {
+			s1 += *buf++;
+			s2 += s1;
+		}
+		s1 %= IMG3_LZSSINTERFACE_BASE;
+		s2 %= IMG3_LZSSINTERFACE_BASE;
+	}
+	return (s2 << 16) | s1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*!	\fn		uint32_t LzssAdler32SSE2( uint32_t adler, const uint8_t *buf, size_t len )
+	\brief	SSE2 adler32 kernel working on 16 byte blocks
+	\param	adler running checksum to continue from
+	\param	buf pointer to the data on which to perform the checksum
+	\param	len size of buf buffer in bytes
+
+	Within each NMAX sized chunk the byte sums are gathered with psadbw and the position weighted
+	sums with pmaddwd; s1 is added to s2 once per block and scaled by the block size at the end.
+*/
+
+__attribute__((target("sse2")))
+static uint32_t LzssAdler32SSE2(uint32_t adler, const uint8_t *buf, size_t len)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i wlo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+	const __m128i whi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+	unsigned long s1 = adler & 0xFFFF;
+	unsigned long s2 = (adler >> 16) & 0xFFFF;
+	uint32_t lane[ 4 ];
+	uint64_t sum1, prefix, sum2;
+	__m128i vs1, vps, vs2, v;
+	size_t n, k;
+
+	while (len >= 16) {
+		n = (len < IMG3_LZSSINTERFACE_NMAX ? len : IMG3_LZSSINTERFACE_NMAX) & ~(size_t)15;
+		len -= n;
+		s2 += s1 * n;
+		vs1 = vps = vs2 = zero;
+		for (k = 0; k < n; k += 16, buf += 16) {
+			v = _mm_loadu_si128((const __m128i *)buf);
+			vps = _mm_add_epi32(vps, vs1);
+			vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(v, zero));
+			vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), wlo));
+			vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), whi));
+		}
+		_mm_storeu_si128((__m128i *)lane, vs1);
+		sum1 = (uint64_t)lane[0] + lane[1] + lane[2] + lane[3];
+		_mm_storeu_si128((__m128i *)lane, vps);
+		prefix = (uint64_t)lane[0] + lane[1] + lane[2] + lane[3];
+		_mm_storeu_si128((__m128i *)lane, vs2);
+		sum2 = (uint64_t)lane[0] + lane[1] + lane[2] + lane[3];
+		s1 = (s1 + sum1) % IMG3_LZSSINTERFACE_BASE;
+		s2 = (s2 + (prefix << 4) + sum2) % IMG3_LZSSINTERFACE_BASE;
+	}
+	return LzssAdler32Scalar((s2 << 16) | s1, buf, len);
+}
+
+/*!	\fn		uint32_t LzssAdler32AVX2( uint32_t adler, const uint8_t *buf, size_t len )
+	\brief	AVX2 adler32 kernel working on 32 byte blocks
+	\param	adler running checksum to continue from
+	\param	buf pointer to the data on which to perform the checksum
+	\param	len size of buf buffer in bytes
+*/
+
+__attribute__((target("avx2")))
+static uint32_t LzssAdler32AVX2(uint32_t adler, const uint8_t *buf, size_t len)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i ones = _mm256_set1_epi16(1);
+	const __m256i weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+											 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+	unsigned long s1 = adler & 0xFFFF;
+	unsigned long s2 = (adler >> 16) & 0xFFFF;
+	uint32_t lane[ 8 ];
+	uint64_t sum1, prefix, sum2;
+	__m256i vs1, vps, vs2, v;
+	size_t n, k;
+	int32_t i;
+
+	while (len >= 32) {
+		n = (len < IMG3_LZSSINTERFACE_NMAX ? len : IMG3_LZSSINTERFACE_NMAX) & ~(size_t)31;
+		len -= n;
+		s2 += s1 * n;
+		vs1 = vps = vs2 = zero;
+		for (k = 0; k < n; k += 32, buf += 32) {
+			v = _mm256_loadu_si256((const __m256i *)buf);
+			vps = _mm256_add_epi32(vps, vs1);
+			vs1 = _mm256_add_epi32(vs1, _mm256_sad_epu8(v, zero));
+			vs2 = _mm256_add_epi32(vs2, _mm256_madd_epi16(_mm256_maddubs_epi16(v, weights), ones));
+		}
+		sum1 = prefix = sum2 = 0;
+		_mm256_storeu_si256((__m256i *)lane, vs1);
+		for (i = 0; i < 8; i++)
+			sum1 += lane[i];
+		_mm256_storeu_si256((__m256i *)lane, vps);
+		for (i = 0; i < 8; i++)
+			prefix += lane[i];
+		_mm256_storeu_si256((__m256i *)lane, vs2);
+		for (i = 0; i < 8; i++)
+			sum2 += lane[i];
+		s1 = (s1 + sum1) % IMG3_LZSSINTERFACE_BASE;
+		s2 = (s2 + (prefix << 5) + sum2) % IMG3_LZSSINTERFACE_BASE;
+	}
+	_mm256_zeroupper();
+	return LzssAdler32Scalar((s2 << 16) | s1, buf, len);
+}
+
+#endif
+
+typedef uint32_t (*lzss_adler32_kernel)(uint32_t, const uint8_t *, size_t);
+
+static lzss_adler32_kernel LzssAdler32Selected = NULL;
+static pthread_once_t LzssAdler32Once = PTHREAD_ONCE_INIT;
+
+/*!	\fn		void LzssAdler32Select()
+	\brief	Picks the fastest adler32 kernel the processor supports.  Run once through pthread_once, since compression threads checksum concurrently.
+*/
+
+static void LzssAdler32Select()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		LzssAdler32Selected = LzssAdler32AVX2;
+	else if (__builtin_cpu_supports("sse2"))
+		LzssAdler32Selected = LzssAdler32SSE2;
+	else
+#endif
+		LzssAdler32Selected = LzssAdler32Scalar;
+}
+
+/*!	\fn		lzss_adler32_kernel LzssAdler32Kernel()
+	\brief	Returns the adler32 kernel picked for this processor
+*/
+
+static lzss_adler32_kernel LzssAdler32Kernel()
+{
+	pthread_once(&LzssAdler32Once, LzssAdler32Select);
+	return LzssAdler32Selected;
+}
+
+/*!	\fn		uint32_t lzadler32_update( uint32_t adler, uint8_t *buf, uint32_t len )
+	\brief	Private function for continuing an adler32 checksum over more data
+	\param	adler checksum of the data seen so far; 1 for none
+	\param	buf pointer to the data on which to perform the checksum
+	\param  len size of buf buffer in bytes
+*/
+
+uint32_t IMG3_LzssInterface::lzadler32_update(uint32_t adler, uint8_t *buf, uint32_t len)
+{
+	return LzssAdler32Kernel()(adler, buf, len);
+}
+
+/*!	\fn		uint32_t lzadler32( uint8_t *buf, int32_t len )
+	\brief	Private function for computing the adler32 checksum of the provided data
+	\param	buf pointer to the data on which to perform the checksum
+	\param  len size of buf buffer in bytes
+*/
+
+uint32_t IMG3_LzssInterface::lzadler32(uint8_t *buf, int32_t len)
+{
+	return lzadler32_update(1, buf, len);
+}
+
+/*!	\fn	int Decompress( uint8_t *dst, uint8_t *src, uint32_t srclen
+	\brief	Private reference decompression method for performing LZSS decompression through a ring buffer
+	\param	dst pointer to a buffer to store the result of the decompression
+	\param	src pointer to the buffer containing the data to be decompressed
+	\param	srclen size of src buffer in bytes
+*/
+
+uint32_t IMG3_LzssInterface::Decompress(uint8_t *dst, uint8_t *src, uint32_t srclen)
+{
+	/* ring buffer of size N, with extra F-1 bytes to aid string comparison */
+	uint8_t text_buf[IMG3_LZSSINTERFACE_N + IMG3_LZSSINTERFACE_F - 1];
+	uint8_t *dststart = dst;
+	uint8_t *srcend = src + srclen;
+	int i, j, k, r, c;
+	unsigned int flags;
+
+	dst = dststart;
+	srcend = src + srclen;
+	for (i = 0; i < IMG3_LZSSINTERFACE_N - IMG3_LZSSINTERFACE_F; i++)
+		text_buf[i] = ' ';
+	r = IMG3_LZSSINTERFACE_N - IMG3_LZSSINTERFACE_F;
+	flags = 0;
+	for ( ; ; ) {
+		if (((flags >>= 1) & 0x100) == 0) {
+			if (src < srcend) c = *src++; else break;
+			flags = c | 0xFF00;  /* uses higher byte cleverly */
+		}  /* to count eight */
+		if (flags & 1) {
+			if (src < srcend) c = *src++; else break;
+			*dst++ = c;
+			text_buf[r++] = c;
+			r &= (IMG3_LZSSINTERFACE_N - 1);
+		} else {
+			if (src < srcend) i = *src++; else break;
+			if (src < srcend) j = *src++; else break;
+			i |= ((j & 0xF0) << 4);
+			j = (j & 0x0F) + IMG3_LZSSINTERFACE_THRESHOLD;
+			for (k = 0; k <= j; k++) {
+				c = text_buf[(i + k) & (IMG3_LZSSINTERFACE_N - 1)];
+				*dst++ = c;
+				text_buf[r++] = c;
+				r &= (IMG3_LZSSINTERFACE_N - 1);
+			}
+		}
+	}
+
+	return dst - dststart;
+}
+
+/*!	\fn		int32_t DecodeTokens( struct lzss_decode_state *dp )
+	\brief	Private decompression method that uses the output buffer itself as the history window
+	\param	dp pointer to the lzss_decode_state structure describing the input, output and flag phase
+
+	The decoder is IMG3_LzssAppleCodec's, specialized for the 4096/18/2 parameters.  Returns
+	IMG3_LZSS_DECODE_INPUT_END, IMG3_LZSS_DECODE_OUTPUT_FULL, or -1 if a back reference points at
+	history that isn't available.
+*/
+
+int32_t IMG3_LzssInterface::DecodeTokens(struct lzss_decode_state *dp)
+{
+	return IMG3_LzssAppleCodec::DecodeTokens(dp);
+}
+
+/*!	\fn		uint32_t DecompressFast( uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen )
+	\brief	Private decompression method that decodes a whole stream with DecodeTokens
+	\param	dst pointer to a buffer to store the result of the decompression
+	\param	dstlen size in bytes of the dst buffer; nothing is written past it
+	\param	src pointer to the buffer containing the data to be decompressed
+	\param	srclen size of src buffer in bytes
+*/
+
+uint32_t IMG3_LzssInterface::DecompressFast(uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen)
+{
+	return IMG3_LzssAppleCodec::Decompress(dst, dstlen, src, srclen);
+}
+
+/*!	\fn		uint32_t DecompressVerify( uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen, uint32_t *checksum )
+	\brief	Private decompression method that checksums the output as it is produced
+	\param	dst pointer to a buffer to store the result of the decompression
+	\param	dstlen size in bytes of the dst buffer; nothing is written past it
+	\param	src pointer to the buffer containing the data to be decompressed
+	\param	srclen size of src buffer in bytes
+	\param	checksum address of a variable in which to store the adler32 checksum of the output
+
+	The stream is decoded in chunks of IMG3_LZSSINTERFACE_VERIFY_CHUNK bytes and each chunk is
+	added to the checksum straight away, while it is still in the cache.
+*/
+
+uint32_t IMG3_LzssInterface::DecompressVerify(uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen, uint32_t *checksum)
+{
+	struct lzss_decode_state ds;
+	uint8_t *done = dst;
+	uint32_t adler = 1;
+	int32_t status;
+
+	InitDecodeState(&ds, dst, dstlen, src, srclen);
+	do {
+		if (ds.dstend - ds.dst > IMG3_LZSSINTERFACE_VERIFY_CHUNK)
+			ds.dststop = ds.dst + IMG3_LZSSINTERFACE_VERIFY_CHUNK;
+		else
+			ds.dststop = ds.dstend;
+		status = DecodeTokens(&ds);
+		if (ds.dst == done)
+			break;
+		adler = lzadler32_update(adler, done, ds.dst - done);
+		done = ds.dst;
+	} while (status == IMG3_LZSS_DECODE_OUTPUT_FULL && ds.dst < ds.dstend);
+
+	*checksum = adler;
+	return ds.dst - dst;
+}
+
+/*!	\fn		void InitDecodeState( struct lzss_decode_state *dp, uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen )
+	\brief	Private method for preparing a decoder at the start of a stream
+	\param	dp pointer to the lzss_decode_state structure to initialize
+	\param	dst pointer to the buffer receiving the start of the output
+	\param	dstlen size in bytes of the dst buffer
+	\param	src pointer to the first token byte of the stream
+	\param	srclen number of token bytes available
+*/
+
+void IMG3_LzssInterface::InitDecodeState(struct lzss_decode_state *dp, uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen)
+{
+	IMG3_LzssAppleCodec::InitDecodeState(dp, dst, dstlen, src, srclen);
+}
+
+/*! \fn		uint8_t * Compress( uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen )
+	\brief	Private compression method for performing LZSS compression
+	\param	dst pointer to a buffer to store the result of the compression
+	\param	dstlen size in bytes of the dst buffer
+	\param	src pointer to the buffer containing the data to be compressed
+	\param 	srclen size in bytes of the src buffer
+*/
+
+uint8_t * IMG3_LzssInterface::Compress(uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen)
+{
+	/* Encoding state, mostly tree but some current match stuff */
+	struct encode_state *sp;
+
+	int i, c, len, r, s, last_match_length, code_buf_ptr;
+	uint8_t code_buf[17], mask;
+	uint8_t *srcend = src + srclen;
+	uint8_t *dstend = dst + dstlen;
+
+	/* initialize trees; the state is kept with the instance so repeated calls don't reallocate it */
+	if (encodeState == NULL)
+		encodeState = new struct encode_state;
+	sp = encodeState;
+	InitState(sp);
+
+	/*
+	 * code_buf[1..16] saves eight units of code, and code_buf[0] works
+	 * as eight flags, "1" representing that the unit is an unencoded
+	 * letter (1 byte), "" a position-and-length pair (2 bytes).
+	 * Thus, eight units require at most 16 bytes of code.
+	 */
+	code_buf[0] = 0;
+	code_buf_ptr = mask = 1;
+
+	/* Clear the buffer with any character that will appear often. */
+	s = 0; r = IMG3_LZSSINTERFACE_N - IMG3_LZSSINTERFACE_F;
+
+	/* Read F bytes into the last F bytes of the buffer */
+	for (len = 0; len < IMG3_LZSSINTERFACE_F && src < srcend; len++)
+		sp->text_buf[r + len] = *src++;
+	if (!len)
+		return NULL; /* text of size zero */
+	/*
+	 * Insert the F strings, each of which begins with one or more
+	 * 'space' characters.  Note the order in which these strings are
+	 * inserted.  This way, degenerate trees will be less likely to occur.
+	 */
+	for (i = 1; i <= IMG3_LZSSINTERFACE_F; i++)
+		InsertNode(sp, r - i);
+
+	/*
 	 * Finally, insert the whole string just read.
 	 * The global variables match_length and match_position are set.
 	 */
@@ -287,68 +1657,1067 @@ uint8_t * IMG3_LzssInterface::Compress(uint8_t *dst, uint32_t dstlen, uint8_t *s
 			sp->match_length = 1;  /* Not long enough match.  Send one byte. */
 			code_buf[0] |= mask;  /* 'send one byte' flag */
 			code_buf[code_buf_ptr++] = sp->text_buf[r]; /* Send uncoded. */
+			stats.literals++;
+		} else {
+			/* Send position and length pair.  Note match_length > THRESHOLD. */
+			code_buf[code_buf_ptr++] = (uint8_t) sp->match_position;
+			code_buf[code_buf_ptr++] = (uint8_t)
+                						( ((sp->match_position >> 4) & 0xF0)
+                								|  (sp->match_length - (IMG3_LZSSINTERFACE_THRESHOLD +1)) );
+			stats.matches++;
+		}
+		if ((mask <<= 1) == 0) {  /* Shift mask left one bit. */
+			/* Send at most 8 units of code together */
+			for (i = 0; i < code_buf_ptr; i++)
+				if (dst < dstend)
+					*dst++ = code_buf[i];
+				else
+					return NULL;
+			code_buf[0] = 0;
+			code_buf_ptr = mask = 1;
+		}
+		last_match_length = sp->match_length;
+		for (i = 0; i < last_match_length && src < srcend; i++) {
+			DeleteNode(sp, s);  /* Delete old strings and */
+			c = *src++;
+			sp->text_buf[s] = c; /* read new bytes */
+
+			/*
+			 * If the position is near the end of buffer, extend the buffer
+			 * to make string comparison easier.
+			 */
+			if (s < IMG3_LZSSINTERFACE_F - 1)
+				sp->text_buf[s + IMG3_LZSSINTERFACE_N] = c;
+
+			/* Since this is a ring buffer, increment the position modulo N. */
+			s = (s + 1) & (IMG3_LZSSINTERFACE_N - 1);
+			r = (r + 1) & (IMG3_LZSSINTERFACE_N - 1);
+
+			/* Register the string in text_buf[ r..r+F-1] */
+			InsertNode(sp, r);
+		}
+		while (i++ < last_match_length) {
+			DeleteNode(sp, s);
+
+			/* After the end of text, no need to read. */
+			s = (s + 1) & (IMG3_LZSSINTERFACE_N - 1);
+			r = (r + 1) & (IMG3_LZSSINTERFACE_N - 1);
+			/* but buffer may not be empty. */
+			if (--len)
+				InsertNode(sp , r);
+		}
+	} while (len > 0);  /* until length of string to be processed is zero */
+	if (code_buf_ptr > 1) {  /* Send remaining code. */
+		for (i = 0; i < code_buf_ptr; i++)
+			if (dst < dstend)
+				*dst++ = code_buf[i];
+			else
+				return NULL;
+	}
+
+	return dst;
+}
+
+/*! \fn		uint8_t * CompressHashChain( uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen )
+	\brief	Private compression method for performing LZSS compression with a hash-chain match finder
+	\param	dst pointer to a buffer to store the result of the compression
+	\param	dstlen size in bytes of the dst buffer
+	\param	src pointer to the buffer containing the data to be compressed
+	\param 	srclen size in bytes of the src buffer
+
+	The input is addressed linearly rather than through a ring buffer, so no bytes have to be copied
+	into a window before they can be matched.  Matches are limited to the N-F bytes preceding the
+	current position, which is the same window the binary tree encoder uses, and are encoded as ring
+	buffer positions so the output is identical in format to that of Compress.
+*/
+
+uint8_t * IMG3_LzssInterface::CompressHashChain(uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen)
+{
+	struct lzss_emit_state es;
+
+	if (srclen == 0)
+		return NULL; /* text of size zero */
+
+	InitContext(&context);
+	InitEmitState(&es, dst, dstlen, 0);
+	if (CompressRange(&context, &es, src, 0, srclen, 0, NULL) < 0)
+		return NULL;
+	if (FlushEmitState(&es) != 0)
+		return NULL;
+
+	stats.literals += es.literals;
+	stats.matches += es.matches;
+	return es.dst;
+}
+
+/*! \fn		void InitContext( struct lzss_context *cp )
+	\brief	Private method for allocating the tables of a compression context on first use
+	\param	cp pointer to the lzss_context structure
+*/
+
+void IMG3_LzssInterface::InitContext(struct lzss_context *cp)
+{
+	if (cp->hash == NULL) {
+		cp->hash = new struct hash_state;
+		memset(cp->hash->head, 0xFF, sizeof(cp->hash->head));
+		cp->hash->base = 0;
+	}
+	if (cp->tokens == NULL)
+		cp->tokens = new struct lzss_token[ IMG3_LZSSINTERFACE_BLOCK_SIZE + IMG3_LZSSINTERFACE_F ];
+	if (level == IMG3_LZSS_LEVEL_OPTIMAL && cp->optimal == NULL)
+		cp->optimal = new struct optimal_state;
+}
+
+/*! \fn		void FreeContext( struct lzss_context *cp )
+	\brief	Private method for releasing the tables of a compression context
+	\param	cp pointer to the lzss_context structure
+*/
+
+void IMG3_LzssInterface::FreeContext(struct lzss_context *cp)
+{
+	if (cp->hash != NULL)
+		delete( cp->hash );
+	if (cp->optimal != NULL)
+		delete( cp->optimal );
+	if (cp->tokens != NULL)
+		delete[]( cp->tokens );
+	cp->hash = NULL;
+	cp->optimal = NULL;
+	cp->tokens = NULL;
+}
+
+/*! \fn		int32_t CompressRange( struct lzss_context *cp, struct lzss_emit_state *ep, uint8_t *src, uint32_t start, uint32_t end, int32_t align, uint32_t *pad )
+	\brief	Private method for compressing one range of the input with the hash-chain match finder
+	\param	cp pointer to the lzss_context structure to use
+	\param	ep pointer to the lzss_emit_state structure that receives the tokens
+	\param	src pointer to the start of the input
+	\param	start offset of the first byte to compress
+	\param	end offset following the last byte to compress; no match extends past it
+	\param	align non-zero if the range must end on a flag byte boundary
+	\param	pad address of the number of bytes to grow the range by, updated to the number added; may be NULL
+
+	Up to N-F bytes preceding start are entered into the hash chains first, so the range is compressed
+	exactly as well as if everything before it had been compressed by the same context.  The range is
+	parsed one block at a time with the parser selected by the compression level.  When align is set,
+	matches near the end of the last block are split into literals and shorter matches until the
+	token count is a multiple of eight.  Every block is grown by as much of what remains of pad
+	as it can absorb, eight tokens at a time, which keeps the alignment.  Returns 0 on success, 1 if the range could not be aligned, and -1 if
+	the output buffer is full.
+*/
+
+int32_t IMG3_LzssInterface::CompressRange(struct lzss_context *cp, struct lzss_emit_state *ep, uint8_t *src, uint32_t start, uint32_t end, int32_t align, uint32_t *pad)
+{
+	struct hash_state *hp = cp->hash;
+	uint32_t p, next, count, phase, extra, grow, want = 0;
+	int32_t result = 0;
+
+	if (pad != NULL) {
+		want = *pad;
+		*pad = 0;
+	}
+
+	InitHashState(hp, end);
+	hp->max_chain = ChainLimit();
+
+	/* Prime the window with the plaintext preceding the range. */
+	p = (start > IMG3_LZSSINTERFACE_MAX_DIST) ? start - IMG3_LZSSINTERFACE_MAX_DIST : 0;
+	for ( ; p < start; p++)
+		HashInsert(hp, src, p);
+
+	while (p < end) {
+		next = p + IMG3_LZSSINTERFACE_BLOCK_SIZE;
+		if (next > end)
+			next = end;
+		switch (level) {
+		case IMG3_LZSS_LEVEL_FAST:
+			next = ParseGreedy(hp, src, p, next, end, cp->tokens, &count);
+			break;
+		case IMG3_LZSS_LEVEL_OPTIMAL:
+			next = ParseOptimal(hp, cp->optimal, src, p, next, cp->tokens, &count);
+			break;
+		default:
+			next = ParseLazy(hp, src, p, next, end, cp->tokens, &count);
+			break;
+		}
+		if (align && next >= end) {
+			/* The flag bit of the next token tells how many tokens the current group already holds. */
+			for (phase = 0; (1 << phase) != ep->mask; phase++)
+				;
+			extra = (8 - (phase + count) % 8) % 8;
+			if (extra != 0 && AlignTokens(cp->tokens, &count, next, extra) != 0)
+				result = 1;
+		}
+		if (pad != NULL && *pad < want) {
+			/* Whole groups of tokens can go anywhere; settle for the largest amount the block can absorb. */
+			for (grow = want - *pad; grow >= IMG3_LZSSINTERFACE_MIN_PAD; grow = (grow > 64) ? grow - grow / 4 : grow - 1)
+				if (PadTokens(cp->tokens, &count, next, grow) == 0)
+					break;
+			if (grow >= IMG3_LZSSINTERFACE_MIN_PAD)
+				*pad += grow;
+		}
+		if (EmitTokens(ep, src, cp->tokens, count) != 0)
+			return -1;
+		p = next;
+	}
+
+	/* Push the base past everything inserted so this range's entries are stale for the next one. */
+	hp->base += end + IMG3_LZSSINTERFACE_N;
+	return result;
+}
+
+/*! \fn		uint32_t ChainLimit( void )
+	\brief	Private method returning how many hash chain entries the compression level may examine
+*/
+
+uint32_t IMG3_LzssInterface::ChainLimit(void)
+{
+	switch (level) {
+	case IMG3_LZSS_LEVEL_FAST:
+		return IMG3_LZSSINTERFACE_FAST_CHAIN;
+	case IMG3_LZSS_LEVEL_OPTIMAL:
+		return IMG3_LZSSINTERFACE_OPTIMAL_CHAIN;
+	default:
+		return IMG3_LZSSINTERFACE_LAZY_CHAIN;
+	}
+}
+
+/*! \fn		int32_t AlignTokens( struct lzss_token *in, uint32_t *count, uint32_t end, uint32_t extra )
+	\brief	Private method for adding tokens to a parsed block without changing what it decodes to
+	\param	in pointer to the token array, which must have room for extra more tokens
+	\param	count address of the number of tokens in the array; updated on success
+	\param	end input offset following the last token
+	\param	extra number of tokens to add
+
+	A match of length L copying from m can be replaced by e literals followed by a match of length L-e
+	copying from m+e, for any e up to L-3, or by L literals.  The distance doesn't change, so the new
+	tokens are valid wherever the original one was.  Matches are split starting from the end of the
+	block.  Returns zero on success; otherwise, it returns -1 and leaves the array untouched.
+*/
+
+int32_t IMG3_LzssInterface::AlignTokens(struct lzss_token *in, uint32_t *count, uint32_t end, uint32_t extra)
+{
+	uint32_t splitIndex[ 8 ], splitCount[ 8 ];
+	uint32_t i, j, e, len, q, w, splits = 0, need = extra;
+
+	for (i = *count; i-- > 0 && need != 0; ) {
+		len = in[i].length;
+		if (len == 1)
+			continue;
+		if (len - 1 <= need)
+			e = len - 1;
+		else if (len > IMG3_LZSSINTERFACE_THRESHOLD + 1)
+			e = (need < len - 3) ? need : len - 3;
+		else
+			continue;
+		splitIndex[splits] = i;
+		splitCount[splits++] = e;
+		need -= e;
+	}
+	if (need != 0)
+		return -1;
+
+	/* Rewrite the tail of the array back to front so nothing is overwritten before it's moved. */
+	w = *count + extra;
+	q = end;
+	j = 0;
+	for (i = *count; i-- > splitIndex[splits - 1]; ) {
+		len = in[i].length;
+		q -= len;
+		if (j < splits && splitIndex[j] == i) {
+			e = splitCount[j++];
+			if (e < len - 1) {
+				w--;
+				in[w].position = in[i].position + e;
+				in[w].length = len - e;
+			} else {
+				e = len;
+			}
+			while (e-- > 0) {
+				w--;
+				in[w].position = q + e;
+				in[w].length = 1;
+			}
+		} else {
+			in[--w] = in[i];
+		}
+	}
+	*count += extra;
+	return 0;
+}
+
+/*! \fn		int32_t PadTokens( struct lzss_token *in, uint32_t *count, uint32_t end, uint32_t bytes )
+	\brief	Private method for growing the encoding of an aligned block without changing what it decodes to
+	\param	in pointer to the token array, which must have room for the added tokens
+	\param	count address of the number of tokens in the array, a multiple of eight; updated on success
+	\param	end input offset following the last token
+	\param	bytes number of bytes to add to the encoding; at least IMG3_LZSSINTERFACE_MIN_PAD
+
+	Tokens are only ever added eight at a time, so the block stays aligned, and each eight cost
+	one more flag byte.  Three rewrites of a match keep its distance: j leading literals add j
+	tokens and j bytes, splitting it into two matches adds one token and two bytes, and turning
+	a three byte match into literals adds two tokens and one byte.  Mixing them reaches any size
+	from five bytes up.  Matches are rewritten starting from the end of the block.  Returns zero
+	on success; otherwise, it returns -1 and leaves the array untouched.
+*/
+
+int32_t IMG3_LzssInterface::PadTokens(struct lzss_token *in, uint32_t *count, uint32_t end, uint32_t bytes)
+{
+	uint32_t groups, leads, splits, spills, need[3], i, j, len, q, w, lowest = 0;
+
+	if (bytes < IMG3_LZSSINTERFACE_MIN_PAD)
+		return -1;
+
+	/* With g groups, 8g tokens are added for 8g+g bytes; splits add a byte each, spills take one away. */
+	if (bytes < 9) {
+		groups = 1;
+		spills = 9 - bytes;
+		splits = 0;
+		leads = 8 - 2 * spills;
+	} else {
+		groups = (bytes + 16) / 17;
+		spills = 0;
+		splits = bytes - 9 * groups;
+		leads = 8 * groups - splits;
+	}
+
+	/* Check that the block has enough matches before touching anything. */
+	need[0] = splits;
+	need[1] = spills;
+	need[2] = leads;
+	for (i = *count; i-- > 0 && (need[0] | need[1] | need[2]) != 0; ) {
+		len = in[i].length;
+		if (need[0] != 0 && len >= 2 * (IMG3_LZSSINTERFACE_THRESHOLD + 1))
+			need[0]--;
+		else if (need[1] != 0 && len == IMG3_LZSSINTERFACE_THRESHOLD + 1)
+			need[1]--;
+		else if (need[2] != 0 && len > IMG3_LZSSINTERFACE_THRESHOLD + 1)
+			need[2] -= (need[2] < len - 3) ? need[2] : len - 3;
+		else
+			continue;
+		lowest = i;
+	}
+	if ((need[0] | need[1] | need[2]) != 0)
+		return -1;
+
+	/* Rewrite the tail of the array back to front, making the same choices. */
+	need[0] = splits;
+	need[1] = spills;
+	need[2] = leads;
+	w = *count + 8 * groups;
+	q = end;
+	for (i = *count; i-- > lowest; ) {
+		len = in[i].length;
+		q -= len;
+		if (need[0] != 0 && len >= 2 * (IMG3_LZSSINTERFACE_THRESHOLD + 1)) {
+			need[0]--;
+			w -= 2;
+			in[w].position = in[i].position;
+			in[w].length = IMG3_LZSSINTERFACE_THRESHOLD + 1;
+			in[w+1].position = in[i].position + IMG3_LZSSINTERFACE_THRESHOLD + 1;
+			in[w+1].length = len - (IMG3_LZSSINTERFACE_THRESHOLD + 1);
+		} else if (need[1] != 0 && len == IMG3_LZSSINTERFACE_THRESHOLD + 1) {
+			need[1]--;
+			for (j = len; j-- > 0; ) {
+				w--;
+				in[w].position = q + j;
+				in[w].length = 1;
+			}
+		} else if (need[2] != 0 && len > IMG3_LZSSINTERFACE_THRESHOLD + 1) {
+			j = (need[2] < len - 3) ? need[2] : len - 3;
+			need[2] -= j;
+			w--;
+			in[w].position = in[i].position + j;
+			in[w].length = len - j;
+			while (j-- > 0) {
+				w--;
+				in[w].position = q + j;
+				in[w].length = 1;
+			}
 		} else {
-			/* Send position and length pair.  Note match_length > THRESHOLD. */
-			code_buf[code_buf_ptr++] = (uint8_t) sp->match_position;
-			code_buf[code_buf_ptr++] = (uint8_t)
-                						( ((sp->match_position >> 4) & 0xF0)
-                								|  (sp->match_length - (IMG3_LZSSINTERFACE_THRESHOLD +1)) );
+			in[--w] = in[i];
 		}
-		if ((mask <<= 1) == 0) {  /* Shift mask left one bit. */
-			/* Send at most 8 units of code together */
-			for (i = 0; i < code_buf_ptr; i++)
-				if (dst < dstend)
-					*dst++ = code_buf[i];
-				else {
-					delete(sp);
-					return NULL;
-				}
-			code_buf[0] = 0;
-			code_buf_ptr = mask = 1;
+	}
+	*count += 8 * groups;
+	return 0;
+}
+
+/*! \fn		int32_t SetThreadCount( uint32_t threads )
+	\brief	Publically available routine for selecting the number of threads used by the hash-chain engine
+	\param	threads number of worker threads; zero selects one per online processor
+*/
+
+int32_t IMG3_LzssInterface::SetThreadCount(uint32_t threads)
+{
+	long online;
+	uint32_t i;
+
+	if (threads == 0) {
+		online = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (online > 0) ? (uint32_t) online : 1;
+	}
+	if (threads > IMG3_LZSSINTERFACE_MAX_THREADS)
+		threads = IMG3_LZSSINTERFACE_MAX_THREADS;
+
+	if (workerContexts != NULL) {
+		for (i = 0; i < threadCount; i++)
+			FreeContext(&workerContexts[i]);
+		delete[]( workerContexts );
+		workerContexts = NULL;
+	}
+	threadCount = threads;
+	return 0;
+}
+
+/*! \fn		void * CompressThread( void *arg )
+	\brief	Private thread routine compressing blocks of the input until none are left
+	\param	arg pointer to the lzss_parallel_job structure describing the work
+*/
+
+void * IMG3_LzssInterface::CompressThread(void *arg)
+{
+	struct lzss_parallel_job *job = (struct lzss_parallel_job *) arg;
+	struct lzss_block *bp;
+	struct lzss_emit_state es;
+	uint32_t k;
+
+	for ( ; ; ) {
+		k = __sync_fetch_and_add(job->next, 1);
+		if (k >= job->count)
+			break;
+		bp = &job->blocks[k];
+
+		job->lzss->InitEmitState(&es, bp->dst, bp->dstlen, bp->start);
+		bp->status = job->lzss->CompressRange(job->context, &es, job->src, bp->start, bp->end, 1, NULL);
+		if (bp->status >= 0 && job->lzss->FlushEmitState(&es) != 0)
+			bp->status = -1;
+		bp->length = es.dst - bp->dst;
+		bp->literals = es.literals;
+		bp->matches = es.matches;
+		bp->checksum = job->lzss->lzadler32(job->src + bp->start, bp->end - bp->start);
+	}
+	return NULL;
+}
+
+/*! \fn		uint8_t * CompressParallel( uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen, uint32_t *checksum )
+	\brief	Private compression method splitting the input into blocks compressed by several threads
+	\param	dst pointer to a buffer to store the result of the compression
+	\param	dstlen size in bytes of the dst buffer
+	\param	src pointer to the buffer containing the data to be compressed
+	\param 	srclen size in bytes of the src buffer
+	\param	checksum address of a variable in which to store the adler32 checksum of src
+
+	Each block is compressed into its own slot of dst, sized for the worst case, with its window primed
+	from the preceding plaintext.  Blocks end on a flag byte boundary, so once every worker is done the
+	slots are simply moved down into one contiguous stream.  A block that could not be aligned leaves a
+	partial group behind; the blocks after it are then re-grouped token by token.  The checksum of each
+	block is computed by the worker that compressed it and the results are combined.  Returns NULL if
+	the output buffer is too small or a thread could not be started.
+*/
+
+uint8_t * IMG3_LzssInterface::CompressParallel(uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen, uint32_t *checksum)
+{
+	struct lzss_parallel_job jobs[ IMG3_LZSSINTERFACE_MAX_THREADS ];
+	pthread_t threads[ IMG3_LZSSINTERFACE_MAX_THREADS ];
+	struct lzss_block *blocks;
+	struct lzss_emit_state es;
+	uint32_t i, count, started, next = 0, offset = 0;
+	uint8_t *result = NULL;
+
+	count = (srclen + IMG3_LZSSINTERFACE_PARALLEL_BLOCK_SIZE - 1) / IMG3_LZSSINTERFACE_PARALLEL_BLOCK_SIZE;
+	blocks = new struct lzss_block[ count ];
+
+	for (i = 0; i < count; i++) {
+		blocks[i].start = i * IMG3_LZSSINTERFACE_PARALLEL_BLOCK_SIZE;
+		blocks[i].end = blocks[i].start + IMG3_LZSSINTERFACE_PARALLEL_BLOCK_SIZE;
+		if (blocks[i].end > srclen)
+			blocks[i].end = srclen;
+		/* Worst case is one flag byte per eight literals; the slack keeps re-grouping behind the reader. */
+		blocks[i].dstlen = (blocks[i].end - blocks[i].start) + (blocks[i].end - blocks[i].start) / 8 + IMG3_LZSSINTERFACE_BLOCK_SLACK;
+		blocks[i].dst = dst + offset;
+		blocks[i].status = -1;
+		offset += blocks[i].dstlen;
+	}
+	if (offset > dstlen)
+		goto CompressParallel_free_blocks;
+
+	if (workerContexts == NULL) {
+		workerContexts = new struct lzss_context[ threadCount ];
+		memset(workerContexts, 0, threadCount * sizeof(struct lzss_context));
+	}
+
+	for (started = 0; started < threadCount && started < count; started++) {
+		InitContext(&workerContexts[started]);
+		jobs[started].lzss = this;
+		jobs[started].context = &workerContexts[started];
+		jobs[started].src = src;
+		jobs[started].blocks = blocks;
+		jobs[started].count = count;
+		jobs[started].next = &next;
+		if (pthread_create(&threads[started], NULL, CompressThread, &jobs[started]) != 0) {
+			errorCode = errno;
+			PRINT_SYSTEM_ERROR();
+			break;
 		}
-		last_match_length = sp->match_length;
-		for (i = 0; i < last_match_length && src < srcend; i++) {
-			DeleteNode(sp, s);  /* Delete old strings and */
-			c = *src++;
-			sp->text_buf[s] = c; /* read new bytes */
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	if (started == 0)
+		goto CompressParallel_free_blocks;
 
-			/*
-			 * If the position is near the end of buffer, extend the buffer
-			 * to make string comparison easier.
-			 */
-			if (s < IMG3_LZSSINTERFACE_F - 1)
-				sp->text_buf[s + IMG3_LZSSINTERFACE_N] = c;
+	/* Stitch the slots together, re-grouping only what follows an unaligned block. */
+	InitEmitState(&es, dst, dstlen, 0);
+	for (i = 0; i < count; i++) {
+		if (blocks[i].status < 0)
+			goto CompressParallel_free_blocks;
+		if (es.mask == 1) {
+			memmove(es.dst, blocks[i].dst, blocks[i].length);
+			es.dst += blocks[i].length;
+			if (blocks[i].status == 1) {
+				/* Pull the block back into the emitter so its trailing partial group is carried forward. */
+				es.dst -= blocks[i].length;
+				if (AppendStream(&es, es.dst, blocks[i].length) != 0)
+					goto CompressParallel_free_blocks;
+			}
+		} else if (AppendStream(&es, blocks[i].dst, blocks[i].length) != 0) {
+			goto CompressParallel_free_blocks;
+		}
+		stats.literals += blocks[i].literals;
+		stats.matches += blocks[i].matches;
+		*checksum = (i == 0) ? blocks[i].checksum : lzadler32_combine(*checksum, blocks[i].checksum, blocks[i].end - blocks[i].start);
+	}
+	if (FlushEmitState(&es) != 0)
+		goto CompressParallel_free_blocks;
+	result = es.dst;
 
-			/* Since this is a ring buffer, increment the position modulo N. */
-			s = (s + 1) & (IMG3_LZSSINTERFACE_N - 1);
-			r = (r + 1) & (IMG3_LZSSINTERFACE_N - 1);
+CompressParallel_free_blocks:
+	delete[]( blocks );
+	return result;
+}
 
-			/* Register the string in text_buf[ r..r+F-1] */
-			InsertNode(sp, r);
+/*! \fn		void * DecompressThread( void *arg )
+	\brief	Private thread routine decoding segments of a stream until none are left
+	\param	arg pointer to the lzss_decode_job structure describing the work
+*/
+
+void * IMG3_LzssInterface::DecompressThread(void *arg)
+{
+	struct lzss_decode_job *job = (struct lzss_decode_job *) arg;
+	IMG3_LzssInterface_Checkpoint *cp;
+	uint32_t k, end;
+
+	for ( ; ; ) {
+		k = __sync_fetch_and_add(job->next, 1);
+		if (k >= job->index->count || *job->failed)
+			break;
+		cp = &job->index->checkpoints[k];
+		end = (k + 1 < job->index->count) ? job->index->checkpoints[k+1].output_offset : job->index->length_uncompressed;
+
+		if (job->lzss->DecodeSegment(job->index, k, job->src, job->dst) != 0) {
+			*job->failed = 1;
+			break;
 		}
-		while (i++ < last_match_length) {
-			DeleteNode(sp, s);
+		/* The segment was just written, so it is checksummed while still in the cache. */
+		if (job->checksums != NULL)
+			job->checksums[k] = job->lzss->lzadler32_update(1, job->dst + cp->output_offset, end - cp->output_offset);
+	}
+	return NULL;
+}
 
-			/* After the end of text, no need to read. */
-			s = (s + 1) & (IMG3_LZSSINTERFACE_N - 1);
-			r = (r + 1) & (IMG3_LZSSINTERFACE_N - 1);
-			/* but buffer may not be empty. */
-			if (--len)
-				InsertNode(sp , r);
+/*! \fn		int32_t DecodeSegment( IMG3_LzssInterface_Index *index, uint32_t k, uint8_t *src, uint8_t *dst )
+	\brief	Private decompression method decoding the segment between two checkpoints into its place in the output
+	\param	index checkpoint index describing the stream
+	\param	k number of the checkpoint the segment starts at
+	\param	src pointer to the first token byte of the stream
+	\param	dst pointer to the start of the output buffer
+
+	The first window's worth of the segment is decoded into a scratch buffer behind a copy of the
+	checkpoint's window and copied out, since the bytes in front of the segment are being written
+	by another thread.  From there on every back reference stays inside the segment, so the rest
+	is decoded in place.  Segments end on token boundaries and the fast path never writes past
+	dstend, so nothing is written outside the segment.  Returns zero if the segment ends exactly
+	where the next checkpoint starts; otherwise, it returns -1.  errorCode is left untouched, as
+	several threads run this at once.
+*/
+
+int32_t IMG3_LzssInterface::DecodeSegment(IMG3_LzssInterface_Index *index, uint32_t k, uint8_t *src, uint8_t *dst)
+{
+	uint8_t scratch[ 2 * IMG3_LZSSINTERFACE_N + IMG3_LZSSINTERFACE_FAST_MARGIN ];
+	IMG3_LzssInterface_Checkpoint *cp = &index->checkpoints[k];
+	struct lzss_decode_state ds;
+	uint32_t start = cp->output_offset, end, length, head;
+
+	end = (k + 1 < index->count) ? index->checkpoints[k+1].output_offset : index->length_uncompressed;
+	length = end - start;
+	if (length == 0)
+		return 0;
+
+	head = (length < IMG3_LZSSINTERFACE_N + IMG3_LZSSINTERFACE_FAST_MARGIN) ? length : IMG3_LZSSINTERFACE_N + IMG3_LZSSINTERFACE_FAST_MARGIN;
+	memcpy(scratch, cp->window, IMG3_LZSSINTERFACE_N);
+	InitDecodeState(&ds, scratch + IMG3_LZSSINTERFACE_N, head, src + cp->input_offset, index->length_compressed - cp->input_offset);
+	ds.dststop = ds.dst + ((length < IMG3_LZSSINTERFACE_N) ? length : IMG3_LZSSINTERFACE_N);
+	ds.histstart = scratch;
+	ds.outbase = start;
+	ds.flags = cp->flags;
+	if (DecodeTokens(&ds) == -1)
+		return -1;
+	head = ds.dst - ds.dstbase;
+	memcpy(dst + start, ds.dstbase, head);
+
+	if (head < length) {
+		ds.dstbase = dst + start;
+		ds.histstart = ds.dstbase;
+		ds.dst = ds.dstbase + head;
+		ds.dstend = ds.dstbase + length;
+		ds.dststop = ds.dstend;
+		if (DecodeTokens(&ds) == -1)
+			return -1;
+	}
+
+	if ((uint32_t)(ds.dst - ds.dstbase) != length)
+		return -1;
+	if (k + 1 < index->count && (uint32_t)(ds.src - src) != index->checkpoints[k+1].input_offset)
+		return -1;
+	return 0;
+}
+
+/*! \fn		int32_t DecompressParallel( uint8_t *inbuff, uint8_t *outbuff, uint32_t *checksum )
+	\brief	Private decompression method splitting a stream at its checkpoints and decoding the segments on several threads
+	\param	inbuff pointer to the buffer containing the compressed data, with a header matching decodeIndex
+	\param	outbuff pointer to a buffer of length_uncompressed bytes to store the decompressed data
+	\param	checksum address of a variable in which to store the adler32 checksum of the output, or NULL
+
+	Segments are handed out in order to the workers, which decode each one straight into its place
+	in outbuff.  The checksum of each segment is computed by the worker that decoded it and the
+	results are combined in order.  Returns zero on success; otherwise, it returns -1 and the
+	contents of outbuff are undefined.
+*/
+
+int32_t IMG3_LzssInterface::DecompressParallel(uint8_t *inbuff, uint8_t *outbuff, uint32_t *checksum)
+{
+	struct lzss_decode_job jobs[ IMG3_LZSSINTERFACE_MAX_THREADS ];
+	pthread_t threads[ IMG3_LZSSINTERFACE_MAX_THREADS ];
+	IMG3_LzssInterface_Index *ip = decodeIndex;
+	uint32_t *checksums = NULL;
+	uint32_t i, started, end, next = 0;
+	int32_t failed = 0;
+
+	/* An index read from disk is only trusted as far as its offsets go in order. */
+	if (ip->checkpoints[0].output_offset != 0)
+		return -1;
+	for (i = 0; i < ip->count; i++) {
+		if (ip->checkpoints[i].input_offset > ip->length_compressed || ip->checkpoints[i].output_offset > ip->length_uncompressed ||
+			(i > 0 && ip->checkpoints[i].output_offset < ip->checkpoints[i-1].output_offset))
+			return -1;
+	}
+
+	if (checksum != NULL)
+		checksums = new uint32_t[ ip->count ];
+
+	for (started = 0; started < threadCount && started < ip->count; started++) {
+		jobs[started].lzss = this;
+		jobs[started].index = ip;
+		jobs[started].src = inbuff + sizeof(IMG3_LzssInterface_CompressionHeader);
+		jobs[started].dst = outbuff;
+		jobs[started].checksums = checksums;
+		jobs[started].next = &next;
+		jobs[started].failed = &failed;
+		if (pthread_create(&threads[started], NULL, DecompressThread, &jobs[started]) != 0) {
+			errorCode = errno;
+			PRINT_SYSTEM_ERROR();
+			break;
 		}
-	} while (len > 0);  /* until length of string to be processed is zero */
-	if (code_buf_ptr > 1) {  /* Send remaining code. */
-		for (i = 0; i < code_buf_ptr; i++)
-			if (dst < dstend)
-				*dst++ = code_buf[i];
-			else {
-				delete(sp);
-				return NULL;
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	if (started == 0 || failed)
+		goto DecompressParallel_free_checksums;
+
+	if (checksum != NULL) {
+		*checksum = 1;
+		for (i = 0; i < ip->count; i++) {
+			end = (i + 1 < ip->count) ? ip->checkpoints[i+1].output_offset : ip->length_uncompressed;
+			*checksum = lzadler32_combine(*checksum, checksums[i], end - ip->checkpoints[i].output_offset);
+		}
+		delete[]( checksums );
+	}
+	return 0;
+
+DecompressParallel_free_checksums:
+	if (checksums != NULL)
+		delete[]( checksums );
+	return -1;
+}
+
+/*! \fn		int32_t AppendStream( struct lzss_emit_state *ep, uint8_t *stream, uint32_t length )
+	\brief	Private method for appending an encoded token stream to an emitter in any group phase
+	\param	ep pointer to the lzss_emit_state structure
+	\param	stream pointer to the encoded tokens
+	\param	length length of the encoded tokens in bytes
+
+	The stream is walked one flag byte group at a time and each token is copied as is into the
+	emitter's current group, so the stream doesn't have to start on the emitter's group boundary.
+	The stream may be located anywhere ahead of the emitter's output, as long as the emitter's
+	pending group fits in the gap.  Returns zero on success; otherwise, it returns -1.
+*/
+
+int32_t IMG3_LzssInterface::AppendStream(struct lzss_emit_state *ep, uint8_t *stream, uint32_t length)
+{
+	uint8_t *end = stream + length;
+	uint8_t flags;
+	uint32_t bit;
+
+	while (stream < end) {
+		flags = *stream++;
+		for (bit = 0; bit < 8 && stream < end; bit++) {
+			if (flags & (1 << bit)) {
+				ep->code_buf[0] |= ep->mask;
+				ep->code_buf[ep->code_buf_ptr++] = *stream++;
+			} else {
+				if (stream + 2 > end)
+					return -1;
+				ep->code_buf[ep->code_buf_ptr++] = *stream++;
+				ep->code_buf[ep->code_buf_ptr++] = *stream++;
 			}
+			if ((ep->mask <<= 1) == 0) {
+				if (ep->dst + ep->code_buf_ptr > ep->dstend)
+					return -1;
+				memcpy(ep->dst, ep->code_buf, ep->code_buf_ptr);
+				ep->dst += ep->code_buf_ptr;
+				ep->code_buf[0] = 0;
+				ep->code_buf_ptr = 1;
+				ep->mask = 1;
+			}
+		}
 	}
+	return 0;
+}
 
-	delete(sp);
-	return dst;
+/*! \fn		int32_t CopyStream( struct lzss_emit_state *ep, uint8_t *stream, uint32_t length )
+	\brief	Private method for appending whole groups of an encoded token stream to an emitter
+	\param	ep pointer to the lzss_emit_state structure
+	\param	stream pointer to the flag byte of the first group to append
+	\param	length number of stream bytes to append
+
+	On a group boundary the groups are copied as they are; otherwise they are regrouped token by
+	token by AppendStream.  Returns zero on success; otherwise, it returns -1.
+*/
+
+int32_t IMG3_LzssInterface::CopyStream(struct lzss_emit_state *ep, uint8_t *stream, uint32_t length)
+{
+	if (ep->mask != 1)
+		return AppendStream(ep, stream, length);
+	if (ep->dst + length > ep->dstend)
+		return -1;
+	memcpy(ep->dst, stream, length);
+	ep->dst += length;
+	return 0;
+}
+
+/*! \fn		int32_t LzssNextToken( struct lzss_token_cursor *tc )
+	\brief	Step a token cursor over the current token without decoding it
+	\param	tc pointer to the lzss_token_cursor structure
+
+	Returns the number of bytes the token decodes to, or -1 if the stream ends inside it.
+*/
+
+static inline int32_t LzssNextToken(struct lzss_token_cursor *tc)
+{
+	int32_t length;
+
+	if (tc->token >= tc->end)
+		return -1;
+	if (*tc->group & (1 << tc->bit)) {
+		length = 1;
+		tc->token++;
+	} else {
+		if (tc->token + 2 > tc->end)
+			return -1;
+		length = IMG3_LzssAppleCodec::MatchLength(tc->token);
+		tc->token += 2;
+	}
+	tc->output += length;
+	if (++tc->bit == 8) {
+		tc->group = tc->token++;
+		tc->bit = 0;
+	}
+	return length;
+}
+
+/*! \fn		uint32_t lzadler32_combine( uint32_t adler1, uint32_t adler2, uint32_t len2 )
+	\brief	Private function combining the adler32 checksums of two consecutive blocks of data
+	\param	adler1 checksum of the first block
+	\param	adler2 checksum of the second block
+	\param	len2 length of the second block in bytes
+*/
+
+uint32_t IMG3_LzssInterface::lzadler32_combine(uint32_t adler1, uint32_t adler2, uint32_t len2)
+{
+	unsigned long sum1, sum2, rem;
+
+	rem = len2 % IMG3_LZSSINTERFACE_BASE;
+	sum1 = adler1 & 0xFFFF;
+	sum2 = (rem * sum1) % IMG3_LZSSINTERFACE_BASE;
+	sum1 += (adler2 & 0xFFFF) + IMG3_LZSSINTERFACE_BASE - 1;
+	sum2 += ((adler1 >> 16) & 0xFFFF) + ((adler2 >> 16) & 0xFFFF) + IMG3_LZSSINTERFACE_BASE - rem;
+	if (sum1 >= IMG3_LZSSINTERFACE_BASE)
+		sum1 -= IMG3_LZSSINTERFACE_BASE;
+	if (sum1 >= IMG3_LZSSINTERFACE_BASE)
+		sum1 -= IMG3_LZSSINTERFACE_BASE;
+	if (sum2 >= (IMG3_LZSSINTERFACE_BASE << 1))
+		sum2 -= (IMG3_LZSSINTERFACE_BASE << 1);
+	if (sum2 >= IMG3_LZSSINTERFACE_BASE)
+		sum2 -= IMG3_LZSSINTERFACE_BASE;
+	return (sum2 << 16) | sum1;
+}
+
+/*! \fn		uint32_t ParseGreedy( struct hash_state *hp, uint8_t *src, uint32_t p, uint32_t end, uint32_t limit, struct lzss_token *out, uint32_t *count )
+	\brief	Private method for parsing a block by always taking the longest match
+	\param	hp pointer to the class instance's hash_state structure
+	\param	src pointer to the start of the input
+	\param	p offset at which to start parsing
+	\param	end offset at which parsing stops; the last token may extend past it
+	\param	limit offset no match may extend past
+	\param	out pointer to the token array to fill
+	\param	count address of a variable in which to store the number of tokens produced
+
+	Returns the offset following the last token.
+*/
+
+uint32_t IMG3_LzssInterface::ParseGreedy(struct hash_state *hp, uint8_t *src, uint32_t p, uint32_t end, uint32_t limit, struct lzss_token *out, uint32_t *count)
+{
+	uint32_t i, len, n = 0;
+
+	while (p < end) {
+		len = limit - p;
+		if (len > IMG3_LZSSINTERFACE_F)
+			len = IMG3_LZSSINTERFACE_F;
+		HashFindMatch(hp, src, p, len);
+
+		if (hp->match_length <= IMG3_LZSSINTERFACE_THRESHOLD) {
+			out[n].position = p;
+			out[n++].length = 1;
+			HashInsert(hp, src, p++);
+		} else {
+			len = hp->match_length;
+			out[n].position = hp->match_position;
+			out[n++].length = len;
+			/* Every position covered by the token is registered so later matches can start inside it. */
+			for (i = 0; i < len; i++)
+				HashInsert(hp, src, p + i);
+			p += len;
+		}
+	}
+	*count = n;
+	return p;
+}
+
+/*! \fn		uint32_t ParseLazy( struct hash_state *hp, uint8_t *src, uint32_t p, uint32_t end, uint32_t limit, struct lzss_token *out, uint32_t *count )
+	\brief	Private method for parsing a block with one byte of lazy match evaluation
+	\param	hp pointer to the class instance's hash_state structure
+	\param	src pointer to the start of the input
+	\param	p offset at which to start parsing
+	\param	end offset at which parsing stops; the last token may extend past it
+	\param	limit offset no match may extend past
+	\param	out pointer to the token array to fill
+	\param	count address of a variable in which to store the number of tokens produced
+
+	Before a match is taken, the match at the following byte is looked up as well.  If it is longer,
+	the current byte is sent as a literal and the decision is repeated one byte later.  Returns the
+	offset following the last token.
+*/
+
+uint32_t IMG3_LzssInterface::ParseLazy(struct hash_state *hp, uint8_t *src, uint32_t p, uint32_t end, uint32_t limit, struct lzss_token *out, uint32_t *count)
+{
+	uint32_t i, len, maxlen, n = 0;
+	uint32_t curLength, curPosition;
+
+	maxlen = limit - p;
+	if (maxlen > IMG3_LZSSINTERFACE_F)
+		maxlen = IMG3_LZSSINTERFACE_F;
+	HashFindMatch(hp, src, p, maxlen);
+	curLength = hp->match_length;
+	curPosition = hp->match_position;
+
+	while (p < end) {
+		HashInsert(hp, src, p);
+
+		if (curLength <= IMG3_LZSSINTERFACE_THRESHOLD) {
+			out[n].position = p;
+			out[n++].length = 1;
+			p++;
+		} else {
+			/* A full length match can't be improved upon, so don't bother looking one byte ahead. */
+			len = 0;
+			if (curLength < IMG3_LZSSINTERFACE_F && p + 1 < limit) {
+				maxlen = limit - (p + 1);
+				if (maxlen > IMG3_LZSSINTERFACE_F)
+					maxlen = IMG3_LZSSINTERFACE_F;
+				HashFindMatch(hp, src, p + 1, maxlen);
+				len = hp->match_length;
+			}
+			if (len > curLength) {
+				out[n].position = p;
+				out[n++].length = 1;
+				p++;
+				curLength = len;
+				curPosition = hp->match_position;
+				continue;
+			}
+			out[n].position = curPosition;
+			out[n++].length = curLength;
+			for (i = 1; i < curLength; i++)
+				HashInsert(hp, src, p + i);
+			p += curLength;
+		}
+		if (p >= limit)
+			break;
+		maxlen = limit - p;
+		if (maxlen > IMG3_LZSSINTERFACE_F)
+			maxlen = IMG3_LZSSINTERFACE_F;
+		HashFindMatch(hp, src, p, maxlen);
+		curLength = hp->match_length;
+		curPosition = hp->match_position;
+	}
+	*count = n;
+	return p;
+}
+
+/*! \fn		uint32_t ParseOptimal( struct hash_state *hp, struct optimal_state *op, uint8_t *src, uint32_t p, uint32_t end, struct lzss_token *out, uint32_t *count )
+	\brief	Private method for finding the smallest encoding of a block
+	\param	hp pointer to the class instance's hash_state structure
+	\param	op pointer to the optimal_state tables to use
+	\param	src pointer to the start of the input
+	\param	p offset at which to start parsing
+	\param	end offset at which parsing stops; no match extends past it
+	\param	out pointer to the token array to fill
+	\param	count address of a variable in which to store the number of tokens produced
+
+	A literal costs nine bits and a match seventeen bits regardless of its length or distance, so
+	the only thing that matters at each position is the longest match available there; any shorter
+	prefix of it is a valid match as well.  The longest match is recorded for every position of the
+	block, and the cheapest path from each position to the end of the block is then computed
+	backwards.  Returns end.
+*/
+
+uint32_t IMG3_LzssInterface::ParseOptimal(struct hash_state *hp, struct optimal_state *op, uint8_t *src, uint32_t p, uint32_t end, struct lzss_token *out, uint32_t *count)
+{
+	uint32_t i, j, len, maxlen, cost, size = end - p, n = 0;
+
+	for (i = 0; i < size; i++) {
+		maxlen = size - i;
+		if (maxlen > IMG3_LZSSINTERFACE_F)
+			maxlen = IMG3_LZSSINTERFACE_F;
+		HashFindMatch(hp, src, p + i, maxlen);
+		HashInsert(hp, src, p + i);
+		op->length[i] = hp->match_length;
+		op->position[i] = hp->match_position;
+	}
+
+	op->cost[size] = 0;
+	for (i = size; i-- > 0; ) {
+		op->cost[i] = op->cost[i + 1] + 9;
+		op->choice[i] = 1;
+		len = op->length[i];
+		/* Walk from the longest length down so ties favour fewer, longer tokens. */
+		for (j = len; j > IMG3_LZSSINTERFACE_THRESHOLD; j--) {
+			cost = op->cost[i + j] + 17;
+			if (cost < op->cost[i]) {
+				op->cost[i] = cost;
+				op->choice[i] = j;
+			}
+		}
+	}
+
+	for (i = 0; i < size; i += op->choice[i]) {
+		if (op->choice[i] == 1)
+			out[n].position = p + i;
+		else
+			out[n].position = op->position[i];
+		out[n++].length = op->choice[i];
+	}
+	*count = n;
+	return end;
+}
+
+/*! \fn		void InitEmitState( struct lzss_emit_state *ep, uint8_t *dst, uint32_t dstlen, uint32_t pos )
+	\brief	Private method for preparing a token emitter
+	\param	ep pointer to the lzss_emit_state structure to initialize
+	\param	dst pointer to the buffer that receives the encoded tokens
+	\param	dstlen size in bytes of the dst buffer
+	\param	pos input offset of the first token that will be emitted
+*/
+
+void IMG3_LzssInterface::InitEmitState(struct lzss_emit_state *ep, uint8_t *dst, uint32_t dstlen, uint32_t pos)
+{
+	ep->dst = dst;
+	ep->dstend = dst + dstlen;
+	ep->code_buf[0] = 0;
+	ep->code_buf_ptr = 1;
+	ep->mask = 1;
+	ep->pos = pos;
+	ep->literals = 0;
+	ep->matches = 0;
+}
+
+/*! \fn		int32_t EmitTokens( struct lzss_emit_state *ep, uint8_t *src, struct lzss_token *in, uint32_t count )
+	\brief	Private method for encoding parsed tokens
+	\param	ep pointer to the lzss_emit_state structure
+	\param	src pointer to the start of the input
+	\param	in pointer to the tokens to encode
+	\param	count number of tokens to encode
+
+	Returns zero on success; otherwise, it returns -1 if the output buffer is full.
+*/
+
+int32_t IMG3_LzssInterface::EmitTokens(struct lzss_emit_state *ep, uint8_t *src, struct lzss_token *in, uint32_t count)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		if (in[i].length == 1) {
+			ep->code_buf[0] |= ep->mask;  /* 'send one byte' flag */
+			ep->code_buf[ep->code_buf_ptr++] = src[ep->pos];
+			ep->literals++;
+		} else {
+			/* Positions are sent as ring buffer offsets; the first input byte lives at N-F. */
+			IMG3_LzssAppleCodec::EncodeMatch(ep->code_buf + ep->code_buf_ptr, IMG3_LzssAppleCodec::RingPosition(in[i].position), in[i].length);
+			ep->code_buf_ptr += 2;
+			ep->matches++;
+		}
+		ep->pos += in[i].length;
+		if ((ep->mask <<= 1) == 0) {
+			/* Send at most 8 units of code together */
+			if (ep->dst + ep->code_buf_ptr > ep->dstend)
+				return -1;
+			memcpy(ep->dst, ep->code_buf, ep->code_buf_ptr);
+			ep->dst += ep->code_buf_ptr;
+			ep->code_buf[0] = 0;
+			ep->code_buf_ptr = 1;
+			ep->mask = 1;
+		}
+	}
+	return 0;
+}
+
+/*! \fn		int32_t FlushEmitState( struct lzss_emit_state *ep )
+	\brief	Private method for writing out a partially filled group of tokens
+	\param	ep pointer to the lzss_emit_state structure
+
+	Returns zero on success; otherwise, it returns -1 if the output buffer is full.
+*/
+
+int32_t IMG3_LzssInterface::FlushEmitState(struct lzss_emit_state *ep)
+{
+	if (ep->code_buf_ptr > 1) {  /* Send remaining code. */
+		if (ep->dst + ep->code_buf_ptr > ep->dstend)
+			return -1;
+		memcpy(ep->dst, ep->code_buf, ep->code_buf_ptr);
+		ep->dst += ep->code_buf_ptr;
+		ep->code_buf[0] = 0;
+		ep->code_buf_ptr = 1;
+		ep->mask = 1;
+	}
+	return 0;
 }
 
 /*!	\fn		void InitState( struct encode_state *sp )
@@ -370,6 +2739,103 @@ void IMG3_LzssInterface::InitState(struct encode_state *sp)
         sp->parent[i] = IMG3_LZSSINTERFACE_NIL;
 }
 
+/*!	\fn		void InitHashState( struct hash_state *hp, uint32_t srclen )
+	\brief	Private method for preparing the hash-chain state for a new input
+	\param	hp pointer to the class instance's hash_state structure
+	\param	srclen length of the input about to be compressed
+
+	The head table is only cleared when the running base offset would overflow; otherwise the
+	base offset alone keeps the previous call's entries out of the window.
+*/
+
+void IMG3_LzssInterface::InitHashState(struct hash_state *hp, uint32_t srclen)
+{
+	if ((uint64_t) hp->base + srclen + 2 * IMG3_LZSSINTERFACE_N >= IMG3_LZSSINTERFACE_HASH_NIL) {
+		memset(hp->head, 0xFF, sizeof(hp->head));
+		hp->base = 0;
+	}
+	hp->limit = srclen;
+	hp->match_position = 0;
+	hp->match_length = 0;
+}
+
+/*!	\fn		uint32_t LzssHash( uint8_t *key )
+	\brief	Multiplicative hash of the THRESHOLD+1 bytes that start a minimum length match
+	\param	key pointer to the first byte of the string
+*/
+
+static inline uint32_t LzssHash(uint8_t *key)
+{
+	uint32_t v = ((uint32_t)key[0] << 16) | ((uint32_t)key[1] << 8) | key[2];
+
+	return (v * 2654435761U) >> (32 - IMG3_LZSSINTERFACE_HASH_BITS);
+}
+
+/*!	\fn		void HashInsert( struct hash_state *hp, uint8_t *src, uint32_t p )
+	\brief	Private method for inserting an input position into the hash chains
+	\param	hp pointer to the class instance's hash_state structure
+	\param	src pointer to the start of the input
+	\param	p offset of the position to insert
+*/
+
+void IMG3_LzssInterface::HashInsert(struct hash_state *hp, uint8_t *src, uint32_t p)
+{
+	uint32_t h, pos;
+
+	/* A minimum length match needs three bytes, so there is nothing to hash near the very end. */
+	if (p + IMG3_LZSSINTERFACE_THRESHOLD + 1 > hp->limit)
+		return;
+
+	h = LzssHash(src + p);
+	pos = hp->base + p;
+	hp->prev[pos & (IMG3_LZSSINTERFACE_N - 1)] = hp->head[h];
+	hp->head[h] = pos;
+}
+
+/*!	\fn		void HashFindMatch( struct hash_state *hp, uint8_t *src, uint32_t p, uint32_t maxlen )
+	\brief	Private method for finding the longest match for an input position
+	\param	hp pointer to the class instance's hash_state structure
+	\param	src pointer to the start of the input
+	\param	p offset of the position to match
+	\param	maxlen the longest match that may be returned
+
+	On return match_length holds the length of the longest match found, or zero, and
+	match_position holds its input offset.
+*/
+
+void IMG3_LzssInterface::HashFindMatch(struct hash_state *hp, uint8_t *src, uint32_t p, uint32_t maxlen)
+{
+	uint8_t *key = src + p, *cand;
+	uint32_t pos, curr, best, chain, i;
+
+	hp->match_length = 0;
+	if (maxlen <= IMG3_LZSSINTERFACE_THRESHOLD)
+		return;
+
+	best = IMG3_LZSSINTERFACE_THRESHOLD;
+	curr = hp->base + p;
+	pos = hp->head[LzssHash(key)];
+	for (chain = hp->max_chain; chain != 0 && pos != IMG3_LZSSINTERFACE_HASH_NIL; chain--) {
+		if (curr - pos > IMG3_LZSSINTERFACE_MAX_DIST)
+			break;
+		cand = src + (pos - hp->base);
+		/* Checking the byte that would extend the best match first rejects most candidates cheaply. */
+		if (cand[best] == key[best] && cand[0] == key[0] && cand[1] == key[1]) {
+			for (i = 2; i < maxlen && cand[i] == key[i]; i++)
+				;
+			if (i > best) {
+				best = i;
+				hp->match_position = pos - hp->base;
+				if (best >= maxlen)
+					break;
+			}
+		}
+		pos = hp->prev[pos & (IMG3_LZSSINTERFACE_N - 1)];
+	}
+	if (best > IMG3_LZSSINTERFACE_THRESHOLD)
+		hp->match_length = best;
+}
+
 /*! \fn		void InsertNode( struct encode_state *sp, int r )
 	\brief	Private method for inserting a node into the binary search tree used for compression
 	\param	sp pointer to the class instance's encode_state structure
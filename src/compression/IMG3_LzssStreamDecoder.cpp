@@ -0,0 +1,250 @@
+/*
+ * IMG3_LzssStreamDecoder.cpp
+ *
+ * Implementation of all IMG3_LzssStreamDecoder class methods.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "IMG3_LzssStreamDecoder.h"
+#include "IMG3_defines.h"
+
+/*! \fn 	IMG3_LzssStreamDecoder()
+	\brief	Constructor for IMG3_LzssStreamDecoder class
+*/
+
+IMG3_LzssStreamDecoder::IMG3_LzssStreamDecoder() {
+	errorCode = IMG3_LZSS_ERROR_NONE;
+	verifyPolicy = IMG3_LZSS_VERIFY_IGNORE;
+	window = new uint8_t[IMG3_LZSSINTERFACE_N + IMG3_LZSSSTREAMDECODER_CHUNK + IMG3_LZSSINTERFACE_FAST_MARGIN];
+	Reset();
+}
+
+/*! \fn		~IMG3_LzssStreamDecoder()
+	\brief	Deconstructor for IMG3_LzssStreamDecoder class
+*/
+
+IMG3_LzssStreamDecoder::~IMG3_LzssStreamDecoder() {
+	delete[]( window );
+}
+
+/*! \fn		int32_t Reset( void )
+	\brief	Publically available routine for preparing the decoder for a new stream
+*/
+
+int32_t IMG3_LzssStreamDecoder::Reset(void)
+{
+	state = IMG3_LZSSSTREAMDECODER_STATE_HEADER;
+	headerLength = 0;
+	remaining = 0;
+	carryLength = 0;
+	checksum = 1;
+	total = 0;
+
+	/* The window starts out as the reference decoder's ring buffer: F unused bytes, then spaces. */
+	memset(window, 0, IMG3_LZSSINTERFACE_F);
+	memset(window + IMG3_LZSSINTERFACE_F, ' ', IMG3_LZSSINTERFACE_N - IMG3_LZSSINTERFACE_F);
+
+	lzss.InitDecodeState(&decode, window + IMG3_LZSSINTERFACE_N, IMG3_LZSSSTREAMDECODER_CHUNK + IMG3_LZSSINTERFACE_FAST_MARGIN, NULL, 0);
+	decode.dststop = decode.dst + IMG3_LZSSSTREAMDECODER_CHUNK;
+	decode.histstart = window;
+	pending = decode.dst;
+	return 0;
+}
+
+/*! \fn		int32_t SetVerifyPolicy( int32_t newPolicy )
+	\brief	Publically available routine for choosing how a checksum mismatch is treated
+	\param	newPolicy IMG3_LZSS_VERIFY_IGNORE, IMG3_LZSS_VERIFY_WARN or IMG3_LZSS_VERIFY_FAIL
+*/
+
+int32_t IMG3_LzssStreamDecoder::SetVerifyPolicy(int32_t newPolicy)
+{
+	if ( newPolicy != IMG3_LZSS_VERIFY_IGNORE && newPolicy != IMG3_LZSS_VERIFY_WARN && newPolicy != IMG3_LZSS_VERIFY_FAIL ) {
+		errorCode = IMG3_LZSS_ERROR_INVALID_POLICY;
+		PRINT_CLASS_ERROR( "unknown verification policy" );
+		return -1;
+	}
+	verifyPolicy = newPolicy;
+	return 0;
+}
+
+/*! \fn		uint32_t GetUncompressedLength( void )
+	\brief	Publically available routine returning the decompressed length given by the header
+*/
+
+uint32_t IMG3_LzssStreamDecoder::GetUncompressedLength(void)
+{
+	if ( state == IMG3_LZSSSTREAMDECODER_STATE_HEADER )
+		return 0;
+	return ntohl(header.length_uncompressed);
+}
+
+/*! \fn		int32_t Decode( uint8_t *inbuff, size_t insize, size_t *consumed, uint8_t *outbuff, size_t outsize, size_t *produced )
+	\brief	Publically available routine for pushing compressed data through the decoder
+	\param	inbuff pointer to the next piece of the compressed stream
+	\param	insize length of inbuff in bytes
+	\param	consumed address of a size_t variable in which to store the number of input bytes used
+	\param	outbuff pointer to a buffer to receive decompressed data
+	\param	outsize length of outbuff in bytes
+	\param	produced address of a size_t variable in which to store the number of bytes written to outbuff
+
+	Tokens are decoded into a window of one chunk behind N bytes of history.  Decoded bytes are
+	handed out before any more input is taken, and once the chunk is full and handed out, the last
+	N bytes are moved to the front to become the history of the next chunk.
+*/
+
+int32_t IMG3_LzssStreamDecoder::Decode(uint8_t *inbuff, size_t insize, size_t *consumed, uint8_t *outbuff, size_t outsize, size_t *produced)
+{
+	uint8_t *before;
+	size_t n;
+	int32_t used;
+
+	CLASS_VALIDATE_PARAMETER( consumed, -1 );
+	CLASS_VALIDATE_PARAMETER( produced, -1 );
+	*consumed = 0;
+	*produced = 0;
+	if ( insize != 0 )
+		CLASS_VALIDATE_PARAMETER( inbuff, -1 );
+	if ( outsize != 0 )
+		CLASS_VALIDATE_PARAMETER( outbuff, -1 );
+
+	for ( ; ; ) {
+		/* Hand out whatever has been decoded. */
+		n = decode.dst - pending;
+		if (n > outsize - *produced)
+			n = outsize - *produced;
+		memcpy(outbuff + *produced, pending, n);
+		pending += n;
+		*produced += n;
+		if (pending < decode.dst)
+			return IMG3_LZSS_STREAM_OK;
+
+		if (state == IMG3_LZSSSTREAMDECODER_STATE_DONE)
+			return IMG3_LZSS_STREAM_END;
+
+		if (state == IMG3_LZSSSTREAMDECODER_STATE_HEADER) {
+			n = sizeof(header) - headerLength;
+			if (n > insize - *consumed)
+				n = insize - *consumed;
+			memcpy((uint8_t *)&header + headerLength, inbuff + *consumed, n);
+			headerLength += n;
+			*consumed += n;
+			if (headerLength < sizeof(header))
+				return IMG3_LZSS_STREAM_OK;
+			if (lzss.IsFileCompressed((uint8_t *)&header) == -1) {
+				errorCode = IMG3_LZSS_ERROR_FILE_IS_NOT_COMPRESSED;
+				PRINT_CLASS_ERROR( "stream is not compressed" );
+				return -1;
+			}
+			remaining = ntohl(header.length_compressed);
+			state = IMG3_LZSSSTREAMDECODER_STATE_BODY;
+		}
+
+		/* Keep the last N bytes as history and make room for another chunk. */
+		if (decode.dst >= decode.dststop) {
+			memmove(window, decode.dst - IMG3_LZSSINTERFACE_N, IMG3_LZSSINTERFACE_N);
+			decode.outbase += decode.dst - decode.dstbase;
+			decode.dst = decode.dstbase;
+			pending = decode.dst;
+		}
+
+		before = decode.dst;
+		used = DecodeInput(inbuff, insize, consumed);
+		if (used == -1)
+			return -1;
+
+		if (decode.dst != before) {
+			if (verifyPolicy != IMG3_LZSS_VERIFY_IGNORE)
+				checksum = lzss.lzadler32_update(checksum, before, decode.dst - before);
+			total += decode.dst - before;
+		} else if (used == 0) {
+			if (remaining != 0)
+				return IMG3_LZSS_STREAM_OK;
+			if (Finish() == -1)
+				return -1;
+			state = IMG3_LZSSSTREAMDECODER_STATE_DONE;
+		}
+	}
+}
+
+/*! \fn		int32_t DecodeInput( uint8_t *inbuff, size_t insize, size_t *consumed )
+	\brief	Private method decoding tokens from the carried bytes or straight from the caller's input
+	\param	inbuff pointer to the caller's input
+	\param	insize length of inbuff in bytes
+	\param	consumed address of the count of input bytes used so far, which is advanced
+
+	A token cut short by the end of the input is moved into carry, and on the next call carry is
+	topped up from the new input and decoded first.  Returns the number of new input bytes used,
+	or -1 if the stream is corrupt.
+*/
+
+int32_t IMG3_LzssStreamDecoder::DecodeInput(uint8_t *inbuff, size_t insize, size_t *consumed)
+{
+	uint8_t *start;
+	size_t avail, take = 0, length, used, leftover, taken;
+	int32_t status;
+
+	avail = insize - *consumed;
+	if (avail > remaining)
+		avail = remaining;
+
+	if (carryLength == 0) {
+		start = inbuff + *consumed;
+		length = avail;
+	} else {
+		take = sizeof(carry) - carryLength;
+		if (take > avail)
+			take = avail;
+		memcpy(carry + carryLength, inbuff + *consumed, take);
+		start = carry;
+		length = carryLength + take;
+	}
+
+	decode.src = start;
+	decode.srcend = start + length;
+	status = lzss.DecodeTokens(&decode);
+	if (status == -1) {
+		errorCode = IMG3_LZSS_ERROR_CORRUPT_STREAM;
+		PRINT_CLASS_ERROR( "back reference before the start of the stream" );
+		return -1;
+	}
+	used = decode.src - start;
+
+	if (status == IMG3_LZSS_DECODE_INPUT_END) {
+		/* At most a flag byte and one byte of a match are left over. */
+		leftover = length - used;
+		memmove(carry, decode.src, leftover);
+		taken = (carryLength == 0) ? length : take;
+		carryLength = leftover;
+	} else if (used >= carryLength) {
+		taken = used - carryLength;
+		carryLength = 0;
+	} else {
+		memmove(carry, carry + used, carryLength - used);
+		carryLength -= used;
+		taken = 0;
+	}
+
+	*consumed += taken;
+	remaining -= taken;
+	return taken;
+}
+
+/*! \fn		int32_t Finish( void )
+	\brief	Private method checking the decoded data against the header
+*/
+
+int32_t IMG3_LzssStreamDecoder::Finish(void)
+{
+	if (verifyPolicy == IMG3_LZSS_VERIFY_IGNORE)
+		return 0;
+
+	if (total != ntohl(header.length_uncompressed) || checksum != ntohl(header.checksum)) {
+		errorCode = IMG3_LZSS_ERROR_CHECKSUM_MISMATCH;
+		PRINT_CLASS_ERROR( "header checksum does not match calculated checksum" );
+		if (verifyPolicy == IMG3_LZSS_VERIFY_FAIL)
+			return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,402 @@
+/*
+ * IMG3_LzssStreamEncoder.cpp
+ *
+ * Implementation of all IMG3_LzssStreamEncoder class methods.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "IMG3_LzssStreamEncoder.h"
+#include "IMG3_defines.h"
+
+/*! \fn 	IMG3_LzssStreamEncoder()
+	\brief	Constructor for IMG3_LzssStreamEncoder class
+*/
+
+IMG3_LzssStreamEncoder::IMG3_LzssStreamEncoder() {
+	errorCode = IMG3_LZSS_ERROR_NONE;
+	sinkType = IMG3_LZSSSTREAMENCODER_SINK_NONE;
+	sinkFd = -1;
+	sinkStart = 0;
+	sinkCallback = NULL;
+	sinkOpaque = NULL;
+	memoryBuffer = NULL;
+	memorySize = 0;
+	written = 0;
+	input = new uint8_t[IMG3_LZSSSTREAMENCODER_INPUT];
+	position = 0;
+	inputLength = 0;
+	output = new uint8_t[IMG3_LZSSSTREAMENCODER_OUTPUT];
+	checksum = 1;
+	total = 0;
+	lzss.SetMatchFinder( IMG3_LZSS_ENGINE_HASH_CHAIN );
+}
+
+/*! \fn		~IMG3_LzssStreamEncoder()
+	\brief	Deconstructor for IMG3_LzssStreamEncoder class
+*/
+
+IMG3_LzssStreamEncoder::~IMG3_LzssStreamEncoder() {
+	delete[]( input );
+	delete[]( output );
+	if ( memoryBuffer != NULL )
+		delete[]( memoryBuffer );
+}
+
+/*! \fn		int32_t SetCompressionLevel( int32_t newLevel )
+	\brief	Publically available routine for selecting the parser used by the stream
+	\param	newLevel IMG3_LZSS_LEVEL_FAST, IMG3_LZSS_LEVEL_LAZY or IMG3_LZSS_LEVEL_OPTIMAL
+*/
+
+int32_t IMG3_LzssStreamEncoder::SetCompressionLevel(int32_t newLevel)
+{
+	if ( sinkType != IMG3_LZSSSTREAMENCODER_SINK_NONE ) {
+		errorCode = IMG3_LZSS_ERROR_INVALID_LEVEL;
+		PRINT_CLASS_ERROR( "compression level can't change in the middle of a stream" );
+		return -1;
+	}
+	if ( lzss.SetCompressionLevel( newLevel ) != 0 ) {
+		errorCode = lzss.GetError();
+		return -1;
+	}
+	return 0;
+}
+
+/*! \fn		int32_t OpenMemory( void )
+	\brief	Publically available routine for starting a stream collected in memory
+*/
+
+int32_t IMG3_LzssStreamEncoder::OpenMemory(void)
+{
+	if ( memoryBuffer != NULL )
+		delete[]( memoryBuffer );
+	memoryBuffer = NULL;
+	memorySize = 0;
+	sinkType = IMG3_LZSSSTREAMENCODER_SINK_MEMORY;
+	return Start();
+}
+
+/*! \fn		int32_t OpenFile( int fd )
+	\brief	Publically available routine for starting a stream written to a file descriptor
+	\param	fd seekable file descriptor, positioned where the stream should start
+*/
+
+int32_t IMG3_LzssStreamEncoder::OpenFile(int fd)
+{
+	off_t start;
+
+	start = lseek( fd, 0, SEEK_CUR );
+	if ( start == -1 ) {
+		errorCode = IMG3_LZSS_ERROR_SINK_NOT_SEEKABLE;
+		PRINT_CLASS_ERROR( "file descriptor is not seekable" );
+		return -1;
+	}
+	sinkFd = fd;
+	sinkStart = start;
+	sinkType = IMG3_LZSSSTREAMENCODER_SINK_FILE;
+	return Start();
+}
+
+/*! \fn		int32_t OpenCallback( IMG3_LzssStreamSink sink, void *opaque )
+	\brief	Publically available routine for starting a stream handed to a callback
+	\param	sink function receiving the compressed data
+	\param	opaque pointer passed to every call of sink
+*/
+
+int32_t IMG3_LzssStreamEncoder::OpenCallback(IMG3_LzssStreamSink sink, void *opaque)
+{
+	CLASS_VALIDATE_PARAMETER( sink, -1 );
+
+	sinkCallback = sink;
+	sinkOpaque = opaque;
+	sinkType = IMG3_LZSSSTREAMENCODER_SINK_CALLBACK;
+	return Start();
+}
+
+/*! \fn		int32_t Start( void )
+	\brief	Private method preparing the compressor and reserving room for the header
+*/
+
+int32_t IMG3_LzssStreamEncoder::Start(void)
+{
+	IMG3_LzssInterface_CompressionHeader header;
+	struct hash_state *hp;
+
+	written = 0;
+	position = 0;
+	inputLength = 0;
+	checksum = 1;
+	total = 0;
+
+	lzss.InitContext( &lzss.context );
+	hp = lzss.context.hash;
+	memset(hp->head, 0xFF, sizeof(hp->head));
+	hp->base = 0;
+	lzss.InitHashState( hp, 0 );
+	hp->max_chain = lzss.ChainLimit();
+	lzss.InitEmitState( &emit, output, IMG3_LZSSSTREAMENCODER_OUTPUT, 0 );
+
+	memset(&header, 0, sizeof(header));
+	if ( Output( 0, (uint8_t *)&header, sizeof(header) ) != 0 ) {
+		sinkType = IMG3_LZSSSTREAMENCODER_SINK_NONE;
+		return -1;
+	}
+	return 0;
+}
+
+/*! \fn		int32_t Output( uint64_t offset, uint8_t *data, size_t length )
+	\brief	Private method sending data to the sink
+	\param	offset offset of the data from the start of the stream
+	\param	data pointer to the data
+	\param	length length of the data in bytes
+*/
+
+int32_t IMG3_LzssStreamEncoder::Output(uint64_t offset, uint8_t *data, size_t length)
+{
+	uint64_t end = offset + length;
+	uint8_t *grown;
+	size_t size;
+	ssize_t n;
+
+	switch ( sinkType ) {
+	case IMG3_LZSSSTREAMENCODER_SINK_MEMORY:
+		if ( end > memorySize ) {
+			size = memorySize ? memorySize * 2 : IMG3_LZSSSTREAMENCODER_CHUNK;
+			while ( size < end )
+				size *= 2;
+			grown = new uint8_t[size];
+			if ( memoryBuffer != NULL ) {
+				memcpy(grown, memoryBuffer, written);
+				delete[]( memoryBuffer );
+			}
+			memoryBuffer = grown;
+			memorySize = size;
+		}
+		memcpy(memoryBuffer + offset, data, length);
+		break;
+
+	case IMG3_LZSSSTREAMENCODER_SINK_FILE:
+		while ( length > 0 ) {
+			n = pwrite( sinkFd, data, length, sinkStart + offset );
+			if ( n == -1 ) {
+				if ( errno == EINTR )
+					continue;
+				errorCode = errno;
+				PRINT_SYSTEM_ERROR();
+				return -1;
+			}
+			data += n;
+			length -= n;
+			offset += n;
+		}
+		break;
+
+	case IMG3_LZSSSTREAMENCODER_SINK_CALLBACK:
+		if ( sinkCallback( sinkOpaque, offset, data, length ) != 0 ) {
+			errorCode = IMG3_LZSS_ERROR_SINK_FAILED;
+			PRINT_CLASS_ERROR( "sink callback failed" );
+			return -1;
+		}
+		break;
+
+	default:
+		errorCode = IMG3_LZSS_ERROR_SINK_NOT_OPEN;
+		PRINT_CLASS_ERROR( "no stream is open" );
+		return -1;
+	}
+
+	if ( end > written )
+		written = end;
+	return 0;
+}
+
+/*! \fn		int32_t Write( uint8_t *inbuff, size_t insize )
+	\brief	Publically available routine for compressing the next piece of input
+	\param	inbuff pointer to the data to compress
+	\param	insize length of inbuff in bytes
+
+	Input is appended to a window holding the N-F bytes matches may reach back to, and each block
+	is parsed as soon as the window holds the block and enough look-ahead for its last token.
+	When the window is full, it is slid down by a multiple of N, which leaves the ring buffer
+	positions of the remaining bytes unchanged, and the hash chains are rebased by the same amount.
+*/
+
+int32_t IMG3_LzssStreamEncoder::Write(uint8_t *inbuff, size_t insize)
+{
+	struct hash_state *hp = lzss.context.hash;
+	uint32_t shift;
+	size_t n;
+
+	if ( sinkType == IMG3_LZSSSTREAMENCODER_SINK_NONE ) {
+		errorCode = IMG3_LZSS_ERROR_SINK_NOT_OPEN;
+		PRINT_CLASS_ERROR( "no stream is open" );
+		return -1;
+	}
+	if ( insize == 0 )
+		return 0;
+	CLASS_VALIDATE_PARAMETER( inbuff, -1 );
+
+	/* The header holds 32 bit lengths and the hash chains 32 bit positions. */
+	if ( (uint64_t) total + insize > IMG3_LZSSINTERFACE_HASH_NIL - 2 * IMG3_LZSSINTERFACE_N ) {
+		errorCode = IMG3_LZSS_ERROR_COMPRESSION_FAILED;
+		PRINT_CLASS_ERROR( "stream too long for the lzss header" );
+		return -1;
+	}
+	checksum = lzss.lzadler32_update( checksum, inbuff, insize );
+	total += insize;
+
+	while ( insize > 0 ) {
+		n = IMG3_LZSSSTREAMENCODER_INPUT - inputLength;
+		if ( n > insize )
+			n = insize;
+		memcpy(input + inputLength, inbuff, n);
+		inputLength += n;
+		inbuff += n;
+		insize -= n;
+
+		while ( inputLength - position >= IMG3_LZSSINTERFACE_BLOCK_SIZE + IMG3_LZSSSTREAMENCODER_LOOKAHEAD ) {
+			if ( CompressBlock( position + IMG3_LZSSINTERFACE_BLOCK_SIZE, inputLength ) != 0 )
+				return -1;
+		}
+
+		if ( inputLength == IMG3_LZSSSTREAMENCODER_INPUT ) {
+			shift = (position - IMG3_LZSSINTERFACE_N) & ~(IMG3_LZSSINTERFACE_N - 1);
+			memmove(input, input + shift, inputLength - shift);
+			inputLength -= shift;
+			position -= shift;
+			emit.pos -= shift;
+			hp->base += shift;
+		}
+	}
+	return 0;
+}
+
+/*! \fn		int32_t CompressBlock( uint32_t end, uint32_t limit )
+	\brief	Private method parsing and encoding one block of the input window
+	\param	end offset at which parsing stops
+	\param	limit offset no match may extend past
+*/
+
+int32_t IMG3_LzssStreamEncoder::CompressBlock(uint32_t end, uint32_t limit)
+{
+	struct lzss_context *cp = &lzss.context;
+	uint32_t count;
+
+	cp->hash->limit = limit;
+	switch ( lzss.level ) {
+	case IMG3_LZSS_LEVEL_FAST:
+		position = lzss.ParseGreedy( cp->hash, input, position, end, limit, cp->tokens, &count );
+		break;
+	case IMG3_LZSS_LEVEL_OPTIMAL:
+		position = lzss.ParseOptimal( cp->hash, cp->optimal, input, position, end, cp->tokens, &count );
+		break;
+	default:
+		position = lzss.ParseLazy( cp->hash, input, position, end, limit, cp->tokens, &count );
+		break;
+	}
+	if ( lzss.EmitTokens( &emit, input, cp->tokens, count ) != 0 ) {
+		errorCode = IMG3_LZSS_ERROR_COMPRESSION_FAILED;
+		PRINT_CLASS_ERROR( "compression failed" );
+		return -1;
+	}
+	return Drain( 0 );
+}
+
+/*! \fn		int32_t Drain( int32_t all )
+	\brief	Private method sending encoded data to the sink in IMG3_LZSSSTREAMENCODER_CHUNK sized pieces
+	\param	all non-zero to send the final partial chunk as well
+*/
+
+int32_t IMG3_LzssStreamEncoder::Drain(int32_t all)
+{
+	uint32_t used = emit.dst - output, sent = 0;
+
+	while ( used - sent >= IMG3_LZSSSTREAMENCODER_CHUNK ) {
+		if ( Output( written, output + sent, IMG3_LZSSSTREAMENCODER_CHUNK ) != 0 )
+			return -1;
+		sent += IMG3_LZSSSTREAMENCODER_CHUNK;
+	}
+	if ( all && used > sent ) {
+		if ( Output( written, output + sent, used - sent ) != 0 )
+			return -1;
+		sent = used;
+	}
+	memmove(output, output + sent, used - sent);
+	emit.dst = output + (used - sent);
+	return 0;
+}
+
+/*! \fn		int32_t Finish( void )
+	\brief	Publically available routine for compressing the remaining input and completing the header
+*/
+
+int32_t IMG3_LzssStreamEncoder::Finish(void)
+{
+	IMG3_LzssInterface_CompressionHeader header;
+	uint8_t padding[ 16 ];
+	uint64_t length;
+	uint32_t end;
+
+	if ( sinkType == IMG3_LZSSSTREAMENCODER_SINK_NONE ) {
+		errorCode = IMG3_LZSS_ERROR_SINK_NOT_OPEN;
+		PRINT_CLASS_ERROR( "no stream is open" );
+		return -1;
+	}
+
+	while ( position < inputLength ) {
+		end = position + IMG3_LZSSINTERFACE_BLOCK_SIZE;
+		if ( end > inputLength )
+			end = inputLength;
+		if ( CompressBlock( end, inputLength ) != 0 )
+			return -1;
+	}
+	if ( lzss.FlushEmitState( &emit ) != 0 || Drain( 1 ) != 0 )
+		return -1;
+
+	length = written - sizeof(header);
+	memset(padding, 0, sizeof(padding));
+	if ( written % 16 && Output( written, padding, 16 - (written % 16) ) != 0 )
+		return -1;
+
+	memset(&header, 0, sizeof(header));
+	header.signature = htonl(IMG3_LZSSINTERFACE_COMP_SIGNATURE);
+	header.compression_type = htonl(IMG3_LZSSINTERFACE_LZSS_SIGNATURE);
+	header.checksum = htonl(checksum);
+	header.length_uncompressed = htonl(total);
+	header.length_compressed = htonl(length);
+	if ( Output( 0, (uint8_t *)&header, sizeof(header) ) != 0 )
+		return -1;
+
+	/* Leave the descriptor just past the stream, as if it had been written sequentially. */
+	if ( sinkType == IMG3_LZSSSTREAMENCODER_SINK_FILE )
+		lseek( sinkFd, sinkStart + written, SEEK_SET );
+
+	sinkType = IMG3_LZSSSTREAMENCODER_SINK_NONE;
+	return 0;
+}
+
+/*! \fn		int32_t TakeBuffer( uint8_t **outbuff, size_t *outsize )
+	\brief	Publically available routine for handing a finished memory stream to the caller
+	\param	outbuff address of a pointer in which to store the stream
+	\param	outsize address of a size_t variable in which to store the length of the stream
+*/
+
+int32_t IMG3_LzssStreamEncoder::TakeBuffer(uint8_t **outbuff, size_t *outsize)
+{
+	CLASS_VALIDATE_PARAMETER( outbuff, -1 );
+	CLASS_VALIDATE_PARAMETER( outsize, -1 );
+
+	if ( memoryBuffer == NULL || sinkType != IMG3_LZSSSTREAMENCODER_SINK_NONE ) {
+		errorCode = IMG3_LZSS_ERROR_SINK_NOT_OPEN;
+		PRINT_CLASS_ERROR( "no finished memory stream" );
+		return -1;
+	}
+	*outbuff = memoryBuffer;
+	*outsize = written;
+	memoryBuffer = NULL;
+	memorySize = 0;
+	return 0;
+}
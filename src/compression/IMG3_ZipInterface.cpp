@@ -8,9 +8,18 @@
  * Implementation of all IMG3_ZipInterface class methods.
  */
 
+#include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
-#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <limits.h>
+#include <ctype.h>
+#include <zlib.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include "IMG3_ZipInterface.h"
 
 /*! \fn		IMG3_ZipInterface()
@@ -21,7 +30,21 @@ IMG3_ZipInterface::IMG3_ZipInterface()
 {
 	fd = NULL;
 	errorCode = ZIP_ERROR_NONE;
-	nodes.clear();
+	threadCount = 1;
+	archiveMap = NULL;
+	archiveMapSize = 0;
+	endOffset = 0;
+	indexCacheEnabled = 0;
+	indexCacheDirectory = NULL;
+	checkpointSpan = ZIP_CHECKPOINT_SPAN;
+	nodes = NULL;
+	nodeCount = 0;
+	nodeBlock = NULL;
+	nameSlots = sectionSlots = NULL;
+	slotMask = 0;
+	nameArena = NULL;
+	indexMap = NULL;
+	indexMapSize = 0;
 	files.clear();
 }
 
@@ -32,6 +55,8 @@ IMG3_ZipInterface::IMG3_ZipInterface()
 IMG3_ZipInterface::~IMG3_ZipInterface() 
 {
 	ResetData();
+	if ( indexCacheDirectory != NULL )
+		delete[]( indexCacheDirectory );
 }
 
 /*!	\fn		ResetData()
@@ -40,21 +65,42 @@ IMG3_ZipInterface::~IMG3_ZipInterface()
 
 void IMG3_ZipInterface::ResetData( void )
 {
-	list< char * >::iterator listIt;
-
-	nodes.clear();
-	for ( listIt = files.begin(); listIt != files.end(); ++listIt ) {
-		char *name = *listIt;
-		if ( name != NULL )
-			delete( name );
-	}
-	files.clear();
+	ReleaseNodes();
+	if ( indexMap != NULL )
+		munmap( indexMap, indexMapSize );
+	indexMap = NULL;
+	indexMapSize = 0;
 	if ( fd != NULL )
 		fclose( fd );
+	fd = NULL;
+	if ( archiveMap != NULL )
+		munmap( archiveMap, archiveMapSize );
+	archiveMap = NULL;
+	archiveMapSize = 0;
+	endOffset = 0;
 
 	errorCode = ZIP_ERROR_NONE;
 }
 
+/*!	\fn		ReleaseNodes()
+	\brief	A private method that frees the node table with its hash slots and name arena, and the checkpoints of the nodes.  The archive, its mappings and errorCode are left alone.
+*/
+
+void IMG3_ZipInterface::ReleaseNodes( void )
+{
+	// The names belong to the node block or the sidecar mapping, so the list only has to be emptied.
+	files.clear();
+	ReleaseCheckpoints();
+	if ( nodeBlock != NULL )
+		delete[]( nodeBlock );
+	nodeBlock = NULL;
+	nodes = NULL;
+	nodeCount = 0;
+	nameSlots = sectionSlots = NULL;
+	slotMask = 0;
+	nameArena = NULL;
+}
+
 /*!	\fn		AnalyzeFile( const char *fileName )
 	\brief	A public method for analyzing ZIP compressed archives.  This function scans archives and creates a list of all files contained in the archive.
 	\param	fileName pointer to a string containing the name of the archive to analyze
@@ -63,6 +109,7 @@ void IMG3_ZipInterface::ResetData( void )
 list<char *> * IMG3_ZipInterface::AnalyzeFile(const char *fileName)
 {
 	ZIP_CentralDirectoryEnd end;
+	ZIP64_CentralDirectoryEnd end64;
 	long fileSize;
 	char *ptr;
 
@@ -94,6 +141,13 @@ list<char *> * IMG3_ZipInterface::AnalyzeFile(const char *fileName)
 		goto zip_getfilelist_close_error;
 	}
 
+	// An archive that was analyzed before can have its members rebuilt from the index sidecar without any scanning.
+	if (indexCacheEnabled && LoadIndexCache(fileName,fd,fileSize) == 0) {
+		fclose(fd);
+		fd = NULL;
+		return &files;
+	}
+
 	// Find the central directory end structure
 	ptr = FindCentralDirectoryEnd(fd,fileSize);
 	if (ptr == NULL) {
@@ -103,21 +157,32 @@ list<char *> * IMG3_ZipInterface::AnalyzeFile(const char *fileName)
 	}
 
 	memcpy(&end,ptr,sizeof(end) - CENTRAL_DIRECTORY_END_EXTRA);
-	delete(ptr);
+	delete[](ptr);
 	end.comment = NULL;
 
+	// ZIP64 archives keep the real location and size of the central directory in a second end record.
+	if (FindZip64End(fileno(fd),&end,&end64) != 0)
+		goto zip_getfilelist_close_error;
+
 	// Once we have the end structure, we can find the central directory listings
-	if (ExtractCentralDirectoryListings(fd,&end) != 0) {
-		errorCode = ZIP_ERROR_NO_CENTRAL_DIRECTORY_FOUND;
+	if (ExtractCentralDirectoryListings(fd,&end64) != 0) {
+		// Keep the more specific error of a malformed listing, such as a short ZIP64 extra field.
+		if (errorCode == ZIP_ERROR_NONE)
+			errorCode = ZIP_ERROR_NO_CENTRAL_DIRECTORY_FOUND;
 		PRINT_CLASS_ERROR( "no central directory was found" );
 		goto zip_getfilelist_close_error;
 	}
+	if (indexCacheEnabled)
+		SaveIndexCache(fileName,fd,fileSize,&end);
+
 	// The central directory listing contain all the information we need, so once we have it return
 	fclose(fd);
+	fd = NULL;
 	return &files;
 
 zip_getfilelist_close_error:
-	fclose(fd);
+	if (fd != NULL)
+		fclose(fd);
 	fd = NULL;
 	return NULL;
 }
@@ -186,66 +251,172 @@ void IMG3_ZipInterface::PrintCentralDirectoryEnd(ZIP_CentralDirectoryEnd *ptr)
 
 char * IMG3_ZipInterface::FindCentralDirectoryEnd(FILE *fd, long fileSize)
 {
-	size_t result;
-	uint16_t index;
+	size_t result, fixedSize = sizeof(ZIP_CentralDirectoryEnd) - CENTRAL_DIRECTORY_END_EXTRA;
+	long index;
 	uint32_t marker;
-	long bytesToRead = ZIP_BUFFER_SIZE;
-	char *endBuffer;
+	uint16_t commentLength;
+	long bytesToRead = ZIP_END_SEARCH_SIZE;
+	char *searchBuffer, *endBuffer;
 
 	errorCode = ZIP_ERROR_NONE;
 
 	CLASS_VALIDATE_PARAMETER( fd, NULL );
 	CLASS_VALIDATE_PARAMETER( fileSize, NULL );
 
-	if (fileSize < ZIP_BUFFER_SIZE)
+	if (fileSize < (long)ZIP_END_SEARCH_SIZE)
 		bytesToRead = fileSize;
+	if (bytesToRead < (long)fixedSize) {
+		errorCode = ZIP_ERROR_NOT_A_ZIP_FILE;
+		PRINT_CLASS_ERROR( "the file is too small to be an archive" );
+		return NULL;
+	}
 
-	// ZIP comments, and the end structure, should never be more than 1024 bytes, so read in that many
+	// The end structure is followed by a comment of at most 65535 bytes, so read in that much of the tail
 	if (fseek(fd,-bytesToRead,SEEK_END)) {
 		errorCode = errno;
 		PRINT_SYSTEM_ERROR();
 		return NULL;
 	}
-	result = fread(buffer,bytesToRead,1,fd);
+	searchBuffer = new char[bytesToRead];
+	result = fread(searchBuffer,bytesToRead,1,fd);
 	if (result == 0) {
 		errorCode = errno;
 		PRINT_SYSTEM_ERROR();
+		delete[](searchBuffer);
 		return NULL;
 	}
 
-	// Scan through the bytes read in looking for the central directory end marker
-	for (index = 0; index < bytesToRead - 3; index++) {
-			marker = *((uint32_t *)(buffer+index));
-			if (marker == CENTRAL_DIRECTORY_END_MARKER) {
-				endBuffer = new char[bytesToRead - index];
-				if (endBuffer == NULL) {
-					errorCode = errno;
-					PRINT_SYSTEM_ERROR();
-					return NULL;
-				}
-				// Once the end marker is found, copy of the end header and return
-				memcpy(endBuffer,buffer+index,bytesToRead-index);
-				return endBuffer;
-			}
+	// Scan backwards for the last end marker whose comment fits in what is left of the file
+	for (index = bytesToRead - (long)fixedSize; index >= 0; index--) {
+			memcpy(&marker,searchBuffer+index,sizeof(marker));
+			if (marker != CENTRAL_DIRECTORY_END_MARKER)
+				continue;
+			memcpy(&commentLength,searchBuffer+index+fixedSize-sizeof(commentLength),sizeof(commentLength));
+			if (index + (long)fixedSize + commentLength > bytesToRead)
+				continue;
+			endBuffer = new char[bytesToRead - index];
+			// Once the end marker is found, copy of the end header and return
+			memcpy(endBuffer,searchBuffer+index,bytesToRead-index);
+			endOffset = (uint64_t)(fileSize - bytesToRead + index);
+			delete[](searchBuffer);
+			return endBuffer;
 	}
 	// If no end marker is found, report the error
+	delete[](searchBuffer);
 	errorCode = ZIP_ERROR_NOT_A_ZIP_FILE;
 	PRINT_CLASS_ERROR( "no end directory marker found" );
 	return NULL;
 }
 
-/*!	\fn		ExtractCentralDirectoryListing( FILE *fd, ZIP_CentralDirectoryEnd *end )
+/*!	\fn		FindZip64End( int archiveFd, ZIP_CentralDirectoryEnd *end, ZIP64_CentralDirectoryEnd *end64 )
+	\brief	A private method that fills end64 with the location, size and number of entries of the central directory.  They are read from the ZIP64 end record when a locator sits in front of the classic end structure, and copied from end otherwise.  A directory that doesn't lie wholly in front of the end records is refused, so nothing is ever allocated for a size the file can't hold.
+	\param	archiveFd descriptor of the ZIP archive file to examine
+	\param	end pointer to the classic central directory end structure, found at endOffset
+	\param	end64 pointer to the structure receiving the central directory's location
+*/
+
+int32_t IMG3_ZipInterface::FindZip64End(int archiveFd, ZIP_CentralDirectoryEnd *end, ZIP64_CentralDirectoryEnd *end64)
+{
+	ZIP64_EndLocator locator;
+	uint64_t directoryLimit = endOffset;
+
+	memset(end64,0,sizeof(ZIP64_CentralDirectoryEnd));
+	end64->sig = ZIP64_CENTRAL_DIRECTORY_END_MARKER;
+	end64->centralDirectoryNumOnDisk = end->centralDirectoryNumOnDisk;
+	end64->centralDirectoryTotalNum = end->centralDirectoryTotalNum;
+	end64->centralDirectorySize = end->centralDirectorySize;
+	end64->centralDirectoryOffset = end->centralDirectoryOffset;
+
+	if (endOffset >= sizeof(locator) &&
+		pread(archiveFd,&locator,sizeof(locator),endOffset - sizeof(locator)) == (ssize_t)sizeof(locator) &&
+		locator.sig == ZIP64_END_LOCATOR_MARKER) {
+		if (locator.endOffset + sizeof(ZIP64_CentralDirectoryEnd) > endOffset - sizeof(locator) ||
+			pread(archiveFd,end64,sizeof(ZIP64_CentralDirectoryEnd),locator.endOffset) != (ssize_t)sizeof(ZIP64_CentralDirectoryEnd) ||
+			end64->sig != ZIP64_CENTRAL_DIRECTORY_END_MARKER) {
+			errorCode = ZIP_ERROR_NO_CENTRAL_DIRECTORY_FOUND;
+			PRINT_CLASS_ERROR( "the ZIP64 end locator doesn't point at a ZIP64 end record" );
+			return -1;
+		}
+		directoryLimit = locator.endOffset;
+	}
+
+	// The size and offset come straight from the file, and a crafted ZIP64 record can claim anything up to 2^64.
+	if (end64->centralDirectorySize > directoryLimit || end64->centralDirectoryOffset > directoryLimit - end64->centralDirectorySize) {
+		errorCode = ZIP_ERROR_MALFORMED_LIST;
+		PRINT_CLASS_ERROR( "the central directory doesn't lie within the archive" );
+		return -1;
+	}
+	return 0;
+}
+
+/*!	\fn		ReadZip64Extra( ZIP_FileNode *node, ZIP_CentralDirectoryHeader *dirHeader, const uint8_t *extra )
+	\brief	A private method that replaces the fields of node which the central directory header marks as too large with their 64-bit values from the ZIP64 extended information extra field.  They appear there in a fixed order, and only when the header field holds its sentinel.
+	\param	node pointer to the file node being filled in
+	\param	dirHeader pointer to the member's central directory header
+	\param	extra pointer to the member's extra field, dirHeader->extraFieldLength bytes long
+*/
+
+int32_t IMG3_ZipInterface::ReadZip64Extra(ZIP_FileNode *node, ZIP_CentralDirectoryHeader *dirHeader, const uint8_t *extra)
+{
+	const uint8_t *field = extra, *limit = extra + dirHeader->extraFieldLength, *data, *dataEnd;
+	uint16_t tag, size;
+
+	while (field + 2*sizeof(uint16_t) <= limit) {
+		memcpy(&tag,field,sizeof(tag));
+		memcpy(&size,field+sizeof(tag),sizeof(size));
+		data = field + 2*sizeof(uint16_t);
+		dataEnd = data + size;
+		if (dataEnd > limit)
+			break;
+		if (tag != ZIP64_EXTRA_TAG) {
+			field = dataEnd;
+			continue;
+		}
+		if (dirHeader->uncompressedSize == ZIP64_SENTINEL_32) {
+			if (data + sizeof(uint64_t) > dataEnd)
+				goto ReadZip64Extra_error;
+			memcpy(&node->uncompressedSize,data,sizeof(uint64_t));
+			data += sizeof(uint64_t);
+		}
+		if (dirHeader->compressedSize == ZIP64_SENTINEL_32) {
+			if (data + sizeof(uint64_t) > dataEnd)
+				goto ReadZip64Extra_error;
+			memcpy(&node->compressedSize,data,sizeof(uint64_t));
+			data += sizeof(uint64_t);
+		}
+		if (dirHeader->fileHeaderOffset == ZIP64_SENTINEL_32) {
+			if (data + sizeof(uint64_t) > dataEnd)
+				goto ReadZip64Extra_error;
+			memcpy(&node->offset,data,sizeof(uint64_t));
+			data += sizeof(uint64_t);
+		}
+		if (dirHeader->startDiskNumber == ZIP64_SENTINEL_16) {
+			if (data + sizeof(uint32_t) > dataEnd)
+				goto ReadZip64Extra_error;
+			memcpy(&node->startingDisk,data,sizeof(uint32_t));
+		}
+		return 0;
+	}
+	return 0;
+
+ReadZip64Extra_error:
+	errorCode = ZIP_ERROR_MALFORMED_LIST;
+	PRINT_CLASS_ERROR( "a ZIP64 extra field is shorter than the fields it replaces" );
+	return -1;
+}
+
+/*!	\fn		ExtractCentralDirectoryListing( FILE *fd, ZIP64_CentralDirectoryEnd *end )
 	\brief	A private method used to extract a list of all files and file nodes contained within the specified ZIP archive file
 	\param	fd pointer to the ZIP archive file structure
-	\param	end pointer to the ZIP_CentralDirectoryEnd structure for the specified file
+	\param	end pointer to the ZIP64_CentralDirectoryEnd structure for the specified file, filled in by FindZip64End
 */
 
-int32_t IMG3_ZipInterface::ExtractCentralDirectoryListings(FILE *fd, ZIP_CentralDirectoryEnd *end)
+int32_t IMG3_ZipInterface::ExtractCentralDirectoryListings(FILE *fd, ZIP64_CentralDirectoryEnd *end)
 {
-	char *records;
+	char *records, *names;
 	ZIP_CentralDirectoryHeader dirHeader;
-	uint16_t index, sizeOfStruct;
-	uint32_t currOffset, recordSize;
+	uint16_t sizeOfStruct;
+	uint64_t index, currOffset, recordSize;
 	ZIP_FileNode *node;
 
 	errorCode = ZIP_ERROR_NONE;
@@ -255,6 +426,13 @@ int32_t IMG3_ZipInterface::ExtractCentralDirectoryListings(FILE *fd, ZIP_Central
 
 	sizeOfStruct = sizeof(dirHeader);
 
+	// Every record holds at least its fixed part, which bounds the number of entries before anything is allocated.
+	if (end->centralDirectoryTotalNum > end->centralDirectorySize / (sizeOfStruct - CENTRAL_DIRECTORY_HEADER_EXTRA)) {
+		errorCode = ZIP_ERROR_MALFORMED_LIST;
+		PRINT_CLASS_ERROR( "the central directory is too small for the number of entries it claims" );
+		return -1;
+	}
+
 	// Using the information in the central directory end structure, allocate room for the central directory and read it in
 	records = new char[end->centralDirectorySize];
 	if (!records) {
@@ -262,160 +440,2612 @@ int32_t IMG3_ZipInterface::ExtractCentralDirectoryListings(FILE *fd, ZIP_Central
 		PRINT_SYSTEM_ERROR();
 		return -1;
 	}
-	if(fseek(fd,end->centralDirectoryOffset,SEEK_SET)) {
+	if(fseeko(fd,(off_t)end->centralDirectoryOffset,SEEK_SET)) {
 		errorCode = errno;
 		PRINT_SYSTEM_ERROR();
+		delete[](records);
 		return -1;
 	}
 	if (fread(records,end->centralDirectorySize,1,fd) == 0) {
 		errorCode = errno;
 		PRINT_SYSTEM_ERROR();
+		delete[](records);
 		return -1;
 	}
 
-	
+	// The names are shorter than the records holding them, so the directory's size, plus a terminator per entry, bounds the arena.
+	if (AllocateNodes(end->centralDirectoryTotalNum,end->centralDirectorySize + end->centralDirectoryTotalNum) != 0) {
+		delete[](records);
+		return -1;
+	}
+	names = nameArena;
+
 	currOffset = recordSize = 0;
 	for (index = 0; index < end->centralDirectoryTotalNum; index++) {
-		// For each entry in the central directory, create a file node and extract its information
+		// For each entry in the central directory, fill in its file node
 		memset(&dirHeader,0,sizeOfStruct);
+		if (currOffset + sizeOfStruct - CENTRAL_DIRECTORY_HEADER_EXTRA > end->centralDirectorySize)
+			goto traversal_error;
 		memcpy(&dirHeader,records+currOffset,sizeOfStruct - CENTRAL_DIRECTORY_HEADER_EXTRA);
 		if (dirHeader.sig != CENTRAL_DIRECTORY_HEADER_MARKER) {
-			fprintf(stderr,"%s: Should be a record at offset %#08x, but the marker isn't there.\n", __FUNCTION__, end->centralDirectoryOffset+currOffset);
+			fprintf(stderr,"%s: Should be a record at offset %#08llx, but the marker isn't there.\n", __FUNCTION__, (unsigned long long)(end->centralDirectoryOffset+currOffset));
 			goto traversal_error;
 		}
-		node = new ZIP_FileNode;
-		if (node == NULL) {
-			errorCode = errno;
-			PRINT_SYSTEM_ERROR();
+		recordSize = sizeOfStruct - CENTRAL_DIRECTORY_HEADER_EXTRA + dirHeader.fileNameLength + dirHeader.extraFieldLength + dirHeader.fileCommentLength;
+		if (currOffset + recordSize > end->centralDirectorySize)
 			goto traversal_error;
-		}
+
+		node = &nodes[index];
 		node->offset = dirHeader.fileHeaderOffset;
 		node->startingDisk = dirHeader.startDiskNumber;
 		node->compressedSize = dirHeader.compressedSize;
 		node->uncompressedSize = dirHeader.uncompressedSize;
+		node->compressionMethod = dirHeader.compressionMethod;
+		node->flags = dirHeader.flags;
+		node->crc32 = dirHeader.crc32;
+		node->fileName = NULL;
 		if (dirHeader.fileNameLength != 0) {
-			dirHeader.fileName = new uint8_t[dirHeader.fileNameLength+1];
-			if (!dirHeader.fileName) {
-				errorCode = errno;	
-				PRINT_SYSTEM_ERROR();
-			}
-			node->fileName = new char[dirHeader.fileNameLength+1];
-			if (!node->fileName) {
-				errorCode = errno;
-				PRINT_SYSTEM_ERROR();
-				goto traversal_error;
-			}
-			memcpy(dirHeader.fileName,records+currOffset+sizeOfStruct-CENTRAL_DIRECTORY_HEADER_EXTRA,dirHeader.fileNameLength);
-			dirHeader.fileName[dirHeader.fileNameLength] = '\0';
-			strncpy(node->fileName,(char *)dirHeader.fileName,dirHeader.fileNameLength);
+			node->fileName = names;
+			memcpy(names,records+currOffset+sizeOfStruct-CENTRAL_DIRECTORY_HEADER_EXTRA,dirHeader.fileNameLength);
+			names[dirHeader.fileNameLength] = '\0';
+			names += dirHeader.fileNameLength + 1;
 		}
-		nodes.push_back(node);
-		files.push_back(node->fileName);
+		if (ReadZip64Extra(node,&dirHeader,(uint8_t *)records+currOffset+sizeOfStruct-CENTRAL_DIRECTORY_HEADER_EXTRA+dirHeader.fileNameLength) != 0)
+			goto traversal_error;
 
-		recordSize = sizeOfStruct - CENTRAL_DIRECTORY_HEADER_EXTRA + dirHeader.fileNameLength + dirHeader.extraFieldLength + dirHeader.fileCommentLength;
 		currOffset += recordSize;
-		if (currOffset > end->centralDirectorySize) {
-			goto traversal_error;
-		}
 	}
 
-	delete(records);
+	delete[](records);
+	IndexNodes();
 	return 0;
 
 traversal_error:
-	nodes.clear();
-	delete(records);
-	if (node != NULL)
-		delete(node);
+	// Only the half-built nodes go; the caller still owns the open archive and reports errorCode.
+	delete[](records);
+	ReleaseNodes();
 	return -1;
 }
 
-/*!	\fn		ExtractFiles( const char *archiveName, char *section )
-	\brief	A public method used to extract all files from a ZIP archive whose name includes the section string provided
-	\param	archiveName	pointer to a string buffer containing the name of the ZIP archive
-	\param 	section pointer to a string buffer containing the section name to use as a filter
+/*!	\fn		ZipHashName( const char *name, size_t length )
+	\brief	A static helper returning the FNV-1a hash of the first length characters of name, lowercased.  Zero is reserved for members without a name.
+	\param	name pointer to the characters to hash
+	\param	length number of characters to hash
 */
 
-list<char *> * IMG3_ZipInterface::ExtractFiles(const char *archiveName, char *section)
+static uint32_t ZipHashName(const char *name, size_t length)
+{
+	uint32_t hash = 0x811c9dc5;
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		hash ^= (uint8_t)tolower((uint8_t)name[i]);
+		hash *= 0x01000193;
+	}
+	return (hash != 0) ? hash : 1;
+}
+
+/*!	\fn		ZipSectionStem( const char *name, size_t *length )
+	\brief	A static helper returning the section stem of a member name: its last path component up to the first dot, so "Firmware/dfu/iBSS.n90ap.RELEASE.dfu" has the stem "iBSS".
+	\param	name pointer to the member name
+	\param	length pointer to the variable receiving the length of the stem
+*/
+
+static const char * ZipSectionStem(const char *name, size_t *length)
+{
+	const char *stem = strrchr(name,'/');
+	const char *dot;
+
+	stem = (stem != NULL) ? stem + 1 : name;
+	dot = strchr(stem,'.');
+	*length = (dot != NULL) ? (size_t)(dot - stem) : strlen(stem);
+	return stem;
+}
+
+/*!	\fn		AllocateNodes( uint64_t count, uint64_t namesLength )
+	\brief	A private method that makes one allocation holding count file nodes, both hash tables and a name arena of namesLength bytes, replacing any previous table.
+	\param	count number of members in the archive
+	\param	namesLength size of the name arena in bytes; zero when the names live elsewhere
+*/
+
+int32_t IMG3_ZipInterface::AllocateNodes(uint64_t count, uint64_t namesLength)
+{
+	uint64_t slots = 16, size;
+
+	if (count >= ZIP_NO_NODE) {
+		errorCode = ZIP_ERROR_MALFORMED_LIST;
+		PRINT_CLASS_ERROR( "the archive holds too many members" );
+		return -1;
+	}
+	// Keep both tables at most half full so probe sequences stay short.
+	while (slots < 2*count)
+		slots <<= 1;
+
+	size = count * sizeof(ZIP_FileNode) + 2 * slots * sizeof(uint32_t) + namesLength;
+	ReleaseCheckpoints();
+	if (nodeBlock != NULL)
+		delete[](nodeBlock);
+	nodeBlock = new uint8_t[size];
+	memset(nodeBlock,0,count * sizeof(ZIP_FileNode) + 2 * slots * sizeof(uint32_t));
+
+	nodes = (ZIP_FileNode *)nodeBlock;
+	nodeCount = (uint32_t)count;
+	nameSlots = (uint32_t *)(nodeBlock + count * sizeof(ZIP_FileNode));
+	sectionSlots = nameSlots + slots;
+	slotMask = (uint32_t)(slots - 1);
+	nameArena = (namesLength != 0) ? (char *)(sectionSlots + slots) : NULL;
+	return 0;
+}
+
+/*!	\fn		IndexNodes()
+	\brief	A private method that hashes every node's name and section stem into the two tables, links members sharing a stem in archive order, and lists the names in files.
+*/
+
+void IMG3_ZipInterface::IndexNodes( void )
 {
-	list<ZIP_FileNode *>::iterator listIt;
-	list<char *> *matchingFiles;
 	ZIP_FileNode *node;
-	char *fileName = NULL;
-	pid_t pid;
-	int status;
+	const char *stem, *headStem;
+	size_t length, headLength;
+	uint32_t index, slot, hash;
+	uint32_t *sectionTails;
 
-	errorCode = ZIP_ERROR_NONE;
+	// The last member of each chain is kept beside its slot, so every member is appended without walking the chain.
+	sectionTails = new uint32_t[slotMask + 1];
+	files.clear();
+	for (index = 0; index < nodeCount; index++) {
+		node = &nodes[index];
+		node->nextInSection = ZIP_NO_NODE;
+		node->nameHash = 0;
+		files.push_back(node->fileName);
+		if (node->fileName == NULL)
+			continue;
 
-	CLASS_VALIDATE_PARAMETER( section, NULL );
-	CLASS_VALIDATE_PARAMETER( archiveName, NULL );
+		node->nameHash = ZipHashName(node->fileName,strlen(node->fileName));
+		for (slot = node->nameHash & slotMask; nameSlots[slot] != 0; slot = (slot + 1) & slotMask)
+			;
+		nameSlots[slot] = index + 1;
 
-	matchingFiles = new list <char *>;
-	if (matchingFiles == NULL) {
-		errorCode = errno;
-		PRINT_SYSTEM_ERROR();
+		// Members sharing a stem are chained from the first one, so the chain is walked in archive order.
+		stem = ZipSectionStem(node->fileName,&length);
+		if (length == 0)
+			continue;
+		hash = ZipHashName(stem,length);
+		for (slot = hash & slotMask; sectionSlots[slot] != 0; slot = (slot + 1) & slotMask) {
+			headStem = ZipSectionStem(nodes[sectionSlots[slot] - 1].fileName,&headLength);
+			if (headLength == length && strncasecmp(headStem,stem,length) == 0)
+				break;
+		}
+		if (sectionSlots[slot] == 0)
+			sectionSlots[slot] = index + 1;
+		else
+			nodes[sectionTails[slot]].nextInSection = index;
+		sectionTails[slot] = index;
+	}
+	delete[](sectionTails);
+}
+
+/*!	\fn		IndexCachePath( const char *archiveName )
+	\brief	A private method returning the name of the index sidecar for archiveName, which the caller deletes.  Sidecars live next to the archive, or in indexCacheDirectory under a hash of the archive's absolute path.
+	\param	archiveName pointer to a string buffer containing the name of the ZIP archive
+*/
+
+char * IMG3_ZipInterface::IndexCachePath(const char *archiveName)
+{
+	char resolved[PATH_MAX];
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	const char *ch;
+	char *path;
+	size_t length;
+
+	if (indexCacheDirectory == NULL) {
+		length = strlen(archiveName) + strlen(ZIP_INDEX_EXTENSION) + 1;
+		path = new char[length];
+		snprintf(path,length,"%s%s",archiveName,ZIP_INDEX_EXTENSION);
+		return path;
+	}
+
+	if (realpath(archiveName,resolved) == NULL)
 		return NULL;
+	// FNV-1a keeps sidecars of identically named archives in different directories apart.
+	for (ch = resolved; *ch != '\0'; ch++) {
+		hash ^= (uint8_t)*ch;
+		hash *= 0x100000001b3ULL;
 	}
+	length = strlen(indexCacheDirectory) + 1 + 16 + strlen(ZIP_INDEX_EXTENSION) + 1;
+	path = new char[length];
+	snprintf(path,length,"%s/%016llx%s",indexCacheDirectory,(unsigned long long)hash,ZIP_INDEX_EXTENSION);
+	return path;
+}
 
-	// Next, we need to figure out what file they actually want extracted.
-	for (listIt = nodes.begin(); listIt != nodes.end(); ++listIt) {
-		node = *listIt;
-		// Iterate through all files in the archive looking for ones that contain the section string in their name
-		if (strcasestr(node->fileName,section) != NULL) {
-			// If a match occurs, store the file name and extract it from the ZIP archive
-			fileName = node->fileName;
-			matchingFiles->push_back(fileName);
-			pid = vfork();
-			if (pid == 0) {
-				execlp("/usr/bin/unzip", "unzip", "-o", "-q", archiveName, fileName, NULL);
-			} else if (pid > 0){
-				if (wait(&status) == -1) {
-					errorCode = errno;
-					PRINT_SYSTEM_ERROR();
-					return NULL;
-				}
-				fprintf(stdout,"Successfully extracted the file %s from the archive %s.\n", fileName, archiveName);
-			} else {
-				errorCode = errno;
-				PRINT_SYSTEM_ERROR();
-				return NULL;
-			}
+/*!	\fn		LoadIndexCache( const char *archiveName, FILE *fd, long fileSize )
+	\brief	A private method that maps the index sidecar of archiveName and rebuilds the file nodes from it.  Returns -1, with errorCode untouched, whenever there is no sidecar or it no longer matches the archive, so the caller falls back to scanning the central directory.
+	\param	archiveName pointer to a string buffer containing the name of the ZIP archive
+	\param	fd pointer to the open ZIP archive
+	\param	fileSize size of the ZIP archive in bytes
+*/
+
+int32_t IMG3_ZipInterface::LoadIndexCache(const char *archiveName, FILE *fd, long fileSize)
+{
+	ZIP_IndexHeader *header;
+	ZIP_IndexEntry *entries;
+	ZIP_CentralDirectoryEnd end;
+	ZIP_FileNode *node;
+	struct stat archiveStat, indexStat;
+	char resolved[PATH_MAX];
+	const char *names;
+	uint8_t *map = NULL;
+	uint64_t expected;
+	uint32_t index;
+	char *path;
+	int indexFd;
+	int32_t result = -1;
+
+	path = IndexCachePath(archiveName);
+	if (path == NULL)
+		return -1;
+	indexFd = open(path,O_RDONLY);
+	delete[](path);
+	if (indexFd < 0)
+		return -1;
+	if (fstat(indexFd,&indexStat) != 0 || indexStat.st_size < (off_t)sizeof(ZIP_IndexHeader))
+		goto LoadIndexCache_close;
+	map = (uint8_t *)mmap(NULL,indexStat.st_size,PROT_READ,MAP_SHARED,indexFd,0);
+	if (map == MAP_FAILED) {
+		map = NULL;
+		goto LoadIndexCache_close;
+	}
+
+	header = (ZIP_IndexHeader *)map;
+	if (header->magic != ZIP_INDEX_MAGIC || header->version != ZIP_INDEX_VERSION)
+		goto LoadIndexCache_close;
+	expected = sizeof(ZIP_IndexHeader) + (uint64_t)header->pathLength + (uint64_t)header->count * sizeof(ZIP_IndexEntry) + header->namesLength;
+	if (expected != (uint64_t)indexStat.st_size)
+		goto LoadIndexCache_close;
+
+	// The sidecar only describes this archive if nothing about it has changed since it was written.
+	if (fstat(fileno(fd),&archiveStat) != 0 || realpath(archiveName,resolved) == NULL)
+		goto LoadIndexCache_close;
+	if (header->archiveSize != (uint64_t)fileSize || header->mtimeSeconds != (int64_t)archiveStat.st_mtim.tv_sec ||
+		header->mtimeNanoseconds != (int64_t)archiveStat.st_mtim.tv_nsec)
+		goto LoadIndexCache_close;
+	if (header->pathLength != strlen(resolved) || memcmp(map + sizeof(ZIP_IndexHeader),resolved,header->pathLength) != 0)
+		goto LoadIndexCache_close;
+	if (header->endOffset + sizeof(end) - CENTRAL_DIRECTORY_END_EXTRA > (uint64_t)fileSize)
+		goto LoadIndexCache_close;
+	memset(&end,0,sizeof(end));
+	if (pread(fileno(fd),&end,sizeof(end) - CENTRAL_DIRECTORY_END_EXTRA,header->endOffset) != (ssize_t)(sizeof(end) - CENTRAL_DIRECTORY_END_EXTRA))
+		goto LoadIndexCache_close;
+	if (memcmp(&end,header->endRecord,sizeof(header->endRecord)) != 0)
+		goto LoadIndexCache_close;
+
+	entries = (ZIP_IndexEntry *)(map + sizeof(ZIP_IndexHeader) + header->pathLength);
+	names = (const char *)(entries + header->count);
+	for (index = 0; index < header->count; index++) {
+		if (entries[index].nameOffset != 0xFFFFFFFF &&
+			((uint64_t)entries[index].nameOffset + entries[index].nameLength >= header->namesLength ||
+			 names[entries[index].nameOffset + entries[index].nameLength] != '\0'))
+			goto LoadIndexCache_close;
+	}
+
+	// The names are used straight out of the mapping, which is kept until the next archive is analyzed.
+	if (AllocateNodes(header->count,0) != 0)
+		goto LoadIndexCache_close;
+	for (index = 0; index < header->count; index++) {
+		node = &nodes[index];
+		node->offset = entries[index].offset;
+		node->startingDisk = entries[index].startingDisk;
+		node->compressedSize = entries[index].compressedSize;
+		node->uncompressedSize = entries[index].uncompressedSize;
+		node->compressionMethod = entries[index].compressionMethod;
+		node->flags = entries[index].flags;
+		node->crc32 = entries[index].crc32;
+		node->fileName = NULL;
+		if (entries[index].nameOffset != 0xFFFFFFFF)
+			node->fileName = (char *)names + entries[index].nameOffset;
+	}
+	IndexNodes();
+	endOffset = header->endOffset;
+	indexMap = map;
+	indexMapSize = indexStat.st_size;
+	map = NULL;
+	result = 0;
+
+LoadIndexCache_close:
+	if (map != NULL)
+		munmap(map,indexStat.st_size);
+	close(indexFd);
+	return result;
+}
+
+/*!	\fn		SaveIndexCache( const char *archiveName, FILE *fd, long fileSize, ZIP_CentralDirectoryEnd *end )
+	\brief	A private method that writes the file nodes of the analyzed archive to its index sidecar.  The sidecar is written under a temporary name and renamed into place, so concurrent runs never see a partial one.  Failures are not errors, since the sidecar is only a cache.
+	\param	archiveName pointer to a string buffer containing the name of the ZIP archive
+	\param	fd pointer to the open ZIP archive
+	\param	fileSize size of the ZIP archive in bytes
+	\param	end pointer to the archive's central directory end structure
+*/
+
+int32_t IMG3_ZipInterface::SaveIndexCache(const char *archiveName, FILE *fd, long fileSize, ZIP_CentralDirectoryEnd *end)
+{
+	ZIP_FileNode *node;
+	ZIP_IndexHeader header;
+	ZIP_IndexEntry *entries;
+	struct stat archiveStat;
+	char resolved[PATH_MAX];
+	char *path, *temporary, *names;
+	size_t length, namesLength = 0;
+	uint32_t index = 0;
+	int indexFd;
+	int32_t result = -1;
+
+	if (fstat(fileno(fd),&archiveStat) != 0 || realpath(archiveName,resolved) == NULL)
+		return -1;
+	path = IndexCachePath(archiveName);
+	if (path == NULL)
+		return -1;
+
+	for (index = 0; index < nodeCount; index++) {
+		if (nodes[index].fileName != NULL)
+			namesLength += strlen(nodes[index].fileName) + 1;
+	}
+
+	memset(&header,0,sizeof(header));
+	header.magic = ZIP_INDEX_MAGIC;
+	header.version = ZIP_INDEX_VERSION;
+	header.archiveSize = (uint64_t)fileSize;
+	header.mtimeSeconds = (int64_t)archiveStat.st_mtim.tv_sec;
+	header.mtimeNanoseconds = (int64_t)archiveStat.st_mtim.tv_nsec;
+	header.endOffset = endOffset;
+	memcpy(header.endRecord,end,sizeof(header.endRecord));
+	header.count = nodeCount;
+	header.pathLength = (uint32_t)strlen(resolved);
+	header.namesLength = (uint32_t)namesLength;
+
+	entries = new ZIP_IndexEntry[nodeCount + 1];
+	names = new char[namesLength + 1];
+	namesLength = 0;
+	for (index = 0; index < nodeCount; index++) {
+		node = &nodes[index];
+		memset(&entries[index],0,sizeof(ZIP_IndexEntry));
+		entries[index].offset = node->offset;
+		entries[index].compressedSize = node->compressedSize;
+		entries[index].uncompressedSize = node->uncompressedSize;
+		entries[index].crc32 = node->crc32;
+		entries[index].compressionMethod = node->compressionMethod;
+		entries[index].flags = node->flags;
+		entries[index].startingDisk = node->startingDisk;
+		entries[index].nameOffset = 0xFFFFFFFF;
+		if (node->fileName != NULL) {
+			length = strlen(node->fileName);
+			entries[index].nameOffset = (uint32_t)namesLength;
+			entries[index].nameLength = (uint16_t)length;
+			memcpy(names + namesLength,node->fileName,length + 1);
+			namesLength += length + 1;
 		}
 	}
 
-	// Return a list of all files extracted from the ZIP archive provided.
-	return matchingFiles;
+	length = strlen(path) + 32;
+	temporary = new char[length];
+	snprintf(temporary,length,"%s.%ld.tmp",path,(long)getpid());
+	indexFd = open(temporary,O_WRONLY | O_CREAT | O_TRUNC,0644);
+	if (indexFd >= 0) {
+		// WriteOutput reports its failures through errorCode, so keep whatever the caller had.
+		int32_t saved = errorCode;
+
+		if (WriteOutput(indexFd,(uint8_t *)&header,sizeof(header)) == 0 &&
+			WriteOutput(indexFd,(uint8_t *)resolved,header.pathLength) == 0 &&
+			WriteOutput(indexFd,(uint8_t *)entries,(size_t)header.count * sizeof(ZIP_IndexEntry)) == 0 &&
+			WriteOutput(indexFd,(uint8_t *)names,namesLength) == 0)
+			result = 0;
+		errorCode = saved;
+		if (close(indexFd) != 0)
+			result = -1;
+		if (result == 0 && rename(temporary,path) != 0)
+			result = -1;
+		if (result != 0)
+			unlink(temporary);
+	}
+
+	delete[](temporary);
+	delete[](names);
+	delete[](entries);
+	delete[](path);
+	return result;
 }
 
-/*!	\fn		ExtractAllFiles( const char *archiveName )
-	\brief	A public method used to extract all the files contained within the ZIP archive specified.
+
+/*!	\fn		CheckpointCachePath( const char *archiveName, ZIP_FileNode *node )
+	\brief	A private method returning the name of a member's checkpoint sidecar, which the caller deletes.  It sits beside the archive's index sidecar, named after the offset of the member's local header.
 	\param	archiveName pointer to a string buffer containing the name of the ZIP archive
+	\param	node pointer to the member's file node
 */
 
-int32_t IMG3_ZipInterface::ExtractAllFiles(const char *archiveName)
+char * IMG3_ZipInterface::CheckpointCachePath(const char *archiveName, ZIP_FileNode *node)
 {
-	pid_t pid;
-	int status;
+	char *indexPath, *path;
+	size_t length;
 
-	errorCode = ZIP_ERROR_NONE;
+	indexPath = IndexCachePath(archiveName);
+	if (indexPath == NULL)
+		return NULL;
+	// "a.zip.zidx" becomes "a.zip.<offset>.zckp".
+	length = strlen(indexPath) - strlen(ZIP_INDEX_EXTENSION);
+	indexPath[length] = '\0';
+	length += 1 + 16 + strlen(ZIP_CHECKPOINT_EXTENSION) + 1;
+	path = new char[length];
+	snprintf(path,length,"%s.%016llx%s",indexPath,(unsigned long long)node->offset,ZIP_CHECKPOINT_EXTENSION);
+	delete[](indexPath);
+	return path;
+}
 
-	CLASS_VALIDATE_PARAMETER( archiveName, -1 );
+/*!	\fn		LoadCheckpoints( const char *archiveName, int archiveFd, ZIP_FileNode *node )
+	\brief	A private method that maps a member's checkpoint sidecar and attaches it to the node.  Returns -1, with errorCode untouched, whenever there is no sidecar or it no longer matches the member, so the caller builds the checkpoints instead.
+	\param	archiveName pointer to a string buffer containing the name of the ZIP archive
+	\param	archiveFd descriptor of the open ZIP archive
+	\param	node pointer to the member's file node
+*/
 
-	// Use the unzip system application to extract all the files contained within the specified ZIP archive.
-	pid = vfork();
-	if (pid == 0) {
-		execlp("/usr/bin/unzip", "unzip", "-q", archiveName, NULL);
-	} else if (pid > 0) {
-		if (waitpid(pid, &status, 0) == -1) {
-			errorCode = errno;
-			PRINT_SYSTEM_ERROR();
+int32_t IMG3_ZipInterface::LoadCheckpoints(const char *archiveName, int archiveFd, ZIP_FileNode *node)
+{
+	ZIP_CheckpointHeader *header;
+	ZIP_CheckpointIndex *index;
+	ZIP_Checkpoint *points;
+	struct stat archiveStat, cacheStat;
+	uint8_t *map = NULL;
+	uint64_t expected;
+	uint32_t i;
+	char *path;
+	int cacheFd;
+	int32_t result = -1;
+
+	path = CheckpointCachePath(archiveName,node);
+	if (path == NULL)
+		return -1;
+	cacheFd = open(path,O_RDONLY);
+	delete[](path);
+	if (cacheFd < 0)
+		return -1;
+	if (fstat(cacheFd,&cacheStat) != 0 || cacheStat.st_size < (off_t)sizeof(ZIP_CheckpointHeader))
+		goto LoadCheckpoints_close;
+	map = (uint8_t *)mmap(NULL,cacheStat.st_size,PROT_READ,MAP_SHARED,cacheFd,0);
+	if (map == MAP_FAILED) {
+		map = NULL;
+		goto LoadCheckpoints_close;
+	}
+
+	header = (ZIP_CheckpointHeader *)map;
+	if (header->magic != ZIP_CHECKPOINT_MAGIC || header->version != ZIP_CHECKPOINT_VERSION)
+		goto LoadCheckpoints_close;
+	expected = sizeof(ZIP_CheckpointHeader) + (uint64_t)header->count * (sizeof(ZIP_Checkpoint) + ZIP_WINDOW_SIZE);
+	if (expected != (uint64_t)cacheStat.st_size)
+		goto LoadCheckpoints_close;
+
+	// The sidecar only describes this member if neither the archive nor the member has changed since it was written.
+	if (fstat(archiveFd,&archiveStat) != 0)
+		goto LoadCheckpoints_close;
+	if (header->archiveSize != (uint64_t)archiveStat.st_size || header->mtimeSeconds != (int64_t)archiveStat.st_mtim.tv_sec ||
+		header->mtimeNanoseconds != (int64_t)archiveStat.st_mtim.tv_nsec)
+		goto LoadCheckpoints_close;
+	if (header->offset != node->offset || header->compressedSize != node->compressedSize ||
+		header->uncompressedSize != node->uncompressedSize || header->crc32 != node->crc32)
+		goto LoadCheckpoints_close;
+
+	points = (ZIP_Checkpoint *)(map + sizeof(ZIP_CheckpointHeader));
+	for (i = 0; i < header->count; i++) {
+		if (points[i].bits > 7 || points[i].compressedOffset > node->compressedSize ||
+			points[i].uncompressedOffset > node->uncompressedSize ||
+			(i > 0 && points[i].uncompressedOffset <= points[i-1].uncompressedOffset))
+			goto LoadCheckpoints_close;
+	}
+
+	index = new ZIP_CheckpointIndex;
+	index->count = header->count;
+	index->points = points;
+	index->windows = (uint8_t *)(points + header->count);
+	index->block = map;
+	index->blockSize = cacheStat.st_size;
+	index->mapped = true;
+	node->checkpoints = index;
+	map = NULL;
+	result = 0;
+
+LoadCheckpoints_close:
+	if (map != NULL)
+		munmap(map,cacheStat.st_size);
+	close(cacheFd);
+	return result;
+}
+
+/*!	\fn		SaveCheckpoints( const char *archiveName, int archiveFd, ZIP_FileNode *node )
+	\brief	A private method that writes a member's checkpoints to its sidecar, under a temporary name renamed into place.  Failures are not errors, since the sidecar is only a cache.
+	\param	archiveName pointer to a string buffer containing the name of the ZIP archive
+	\param	archiveFd descriptor of the open ZIP archive
+	\param	node pointer to the member's file node, whose checkpoints have been built
+*/
+
+int32_t IMG3_ZipInterface::SaveCheckpoints(const char *archiveName, int archiveFd, ZIP_FileNode *node)
+{
+	ZIP_CheckpointHeader header;
+	ZIP_CheckpointIndex *index = node->checkpoints;
+	struct stat archiveStat;
+	char *path, *temporary;
+	size_t length;
+	int cacheFd;
+	int32_t saved, result = -1;
+
+	if (index == NULL || fstat(archiveFd,&archiveStat) != 0)
+		return -1;
+	path = CheckpointCachePath(archiveName,node);
+	if (path == NULL)
+		return -1;
+
+	memset(&header,0,sizeof(header));
+	header.magic = ZIP_CHECKPOINT_MAGIC;
+	header.version = ZIP_CHECKPOINT_VERSION;
+	header.archiveSize = (uint64_t)archiveStat.st_size;
+	header.mtimeSeconds = (int64_t)archiveStat.st_mtim.tv_sec;
+	header.mtimeNanoseconds = (int64_t)archiveStat.st_mtim.tv_nsec;
+	header.offset = node->offset;
+	header.compressedSize = node->compressedSize;
+	header.uncompressedSize = node->uncompressedSize;
+	header.crc32 = node->crc32;
+	header.span = checkpointSpan;
+	header.count = index->count;
+
+	length = strlen(path) + 32;
+	temporary = new char[length];
+	snprintf(temporary,length,"%s.%ld.tmp",path,(long)getpid());
+	cacheFd = open(temporary,O_WRONLY | O_CREAT | O_TRUNC,0644);
+	if (cacheFd >= 0) {
+		// WriteOutput reports its failures through errorCode, so keep whatever the caller had.
+		saved = errorCode;
+		if (WriteOutput(cacheFd,(uint8_t *)&header,sizeof(header)) == 0 &&
+			WriteOutput(cacheFd,(uint8_t *)index->points,(size_t)index->count * sizeof(ZIP_Checkpoint)) == 0 &&
+			WriteOutput(cacheFd,index->windows,(size_t)index->count * ZIP_WINDOW_SIZE) == 0)
+			result = 0;
+		errorCode = saved;
+		if (close(cacheFd) != 0)
+			result = -1;
+		if (result == 0 && rename(temporary,path) != 0)
+			result = -1;
+		if (result != 0)
+			unlink(temporary);
+	}
+
+	delete[](temporary);
+	delete[](path);
+	return result;
+}
+
+/*!	\fn		ReleaseCheckpoints()
+	\brief	A private method that frees, or unmaps, the checkpoints of every node.
+*/
+
+void IMG3_ZipInterface::ReleaseCheckpoints( void )
+{
+	ZIP_CheckpointIndex *index;
+	uint32_t i;
+
+	for (i = 0; i < nodeCount; i++) {
+		index = nodes[i].checkpoints;
+		if (index == NULL)
+			continue;
+		if (index->mapped)
+			munmap(index->block,index->blockSize);
+		else
+			delete[](index->block);
+		delete(index);
+		nodes[i].checkpoints = NULL;
+	}
+}
+
+/*!	\fn		ZipPathIsSafe( const char *path )
+	\brief	A static helper that rejects member names which would land outside of the extraction directory.
+	\param	path pointer to the member name stored in the archive
+*/
+
+static bool ZipPathIsSafe(const char *path)
+{
+	const char *component = path;
+	const char *slash;
+
+	if (path[0] == '/')
+		return false;
+
+	while (*component != '\0') {
+		slash = strchr(component,'/');
+		if (slash == NULL)
+			slash = component + strlen(component);
+		if ((slash - component) == 2 && component[0] == '.' && component[1] == '.')
+			return false;
+		component = (*slash == '/') ? slash + 1 : slash;
+	}
+	return true;
+}
+
+/*!	\fn		ZipCreateParents( const char *path )
+	\brief	A static helper that creates every directory leading up to the final component of path, the way unzip does.
+	\param	path pointer to the relative path of the member being extracted
+*/
+
+static int ZipCreateParents(const char *path)
+{
+	char *copy, *slash;
+
+	copy = new char[strlen(path)+1];
+	strcpy(copy,path);
+
+	for (slash = strchr(copy,'/'); slash != NULL; slash = strchr(slash+1,'/')) {
+		if (slash == copy)
+			continue;
+		*slash = '\0';
+		if (mkdir(copy,0755) != 0 && errno != EEXIST) {
+			delete[](copy);
 			return -1;
 		}
-		fprintf(stdout,"Successfully unzipped the archive %s.\n", archiveName);
-	} else {
+		*slash = '/';
+	}
+	delete[](copy);
+	return 0;
+}
+
+/*!	\fn		FindNode( const char *fileName )
+	\brief	A private method that returns the node of the member whose name matches fileName exactly.
+	\param	fileName pointer to the name of the member as stored in the archive
+*/
+
+ZIP_FileNode * IMG3_ZipInterface::FindNode(const char *fileName)
+{
+	ZIP_FileNode *node;
+	uint32_t slot, hash;
+
+	// Names are hashed lowercased, so members differing only in case share a probe sequence and are told apart here.
+	if (nodeCount != 0) {
+		hash = ZipHashName(fileName,strlen(fileName));
+		for (slot = hash & slotMask; nameSlots[slot] != 0; slot = (slot + 1) & slotMask) {
+			node = &nodes[nameSlots[slot] - 1];
+			if (node->nameHash == hash && strcmp(node->fileName,fileName) == 0)
+				return node;
+		}
+	}
+	errorCode = ZIP_ERROR_MEMBER_NOT_FOUND;
+	PRINT_CLASS_ERROR( "no member with that name exists in the archive" );
+	return NULL;
+}
+
+/*!	\fn		OpenArchive( const char *archiveName )
+	\brief	A private method that opens an archive for extraction.  If no archive has been analyzed yet, it is analyzed first so its members are known.
+	\param	archiveName pointer to a string buffer containing the name of the ZIP archive
+*/
+
+int IMG3_ZipInterface::OpenArchive(const char *archiveName)
+{
+	int archiveFd;
+
+	if (nodeCount == 0 && AnalyzeFile(archiveName) == NULL)
+		return -1;
+
+	archiveFd = open(archiveName,O_RDONLY);
+	if (archiveFd < 0) {
 		errorCode = errno;
 		PRINT_SYSTEM_ERROR();
 		return -1;
 	}
+	return archiveFd;
+}
+
+/*!	\fn		ReadArchive( int archiveFd, uint8_t *data, size_t length, off_t offset )
+	\brief	A private method that reads exactly length bytes at offset, treating a short archive as a corrupt member.
+	\param	archiveFd descriptor of the open ZIP archive
+	\param	data pointer to the buffer receiving the bytes
+	\param	length number of bytes to read
+	\param	offset position in the archive to read from
+*/
+
+int32_t IMG3_ZipInterface::ReadArchive(int archiveFd, uint8_t *data, size_t length, off_t offset)
+{
+	ssize_t result;
+
+	while (length > 0) {
+		result = pread(archiveFd,data,length,offset);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			errorCode = errno;
+			PRINT_SYSTEM_ERROR();
+			return -1;
+		}
+		if (result == 0) {
+			errorCode = ZIP_ERROR_CORRUPT_MEMBER;
+			PRINT_CLASS_ERROR( "the archive ends in the middle of a member" );
+			return -1;
+		}
+		data += result;
+		length -= result;
+		offset += result;
+	}
 	return 0;
 }
+
+/*!	\fn		WriteOutput( int outFd, uint8_t *data, size_t length )
+	\brief	A private method that writes all of data to outFd.
+	\param	outFd descriptor of the output file
+	\param	data pointer to the bytes to write
+	\param	length number of bytes to write
+*/
+
+int32_t IMG3_ZipInterface::WriteOutput(int outFd, uint8_t *data, size_t length)
+{
+	ssize_t result;
+
+	while (length > 0) {
+		result = write(outFd,data,length);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			errorCode = errno;
+			PRINT_SYSTEM_ERROR();
+			return -1;
+		}
+		data += result;
+		length -= result;
+	}
+	return 0;
+}
+
+/*!	\fn		MapArchive( int archiveFd )
+	\brief	A private method that maps the whole archive read-only, once per analyzed archive.  Returns zero when the mapping exists; otherwise, it returns -1 with errno set and leaves errorCode untouched, since callers can fall back to pread.
+	\param	archiveFd descriptor of the open ZIP archive
+*/
+
+int32_t IMG3_ZipInterface::MapArchive(int archiveFd)
+{
+	struct stat st;
+	void *map;
+
+	if (archiveMap != NULL)
+		return 0;
+	if (fstat(archiveFd,&st) != 0)
+		return -1;
+	if (st.st_size <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	map = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,archiveFd,0);
+	if (map == MAP_FAILED)
+		return -1;
+	archiveMap = (uint8_t *)map;
+	archiveMapSize = st.st_size;
+	return 0;
+}
+
+/*!	\fn		CopyRange( int archiveFd, off_t offset, int outFd, size_t length )
+	\brief	A private method that copies a range of the archive into outFd at its current position with copy_file_range, so the data never passes through user space.  Where the kernel can't copy between the two files, the range is written straight from the archive mapping.
+	\param	archiveFd descriptor of the open ZIP archive
+	\param	offset position of the range in the archive
+	\param	outFd descriptor of the output file
+	\param	length number of bytes to copy
+*/
+
+int32_t IMG3_ZipInterface::CopyRange(int archiveFd, off_t offset, int outFd, size_t length)
+{
+	ssize_t result;
+
+	while (length > 0) {
+		result = copy_file_range(archiveFd,&offset,outFd,NULL,length,0);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP || errno == EBADF)
+				return WriteOutput(outFd,archiveMap + offset,length);
+			errorCode = errno;
+			PRINT_SYSTEM_ERROR();
+			return -1;
+		}
+		if (result == 0) {
+			errorCode = ZIP_ERROR_CORRUPT_MEMBER;
+			PRINT_CLASS_ERROR( "the archive ends in the middle of a member" );
+			return -1;
+		}
+		length -= result;
+	}
+	return 0;
+}
+
+/*!	\fn		LocateData( int archiveFd, ZIP_FileNode *node, off_t *dataOffset )
+	\brief	A private method that reads a member's local header and returns the offset of its data.  Sizes and the CRC-32 are taken from the central directory, since the local copies are zero when a data descriptor is used.
+	\param	archiveFd descriptor of the open ZIP archive
+	\param	node pointer to the member's file node
+	\param	dataOffset pointer to the variable receiving the offset of the member's data
+*/
+
+int32_t IMG3_ZipInterface::LocateData(int archiveFd, ZIP_FileNode *node, off_t *dataOffset)
+{
+	ZIP_LocalHeader header;
+
+	memset(&header,0,sizeof(header));
+	if (ReadArchive(archiveFd,(uint8_t *)&header,ZIP_LOCAL_HEADER_SIZE,node->offset) != 0)
+		return -1;
+	if (header.sig != LOCAL_FILE_HEADER_MARKER) {
+		errorCode = ZIP_ERROR_CORRUPT_MEMBER;
+		PRINT_CLASS_ERROR( "no local file header at the offset given by the central directory" );
+		return -1;
+	}
+	*dataOffset = (off_t)node->offset + ZIP_LOCAL_HEADER_SIZE + header.fileNameLength + header.extraFieldLength;
+	return 0;
+}
+
+static uint32_t ZipCrc32Table[ 8 ][ 256 ];
+
+/*!	\fn		ZipCrc32BuildTables()
+	\brief	A static helper filling the eight slicing-by-8 tables for the reflected CRC-32 polynomial.  Table k advances a byte through k further zero bytes.
+*/
+
+static void ZipCrc32BuildTables()
+{
+	uint32_t n, k, c;
+
+	for (n = 0; n < 256; n++) {
+		c = n;
+		for (k = 0; k < 8; k++)
+			c = (c & 1) ? ZIP_CRC32_POLYNOMIAL ^ (c >> 1) : c >> 1;
+		ZipCrc32Table[0][n] = c;
+	}
+	for (n = 0; n < 256; n++) {
+		c = ZipCrc32Table[0][n];
+		for (k = 1; k < 8; k++) {
+			c = ZipCrc32Table[0][c & 0xFF] ^ (c >> 8);
+			ZipCrc32Table[k][n] = c;
+		}
+	}
+}
+
+/*!	\fn		ZipCrc32Slice8( uint32_t crc, const uint8_t *buf, size_t len )
+	\brief	A static slicing-by-8 kernel continuing a pre-inverted CRC-32 over buf, eight bytes per step.
+	\param	crc running checksum, already inverted
+	\param	buf pointer to the data on which to perform the checksum
+	\param	len size of buf buffer in bytes
+*/
+
+static uint32_t ZipCrc32Slice8(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	uint32_t one, two;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (len >= 8) {
+		memcpy(&one,buf,4);
+		memcpy(&two,buf+4,4);
+		one ^= crc;
+		crc = ZipCrc32Table[7][one & 0xFF] ^ ZipCrc32Table[6][(one >> 8) & 0xFF] ^
+			  ZipCrc32Table[5][(one >> 16) & 0xFF] ^ ZipCrc32Table[4][one >> 24] ^
+			  ZipCrc32Table[3][two & 0xFF] ^ ZipCrc32Table[2][(two >> 8) & 0xFF] ^
+			  ZipCrc32Table[1][(two >> 16) & 0xFF] ^ ZipCrc32Table[0][two >> 24];
+		buf += 8;
+		len -= 8;
+	}
+#endif
+	while (len--)
+		crc = ZipCrc32Table[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*!	\fn		ZipCrc32Fold( uint32_t crc, const uint8_t *buf, size_t len )
+	\brief	A static carry-less multiply kernel continuing a pre-inverted CRC-32 over buf
+	\param	crc running checksum, already inverted
+	\param	buf pointer to the data on which to perform the checksum
+	\param	len size of buf buffer in bytes
+
+	Four 128 bit lanes are folded forward 64 bytes at a time with pclmulqdq, then folded into one
+	lane, reduced to 64 bits and Barrett reduced to the 32 bit remainder.  Fewer than 64 bytes, and
+	whatever is left past the last 16 byte block, go through the slicing-by-8 kernel.
+*/
+
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t ZipCrc32Fold(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+	const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4, t1, t2, t3, t4;
+
+	if (len < 64)
+		return ZipCrc32Slice8(crc,buf,len);
+
+	x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)buf),_mm_cvtsi32_si128((int)crc));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 16));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 32));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 48));
+	buf += 64;
+	len -= 64;
+
+	while (len >= 64) {
+		t1 = _mm_clmulepi64_si128(x1,k1k2,0x00);
+		t2 = _mm_clmulepi64_si128(x2,k1k2,0x00);
+		t3 = _mm_clmulepi64_si128(x3,k1k2,0x00);
+		t4 = _mm_clmulepi64_si128(x4,k1k2,0x00);
+		x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1,k1k2,0x11),t1);
+		x2 = _mm_xor_si128(_mm_clmulepi64_si128(x2,k1k2,0x11),t2);
+		x3 = _mm_xor_si128(_mm_clmulepi64_si128(x3,k1k2,0x11),t3);
+		x4 = _mm_xor_si128(_mm_clmulepi64_si128(x4,k1k2,0x11),t4);
+		x1 = _mm_xor_si128(x1,_mm_loadu_si128((const __m128i *)buf));
+		x2 = _mm_xor_si128(x2,_mm_loadu_si128((const __m128i *)(buf + 16)));
+		x3 = _mm_xor_si128(x3,_mm_loadu_si128((const __m128i *)(buf + 32)));
+		x4 = _mm_xor_si128(x4,_mm_loadu_si128((const __m128i *)(buf + 48)));
+		buf += 64;
+		len -= 64;
+	}
+
+	// Fold the four lanes into one, then any remaining whole blocks into that.
+	t1 = _mm_clmulepi64_si128(x1,k3k4,0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1,k3k4,0x11),x2),t1);
+	t1 = _mm_clmulepi64_si128(x1,k3k4,0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1,k3k4,0x11),x3),t1);
+	t1 = _mm_clmulepi64_si128(x1,k3k4,0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1,k3k4,0x11),x4),t1);
+	while (len >= 16) {
+		t1 = _mm_clmulepi64_si128(x1,k3k4,0x00);
+		x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1,k3k4,0x11),t1);
+		x1 = _mm_xor_si128(x1,_mm_loadu_si128((const __m128i *)buf));
+		buf += 16;
+		len -= 16;
+	}
+
+	// Fold 128 bits down to 64, then Barrett reduce to 32.
+	x2 = _mm_clmulepi64_si128(x1,k3k4,0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1,8),x2);
+	x2 = _mm_srli_si128(x1,4);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1,mask),k5k0,0x00),x2);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x1,mask),poly,0x10);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x2,mask),poly,0x00);
+	crc = (uint32_t)_mm_extract_epi32(_mm_xor_si128(x1,x2),1);
+
+	return ZipCrc32Slice8(crc,buf,len);
+}
+
+#endif
+
+typedef uint32_t (*zip_crc32_kernel)(uint32_t, const uint8_t *, size_t);
+
+static zip_crc32_kernel ZipCrc32Selected = NULL;
+static pthread_once_t ZipCrc32Once = PTHREAD_ONCE_INIT;
+
+/*!	\fn		ZipCrc32Select()
+	\brief	A static helper building the tables and picking the fastest CRC-32 kernel the processor supports.  Run once through pthread_once, since extraction threads checksum concurrently.
+*/
+
+static void ZipCrc32Select()
+{
+	ZipCrc32BuildTables();
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+		ZipCrc32Selected = ZipCrc32Fold;
+	else
+#endif
+		ZipCrc32Selected = ZipCrc32Slice8;
+}
+
+/*!	\fn		ZipCrc32( uint32_t crc, const uint8_t *buf, size_t len )
+	\brief	A static helper continuing a standard (zlib compatible) CRC-32 over more data with the fastest available kernel.
+	\param	crc checksum of the data seen so far; 0 for none
+	\param	buf pointer to the data on which to perform the checksum
+	\param	len size of buf buffer in bytes
+*/
+
+static uint32_t ZipCrc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	pthread_once(&ZipCrc32Once,ZipCrc32Select);
+	return ~ZipCrc32Selected(~crc,buf,len);
+}
+
+/*!	\fn		ExtractNode( int archiveFd, ZIP_FileNode *node, uint8_t *outbuff, size_t outsize, int outFd )
+	\brief	A private method that inflates (method 8) or copies (method 0) one member, verifying its size and CRC-32 against the central directory.
+	\param	archiveFd descriptor of the open ZIP archive
+	\param	node pointer to the member's file node
+	\param	outbuff pointer to the buffer receiving the member, or NULL to write it to outFd instead
+	\param	outsize size of outbuff in bytes
+	\param	outFd descriptor receiving the member when outbuff is NULL
+*/
+
+int32_t IMG3_ZipInterface::ExtractNode(int archiveFd, ZIP_FileNode *node, uint8_t *outbuff, size_t outsize, int outFd)
+{
+	z_stream strm;
+	bool inflating = false;
+	uint8_t *input = NULL, *output = NULL, *mark, *data;
+	uint64_t remaining;
+	uint32_t chunk, crc;
+	size_t produced = 0, window;
+	off_t dataOffset;
+	int ret;
+	int32_t result = -1;
+
+	if (node->flags & ZIP_FLAG_ENCRYPTED) {
+		errorCode = ZIP_ERROR_UNSUPPORTED_METHOD;
+		PRINT_CLASS_ERROR( "encrypted members are not supported" );
+		return -1;
+	}
+	if (node->compressionMethod != ZIP_METHOD_STORED && node->compressionMethod != ZIP_METHOD_DEFLATED) {
+		errorCode = ZIP_ERROR_UNSUPPORTED_METHOD;
+		PRINT_CLASS_ERROR( "only stored and deflated members are supported" );
+		return -1;
+	}
+	if (outbuff != NULL && outsize < node->uncompressedSize) {
+		errorCode = ZIP_ERROR_OUTPUT_TOO_SMALL;
+		PRINT_CLASS_ERROR( "the output buffer is smaller than the member" );
+		return -1;
+	}
+	if (node->compressionMethod == ZIP_METHOD_STORED && node->compressedSize != node->uncompressedSize) {
+		errorCode = ZIP_ERROR_CORRUPT_MEMBER;
+		PRINT_CLASS_ERROR( "stored member has differing compressed and uncompressed sizes" );
+		return -1;
+	}
+	if (LocateData(archiveFd,node,&dataOffset) != 0)
+		return -1;
+
+	crc = 0;
+	remaining = node->compressedSize;
+
+	if (node->compressionMethod == ZIP_METHOD_STORED && outbuff == NULL && archiveMap != NULL) {
+		// Stored members are checksummed in place in the mapping and copied into the file by the kernel.
+		if ((uint64_t)dataOffset + node->compressedSize > archiveMapSize) {
+			errorCode = ZIP_ERROR_CORRUPT_MEMBER;
+			PRINT_CLASS_ERROR( "the archive ends in the middle of a member" );
+			goto ExtractNode_cleanup;
+		}
+		crc = ZipCrc32(0,archiveMap + dataOffset,node->compressedSize);
+		if (CopyRange(archiveFd,dataOffset,outFd,node->compressedSize) != 0)
+			goto ExtractNode_cleanup;
+		produced = node->compressedSize;
+	} else if (node->compressionMethod == ZIP_METHOD_STORED) {
+		input = new uint8_t[ZIP_EXTRACT_CHUNK];
+
+		// Stored members are read straight into the caller's buffer, or staged through the input buffer for a file.
+		while (remaining > 0) {
+			chunk = (remaining < ZIP_EXTRACT_CHUNK) ? remaining : ZIP_EXTRACT_CHUNK;
+			data = (outbuff != NULL) ? outbuff + produced : input;
+			if (ReadArchive(archiveFd,data,chunk,dataOffset) != 0)
+				goto ExtractNode_cleanup;
+			crc = ZipCrc32(crc,data,chunk);
+			if (outbuff == NULL && WriteOutput(outFd,data,chunk) != 0)
+				goto ExtractNode_cleanup;
+			dataOffset += chunk;
+			remaining -= chunk;
+			produced += chunk;
+		}
+	} else {
+		memset(&strm,0,sizeof(strm));
+		if (inflateInit2(&strm,-MAX_WBITS) != Z_OK) {
+			errorCode = ENOMEM;
+			PRINT_CLASS_ERROR( "unable to initialize zlib" );
+			goto ExtractNode_cleanup;
+		}
+		inflating = true;
+		input = new uint8_t[ZIP_EXTRACT_CHUNK];
+
+		// Inflate directly into the caller's buffer when there is one; otherwise cycle through a chunk buffer.
+		if (outbuff != NULL) {
+			strm.next_out = outbuff;
+			strm.avail_out = 0;
+		} else {
+			output = new uint8_t[ZIP_EXTRACT_CHUNK];
+		}
+
+		do {
+			if (strm.avail_in == 0 && remaining > 0) {
+				chunk = (remaining < ZIP_EXTRACT_CHUNK) ? remaining : ZIP_EXTRACT_CHUNK;
+				if (ReadArchive(archiveFd,input,chunk,dataOffset) != 0)
+					goto ExtractNode_cleanup;
+				strm.next_in = input;
+				strm.avail_in = chunk;
+				dataOffset += chunk;
+				remaining -= chunk;
+			}
+			if (outbuff == NULL) {
+				strm.next_out = output;
+				strm.avail_out = ZIP_EXTRACT_CHUNK;
+			} else if (strm.avail_out == 0) {
+				// zlib counts output space in 32 bits, so members past 4 GB are inflated into the buffer a window at a time.
+				window = outsize - (size_t)(strm.next_out - outbuff);
+				strm.avail_out = (window > 0xFFFFFFFF) ? 0xFFFFFFFF : (uInt)window;
+			}
+			mark = strm.next_out;
+			ret = inflate(&strm,Z_NO_FLUSH);
+			if (ret != Z_OK && ret != Z_STREAM_END) {
+				errorCode = ZIP_ERROR_CORRUPT_MEMBER;
+				PRINT_CLASS_ERROR( "the member's deflate stream is corrupt or truncated" );
+				goto ExtractNode_cleanup;
+			}
+			// Checksum the bytes just produced while they are still in cache.
+			crc = ZipCrc32(crc,mark,strm.next_out - mark);
+			if (outbuff == NULL && WriteOutput(outFd,output,strm.next_out - mark) != 0)
+				goto ExtractNode_cleanup;
+		} while (ret != Z_STREAM_END);
+		produced = strm.total_out;
+	}
+
+	if (produced != node->uncompressedSize) {
+		errorCode = ZIP_ERROR_CORRUPT_MEMBER;
+		PRINT_CLASS_ERROR( "the member's size doesn't match the central directory" );
+		goto ExtractNode_cleanup;
+	}
+	if (crc != node->crc32) {
+		errorCode = ZIP_ERROR_CRC_MISMATCH;
+		PRINT_CLASS_ERROR( "the member's CRC-32 doesn't match the central directory" );
+		goto ExtractNode_cleanup;
+	}
+	result = 0;
+
+ExtractNode_cleanup:
+	if (inflating)
+		inflateEnd(&strm);
+	if (output != NULL)
+		delete[](output);
+	if (input != NULL)
+		delete[](input);
+	return result;
+}
+
+/*!	\fn		BuildCheckpoints( int archiveFd, ZIP_FileNode *node )
+	\brief	A private method that inflates a deflated member once, end to end, and attaches checkpoints recorded at the first block boundary after every checkpointSpan bytes of output.  The member's size and CRC-32 are verified on the way, so a corrupt member gets no checkpoints.
+	\param	archiveFd descriptor of the open ZIP archive
+	\param	node pointer to the member's file node
+*/
+
+int32_t IMG3_ZipInterface::BuildCheckpoints(int archiveFd, ZIP_FileNode *node)
+{
+	ZIP_CheckpointIndex *index;
+	ZIP_Checkpoint *point;
+	z_stream strm;
+	bool inflating = false;
+	uint8_t *input = NULL, *window = NULL, *mark, *dest;
+	uint64_t remaining, capacity, totalIn = 0, totalOut = 0, last = 0;
+	uint32_t chunk, crc = 0, left;
+	off_t dataOffset;
+	int ret = Z_OK;
+	int32_t result = -1;
+
+	if (LocateData(archiveFd,node,&dataOffset) != 0)
+		return -1;
+
+	// Checkpoints are at least a span apart, which bounds how many there can be.
+	capacity = node->uncompressedSize / checkpointSpan + 1;
+	index = new ZIP_CheckpointIndex;
+	index->count = 0;
+	index->blockSize = capacity * (sizeof(ZIP_Checkpoint) + ZIP_WINDOW_SIZE);
+	index->block = new uint8_t[index->blockSize];
+	index->points = (ZIP_Checkpoint *)index->block;
+	index->windows = index->block + capacity * sizeof(ZIP_Checkpoint);
+	index->mapped = false;
+
+	memset(&strm,0,sizeof(strm));
+	if (inflateInit2(&strm,-MAX_WBITS) != Z_OK) {
+		errorCode = ENOMEM;
+		PRINT_CLASS_ERROR( "unable to initialize zlib" );
+		goto BuildCheckpoints_cleanup;
+	}
+	inflating = true;
+	input = new uint8_t[ZIP_EXTRACT_CHUNK];
+	window = new uint8_t[ZIP_WINDOW_SIZE];
+	remaining = node->compressedSize;
+
+	// Output cycles through a ring the size of the deflate window, so the window behind any block boundary is at hand.
+	do {
+		if (strm.avail_in == 0 && remaining > 0) {
+			chunk = (remaining < ZIP_EXTRACT_CHUNK) ? remaining : ZIP_EXTRACT_CHUNK;
+			if (ReadArchive(archiveFd,input,chunk,dataOffset) != 0)
+				goto BuildCheckpoints_cleanup;
+			strm.next_in = input;
+			strm.avail_in = chunk;
+			dataOffset += chunk;
+			remaining -= chunk;
+		}
+		if (strm.avail_out == 0) {
+			strm.next_out = window;
+			strm.avail_out = ZIP_WINDOW_SIZE;
+		}
+		mark = strm.next_out;
+		totalIn += strm.avail_in;
+		totalOut += strm.avail_out;
+		ret = inflate(&strm,Z_BLOCK);
+		totalIn -= strm.avail_in;
+		totalOut -= strm.avail_out;
+		if (ret != Z_OK && ret != Z_STREAM_END) {
+			errorCode = ZIP_ERROR_CORRUPT_MEMBER;
+			PRINT_CLASS_ERROR( "the member's deflate stream is corrupt or truncated" );
+			goto BuildCheckpoints_cleanup;
+		}
+		crc = ZipCrc32(crc,mark,strm.next_out - mark);
+
+		// Between two blocks, with no bits of the next one consumed beyond strm.data_type & 7, inflating can be resumed.
+		if (ret == Z_OK && (strm.data_type & 128) && !(strm.data_type & 64) &&
+			totalOut - last >= checkpointSpan && index->count < capacity) {
+			point = &index->points[index->count];
+			memset(point,0,sizeof(ZIP_Checkpoint));
+			point->uncompressedOffset = totalOut;
+			point->compressedOffset = totalIn;
+			point->bits = strm.data_type & 7;
+			left = strm.avail_out;
+			dest = index->windows + (size_t)index->count * ZIP_WINDOW_SIZE;
+			memcpy(dest,window + ZIP_WINDOW_SIZE - left,left);
+			memcpy(dest + left,window,ZIP_WINDOW_SIZE - left);
+			index->count++;
+			last = totalOut;
+		}
+	} while (ret != Z_STREAM_END);
+
+	if (totalOut != node->uncompressedSize) {
+		errorCode = ZIP_ERROR_CORRUPT_MEMBER;
+		PRINT_CLASS_ERROR( "the member's size doesn't match the central directory" );
+		goto BuildCheckpoints_cleanup;
+	}
+	if (crc != node->crc32) {
+		errorCode = ZIP_ERROR_CRC_MISMATCH;
+		PRINT_CLASS_ERROR( "the member's CRC-32 doesn't match the central directory" );
+		goto BuildCheckpoints_cleanup;
+	}
+	node->checkpoints = index;
+	index = NULL;
+	result = 0;
+
+BuildCheckpoints_cleanup:
+	if (inflating)
+		inflateEnd(&strm);
+	if (window != NULL)
+		delete[](window);
+	if (input != NULL)
+		delete[](input);
+	if (index != NULL) {
+		delete[](index->block);
+		delete(index);
+	}
+	return result;
+}
+
+/*!	\fn		InflateRange( int archiveFd, ZIP_FileNode *node, ZIP_Checkpoint *start, const uint8_t *window, uint64_t offset, uint8_t *buffer, size_t length )
+	\brief	A private method that inflates length bytes of a deflated member, starting offset bytes in, into buffer.  Only the output between the starting point and offset is inflated and thrown away.  The range has to lie inside the member; it can't be checked against the member's CRC-32.
+	\param	archiveFd descriptor of the open ZIP archive
+	\param	node pointer to the member's file node
+	\param	start pointer to the checkpoint to resume from, or NULL to start at the beginning of the member
+	\param	window pointer to the ZIP_WINDOW_SIZE bytes of output in front of start
+	\param	offset offset of the range within the member's uncompressed contents
+	\param	buffer pointer to the buffer receiving the range
+	\param	length length of the range in bytes
+*/
+
+int32_t IMG3_ZipInterface::InflateRange(int archiveFd, ZIP_FileNode *node, ZIP_Checkpoint *start, const uint8_t *window, uint64_t offset, uint8_t *buffer, size_t length)
+{
+	z_stream strm;
+	uint8_t *input = NULL, *discard = NULL;
+	uint64_t remaining, skip;
+	uint32_t chunk, available, used;
+	size_t produced = 0, space;
+	off_t dataOffset;
+	uint8_t byte;
+	int ret;
+	int32_t result = -1;
+
+	if (LocateData(archiveFd,node,&dataOffset) != 0)
+		return -1;
+	if (start != NULL && (start->compressedOffset > node->compressedSize || start->bits > 7 ||
+		(start->bits != 0 && start->compressedOffset == 0) || start->uncompressedOffset > offset)) {
+		errorCode = ZIP_ERROR_CORRUPT_MEMBER;
+		PRINT_CLASS_ERROR( "the member's checkpoint lies outside of it" );
+		return -1;
+	}
+
+	memset(&strm,0,sizeof(strm));
+	if (inflateInit2(&strm,-MAX_WBITS) != Z_OK) {
+		errorCode = ENOMEM;
+		PRINT_CLASS_ERROR( "unable to initialize zlib" );
+		return -1;
+	}
+
+	remaining = node->compressedSize;
+	skip = offset;
+	if (start != NULL) {
+		// Resume at the checkpoint: hand back the unread bits of the byte it splits, then the window behind it.
+		chunk = start->compressedOffset - (start->bits ? 1 : 0);
+		dataOffset += chunk;
+		remaining -= chunk;
+		if (start->bits) {
+			if (ReadArchive(archiveFd,&byte,1,dataOffset) != 0)
+				goto InflateRange_cleanup;
+			dataOffset++;
+			remaining--;
+			inflatePrime(&strm,start->bits,byte >> (8 - start->bits));
+		}
+		inflateSetDictionary(&strm,window,ZIP_WINDOW_SIZE);
+		skip = offset - start->uncompressedOffset;
+	}
+	input = new uint8_t[ZIP_EXTRACT_CHUNK];
+	if (skip > 0)
+		discard = new uint8_t[ZIP_WINDOW_SIZE];
+
+	while (produced < length) {
+		if (strm.avail_in == 0 && remaining > 0) {
+			chunk = (remaining < ZIP_EXTRACT_CHUNK) ? remaining : ZIP_EXTRACT_CHUNK;
+			if (ReadArchive(archiveFd,input,chunk,dataOffset) != 0)
+				goto InflateRange_cleanup;
+			strm.next_in = input;
+			strm.avail_in = chunk;
+			dataOffset += chunk;
+			remaining -= chunk;
+		}
+		if (skip > 0) {
+			strm.next_out = discard;
+			strm.avail_out = (skip < ZIP_WINDOW_SIZE) ? (uInt)skip : ZIP_WINDOW_SIZE;
+		} else {
+			space = length - produced;
+			strm.next_out = buffer + produced;
+			strm.avail_out = (space > 0xFFFFFFFF) ? 0xFFFFFFFF : (uInt)space;
+		}
+		available = strm.avail_out;
+		ret = inflate(&strm,Z_NO_FLUSH);
+		used = available - strm.avail_out;
+		if (skip > 0)
+			skip -= used;
+		else
+			produced += used;
+		// The stream may only end once the whole range has come out of it.
+		if ((ret != Z_OK && ret != Z_STREAM_END) || (ret == Z_STREAM_END && produced < length)) {
+			errorCode = ZIP_ERROR_CORRUPT_MEMBER;
+			PRINT_CLASS_ERROR( "the member's deflate stream is corrupt or truncated" );
+			goto InflateRange_cleanup;
+		}
+	}
+	result = 0;
+
+InflateRange_cleanup:
+	inflateEnd(&strm);
+	if (discard != NULL)
+		delete[](discard);
+	if (input != NULL)
+		delete[](input);
+	return result;
+}
+
+/*!	\fn		ExtractNodeToPath( int archiveFd, ZIP_FileNode *node )
+	\brief	A private method that extracts one member to its stored path under the current directory, creating parent directories as needed.
+	\param	archiveFd descriptor of the open ZIP archive
+	\param	node pointer to the member's file node
+*/
+
+int32_t IMG3_ZipInterface::ExtractNodeToPath(int archiveFd, ZIP_FileNode *node)
+{
+	size_t length;
+	int outFd;
+	int32_t result;
+
+	if (node->fileName == NULL || !ZipPathIsSafe(node->fileName)) {
+		errorCode = ZIP_ERROR_UNSAFE_PATH;
+		PRINT_CLASS_ERROR( "refusing to extract a member outside of the current directory" );
+		return -1;
+	}
+	if (ZipCreateParents(node->fileName) != 0) {
+		errorCode = errno;
+		PRINT_SYSTEM_ERROR();
+		return -1;
+	}
+
+	// Directory entries only need their directories created.
+	length = strlen(node->fileName);
+	if (length == 0 || node->fileName[length-1] == '/')
+		return 0;
+
+	outFd = open(node->fileName,O_WRONLY | O_CREAT | O_TRUNC,0644);
+	if (outFd < 0) {
+		errorCode = errno;
+		PRINT_SYSTEM_ERROR();
+		return -1;
+	}
+	result = ExtractNode(archiveFd,node,NULL,0,outFd);
+	if (close(outFd) != 0 && result == 0) {
+		errorCode = errno;
+		PRINT_SYSTEM_ERROR();
+		result = -1;
+	}
+	return result;
+}
+
+/*!	\fn		ZipCompareOffsets( const void *a, const void *b )
+	\brief	A static qsort comparator ordering file nodes by the offset of their local header.
+*/
+
+static int ZipCompareOffsets(const void *a, const void *b)
+{
+	const ZIP_FileNode *left = *(ZIP_FileNode * const *)a;
+	const ZIP_FileNode *right = *(ZIP_FileNode * const *)b;
+
+	if (left->offset < right->offset)
+		return -1;
+	return (left->offset > right->offset) ? 1 : 0;
+}
+
+/*!	\fn		ExtractThread( void *arg )
+	\brief	A private thread routine extracting members until none are left or another thread has failed.
+	\param	arg pointer to the ZIP_ExtractJob structure describing the work
+
+	Members are extracted through an instance of the thread's own that only borrows the archive
+	mapping, so each thread records and reports its errors without touching the shared instance.
+*/
+
+void * IMG3_ZipInterface::ExtractThread(void *arg)
+{
+	ZIP_ExtractJob *job = (ZIP_ExtractJob *)arg;
+	IMG3_ZipInterface worker;
+	uint32_t k;
+
+	worker.archiveMap = job->zip->archiveMap;
+	worker.archiveMapSize = job->zip->archiveMapSize;
+	for ( ; ; ) {
+		k = __sync_fetch_and_add(job->next,1);
+		if (k >= job->count || __atomic_load_n(job->failed,__ATOMIC_RELAXED))
+			break;
+		if (worker.ExtractNodeToPath(job->archiveFd,job->members[k]) != 0) {
+			if (__sync_bool_compare_and_swap(job->failed,0,1))
+				job->error = worker.errorCode;
+			break;
+		}
+	}
+	// The mapping belongs to the shared instance, which unmaps it.
+	worker.archiveMap = NULL;
+	worker.archiveMapSize = 0;
+	return NULL;
+}
+
+/*!	\fn		ExtractMembers( int archiveFd, ZIP_FileNode **members, uint32_t count )
+	\brief	A private method that extracts a set of members to their paths under the current directory.
+	\param	archiveFd descriptor of the open ZIP archive
+	\param	members array of the members to extract; it is sorted by archive offset in place
+	\param	count number of members in the array
+
+	Members are sorted so the archive is read front to back, then handed out in that order to
+	threadCount workers that each read with pread and inflate on their own.  Any members left
+	over because a thread couldn't be started are extracted by the calling thread.  When a
+	member fails, errorCode holds the error of the first member that failed.
+*/
+
+int32_t IMG3_ZipInterface::ExtractMembers(int archiveFd, ZIP_FileNode **members, uint32_t count)
+{
+	ZIP_ExtractJob jobs[ ZIP_MAX_THREADS ];
+	pthread_t threads[ ZIP_MAX_THREADS ];
+	uint32_t i, started = 0, next = 0;
+	int32_t failed = 0;
+
+	qsort(members,count,sizeof(ZIP_FileNode *),ZipCompareOffsets);
+
+	// Map the archive up front so stored members can be copied without staging them; extraction works without it.
+	MapArchive(archiveFd);
+
+	if (threadCount > 1 && count > 1) {
+		for (started = 0; started < threadCount && started < count; started++) {
+			jobs[started].zip = this;
+			jobs[started].archiveFd = archiveFd;
+			jobs[started].members = members;
+			jobs[started].count = count;
+			jobs[started].next = &next;
+			jobs[started].failed = &failed;
+			jobs[started].error = ZIP_ERROR_NONE;
+			if (pthread_create(&threads[started],NULL,ExtractThread,&jobs[started]) != 0)
+				break;
+		}
+		for (i = 0; i < started; i++)
+			pthread_join(threads[i],NULL);
+		if (failed) {
+			for (i = 0; i < started; i++) {
+				if (jobs[i].error != ZIP_ERROR_NONE)
+					errorCode = jobs[i].error;
+			}
+			return -1;
+		}
+	}
+
+	for (i = next; i < count; i++) {
+		if (ExtractNodeToPath(archiveFd,members[i]) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*!	\fn		ExtractFiles( const char *archiveName, char *section )
+	\brief	A public method used to extract all files from a ZIP archive whose name includes the section string provided
+	\param	archiveName	pointer to a string buffer containing the name of the ZIP archive
+	\param 	section pointer to a string buffer containing the section name to use as a filter
+*/
+
+list<char *> * IMG3_ZipInterface::ExtractFiles(const char *archiveName, char *section)
+{
+	ZIP_FileNode **members;
+	uint32_t count;
+	int archiveFd;
+
+	errorCode = ZIP_ERROR_NONE;
+
+	CLASS_VALIDATE_PARAMETER( section, NULL );
+	CLASS_VALIDATE_PARAMETER( archiveName, NULL );
+
+	archiveFd = OpenArchive(archiveName);
+	if (archiveFd < 0)
+		return NULL;
+
+	// Next, we need to figure out what file they actually want extracted.
+	members = new ZIP_FileNode *[nodeCount + 1];
+	count = SelectSection(section,members);
+	return ExtractSelection(archiveFd,archiveName,members,count);
+}
+
+/*!	\fn		ExtractFiles( const char *archiveName, IMG3_ZipSelector *selector, const char *section )
+	\brief	A public method used to extract every file from a ZIP archive that the selector and section select, in a single pass over the members
+	\param	archiveName	pointer to a string buffer containing the name of the ZIP archive
+	\param 	selector pointer to the selector holding the compiled include and exclude patterns
+	\param	section pointer to a section name selecting members as ExtractFiles( archiveName, section ) does, or NULL
+*/
+
+list<char *> * IMG3_ZipInterface::ExtractFiles(const char *archiveName, IMG3_ZipSelector *selector, const char *section)
+{
+	ZIP_FileNode **members;
+	uint32_t count;
+	int archiveFd;
+
+	errorCode = ZIP_ERROR_NONE;
+
+	CLASS_VALIDATE_PARAMETER( selector, NULL );
+	CLASS_VALIDATE_PARAMETER( archiveName, NULL );
+
+	archiveFd = OpenArchive(archiveName);
+	if (archiveFd < 0)
+		return NULL;
+
+	members = new ZIP_FileNode *[nodeCount + 1];
+	count = SelectMembers(selector,section,members);
+	return ExtractSelection(archiveFd,archiveName,members,count);
+}
+
+/*!	\fn		ExtractSelection( int archiveFd, const char *archiveName, ZIP_FileNode **members, uint32_t count )
+	\brief	A private method that extracts the selected members, then returns a list of their names.  It takes ownership of members and closes archiveFd.
+	\param	archiveFd descriptor of the open ZIP archive
+	\param	archiveName pointer to a string buffer containing the name of the ZIP archive
+	\param	members array of the selected members, allocated with new[]
+	\param	count number of members in the array
+*/
+
+list<char *> * IMG3_ZipInterface::ExtractSelection(int archiveFd, const char *archiveName, ZIP_FileNode **members, uint32_t count)
+{
+	list<char *>::iterator fileIt;
+	list<char *> *matchingFiles;
+	uint32_t i;
+
+	matchingFiles = new list <char *>;
+	for (i = 0; i < count; i++)
+		matchingFiles->push_back(members[i]->fileName);
+
+	// Extract every match, several at once when more than one thread is selected.
+	if (ExtractMembers(archiveFd,members,count) != 0) {
+		delete[](members);
+		delete(matchingFiles);
+		close(archiveFd);
+		return NULL;
+	}
+	delete[](members);
+	close(archiveFd);
+
+	for (fileIt = matchingFiles->begin(); fileIt != matchingFiles->end(); ++fileIt)
+		fprintf(stdout,"Successfully extracted the file %s from the archive %s.\n", *fileIt, archiveName);
+
+	// Return a list of all files extracted from the ZIP archive provided.
+	return matchingFiles;
+}
+
+/*!	\fn		MatchFiles( const char *section )
+	\brief	A public method returning the names of all analyzed members whose name includes the section string, using the same rule as ExtractFiles.  Nothing is extracted; the caller deletes the returned list, but not the names in it.
+	\param	section pointer to a string buffer containing the section name to use as a filter
+*/
+
+list<char *> * IMG3_ZipInterface::MatchFiles(const char *section)
+{
+	list<char *> *matchingFiles;
+	ZIP_FileNode **members;
+	uint32_t count, i;
+
+	errorCode = ZIP_ERROR_NONE;
+
+	CLASS_VALIDATE_PARAMETER( section, NULL );
+
+	matchingFiles = new list <char *>;
+	members = new ZIP_FileNode *[nodeCount + 1];
+	count = SelectSection(section,members);
+	for (i = 0; i < count; i++)
+		matchingFiles->push_back(members[i]->fileName);
+	delete[](members);
+	return matchingFiles;
+}
+
+/*!	\fn		MatchFiles( IMG3_ZipSelector *selector, const char *section )
+	\brief	A public method returning the names of all analyzed members the selector and section select, in archive order.  Nothing is extracted; the caller deletes the returned list, but not the names in it.
+	\param	selector pointer to the selector holding the compiled include and exclude patterns
+	\param	section pointer to a section name selecting members as MatchFiles( section ) does, or NULL
+*/
+
+list<char *> * IMG3_ZipInterface::MatchFiles(IMG3_ZipSelector *selector, const char *section)
+{
+	list<char *> *matchingFiles;
+	ZIP_FileNode **members;
+	uint32_t count, i;
+
+	errorCode = ZIP_ERROR_NONE;
+
+	CLASS_VALIDATE_PARAMETER( selector, NULL );
+
+	matchingFiles = new list <char *>;
+	members = new ZIP_FileNode *[nodeCount + 1];
+	count = SelectMembers(selector,section,members);
+	for (i = 0; i < count; i++)
+		matchingFiles->push_back(members[i]->fileName);
+	delete[](members);
+	return matchingFiles;
+}
+
+/*!	\fn		SelectMembers( IMG3_ZipSelector *selector, const char *section, ZIP_FileNode **selected )
+	\brief	A private method that stores every member the selector and section select in selected, in archive order, and returns how many there are.  Each name is tested once against all of the selector's patterns.
+	\param	selector pointer to the selector holding the compiled include and exclude patterns
+	\param	section pointer to a section name, or NULL
+	\param	selected array of at least nodeCount entries receiving the members
+
+	A section selects exactly what SelectSection does, and the include patterns add to it rather
+	than narrowing it; without a section, a selector with no include patterns selects every member.
+	Exclude patterns then remove members whatever selected them.
+*/
+
+uint32_t IMG3_ZipInterface::SelectMembers(IMG3_ZipSelector *selector, const char *section, ZIP_FileNode **selected)
+{
+	uint8_t *inSection = NULL;
+	uint32_t index, count = 0;
+	bool picked;
+
+	if (section != NULL) {
+		inSection = new uint8_t[nodeCount + 1];
+		memset(inSection,0,nodeCount + 1);
+		count = SelectSection(section,selected);
+		for (index = 0; index < count; index++)
+			inSection[selected[index] - nodes] = 1;
+		count = 0;
+	}
+
+	for (index = 0; index < nodeCount; index++) {
+		if (inSection != NULL)
+			picked = inSection[index] || (selector->HasIncludes() && selector->Included(nodes[index].fileName));
+		else
+			picked = selector->Included(nodes[index].fileName);
+		if (picked && !selector->Excluded(nodes[index].fileName))
+			selected[count++] = &nodes[index];
+	}
+	if (inSection != NULL)
+		delete[](inSection);
+	return count;
+}
+
+/*!	\fn		FindSection( const char *section )
+	\brief	A private method returning the index of the first member whose section stem equals section, ignoring case, or ZIP_NO_NODE.  The rest follow through nextInSection.
+	\param	section pointer to the section name
+*/
+
+uint32_t IMG3_ZipInterface::FindSection(const char *section)
+{
+	const char *stem;
+	size_t length, sectionLength = strlen(section);
+	uint32_t slot;
+
+	if (nodeCount == 0 || sectionLength == 0)
+		return ZIP_NO_NODE;
+	for (slot = ZipHashName(section,sectionLength) & slotMask; sectionSlots[slot] != 0; slot = (slot + 1) & slotMask) {
+		stem = ZipSectionStem(nodes[sectionSlots[slot] - 1].fileName,&length);
+		if (length == sectionLength && strncasecmp(stem,section,length) == 0)
+			return sectionSlots[slot] - 1;
+	}
+	return ZIP_NO_NODE;
+}
+
+/*!	\fn		SelectSection( const char *section, ZIP_FileNode **selected )
+	\brief	A private method that stores the members a section string selects in selected, in archive order, and returns how many there are.  When section is the stem of some member, such as "kernelcache" or "iBSS", those members are found through the section index; otherwise every member whose name includes section is selected.
+	\param	section pointer to the section name
+	\param	selected array of at least nodeCount entries receiving the members
+*/
+
+uint32_t IMG3_ZipInterface::SelectSection(const char *section, ZIP_FileNode **selected)
+{
+	uint32_t index, count = 0;
+
+	for (index = FindSection(section); index != ZIP_NO_NODE; index = nodes[index].nextInSection)
+		selected[count++] = &nodes[index];
+	if (count != 0)
+		return count;
+
+	for (index = 0; index < nodeCount; index++) {
+		if (nodes[index].fileName != NULL && strcasestr(nodes[index].fileName,section) != NULL)
+			selected[count++] = &nodes[index];
+	}
+	return count;
+}
+
+/*!	\fn		ExtractAllFiles( const char *archiveName )
+	\brief	A public method used to extract all the files contained within the ZIP archive specified.
+	\param	archiveName pointer to a string buffer containing the name of the ZIP archive
+*/
+
+int32_t IMG3_ZipInterface::ExtractAllFiles(const char *archiveName)
+{
+	ZIP_FileNode **members;
+	uint32_t count = 0;
+	int archiveFd;
+	int32_t result;
+
+	errorCode = ZIP_ERROR_NONE;
+
+	CLASS_VALIDATE_PARAMETER( archiveName, -1 );
+
+	archiveFd = OpenArchive(archiveName);
+	if (archiveFd < 0)
+		return -1;
+
+	// Extract every member to its path under the current directory.
+	members = new ZIP_FileNode *[nodeCount + 1];
+	for (count = 0; count < nodeCount; count++)
+		members[count] = &nodes[count];
+	result = ExtractMembers(archiveFd,members,count);
+	delete[](members);
+	close(archiveFd);
+	if (result != 0)
+		return -1;
+
+	fprintf(stdout,"Successfully unzipped the archive %s.\n", archiveName);
+	return 0;
+}
+
+/*!	\fn		ExtractFile( const char *archiveName, const char *fileName, uint8_t *outbuff, size_t outsize, size_t *written )
+	\brief	A public method used to extract a single member into a caller-supplied buffer.
+	\param	archiveName pointer to a string buffer containing the name of the ZIP archive
+	\param	fileName pointer to the exact name of the member to extract
+	\param	outbuff pointer to the buffer receiving the member's contents
+	\param	outsize size of outbuff in bytes; must be at least the member's uncompressed size
+	\param	written pointer to the variable receiving the number of bytes extracted
+*/
+
+int32_t IMG3_ZipInterface::ExtractFile(const char *archiveName, const char *fileName, uint8_t *outbuff, size_t outsize, size_t *written)
+{
+	ZIP_FileNode *node;
+	int archiveFd;
+	int32_t result;
+
+	errorCode = ZIP_ERROR_NONE;
+
+	CLASS_VALIDATE_PARAMETER( archiveName, -1 );
+	CLASS_VALIDATE_PARAMETER( fileName, -1 );
+	CLASS_VALIDATE_PARAMETER( outbuff, -1 );
+	CLASS_VALIDATE_PARAMETER( written, -1 );
+
+	*written = 0;
+	archiveFd = OpenArchive(archiveName);
+	if (archiveFd < 0)
+		return -1;
+
+	node = FindNode(fileName);
+	result = (node != NULL) ? ExtractNode(archiveFd,node,outbuff,outsize,-1) : -1;
+	close(archiveFd);
+	if (result == 0)
+		*written = node->uncompressedSize;
+	return result;
+}
+
+/*!	\fn		ExtractFile( const char *archiveName, const char *fileName, int outFd )
+	\brief	A public method used to extract a single member into an open file descriptor, starting at its current position.
+	\param	archiveName pointer to a string buffer containing the name of the ZIP archive
+	\param	fileName pointer to the exact name of the member to extract
+	\param	outFd descriptor receiving the member's contents
+*/
+
+int32_t IMG3_ZipInterface::ExtractFile(const char *archiveName, const char *fileName, int outFd)
+{
+	ZIP_FileNode *node;
+	int archiveFd;
+	int32_t result;
+
+	errorCode = ZIP_ERROR_NONE;
+
+	CLASS_VALIDATE_PARAMETER( archiveName, -1 );
+	CLASS_VALIDATE_PARAMETER( fileName, -1 );
+
+	if (outFd < 0) {
+		errorCode = IMG3_ERROR_INVALID_PARAMETER;
+		PRINT_CLASS_ERROR( "invalid output descriptor" );
+		return -1;
+	}
+
+	archiveFd = OpenArchive(archiveName);
+	if (archiveFd < 0)
+		return -1;
+
+	MapArchive(archiveFd);
+	node = FindNode(fileName);
+	result = (node != NULL) ? ExtractNode(archiveFd,node,NULL,0,outFd) : -1;
+	close(archiveFd);
+	return result;
+}
+
+/*!	\fn		ReadFileRange( const char *archiveName, const char *fileName, uint64_t offset, uint8_t *buffer, size_t length, size_t *bytesRead )
+	\brief	A public method reading part of a member without extracting the rest of it.  Stored members are read in place.  Deflated members are inflated from the nearest checkpoint in front of offset, so a read costs at most about one checkpoint span of inflating.  The checkpoints are built the first time a range past the first span is read, by inflating the member once, and kept in a sidecar next to the index sidecar when index caching is enabled.  Ranges running past the end of the member are cut short, and partial reads can't be checked against the member's CRC-32.
+	\param	archiveName pointer to a string buffer containing the name of the ZIP archive
+	\param	fileName pointer to the exact name of the member to read
+	\param	offset offset of the range within the member's uncompressed contents
+	\param	buffer pointer to the buffer receiving the range
+	\param	length length of the range in bytes
+	\param	bytesRead pointer to the variable receiving the number of bytes read
+*/
+
+int32_t IMG3_ZipInterface::ReadFileRange(const char *archiveName, const char *fileName, uint64_t offset, uint8_t *buffer, size_t length, size_t *bytesRead)
+{
+	ZIP_FileNode *node;
+	ZIP_CheckpointIndex *index;
+	ZIP_Checkpoint *start = NULL;
+	const uint8_t *window = NULL;
+	uint32_t low, high, middle;
+	off_t dataOffset;
+	int archiveFd;
+	int32_t result = -1;
+
+	errorCode = ZIP_ERROR_NONE;
+
+	CLASS_VALIDATE_PARAMETER( archiveName, -1 );
+	CLASS_VALIDATE_PARAMETER( fileName, -1 );
+	CLASS_VALIDATE_PARAMETER( buffer, -1 );
+	CLASS_VALIDATE_PARAMETER( bytesRead, -1 );
+
+	*bytesRead = 0;
+	archiveFd = OpenArchive(archiveName);
+	if (archiveFd < 0)
+		return -1;
+
+	node = FindNode(fileName);
+	if (node == NULL)
+		goto ReadFileRange_close;
+	if (node->flags & ZIP_FLAG_ENCRYPTED) {
+		errorCode = ZIP_ERROR_UNSUPPORTED_METHOD;
+		PRINT_CLASS_ERROR( "encrypted members are not supported" );
+		goto ReadFileRange_close;
+	}
+	if (node->compressionMethod != ZIP_METHOD_STORED && node->compressionMethod != ZIP_METHOD_DEFLATED) {
+		errorCode = ZIP_ERROR_UNSUPPORTED_METHOD;
+		PRINT_CLASS_ERROR( "only stored and deflated members are supported" );
+		goto ReadFileRange_close;
+	}
+	if (offset >= node->uncompressedSize || length == 0) {
+		result = 0;
+		goto ReadFileRange_close;
+	}
+	if (length > node->uncompressedSize - offset)
+		length = node->uncompressedSize - offset;
+
+	if (node->compressionMethod == ZIP_METHOD_STORED) {
+		if (LocateData(archiveFd,node,&dataOffset) != 0)
+			goto ReadFileRange_close;
+		result = ReadArchive(archiveFd,buffer,length,dataOffset + offset);
+	} else {
+		// Ranges inside the first span are quicker to reach from the start, so only later ones need checkpoints.
+		if (node->checkpoints == NULL && offset >= checkpointSpan &&
+			!(indexCacheEnabled && LoadCheckpoints(archiveName,archiveFd,node) == 0)) {
+			if (BuildCheckpoints(archiveFd,node) != 0)
+				goto ReadFileRange_close;
+			if (indexCacheEnabled)
+				SaveCheckpoints(archiveName,archiveFd,node);
+		}
+
+		// Resume from the last checkpoint at or before offset, if there is one.
+		index = node->checkpoints;
+		if (index != NULL && index->count > 0 && index->points[0].uncompressedOffset <= offset) {
+			low = 0;
+			high = index->count - 1;
+			while (low < high) {
+				middle = low + (high - low + 1) / 2;
+				if (index->points[middle].uncompressedOffset <= offset)
+					low = middle;
+				else
+					high = middle - 1;
+			}
+			start = &index->points[low];
+			window = index->windows + (size_t)low * ZIP_WINDOW_SIZE;
+		}
+		result = InflateRange(archiveFd,node,start,window,offset,buffer,length);
+	}
+	if (result == 0)
+		*bytesRead = length;
+
+ReadFileRange_close:
+	close(archiveFd);
+	return result;
+}
+
+/*!	\fn		SetCheckpointSpan( uint32_t span )
+	\brief	A public method for selecting how many bytes of output lie between the inflate checkpoints ReadFileRange records.  Smaller spans make reads cheaper and checkpoints bigger; each one holds a 32 KB window.  Sidecars already written keep their own span.
+	\param	span output bytes between checkpoints; raised to ZIP_WINDOW_SIZE if smaller
+*/
+
+int32_t IMG3_ZipInterface::SetCheckpointSpan(uint32_t span)
+{
+	if (span < ZIP_WINDOW_SIZE)
+		span = ZIP_WINDOW_SIZE;
+	checkpointSpan = span;
+	return 0;
+}
+
+/*!	\fn		SetIndexCache( uint8_t enabled, const char *directory )
+	\brief	A public method for caching each analyzed archive's central directory in an index sidecar.  Later AnalyzeFile calls on an unchanged archive load the sidecar instead of scanning the archive.
+	\param	enabled nonzero to read and write sidecars, zero to ignore them
+	\param	directory directory holding the sidecars, or NULL to keep each one next to its archive
+*/
+
+int32_t IMG3_ZipInterface::SetIndexCache(uint8_t enabled, const char *directory)
+{
+	if (indexCacheDirectory != NULL)
+		delete[](indexCacheDirectory);
+	indexCacheDirectory = NULL;
+	if (directory != NULL) {
+		indexCacheDirectory = new char[strlen(directory)+1];
+		strcpy(indexCacheDirectory,directory);
+	}
+	indexCacheEnabled = enabled;
+	return 0;
+}
+
+/*!	\fn		SetThreadCount( uint32_t threads )
+	\brief	A public method for selecting the number of threads ExtractFiles and ExtractAllFiles use.
+	\param	threads number of worker threads; zero selects one per online processor
+*/
+
+int32_t IMG3_ZipInterface::SetThreadCount(uint32_t threads)
+{
+	long online;
+
+	if (threads == 0) {
+		online = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (online > 0) ? (uint32_t)online : 1;
+	}
+	if (threads > ZIP_MAX_THREADS)
+		threads = ZIP_MAX_THREADS;
+	threadCount = threads;
+	return 0;
+}
+
+/*!	\fn		MapFile( const char *archiveName, const char *fileName, const uint8_t **data, size_t *length )
+	\brief	A public method returning a read-only view of a stored member straight out of a mapping of the archive.  Nothing is copied or checksummed; the view stays valid until the next AnalyzeFile call or until the instance is destroyed.
+	\param	archiveName pointer to a string buffer containing the name of the ZIP archive
+	\param	fileName pointer to the exact name of the member to map
+	\param	data pointer to the variable receiving the start of the member's contents
+	\param	length pointer to the variable receiving the member's length
+*/
+
+int32_t IMG3_ZipInterface::MapFile(const char *archiveName, const char *fileName, const uint8_t **data, size_t *length)
+{
+	ZIP_FileNode *node;
+	off_t dataOffset;
+	int archiveFd;
+	int32_t result = -1;
+
+	errorCode = ZIP_ERROR_NONE;
+
+	CLASS_VALIDATE_PARAMETER( archiveName, -1 );
+	CLASS_VALIDATE_PARAMETER( fileName, -1 );
+	CLASS_VALIDATE_PARAMETER( data, -1 );
+	CLASS_VALIDATE_PARAMETER( length, -1 );
+
+	archiveFd = OpenArchive(archiveName);
+	if (archiveFd < 0)
+		return -1;
+
+	node = FindNode(fileName);
+	if (node == NULL)
+		goto MapFile_close;
+	if (node->compressionMethod != ZIP_METHOD_STORED || (node->flags & ZIP_FLAG_ENCRYPTED) || node->compressedSize != node->uncompressedSize) {
+		errorCode = ZIP_ERROR_NOT_STORED;
+		PRINT_CLASS_ERROR( "only unencrypted stored members can be mapped" );
+		goto MapFile_close;
+	}
+	if (MapArchive(archiveFd) != 0) {
+		errorCode = errno;
+		PRINT_SYSTEM_ERROR();
+		goto MapFile_close;
+	}
+	if (LocateData(archiveFd,node,&dataOffset) != 0)
+		goto MapFile_close;
+	if ((uint64_t)dataOffset + node->uncompressedSize > archiveMapSize) {
+		errorCode = ZIP_ERROR_CORRUPT_MEMBER;
+		PRINT_CLASS_ERROR( "the archive ends in the middle of a member" );
+		goto MapFile_close;
+	}
+
+	*data = archiveMap + dataOffset;
+	*length = node->uncompressedSize;
+	result = 0;
+
+MapFile_close:
+	close(archiveFd);
+	return result;
+}
+
+/*!	\fn		ExtractFileToMemory( const char *archiveName, const char *fileName, uint8_t **data, size_t *length, size_t *mapSize )
+	\brief	A public method used to extract a single member into a private, writable anonymous mapping, so it can be handed straight to IMG3_FileInterface::ParseFile without going through a file.  The mapping is zero-filled past the member for at least ZIP_MEMORY_SLACK bytes, and is released with ReleaseFileMemory.
+	\param	archiveName pointer to a string buffer containing the name of the ZIP archive
+	\param	fileName pointer to the exact name of the member to extract
+	\param	data pointer to the variable receiving the start of the mapping
+	\param	length pointer to the variable receiving the member's length
+	\param	mapSize pointer to the variable receiving the length of the mapping
+*/
+
+int32_t IMG3_ZipInterface::ExtractFileToMemory(const char *archiveName, const char *fileName, uint8_t **data, size_t *length, size_t *mapSize)
+{
+	ZIP_FileNode *node;
+	size_t pageSize, size;
+	void *map;
+	int archiveFd;
+	int32_t result = -1;
+
+	errorCode = ZIP_ERROR_NONE;
+
+	CLASS_VALIDATE_PARAMETER( archiveName, -1 );
+	CLASS_VALIDATE_PARAMETER( fileName, -1 );
+	CLASS_VALIDATE_PARAMETER( data, -1 );
+	CLASS_VALIDATE_PARAMETER( length, -1 );
+	CLASS_VALIDATE_PARAMETER( mapSize, -1 );
+
+	*data = NULL;
+	*length = *mapSize = 0;
+	archiveFd = OpenArchive(archiveName);
+	if (archiveFd < 0)
+		return -1;
+
+	node = FindNode(fileName);
+	if (node == NULL)
+		goto ExtractFileToMemory_close;
+
+	pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	size = (((size_t)node->uncompressedSize + ZIP_MEMORY_SLACK + pageSize - 1) / pageSize) * pageSize;
+	map = mmap(NULL,size,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+	if (map == MAP_FAILED) {
+		errorCode = errno;
+		PRINT_SYSTEM_ERROR();
+		goto ExtractFileToMemory_close;
+	}
+	if (ExtractNode(archiveFd,node,(uint8_t *)map,size,-1) != 0) {
+		munmap(map,size);
+		goto ExtractFileToMemory_close;
+	}
+
+	*data = (uint8_t *)map;
+	*length = node->uncompressedSize;
+	*mapSize = size;
+	result = 0;
+
+ExtractFileToMemory_close:
+	close(archiveFd);
+	return result;
+}
+
+/*!	\fn		ReleaseFileMemory( uint8_t *data, size_t mapSize )
+	\brief	A public method releasing a mapping returned by ExtractFileToMemory.
+	\param	data pointer to the start of the mapping; NULL is ignored
+	\param	mapSize length of the mapping
+*/
+
+void IMG3_ZipInterface::ReleaseFileMemory(uint8_t *data, size_t mapSize)
+{
+	if (data != NULL && mapSize != 0)
+		munmap(data,mapSize);
+}
+
+/*!	\fn		ReadCentralDirectory( int archiveFd, ZIP_CentralDirectoryEnd *end, ZIP64_CentralDirectoryEnd *end64, uint8_t **comment )
+	\brief	A private method that rereads the analyzed archive's central directory end structures, archive comment and raw central directory, which the caller deletes.  The nodes don't keep everything a central directory header holds, such as times, attributes and extra fields, so a rewrite starts from the original records.
+	\param	archiveFd descriptor of the open ZIP archive
+	\param	end pointer to the structure receiving the central directory end, without its comment
+	\param	end64 pointer to the structure receiving the central directory's location
+	\param	comment pointer to the variable receiving the archive comment, or NULL when there is none
+*/
+
+uint8_t * IMG3_ZipInterface::ReadCentralDirectory(int archiveFd, ZIP_CentralDirectoryEnd *end, ZIP64_CentralDirectoryEnd *end64, uint8_t **comment)
+{
+	size_t fixedSize = sizeof(ZIP_CentralDirectoryEnd) - CENTRAL_DIRECTORY_END_EXTRA;
+	uint8_t *records;
+
+	*comment = NULL;
+	memset(end,0,sizeof(ZIP_CentralDirectoryEnd));
+	if (ReadArchive(archiveFd,(uint8_t *)end,fixedSize,endOffset) != 0)
+		return NULL;
+	end->comment = NULL;
+	if (end->sig != CENTRAL_DIRECTORY_END_MARKER) {
+		errorCode = ZIP_ERROR_NO_CENTRAL_DIRECTORY_FOUND;
+		PRINT_CLASS_ERROR( "the archive changed after it was analyzed" );
+		return NULL;
+	}
+	if (FindZip64End(archiveFd,end,end64) != 0)
+		return NULL;
+	if (end64->centralDirectoryTotalNum != nodeCount) {
+		errorCode = ZIP_ERROR_MALFORMED_LIST;
+		PRINT_CLASS_ERROR( "the central directory doesn't hold the analyzed members" );
+		return NULL;
+	}
+
+	if (end->commentLength != 0) {
+		*comment = new uint8_t[end->commentLength];
+		if (ReadArchive(archiveFd,*comment,end->commentLength,endOffset + fixedSize) != 0) {
+			delete[](*comment);
+			*comment = NULL;
+			return NULL;
+		}
+	}
+	records = new uint8_t[end64->centralDirectorySize + 1];
+	if (ReadArchive(archiveFd,records,end64->centralDirectorySize,end64->centralDirectoryOffset) != 0) {
+		delete[](records);
+		if (*comment != NULL)
+			delete[](*comment);
+		*comment = NULL;
+		return NULL;
+	}
+	return records;
+}
+
+/*!	\fn		CompressReplacement( ZIP_Replacement *replacement, ZIP_RewriteEntry *entry )
+	\brief	A private method that takes a member's new contents and their CRC-32 into its rewrite entry.  A stored member stays stored and is written straight from the caller's buffer; any other member is deflated.
+	\param	replacement pointer to the member's new contents
+	\param	entry pointer to the member's rewrite entry
+*/
+
+int32_t IMG3_ZipInterface::CompressReplacement(ZIP_Replacement *replacement, ZIP_RewriteEntry *entry)
+{
+	z_stream strm;
+	const uint8_t *input = replacement->data;
+	size_t remaining = replacement->length, space;
+	uLong bound;
+	uint32_t chunk;
+	int ret;
+
+	entry->replaced = true;
+	entry->uncompressedSize = replacement->length;
+	entry->crc32 = ZipCrc32(0,replacement->data,replacement->length);
+	if (entry->node->compressionMethod == ZIP_METHOD_STORED) {
+		entry->compressionMethod = ZIP_METHOD_STORED;
+		entry->compressedSize = replacement->length;
+		entry->data = replacement->data;
+		return 0;
+	}
+
+	memset(&strm,0,sizeof(strm));
+	if (deflateInit2(&strm,Z_DEFAULT_COMPRESSION,Z_DEFLATED,-MAX_WBITS,8,Z_DEFAULT_STRATEGY) != Z_OK) {
+		errorCode = ENOMEM;
+		PRINT_CLASS_ERROR( "unable to initialize zlib" );
+		return -1;
+	}
+	bound = deflateBound(&strm,replacement->length);
+	entry->buffer = new uint8_t[bound];
+	strm.next_out = entry->buffer;
+
+	// zlib counts in 32 bits, so contents past 4 GB are fed to it and taken from it a window at a time.
+	do {
+		if (strm.avail_in == 0 && remaining > 0) {
+			chunk = (remaining < 0x40000000) ? (uint32_t)remaining : 0x40000000;
+			strm.next_in = (Bytef *)input;
+			strm.avail_in = chunk;
+			input += chunk;
+			remaining -= chunk;
+		}
+		space = bound - (size_t)(strm.next_out - entry->buffer);
+		strm.avail_out = (space < 0x40000000) ? (uInt)space : 0x40000000;
+		ret = deflate(&strm,(remaining == 0) ? Z_FINISH : Z_NO_FLUSH);
+		if (ret == Z_STREAM_ERROR || (ret == Z_BUF_ERROR && strm.avail_out == 0)) {
+			deflateEnd(&strm);
+			errorCode = ZIP_ERROR_CORRUPT_MEMBER;
+			PRINT_CLASS_ERROR( "unable to compress the replacement contents" );
+			return -1;
+		}
+	} while (ret != Z_STREAM_END);
+
+	entry->compressedSize = (uint64_t)(strm.next_out - entry->buffer);
+	entry->compressionMethod = ZIP_METHOD_DEFLATED;
+	entry->data = entry->buffer;
+	deflateEnd(&strm);
+	return 0;
+}
+
+/*!	\fn		WriteLocalHeader( int outFd, ZIP_RewriteEntry *entry )
+	\brief	A private method that writes a fresh local header for a member at the current position of outFd.  The CRC-32 and sizes are always filled in, so no data descriptor follows the member, and a ZIP64 extra field is added only when a size needs one.
+	\param	outFd descriptor of the archive being written
+	\param	entry pointer to the member's rewrite entry
+*/
+
+int32_t IMG3_ZipInterface::WriteLocalHeader(int outFd, ZIP_RewriteEntry *entry)
+{
+	ZIP_CentralDirectoryHeader dirHeader;
+	ZIP_LocalHeader local;
+	size_t fixedSize = sizeof(ZIP_CentralDirectoryHeader) - CENTRAL_DIRECTORY_HEADER_EXTRA, length;
+	uint16_t tag = ZIP64_EXTRA_TAG, size = 2*sizeof(uint64_t);
+	uint8_t *header;
+	bool zip64;
+	int32_t result;
+
+	memcpy(&dirHeader,entry->record,fixedSize);
+	zip64 = (entry->compressedSize >= ZIP64_SENTINEL_32 || entry->uncompressedSize >= ZIP64_SENTINEL_32);
+
+	memset(&local,0,sizeof(local));
+	local.sig = LOCAL_FILE_HEADER_MARKER;
+	local.versionNeeded = dirHeader.versionNeeded;
+	local.flags = dirHeader.flags & ~ZIP_FLAG_DATA_DESCRIPTOR;
+	local.compressionMethod = entry->compressionMethod;
+	local.lastModTime = dirHeader.lastModTime;
+	local.lastModDate = dirHeader.lastModDate;
+	local.crc32 = entry->crc32;
+	local.compressedSize = zip64 ? ZIP64_SENTINEL_32 : (uint32_t)entry->compressedSize;
+	local.uncompressedSize = zip64 ? ZIP64_SENTINEL_32 : (uint32_t)entry->uncompressedSize;
+	local.fileNameLength = dirHeader.fileNameLength;
+	local.extraFieldLength = zip64 ? 2*sizeof(uint16_t) + size : 0;
+	if (zip64 && local.versionNeeded < ZIP64_VERSION_NEEDED)
+		local.versionNeeded = ZIP64_VERSION_NEEDED;
+
+	header = new uint8_t[ZIP_LOCAL_HEADER_SIZE + local.fileNameLength + local.extraFieldLength];
+	memcpy(header,&local,ZIP_LOCAL_HEADER_SIZE);
+	memcpy(header + ZIP_LOCAL_HEADER_SIZE,entry->record + fixedSize,local.fileNameLength);
+	length = ZIP_LOCAL_HEADER_SIZE + local.fileNameLength;
+	if (zip64) {
+		// A local ZIP64 field always holds both sizes, uncompressed first.
+		memcpy(header + length,&tag,sizeof(tag));
+		memcpy(header + length + 2,&size,sizeof(size));
+		memcpy(header + length + 4,&entry->uncompressedSize,sizeof(uint64_t));
+		memcpy(header + length + 12,&entry->compressedSize,sizeof(uint64_t));
+		length += local.extraFieldLength;
+	}
+	result = WriteOutput(outFd,header,length);
+	delete[](header);
+	return result;
+}
+
+/*!	\fn		BuildCentralHeader( uint8_t *out, ZIP_RewriteEntry *entry )
+	\brief	A private method that regenerates a member's central directory header into out and returns its length, or zero when it can't be built.  Everything but the method, CRC-32, sizes and offset is kept from the original header; its ZIP64 extra field is replaced by one holding whichever values now need it.
+	\param	out pointer to a buffer with room for the original header plus ZIP64_EXTRA_MAX_SIZE bytes
+	\param	entry pointer to the member's rewrite entry
+*/
+
+size_t IMG3_ZipInterface::BuildCentralHeader(uint8_t *out, ZIP_RewriteEntry *entry)
+{
+	ZIP_CentralDirectoryHeader dirHeader;
+	size_t fixedSize = sizeof(ZIP_CentralDirectoryHeader) - CENTRAL_DIRECTORY_HEADER_EXTRA, length;
+	const uint8_t *name, *field, *limit;
+	uint16_t tag, size;
+	uint8_t *extra, *data;
+
+	memcpy(&dirHeader,entry->record,fixedSize);
+	name = entry->record + fixedSize;
+	field = name + dirHeader.fileNameLength;
+	limit = field + dirHeader.extraFieldLength;
+
+	memcpy(out + fixedSize,name,dirHeader.fileNameLength);
+	extra = out + fixedSize + dirHeader.fileNameLength;
+	length = 0;
+
+	// Keep every extra field but the old ZIP64 one.
+	while (field + 2*sizeof(uint16_t) <= limit) {
+		memcpy(&tag,field,sizeof(tag));
+		memcpy(&size,field+sizeof(tag),sizeof(size));
+		if (field + 2*sizeof(uint16_t) + size > limit)
+			break;
+		if (tag != ZIP64_EXTRA_TAG) {
+			memcpy(extra + length,field,2*sizeof(uint16_t) + size);
+			length += 2*sizeof(uint16_t) + size;
+		}
+		field += 2*sizeof(uint16_t) + size;
+	}
+
+	data = extra + length + 2*sizeof(uint16_t);
+	if (entry->uncompressedSize >= ZIP64_SENTINEL_32) {
+		memcpy(data,&entry->uncompressedSize,sizeof(uint64_t));
+		data += sizeof(uint64_t);
+	}
+	if (entry->compressedSize >= ZIP64_SENTINEL_32) {
+		memcpy(data,&entry->compressedSize,sizeof(uint64_t));
+		data += sizeof(uint64_t);
+	}
+	if (entry->offset >= ZIP64_SENTINEL_32) {
+		memcpy(data,&entry->offset,sizeof(uint64_t));
+		data += sizeof(uint64_t);
+	}
+	if (data != extra + length + 2*sizeof(uint16_t)) {
+		tag = ZIP64_EXTRA_TAG;
+		size = (uint16_t)(data - (extra + length + 2*sizeof(uint16_t)));
+		memcpy(extra + length,&tag,sizeof(tag));
+		memcpy(extra + length + sizeof(tag),&size,sizeof(size));
+		length += 2*sizeof(uint16_t) + size;
+		if (dirHeader.versionNeeded < ZIP64_VERSION_NEEDED)
+			dirHeader.versionNeeded = ZIP64_VERSION_NEEDED;
+	}
+	if (length > 0xFFFF) {
+		errorCode = ZIP_ERROR_MALFORMED_LIST;
+		PRINT_CLASS_ERROR( "a member's extra fields no longer fit in its central directory header" );
+		return 0;
+	}
+	memcpy(extra + length,limit,dirHeader.fileCommentLength);
+
+	dirHeader.flags &= ~ZIP_FLAG_DATA_DESCRIPTOR;
+	dirHeader.compressionMethod = entry->compressionMethod;
+	dirHeader.crc32 = entry->crc32;
+	dirHeader.compressedSize = (entry->compressedSize >= ZIP64_SENTINEL_32) ? ZIP64_SENTINEL_32 : (uint32_t)entry->compressedSize;
+	dirHeader.uncompressedSize = (entry->uncompressedSize >= ZIP64_SENTINEL_32) ? ZIP64_SENTINEL_32 : (uint32_t)entry->uncompressedSize;
+	dirHeader.fileHeaderOffset = (entry->offset >= ZIP64_SENTINEL_32) ? ZIP64_SENTINEL_32 : (uint32_t)entry->offset;
+	dirHeader.startDiskNumber = 0;
+	dirHeader.extraFieldLength = (uint16_t)length;
+	memcpy(out,&dirHeader,fixedSize);
+	return fixedSize + dirHeader.fileNameLength + length + dirHeader.fileCommentLength;
+}
+
+/*!	\fn		WriteDirectoryEnd( int outFd, uint64_t directoryOffset, uint64_t directorySize, ZIP_CentralDirectoryEnd *end, uint8_t *comment )
+	\brief	A private method that writes the central directory end structure, with the original archive comment, behind the new central directory.  The ZIP64 end record and locator are written in front of it when the counts, size or offset don't fit.
+	\param	outFd descriptor of the archive being written
+	\param	directoryOffset offset of the new central directory
+	\param	directorySize size of the new central directory in bytes
+	\param	end pointer to the original central directory end structure
+	\param	comment pointer to the original archive comment, end->commentLength bytes long
+*/
+
+int32_t IMG3_ZipInterface::WriteDirectoryEnd(int outFd, uint64_t directoryOffset, uint64_t directorySize, ZIP_CentralDirectoryEnd *end, uint8_t *comment)
+{
+	ZIP_CentralDirectoryEnd newEnd;
+	ZIP64_CentralDirectoryEnd end64;
+	ZIP64_EndLocator locator;
+	bool zip64;
+
+	zip64 = (nodeCount >= ZIP64_SENTINEL_16 || directorySize >= ZIP64_SENTINEL_32 || directoryOffset >= ZIP64_SENTINEL_32);
+	if (zip64) {
+		memset(&end64,0,sizeof(end64));
+		end64.sig = ZIP64_CENTRAL_DIRECTORY_END_MARKER;
+		end64.recordSize = sizeof(end64) - sizeof(end64.sig) - sizeof(end64.recordSize);
+		end64.versionMade = ZIP64_VERSION_NEEDED;
+		end64.versionNeeded = ZIP64_VERSION_NEEDED;
+		end64.centralDirectoryNumOnDisk = nodeCount;
+		end64.centralDirectoryTotalNum = nodeCount;
+		end64.centralDirectorySize = directorySize;
+		end64.centralDirectoryOffset = directoryOffset;
+		memset(&locator,0,sizeof(locator));
+		locator.sig = ZIP64_END_LOCATOR_MARKER;
+		locator.endOffset = directoryOffset + directorySize;
+		locator.totalDisks = 1;
+		if (WriteOutput(outFd,(uint8_t *)&end64,sizeof(end64)) != 0 ||
+			WriteOutput(outFd,(uint8_t *)&locator,sizeof(locator)) != 0)
+			return -1;
+	}
+
+	memset(&newEnd,0,sizeof(newEnd));
+	newEnd.sig = CENTRAL_DIRECTORY_END_MARKER;
+	newEnd.centralDirectoryNumOnDisk = (nodeCount >= ZIP64_SENTINEL_16) ? ZIP64_SENTINEL_16 : (uint16_t)nodeCount;
+	newEnd.centralDirectoryTotalNum = newEnd.centralDirectoryNumOnDisk;
+	newEnd.centralDirectorySize = (directorySize >= ZIP64_SENTINEL_32) ? ZIP64_SENTINEL_32 : (uint32_t)directorySize;
+	newEnd.centralDirectoryOffset = (directoryOffset >= ZIP64_SENTINEL_32) ? ZIP64_SENTINEL_32 : (uint32_t)directoryOffset;
+	newEnd.commentLength = end->commentLength;
+	if (WriteOutput(outFd,(uint8_t *)&newEnd,sizeof(newEnd) - CENTRAL_DIRECTORY_END_EXTRA) != 0)
+		return -1;
+	if (end->commentLength != 0 && WriteOutput(outFd,comment,end->commentLength) != 0)
+		return -1;
+	return 0;
+}
+
+/*!	\fn		ZipCompareEntryOffsets( const void *a, const void *b )
+	\brief	A static qsort comparator ordering rewrite entries by the offset of their member's original local header.
+*/
+
+static int ZipCompareEntryOffsets(const void *a, const void *b)
+{
+	const ZIP_RewriteEntry *left = *(ZIP_RewriteEntry * const *)a;
+	const ZIP_RewriteEntry *right = *(ZIP_RewriteEntry * const *)b;
+
+	if (left->node->offset < right->node->offset)
+		return -1;
+	return (left->node->offset > right->node->offset) ? 1 : 0;
+}
+
+/*!	\fn		RewriteArchive( const char *archiveName, const char *outputName, ZIP_Replacement *replacements, uint32_t count )
+	\brief	A public method writing a copy of an archive in which some members have new contents.  Only the replaced members are compressed; the compressed bytes of all others are copied verbatim, inside the kernel where copy_file_range allows it.  Every local header, the central directory and its end structure are regenerated with the new offsets, sizes and CRC-32s.
+	\param	archiveName pointer to a string buffer containing the name of the ZIP archive
+	\param	outputName pointer to the name of the archive to write; it is written under a temporary name and renamed into place, so it may be archiveName itself
+	\param	replacements array of the members to replace, each named exactly as in the archive
+	\param	count number of entries in replacements
+
+	Members are written in their original order, so the new archive keeps the old one's layout, and
+	their times, attributes, extra fields and comments are kept.  No data descriptors are written.
+*/
+
+int32_t IMG3_ZipInterface::RewriteArchive(const char *archiveName, const char *outputName, ZIP_Replacement *replacements, uint32_t count)
+{
+	ZIP_CentralDirectoryEnd end;
+	ZIP64_CentralDirectoryEnd end64;
+	ZIP_CentralDirectoryHeader dirHeader;
+	ZIP_RewriteEntry *entries = NULL, **order = NULL, *entry;
+	ZIP_FileNode *node;
+	struct stat archiveStat, outputStat;
+	uint8_t *records = NULL, *comment = NULL, *directory = NULL;
+	uint64_t recordOffset, directoryOffset, directorySize = 0;
+	size_t fixedSize = sizeof(ZIP_CentralDirectoryHeader) - CENTRAL_DIRECTORY_HEADER_EXTRA, length;
+	char *temporary = NULL;
+	off_t dataOffset, outOffset;
+	uint32_t i;
+	int archiveFd, outFd = -1;
+	int32_t result = -1;
+	bool inPlace = false;
+
+	errorCode = ZIP_ERROR_NONE;
+
+	CLASS_VALIDATE_PARAMETER( archiveName, -1 );
+	CLASS_VALIDATE_PARAMETER( outputName, -1 );
+	if (count != 0)
+		CLASS_VALIDATE_PARAMETER( replacements, -1 );
+
+	archiveFd = OpenArchive(archiveName);
+	if (archiveFd < 0)
+		return -1;
+	records = ReadCentralDirectory(archiveFd,&end,&end64,&comment);
+	if (records == NULL)
+		goto RewriteArchive_cleanup;
+
+	// The central directory lists the members in node order; each keeps a pointer to its original header.
+	entries = new ZIP_RewriteEntry[nodeCount + 1];
+	memset(entries,0,(nodeCount + 1) * sizeof(ZIP_RewriteEntry));
+	recordOffset = 0;
+	for (i = 0; i < nodeCount; i++) {
+		if (recordOffset + fixedSize > end64.centralDirectorySize)
+			goto RewriteArchive_malformed;
+		memcpy(&dirHeader,records + recordOffset,fixedSize);
+		length = fixedSize + dirHeader.fileNameLength + dirHeader.extraFieldLength + dirHeader.fileCommentLength;
+		if (dirHeader.sig != CENTRAL_DIRECTORY_HEADER_MARKER || recordOffset + length > end64.centralDirectorySize)
+			goto RewriteArchive_malformed;
+		entry = &entries[i];
+		entry->record = records + recordOffset;
+		entry->node = &nodes[i];
+		entry->compressedSize = nodes[i].compressedSize;
+		entry->uncompressedSize = nodes[i].uncompressedSize;
+		entry->crc32 = nodes[i].crc32;
+		entry->compressionMethod = nodes[i].compressionMethod;
+		recordOffset += length;
+	}
+
+	// Replacements are compressed up front, so the new archive is written in a single pass.
+	for (i = 0; i < count; i++) {
+		if (replacements[i].fileName == NULL || (replacements[i].data == NULL && replacements[i].length != 0)) {
+			errorCode = IMG3_ERROR_INVALID_PARAMETER;
+			PRINT_CLASS_ERROR( "a replacement has no name or no contents" );
+			goto RewriteArchive_cleanup;
+		}
+		node = FindNode(replacements[i].fileName);
+		if (node == NULL)
+			goto RewriteArchive_cleanup;
+		entry = &entries[node - nodes];
+		if (entry->replaced) {
+			errorCode = IMG3_ERROR_INVALID_PARAMETER;
+			PRINT_CLASS_ERROR( "a member is replaced more than once" );
+			goto RewriteArchive_cleanup;
+		}
+		if (node->flags & ZIP_FLAG_ENCRYPTED) {
+			errorCode = ZIP_ERROR_UNSUPPORTED_METHOD;
+			PRINT_CLASS_ERROR( "encrypted members can't be replaced" );
+			goto RewriteArchive_cleanup;
+		}
+		if (CompressReplacement(&replacements[i],entry) != 0)
+			goto RewriteArchive_cleanup;
+	}
+
+	// Unchanged members are copied out of the archive, falling back to the mapping when the kernel can't copy.
+	if (MapArchive(archiveFd) != 0) {
+		errorCode = errno;
+		PRINT_SYSTEM_ERROR();
+		goto RewriteArchive_cleanup;
+	}
+	length = strlen(outputName) + 32;
+	temporary = new char[length];
+	snprintf(temporary,length,"%s.%ld.tmp",outputName,(long)getpid());
+	outFd = open(temporary,O_WRONLY | O_CREAT | O_TRUNC,0644);
+	if (outFd < 0) {
+		errorCode = errno;
+		PRINT_SYSTEM_ERROR();
+		goto RewriteArchive_cleanup;
+	}
+
+	order = new ZIP_RewriteEntry *[nodeCount + 1];
+	for (i = 0; i < nodeCount; i++)
+		order[i] = &entries[i];
+	qsort(order,nodeCount,sizeof(ZIP_RewriteEntry *),ZipCompareEntryOffsets);
+	for (i = 0; i < nodeCount; i++) {
+		entry = order[i];
+		if (!entry->replaced) {
+			if (LocateData(archiveFd,entry->node,&dataOffset) != 0)
+				goto RewriteArchive_cleanup;
+			if ((uint64_t)dataOffset + entry->compressedSize > archiveMapSize) {
+				errorCode = ZIP_ERROR_CORRUPT_MEMBER;
+				PRINT_CLASS_ERROR( "the archive ends in the middle of a member" );
+				goto RewriteArchive_cleanup;
+			}
+		}
+		outOffset = lseek(outFd,0,SEEK_CUR);
+		if (outOffset < 0) {
+			errorCode = errno;
+			PRINT_SYSTEM_ERROR();
+			goto RewriteArchive_cleanup;
+		}
+		entry->offset = (uint64_t)outOffset;
+		if (WriteLocalHeader(outFd,entry) != 0)
+			goto RewriteArchive_cleanup;
+		if (entry->replaced) {
+			if (WriteOutput(outFd,(uint8_t *)entry->data,entry->compressedSize) != 0)
+				goto RewriteArchive_cleanup;
+		} else if (CopyRange(archiveFd,dataOffset,outFd,entry->compressedSize) != 0) {
+			goto RewriteArchive_cleanup;
+		}
+	}
+
+	outOffset = lseek(outFd,0,SEEK_CUR);
+	if (outOffset < 0) {
+		errorCode = errno;
+		PRINT_SYSTEM_ERROR();
+		goto RewriteArchive_cleanup;
+	}
+	directoryOffset = (uint64_t)outOffset;
+	directory = new uint8_t[end64.centralDirectorySize + (size_t)nodeCount * ZIP64_EXTRA_MAX_SIZE + 1];
+	for (i = 0; i < nodeCount; i++) {
+		length = BuildCentralHeader(directory + directorySize,&entries[i]);
+		if (length == 0)
+			goto RewriteArchive_cleanup;
+		directorySize += length;
+	}
+	if (WriteOutput(outFd,directory,directorySize) != 0 ||
+		WriteDirectoryEnd(outFd,directoryOffset,directorySize,&end,comment) != 0)
+		goto RewriteArchive_cleanup;
+
+	// Replacing the analyzed archive itself leaves the nodes describing a file that is gone.
+	inPlace = (fstat(archiveFd,&archiveStat) == 0 && stat(outputName,&outputStat) == 0 &&
+			   archiveStat.st_dev == outputStat.st_dev && archiveStat.st_ino == outputStat.st_ino);
+	result = close(outFd);
+	outFd = -1;
+	if (result == 0)
+		result = rename(temporary,outputName);
+	if (result != 0) {
+		errorCode = errno;
+		PRINT_SYSTEM_ERROR();
+		result = -1;
+	}
+	goto RewriteArchive_cleanup;
+
+RewriteArchive_malformed:
+	errorCode = ZIP_ERROR_MALFORMED_LIST;
+	PRINT_CLASS_ERROR( "the central directory doesn't hold the analyzed members" );
+
+RewriteArchive_cleanup:
+	if (outFd >= 0)
+		close(outFd);
+	if (temporary != NULL) {
+		if (result != 0)
+			unlink(temporary);
+		delete[](temporary);
+	}
+	if (entries != NULL) {
+		for (i = 0; i < nodeCount; i++) {
+			if (entries[i].buffer != NULL)
+				delete[](entries[i].buffer);
+		}
+		delete[](entries);
+	}
+	if (order != NULL)
+		delete[](order);
+	if (directory != NULL)
+		delete[](directory);
+	if (comment != NULL)
+		delete[](comment);
+	if (records != NULL)
+		delete[](records);
+	close(archiveFd);
+	if (result == 0 && inPlace)
+		ResetData();
+	return result;
+}
@@ -0,0 +1,298 @@
+/**
+ * @file
+ * @version 1.0
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of all IMG3_ZipSelector class methods.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include "IMG3_ZipSelector.h"
+#include "IMG3_defines.h"
+
+/*! \fn		IMG3_ZipSelector()
+	\brief	Constructor for IMG3_ZipSelector class.  A selector without include patterns selects every member.
+*/
+
+IMG3_ZipSelector::IMG3_ZipSelector()
+{
+	errorCode = ZIP_SELECTOR_ERROR_NONE;
+	includes.clear();
+	excludes.clear();
+}
+
+/*!	\fn		~IMG3_ZipSelector()
+	\brief	Deconstructor for IMG3_ZipSelector class.
+*/
+
+IMG3_ZipSelector::~IMG3_ZipSelector()
+{
+	list<ZIP_Pattern *> *lists[2] = { &includes, &excludes };
+	list<ZIP_Pattern *>::iterator listIt;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		for (listIt = lists[i]->begin(); listIt != lists[i]->end(); ++listIt) {
+			if ((*listIt)->type != ZIP_PATTERN_SECTION)
+				regfree(&(*listIt)->regex);
+			delete[]((*listIt)->text);
+			delete(*listIt);
+		}
+		lists[i]->clear();
+	}
+}
+
+/*!	\fn		ZipGlobToRegex( const char *glob )
+	\brief	A static helper translating a shell glob into an anchored POSIX extended regular expression, which the caller deletes.  * and ? stop at slashes, ** doesn't, a directory matched by ** may also be no directory at all, and bracket expressions are kept with ! turned into ^.
+	\param	glob pointer to the glob to translate
+*/
+
+static char * ZipGlobToRegex(const char *glob)
+{
+	char *regex, *out;
+	const char *ch, *close;
+
+	// Every glob character becomes at most five regex characters ("[^/]" plus an escape), plus the anchors.
+	regex = new char[5*strlen(glob) + 3];
+	out = regex;
+	*out++ = '^';
+	for (ch = glob; *ch != '\0'; ch++) {
+		switch (*ch) {
+		case '*':
+			if (ch[1] == '*' && ch[2] == '/') {
+				strcpy(out,"(.*/)?");
+				out += 6;
+				ch += 2;
+			} else if (ch[1] == '*') {
+				strcpy(out,".*");
+				out += 2;
+				ch++;
+			} else {
+				strcpy(out,"[^/]*");
+				out += 5;
+			}
+			break;
+		case '?':
+			strcpy(out,"[^/]");
+			out += 4;
+			break;
+		case '[':
+			// A ] straight after the opening bracket, or after its !, is a member rather than the end.
+			close = ch + 1;
+			if (*close == '!')
+				close++;
+			if (*close == ']')
+				close++;
+			close = strchr(close,']');
+			if (close == NULL) {
+				*out++ = '\\';
+				*out++ = '[';
+				break;
+			}
+			*out++ = '[';
+			ch++;
+			if (*ch == '!') {
+				*out++ = '^';
+				ch++;
+			}
+			while (ch < close)
+				*out++ = *ch++;
+			*out++ = ']';
+			break;
+		case '.': case '^': case '$': case '+': case '(': case ')':
+		case '{': case '}': case '|': case '\\': case ']':
+			*out++ = '\\';
+			*out++ = *ch;
+			break;
+		default:
+			*out++ = *ch;
+			break;
+		}
+	}
+	*out++ = '$';
+	*out = '\0';
+	return regex;
+}
+
+/*!	\fn		Compile( const char *pattern, ZIP_PatternType type )
+	\brief	A private method compiling one pattern, so matching it later costs no parsing.  Returns NULL when a glob or regex doesn't compile.
+	\param	pattern pointer to the pattern text
+	\param	type kind of pattern, or ZIP_PATTERN_AUTO to work it out from the text
+*/
+
+ZIP_Pattern * IMG3_ZipSelector::Compile(const char *pattern, ZIP_PatternType type)
+{
+	ZIP_Pattern *compiled;
+	char *regex = NULL;
+	char message[128];
+	int result;
+
+	if (type == ZIP_PATTERN_AUTO) {
+		if (strncmp(pattern,ZIP_PATTERN_PREFIX_GLOB,strlen(ZIP_PATTERN_PREFIX_GLOB)) == 0) {
+			type = ZIP_PATTERN_GLOB;
+			pattern += strlen(ZIP_PATTERN_PREFIX_GLOB);
+		} else if (strncmp(pattern,ZIP_PATTERN_PREFIX_REGEX,strlen(ZIP_PATTERN_PREFIX_REGEX)) == 0) {
+			type = ZIP_PATTERN_REGEX;
+			pattern += strlen(ZIP_PATTERN_PREFIX_REGEX);
+		} else if (strncmp(pattern,ZIP_PATTERN_PREFIX_SECTION,strlen(ZIP_PATTERN_PREFIX_SECTION)) == 0) {
+			type = ZIP_PATTERN_SECTION;
+			pattern += strlen(ZIP_PATTERN_PREFIX_SECTION);
+		} else {
+			type = (strpbrk(pattern,"*?[") != NULL) ? ZIP_PATTERN_GLOB : ZIP_PATTERN_SECTION;
+		}
+	}
+
+	compiled = new ZIP_Pattern;
+	compiled->type = type;
+	compiled->length = strlen(pattern);
+	compiled->text = new char[compiled->length + 1];
+	strcpy(compiled->text,pattern);
+	compiled->baseName = (type == ZIP_PATTERN_GLOB && strchr(pattern,'/') == NULL);
+	if (type == ZIP_PATTERN_SECTION)
+		return compiled;
+
+	if (type == ZIP_PATTERN_GLOB)
+		regex = ZipGlobToRegex(pattern);
+	result = regcomp(&compiled->regex,(regex != NULL) ? regex : pattern,REG_EXTENDED | REG_ICASE | REG_NOSUB);
+	if (regex != NULL)
+		delete[](regex);
+	if (result != 0) {
+		regerror(result,&compiled->regex,message,sizeof(message));
+		errorCode = ZIP_SELECTOR_ERROR_INVALID_PATTERN;
+		fprintf(stderr,"%s: invalid pattern %s: %s.\n", __FUNCTION__, pattern, message);
+		delete[](compiled->text);
+		delete(compiled);
+		return NULL;
+	}
+	return compiled;
+}
+
+/*!	\fn		Include( const char *pattern, ZIP_PatternType type )
+	\brief	A public method adding a pattern to select members by.  Once any are added, a member has to match at least one.
+	\param	pattern pointer to the pattern text
+	\param	type kind of pattern, or ZIP_PATTERN_AUTO to work it out from the text
+*/
+
+int32_t IMG3_ZipSelector::Include(const char *pattern, ZIP_PatternType type)
+{
+	ZIP_Pattern *compiled;
+
+	CLASS_VALIDATE_PARAMETER( pattern, -1 );
+
+	compiled = Compile(pattern,type);
+	if (compiled == NULL)
+		return -1;
+	includes.push_back(compiled);
+	return 0;
+}
+
+/*!	\fn		Exclude( const char *pattern, ZIP_PatternType type )
+	\brief	A public method adding a pattern that keeps members out of the selection, whatever they include.
+	\param	pattern pointer to the pattern text
+	\param	type kind of pattern, or ZIP_PATTERN_AUTO to work it out from the text
+*/
+
+int32_t IMG3_ZipSelector::Exclude(const char *pattern, ZIP_PatternType type)
+{
+	ZIP_Pattern *compiled;
+
+	CLASS_VALIDATE_PARAMETER( pattern, -1 );
+
+	compiled = Compile(pattern,type);
+	if (compiled == NULL)
+		return -1;
+	excludes.push_back(compiled);
+	return 0;
+}
+
+/*!	\fn		MatchPattern( ZIP_Pattern *pattern, const char *name, const char *baseName, size_t stemLength )
+	\brief	A private method testing one member name against one compiled pattern.
+	\param	pattern pointer to the compiled pattern
+	\param	name pointer to the member's full name
+	\param	baseName pointer to the member's last path component, inside name, which its section stem starts
+	\param	stemLength length of the section stem
+*/
+
+bool IMG3_ZipSelector::MatchPattern(ZIP_Pattern *pattern, const char *name, const char *baseName, size_t stemLength)
+{
+	if (pattern->type == ZIP_PATTERN_SECTION)
+		return pattern->length == stemLength && strncasecmp(pattern->text,baseName,stemLength) == 0;
+	return regexec(&pattern->regex,pattern->baseName ? baseName : name,0,NULL,0) == 0;
+}
+
+/*!	\fn		ZipSplitName( const char *name, size_t *stemLength )
+	\brief	A static helper returning a member's last path component and the length of its section stem, which every pattern shares.
+	\param	name pointer to the member's full name
+	\param	stemLength pointer to the variable receiving the length of the section stem
+*/
+
+static const char * ZipSplitName(const char *name, size_t *stemLength)
+{
+	const char *baseName, *dot;
+
+	baseName = strrchr(name,'/');
+	baseName = (baseName != NULL) ? baseName + 1 : name;
+	dot = strchr(baseName,'.');
+	*stemLength = (dot != NULL) ? (size_t)(dot - baseName) : strlen(baseName);
+	return baseName;
+}
+
+/*!	\fn		Included( const char *name )
+	\brief	A public method returning whether a member matches an include pattern, or there are no include patterns.  Exclude patterns aren't consulted.
+	\param	name pointer to the member's name as stored in the archive
+*/
+
+bool IMG3_ZipSelector::Included(const char *name)
+{
+	list<ZIP_Pattern *>::iterator listIt;
+	const char *baseName;
+	size_t stemLength;
+
+	if (name == NULL)
+		return false;
+	if (includes.empty())
+		return true;
+
+	baseName = ZipSplitName(name,&stemLength);
+	for (listIt = includes.begin(); listIt != includes.end(); ++listIt) {
+		if (MatchPattern(*listIt,name,baseName,stemLength))
+			return true;
+	}
+	return false;
+}
+
+/*!	\fn		Excluded( const char *name )
+	\brief	A public method returning whether a member matches any exclude pattern.
+	\param	name pointer to the member's name as stored in the archive
+*/
+
+bool IMG3_ZipSelector::Excluded(const char *name)
+{
+	list<ZIP_Pattern *>::iterator listIt;
+	const char *baseName;
+	size_t stemLength;
+
+	if (name == NULL)
+		return false;
+
+	baseName = ZipSplitName(name,&stemLength);
+	for (listIt = excludes.begin(); listIt != excludes.end(); ++listIt) {
+		if (MatchPattern(*listIt,name,baseName,stemLength))
+			return true;
+	}
+	return false;
+}
+
+/*!	\fn		Matches( const char *name )
+	\brief	A public method returning whether a member is selected: it matches no exclude pattern, and matches an include pattern or there are none.
+	\param	name pointer to the member's name as stored in the archive
+*/
+
+bool IMG3_ZipSelector::Matches(const char *name)
+{
+	return Included(name) && !Excluded(name);
+}
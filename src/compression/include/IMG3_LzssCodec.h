@@ -0,0 +1,358 @@
+/*! \file IMG3_LzssCodec.h
+	\version 1.0
+
+	This is a C++ class template describing one flavour of the LZSS format: the token layout and a
+	decoder for it.  The flavour is fixed at compile time by the window size, the maximum match
+	length, the threshold below which a match isn't worth encoding and the byte the decoder's ring
+	buffer starts out filled with, so every mask and shift in the decoder is a constant and the hot
+	loop is specialized for each flavour.  Apple's kernelcaches use IMG3_LzssAppleCodec.
+ */
+
+#ifndef IMG3_LZSSCODEC_H_
+#define IMG3_LZSSCODEC_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define IMG3_LZSS_DECODE_INPUT_END		0x0000
+#define IMG3_LZSS_DECODE_OUTPUT_FULL	0x0001
+
+//! lzss_decode_state
+/*! A structure representing a decoder positioned on a token boundary.  The output buffer doubles as
+	the history window: back references are read from the bytes before dst. */
+
+struct lzss_decode_state {
+	uint8_t *src;		/*!< Next input byte */
+	uint8_t *srcend;	/*!< End of the available input */
+	uint8_t *dst;		/*!< Next output byte */
+	uint8_t *dstend;	/*!< End of the output buffer; never written past */
+	uint8_t *dststop;	/*!< Decoding stops at the first token boundary at or past this point */
+	uint8_t *dstbase;	/*!< Address of the output byte at offset outbase of the stream */
+	uint8_t *histstart;	/*!< Lowest address back references may be read from */
+	uint32_t outbase;	/*!< Offset of dstbase within the decompressed stream */
+	uint32_t flags;		/*!< Remaining flag bits of the current group, above a sentinel bit */
+};
+
+//! IMG3_LzssCodec class template
+/*!
+	Tokens come in groups of eight behind a flag byte whose set bits mark literals.  A match is two
+	bytes holding the ring buffer position of its source, low byte first, with the length minus
+	THRESHOLD + 1 packed into the low bits of the second byte.  The ring buffer is N bytes, the
+	first output byte is written at position N - F, and the N - F bytes before it hold FILL.
+	The position takes log2(N) bits, leaving the rest of the 16 for the length.
+
+	\param N the window size, a power of two from 256 to 32768
+	\param F the maximum match length
+	\param THRESHOLD the longest match that is encoded as literals instead
+	\param FILL the byte the ring buffer is filled with before any output exists
+*/
+
+template <uint32_t N, uint32_t F, uint32_t THRESHOLD, uint8_t FILL>
+class IMG3_LzssCodec {
+private:
+	//! Private function
+	/*! Number of bits needed for values below x, a power of two. */
+	static constexpr uint32_t Log2( uint32_t x ) { return (x <= 1) ? 0 : 1 + Log2( x >> 1 ); }
+
+public:
+	//! Mask reducing an offset to a ring buffer position.
+	static constexpr uint32_t WindowMask = N - 1;
+
+	//! Number of bits of a match holding the ring buffer position.
+	static constexpr uint32_t PositionBits = Log2( N );
+
+	//! Number of bits of a match holding the length.
+	static constexpr uint32_t LengthBits = 16 - PositionBits;
+
+	//! Mask extracting the length from the second byte of a match.
+	static constexpr uint32_t LengthMask = (1 << LengthBits) - 1;
+
+	//! Shortest match that is encoded as a match.
+	static constexpr uint32_t MinMatch = THRESHOLD + 1;
+
+	//! Ring buffer position of the first output byte.
+	static constexpr uint32_t RingStart = N - F;
+
+	//! Room a whole group may need, including the bytes a chunked copy writes past a match.
+	static constexpr uint32_t FastMargin = 8 * F + 8;
+
+	static_assert( (N & (N - 1)) == 0 && N >= 256 && N <= 32768, "window size must be a power of two from 256 to 32768" );
+	static_assert( F >= MinMatch && F - MinMatch <= LengthMask, "match lengths don't fit the length bits" );
+	static_assert( F < N, "maximum match length must be smaller than the window" );
+
+	//! MatchPosition public function.
+	/*! This function returns the ring buffer position of the source of a match.
+		\param token a pointer to the two bytes of the match
+	*/
+	static inline uint32_t MatchPosition( const uint8_t *token ) { return token[0] | ((uint32_t)(token[1] >> LengthBits) << 8); }
+
+	//! MatchLength public function.
+	/*! This function returns the number of bytes a match decodes to.
+		\param token a pointer to the two bytes of the match
+	*/
+	static inline uint32_t MatchLength( const uint8_t *token ) { return (token[1] & LengthMask) + MinMatch; }
+
+	//! EncodeMatch public function.
+	/*! This function writes a match in its two byte form.
+		\param token a pointer to the two bytes to write
+		\param position the ring buffer position of the source
+		\param length the number of bytes copied, from MinMatch to F
+	*/
+	static inline void EncodeMatch( uint8_t *token, uint32_t position, uint32_t length )
+	{
+		token[0] = (uint8_t) position;
+		token[1] = (uint8_t)(((position >> 8) << LengthBits) | (length - MinMatch));
+	}
+
+	//! RingPosition public function.
+	/*! This function returns the ring buffer position of a decompressed offset.
+		\param offset the offset within the decompressed stream
+	*/
+	static inline uint32_t RingPosition( uint32_t offset ) { return (offset + RingStart) & WindowMask; }
+
+	//! PrehistoryByte public function.
+	/*! This function returns what the ring buffer holds before any output exists.
+		\param logical a negative offset, relative to the first decompressed byte
+	*/
+	static inline uint8_t PrehistoryByte( int64_t logical )
+	{
+		return (((logical + RingStart) & WindowMask) < RingStart) ? FILL : 0;
+	}
+
+	//! HistoryByte public function.
+	/*! This function reads one history byte for a back reference.  Returns zero on success;
+		otherwise, it returns -1 if the byte is history that simply isn't available.
+		\param dp a pointer to the decoder state
+		\param from the address of the byte in the output buffer
+		\param value a pointer to where the byte is stored
+	*/
+	static inline int32_t HistoryByte( struct lzss_decode_state *dp, uint8_t *from, uint8_t *value );
+
+	//! InitDecodeState public function.
+	/*! This function prepares a decoder at the start of a stream.
+		\param dp a pointer to the decoder state
+		\param dst a pointer to the buffer receiving the start of the output
+		\param dstlen the size of the dst buffer
+		\param src a pointer to the first token byte of the stream
+		\param srclen the number of token bytes available
+	*/
+	static void InitDecodeState( struct lzss_decode_state *dp, uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen );
+
+	//! DecodeTokens public function.
+	/*! This function decodes tokens straight into the output buffer, using it as the history
+		window.  It returns IMG3_LZSS_DECODE_INPUT_END, IMG3_LZSS_DECODE_OUTPUT_FULL, or -1 if a
+		back reference points at history that isn't available.
+		\param dp a pointer to the decoder state
+	*/
+	static int32_t DecodeTokens( struct lzss_decode_state *dp );
+
+	//! Decompress public function.
+	/*! This function decodes a whole token stream, without any header, and returns the number of
+		bytes written.  Nothing is written past dstlen.
+		\param dst a pointer to the buffer to store the decompressed data
+		\param dstlen the size of the dst buffer
+		\param src a pointer to the token stream
+		\param srclen the length of the token stream
+	*/
+	static uint32_t Decompress( uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen );
+};
+
+/*! \fn		int32_t HistoryByte( struct lzss_decode_state *dp, uint8_t *from, uint8_t *value )
+	\brief	Read one history byte for a back reference, substituting the initial ring buffer before the start of the stream
+	\param	dp pointer to the lzss_decode_state structure
+	\param	from address of the byte in the output buffer
+	\param	value address of a byte in which to store the history byte
+
+	Before any output exists, the ring buffer of the reference decoder holds N-F bytes of FILL
+	followed by uninitialized bytes; the stream may legitimately copy from the fill.
+*/
+
+template <uint32_t N, uint32_t F, uint32_t THRESHOLD, uint8_t FILL>
+inline int32_t IMG3_LzssCodec<N, F, THRESHOLD, FILL>::HistoryByte(struct lzss_decode_state *dp, uint8_t *from, uint8_t *value)
+{
+	int64_t logical;
+
+	if (from >= dp->histstart) {
+		*value = *from;
+		return 0;
+	}
+	logical = (int64_t) dp->outbase + (from - dp->dstbase);
+	if (logical >= 0)
+		return -1;
+	*value = PrehistoryByte(logical);
+	return 0;
+}
+
+/*! \fn		void InitDecodeState( struct lzss_decode_state *dp, uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen )
+	\brief	Prepare a decoder at the start of a stream
+	\param	dp pointer to the lzss_decode_state structure to initialize
+	\param	dst pointer to the buffer receiving the start of the output
+	\param	dstlen size in bytes of the dst buffer
+	\param	src pointer to the first token byte of the stream
+	\param	srclen number of token bytes available
+*/
+
+template <uint32_t N, uint32_t F, uint32_t THRESHOLD, uint8_t FILL>
+void IMG3_LzssCodec<N, F, THRESHOLD, FILL>::InitDecodeState(struct lzss_decode_state *dp, uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen)
+{
+	dp->src = src;
+	dp->srcend = src + srclen;
+	dp->dst = dst;
+	dp->dstend = dst + dstlen;
+	dp->dststop = dp->dstend;
+	dp->dstbase = dst;
+	dp->histstart = dst;
+	dp->outbase = 0;
+	dp->flags = 0;
+}
+
+/*!	\fn		int32_t DecodeTokens( struct lzss_decode_state *dp )
+	\brief	Decode tokens using the output buffer itself as the history window
+	\param	dp pointer to the lzss_decode_state structure describing the input, output and flag phase
+
+	Back references are resolved by converting the ring buffer position into a distance from the
+	current output position and copying straight out of the bytes already written, so every byte is
+	written exactly once.  While at least a whole group of input and output is available, the eight
+	tokens behind a flag byte are decoded without any further bounds checks: a flag byte of 0xFF is a
+	single 8 byte copy, matches at least 8 bytes back are copied 8 bytes at a time, and a distance of
+	one is a fill.  Near the ends of either buffer tokens are decoded one at a time with full checks,
+	and decoding stops on a token boundary so the state can be resumed.
+
+	Decoding stops at the first token boundary at or past dststop, before any token that doesn't fit
+	in dstend, or when the input runs out.
+*/
+
+template <uint32_t N, uint32_t F, uint32_t THRESHOLD, uint8_t FILL>
+int32_t IMG3_LzssCodec<N, F, THRESHOLD, FILL>::DecodeTokens(struct lzss_decode_state *dp)
+{
+	uint8_t *src = dp->src, *srcend = dp->srcend, *fsrc;
+	uint8_t *dst = dp->dst, *dstend = dp->dstend, *dststop = dp->dststop;
+	uint8_t *histstart = dp->histstart, *dstbase = dp->dstbase, *from;
+	uint32_t flags = dp->flags, f, c, i, d, len, k, bit;
+	uint32_t ringoff = RingPosition(dp->outbase);
+	int32_t status = IMG3_LZSS_DECODE_INPUT_END;
+
+	for ( ; ; ) {
+		if (dst >= dststop) {
+			status = IMG3_LZSS_DECODE_OUTPUT_FULL;
+			break;
+		}
+
+		if (((flags >> 1) & 0x100) == 0 && srcend - src >= 1 + 2 * 8 && dstend - dst >= FastMargin) {
+			c = *src++;
+			if (c == 0xFF) {
+				/* Eight literals in a row. */
+				memcpy(dst, src, 8);
+				dst += 8;
+				src += 8;
+				flags = 0;
+				continue;
+			}
+			for (bit = 0; bit < 8; bit++, c >>= 1) {
+				if (c & 1) {
+					*dst++ = *src++;
+					continue;
+				}
+				i = MatchPosition(src);
+				len = MatchLength(src);
+				src += 2;
+				d = ((uint32_t)(dst - dstbase) + ringoff - i) & WindowMask;
+				if (d == 0)
+					d = N;
+				from = dst - d;
+				if (from < histstart) {
+					dp->src = src - 2;
+					dp->dst = dst;
+					for (k = 0; k < len; k++) {
+						if (HistoryByte(dp, from + k, dst + k) != 0)
+							return -1;
+					}
+				} else if (d >= 8) {
+					/* Chunks never overlap their own source; the few bytes written past len are overwritten later. */
+					for (k = 0; k < len; k += 8)
+						memcpy(dst + k, from + k, 8);
+				} else if (d == 1) {
+					memset(dst, from[0], len);
+				} else {
+					for (k = 0; k < len; k++)
+						dst[k] = from[k];
+				}
+				dst += len;
+			}
+			flags = 0;
+			continue;
+		}
+
+		/* One token at a time, committing nothing until the whole token is known to fit. */
+		fsrc = src;
+		f = flags >> 1;
+		if ((f & 0x100) == 0) {
+			if (src >= srcend)
+				break;
+			f = *src++ | 0xFF00;  /* uses higher byte cleverly to count eight */
+		}
+		if (f & 1) {
+			if (src >= srcend) {
+				src = fsrc;
+				break;
+			}
+			if (dst >= dstend) {
+				src = fsrc;
+				status = IMG3_LZSS_DECODE_OUTPUT_FULL;
+				break;
+			}
+			*dst++ = *src++;
+		} else {
+			if (srcend - src < 2) {
+				src = fsrc;
+				break;
+			}
+			i = MatchPosition(src);
+			len = MatchLength(src);
+			if ((uint32_t)(dstend - dst) < len) {
+				src = fsrc;
+				status = IMG3_LZSS_DECODE_OUTPUT_FULL;
+				break;
+			}
+			d = ((uint32_t)(dst - dstbase) + ringoff - i) & WindowMask;
+			if (d == 0)
+				d = N;
+			from = dst - d;
+			for (k = 0; k < len; k++) {
+				if (HistoryByte(dp, from + k, dst + k) != 0) {
+					dp->src = fsrc;
+					dp->dst = dst;
+					return -1;
+				}
+			}
+			src += 2;
+			dst += len;
+		}
+		flags = f;
+	}
+
+	dp->src = src;
+	dp->dst = dst;
+	dp->flags = flags;
+	return status;
+}
+
+/*!	\fn		uint32_t Decompress( uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen )
+	\brief	Decode a whole token stream with DecodeTokens
+	\param	dst pointer to a buffer to store the result of the decompression
+	\param	dstlen size in bytes of the dst buffer; nothing is written past it
+	\param	src pointer to the token stream
+	\param	srclen size of src buffer in bytes
+*/
+
+template <uint32_t N, uint32_t F, uint32_t THRESHOLD, uint8_t FILL>
+uint32_t IMG3_LzssCodec<N, F, THRESHOLD, FILL>::Decompress(uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen)
+{
+	struct lzss_decode_state ds;
+
+	InitDecodeState(&ds, dst, dstlen, src, srclen);
+	DecodeTokens(&ds);
+	return ds.dst - dst;
+}
+
+#endif /* IMG3_LZSSCODEC_H_ */
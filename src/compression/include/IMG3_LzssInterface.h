@@ -11,6 +11,8 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <pthread.h>
+#include "IMG3_LzssCodec.h"
 
 #define IMG3_LZSSINTERFACE_BASE 65521L
 #define IMG3_LZSSINTERFACE_NMAX 5521
@@ -18,8 +20,48 @@
 #define IMG3_LZSSINTERFACE_N           4096
 #define IMG3_LZSSINTERFACE_F           18
 #define IMG3_LZSSINTERFACE_THRESHOLD   2
+#define IMG3_LZSSINTERFACE_FILL        ' '
 #define IMG3_LZSSINTERFACE_NIL         IMG3_LZSSINTERFACE_N
 
+#define IMG3_LZSSINTERFACE_HASH_BITS   15
+#define IMG3_LZSSINTERFACE_HASH_SIZE   ( 1 << IMG3_LZSSINTERFACE_HASH_BITS )
+#define IMG3_LZSSINTERFACE_HASH_NIL    0xFFFFFFFF
+#define IMG3_LZSSINTERFACE_MAX_DIST    ( IMG3_LZSSINTERFACE_N - IMG3_LZSSINTERFACE_F )
+#define IMG3_LZSSINTERFACE_FAST_CHAIN  16
+#define IMG3_LZSSINTERFACE_LAZY_CHAIN  48
+#define IMG3_LZSSINTERFACE_OPTIMAL_CHAIN 64
+#define IMG3_LZSSINTERFACE_BLOCK_SIZE  0x10000
+#define IMG3_LZSSINTERFACE_BLOCK_SLACK 64
+
+/* Worst case output of LzssCompress: one flag byte per eight literals, slack for every parallel block,
+   the header, the final partial group and the padding to 16 bytes. */
+#define IMG3_LZSSINTERFACE_BOUND( X )	( (X) + (X) / 8 + IMG3_LZSSINTERFACE_BLOCK_SLACK * ((X) / IMG3_LZSSINTERFACE_PARALLEL_BLOCK_SIZE + 2) + \
+										  sizeof(IMG3_LzssInterface_CompressionHeader) + 16 )
+
+#define IMG3_LZSSINTERFACE_MIN_PAD	5
+#define IMG3_LZSSINTERFACE_EXACT_REACH ( 64 * IMG3_LZSSINTERFACE_N )
+
+#define IMG3_LZSSINTERFACE_FAST_MARGIN ( IMG3_LzssAppleCodec::FastMargin )
+#define IMG3_LZSSINTERFACE_VERIFY_CHUNK 0x4000
+
+#define IMG3_LZSSINTERFACE_INDEX_SPACING 0x10000
+#define IMG3_LZSSINTERFACE_INDEX_SIGNATURE 0x6C7A6978
+#define IMG3_LZSSINTERFACE_INDEX_VERSION 1
+
+#define IMG3_LZSSINTERFACE_PARALLEL_BLOCK_SIZE 0x100000
+#define IMG3_LZSSINTERFACE_MAX_THREADS 64
+
+#define IMG3_LZSS_ENGINE_BINARY_TREE	0x0000
+#define IMG3_LZSS_ENGINE_HASH_CHAIN		0x0001
+
+#define IMG3_LZSS_VERIFY_IGNORE	0
+#define IMG3_LZSS_VERIFY_WARN	1
+#define IMG3_LZSS_VERIFY_FAIL	2
+
+#define IMG3_LZSS_LEVEL_FAST			0x0001
+#define IMG3_LZSS_LEVEL_LAZY			0x0002
+#define IMG3_LZSS_LEVEL_OPTIMAL			0x0003
+
 #define IMG3_LZSSINTERFACE_COMP_SIGNATURE 0x636F6D70
 #define IMG3_LZSSINTERFACE_LZSS_SIGNATURE 0x6C7A7373
 
@@ -29,6 +71,17 @@
 #define IMG3_LZSS_ERROR_COMPRESSION_FAILED		0x0003
 #define IMG3_LZSS_ERROR_CHECKSUM_MISMATCH		0x0004
 #define IMG3_LZSS_ERROR_INPUT_TOO_SMALL			0x0005
+#define IMG3_LZSS_ERROR_INVALID_ENGINE			0x0006
+#define IMG3_LZSS_ERROR_INVALID_LEVEL			0x0007
+#define IMG3_LZSS_ERROR_INVALID_POLICY			0x0008
+#define IMG3_LZSS_ERROR_INVALID_INDEX			0x0009
+#define IMG3_LZSS_ERROR_INVALID_RANGE			0x000A
+#define IMG3_LZSS_ERROR_CORRUPT_STREAM			0x000B
+#define IMG3_LZSS_ERROR_SINK_NOT_OPEN			0x000C
+#define IMG3_LZSS_ERROR_SINK_NOT_SEEKABLE		0x000D
+#define IMG3_LZSS_ERROR_SINK_FAILED				0x000E
+#define IMG3_LZSS_ERROR_OUTPUT_TOO_SMALL		0x000F
+#define IMG3_LZSS_ERROR_TARGET_TOO_SMALL		0x0010
 
 //! IMG3_LzssInterface_CompressionHeader
 /*! A structure representing the LZSS compression header. */
@@ -42,6 +95,43 @@ typedef struct IMG3_LzssInterface_CompressionHeader {
     uint8_t  padding[ 0x16c ];		/*!< 0x16C bytes of zero padding before data */
 } __attribute__((__packed__)) IMG3_LzssInterface_CompressionHeader;
 
+//! IMG3_LzssInterface_Checkpoint
+/*! A structure representing the decoder state at one point of a compressed stream. */
+
+typedef struct IMG3_LzssInterface_Checkpoint {
+	uint32_t input_offset;		/*!< Offset of the next token byte, relative to the end of the header */
+	uint32_t output_offset;		/*!< Number of bytes decompressed before this point */
+	uint32_t flags;				/*!< Remaining flag bits of the current group */
+	uint8_t window[ IMG3_LZSSINTERFACE_N ];	/*!< The N decompressed bytes before this point */
+} IMG3_LzssInterface_Checkpoint;
+
+//! IMG3_LzssInterface_Index
+/*! A structure representing a checkpoint index for random access into a compressed stream. */
+
+typedef struct IMG3_LzssInterface_Index {
+	uint32_t checksum;				/*!< Header checksum of the indexed stream */
+	uint32_t length_uncompressed;	/*!< Header uncompressed length of the indexed stream */
+	uint32_t length_compressed;		/*!< Header compressed length of the indexed stream */
+	uint32_t spacing;				/*!< Minimum number of decompressed bytes between checkpoints */
+	uint32_t count;					/*!< Number of checkpoints */
+	IMG3_LzssInterface_Checkpoint *checkpoints;	/*!< Checkpoints in increasing output order; the first is the start of the stream */
+} IMG3_LzssInterface_Index;
+
+//! IMG3_LzssInterface_Patch
+/*! A structure describing one modified range of the decompressed data. */
+
+typedef struct IMG3_LzssInterface_Patch {
+	uint32_t offset;	/*!< Offset of the first modified byte */
+	uint32_t length;	/*!< Number of modified bytes */
+	uint8_t *original;	/*!< The length bytes the range held before it was modified, or NULL if unknown */
+} IMG3_LzssInterface_Patch;
+
+//! IMG3_LzssAppleCodec
+/*! The LZSS flavour used by Apple's kernelcaches: a 4 KB window, matches of 3 to 18 bytes and a
+	ring buffer filled with spaces. */
+
+typedef IMG3_LzssCodec< IMG3_LZSSINTERFACE_N, IMG3_LZSSINTERFACE_F, IMG3_LZSSINTERFACE_THRESHOLD, IMG3_LZSSINTERFACE_FILL > IMG3_LzssAppleCodec;
+
 //! encode_state
 /*! A structure representing the encode state used for the LZSS encoding state machine. */
 
@@ -54,6 +144,129 @@ struct encode_state {
 	int match_length;	/*!< Match length of longest match */
 };
 
+//! hash_state
+/*! A structure representing the hash-chain match finder state.  Positions are stored with a running
+	base offset added so the tables can be reused across calls without being cleared; entries left
+	over from a previous call always fall outside the window of the current one. */
+
+struct hash_state {
+	uint32_t head[ IMG3_LZSSINTERFACE_HASH_SIZE ];	/*!< Most recent position inserted for each hash bucket */
+	uint32_t prev[ IMG3_LZSSINTERFACE_N ];			/*!< Previous position with the same hash, indexed modulo N */
+	uint32_t base;									/*!< Offset added to every position of the current call */
+	uint32_t limit;									/*!< Length of the input of the current call */
+	uint32_t max_chain;								/*!< Number of chain entries examined per lookup */
+	int match_position;	/*!< Input offset of longest match */
+	int match_length;	/*!< Match length of longest match */
+};
+
+//! lzss_token
+/*! A structure representing a single parsed token.  A length of one is a literal; anything longer is a
+	match copied from the given input offset. */
+
+struct lzss_token {
+	uint32_t position;	/*!< Input offset of the match source, or of the literal itself */
+	uint32_t length;	/*!< Number of input bytes covered by the token */
+};
+
+//! optimal_state
+/*! A structure representing the per-block tables used by the optimal parser. */
+
+struct optimal_state {
+	uint8_t  length[ IMG3_LZSSINTERFACE_BLOCK_SIZE ];		/*!< Longest match found at each position */
+	uint8_t  choice[ IMG3_LZSSINTERFACE_BLOCK_SIZE ];		/*!< Length of the token chosen at each position */
+	uint32_t position[ IMG3_LZSSINTERFACE_BLOCK_SIZE ];		/*!< Input offset of the longest match at each position */
+	uint32_t cost[ IMG3_LZSSINTERFACE_BLOCK_SIZE + 1 ];		/*!< Bits needed to encode the rest of the block from each position */
+};
+
+//! lzss_emit_state
+/*! A structure representing a token encoder writing flag-byte groups into an output buffer. */
+
+struct lzss_emit_state {
+	uint8_t *dst;			/*!< Next byte of the output buffer */
+	uint8_t *dstend;		/*!< End of the output buffer */
+	uint8_t code_buf[17];	/*!< Flag byte followed by up to eight encoded tokens */
+	uint32_t code_buf_ptr;	/*!< Next free byte of code_buf */
+	uint8_t mask;			/*!< Flag bit of the next token */
+	uint32_t pos;			/*!< Input offset of the next token */
+	uint64_t literals;		/*!< Number of literals emitted */
+	uint64_t matches;		/*!< Number of matches emitted */
+};
+
+//! lzss_context
+/*! A structure grouping the tables one thread needs to run the hash-chain engine.  Each table is
+	allocated on first use and kept for later compressions. */
+
+struct lzss_context {
+	struct hash_state *hash;		/*!< Hash-chain match finder state */
+	struct optimal_state *optimal;	/*!< Optimal parser tables, only allocated at IMG3_LZSS_LEVEL_OPTIMAL */
+	struct lzss_token *tokens;		/*!< Token array holding one parsed block */
+};
+
+//! lzss_block
+/*! A structure representing one block of a parallel compression. */
+
+struct lzss_block {
+	uint32_t start;		/*!< Input offset of the first byte of the block */
+	uint32_t end;		/*!< Input offset following the last byte of the block */
+	uint8_t *dst;		/*!< Slot of the output buffer the block is compressed into */
+	uint32_t dstlen;	/*!< Size of the slot in bytes */
+	uint32_t length;	/*!< Number of bytes written to the slot */
+	uint32_t checksum;	/*!< Adler32 checksum of the block's input */
+	int32_t status;		/*!< 0 if the block ends on a flag byte boundary, 1 if it doesn't, -1 on failure */
+	uint64_t literals;	/*!< Number of literals emitted for the block */
+	uint64_t matches;	/*!< Number of matches emitted for the block */
+};
+
+class IMG3_LzssInterface;
+
+//! lzss_parallel_job
+/*! A structure describing the work handed to one compression thread. */
+
+struct lzss_parallel_job {
+	IMG3_LzssInterface *lzss;		/*!< Instance whose settings are used */
+	struct lzss_context *context;	/*!< Tables owned by the thread */
+	uint8_t *src;					/*!< Start of the input */
+	struct lzss_block *blocks;		/*!< All blocks of the input */
+	uint32_t count;					/*!< Number of blocks */
+	volatile uint32_t *next;		/*!< Index of the next block to hand out, shared by all threads */
+};
+
+//! lzss_decode_job
+/*! A structure describing the work handed to one decompression thread.  Segment k runs from
+	checkpoint k of the index to the next checkpoint, or to the end of the stream. */
+
+struct lzss_decode_job {
+	IMG3_LzssInterface *lzss;			/*!< Instance whose decoder is used */
+	IMG3_LzssInterface_Index *index;	/*!< Checkpoints splitting the stream into segments */
+	uint8_t *src;						/*!< First token byte of the stream */
+	uint8_t *dst;						/*!< Start of the output buffer */
+	uint32_t *checksums;				/*!< Adler32 checksum of each segment, or NULL when not verifying */
+	volatile uint32_t *next;			/*!< Index of the next segment to hand out, shared by all threads */
+	volatile int32_t *failed;			/*!< Set by any thread whose segment didn't decode cleanly */
+};
+
+//! lzss_token_cursor
+/*! A structure representing a position in an encoded token stream, walked without decoding it. */
+
+struct lzss_token_cursor {
+	uint8_t *group;		/*!< Flag byte of the current group */
+	uint8_t *token;		/*!< First byte of the current token */
+	uint8_t *end;		/*!< End of the token stream */
+	uint32_t bit;		/*!< Index of the current token within its group */
+	uint32_t output;	/*!< Decompressed offset of the current token */
+};
+
+//! IMG3_LzssInterface_CompressionStats
+/*! A structure reporting the size and throughput of the last compression. */
+
+typedef struct IMG3_LzssInterface_CompressionStats {
+	uint64_t input_bytes;	/*!< Number of bytes compressed */
+	uint64_t output_bytes;	/*!< Number of bytes in the compressed stream, excluding the header */
+	uint64_t literals;		/*!< Number of literal tokens */
+	uint64_t matches;		/*!< Number of match tokens */
+	double seconds;			/*!< Time spent compressing */
+} IMG3_LzssInterface_CompressionStats;
+
 //! IMG3_LzssInteface class
 /*!	
 	The IMG3_LzssInterface class is used to provide wrappers around the opensource LZSS code
@@ -64,11 +277,54 @@ struct encode_state {
 */
 
 class IMG3_LzssInterface {
+	friend class IMG3_LzssStreamDecoder;
+	friend class IMG3_LzssStreamEncoder;
+
 private:
 	//! Private int32_t variable 
 	/*! This variable represents any error encoutered during compression or decompression. */
 	int32_t errorCode;
 
+	//! Private int32_t variable
+	/*! This variable selects the match finder used by LzssCompress. */
+	int32_t engine;
+
+	//! Private int32_t variable
+	/*! This variable selects the parser used by the hash-chain engine. */
+	int32_t level;
+
+	//! Private encode_state pointer
+	/*! Binary tree state, allocated on first use and reused by subsequent compressions. */
+	struct encode_state *encodeState;
+
+	//! Private lzss_context variable
+	/*! Hash-chain tables used by serial compressions, kept for reuse by subsequent calls. */
+	struct lzss_context context;
+
+	//! Private lzss_context pointer
+	/*! One set of hash-chain tables per compression thread, allocated on first use. */
+	struct lzss_context *workerContexts;
+
+	//! Private uint32_t variable
+	/*! Number of threads used by the hash-chain engine. */
+	uint32_t threadCount;
+
+	//! Private IMG3_LzssInterface_CompressionStats variable
+	/*! Size and throughput of the last compression. */
+	IMG3_LzssInterface_CompressionStats stats;
+
+	//! Private int32_t variable
+	/*! What LzssDecompress does about a checksum mismatch; one of the IMG3_LZSS_VERIFY_* values. */
+	int32_t verifyPolicy;
+
+	//! Private IMG3_LzssInterface_Index pointer
+	/*! Checkpoints LzssDecompress may use to decode on several threads; owned by the caller. */
+	IMG3_LzssInterface_Index *decodeIndex;
+
+	//! Private uint8_t variable
+	/*! Whether the last decompression was split across the checkpoints of decodeIndex. */
+	uint8_t decodeIndexUsed;
+
 	//! Private function
 	/*! This function is used to initialize the state machine used in the compression and
 		decompression routines. */
@@ -81,7 +337,109 @@ private:
 	//! Private function
 	/*! Delete node from the encoding binary search tree. */
 	void DeleteNode( struct encode_state *sp, int p );
+
+	//! Private function
+	/*! Prepare the hash-chain state for a new input of the given length. */
+	void InitHashState( struct hash_state *hp, uint32_t srclen );
+
+	//! Private function
+	/*! Insert the string starting at input offset p into the hash chains. */
+	void HashInsert( struct hash_state *hp, uint8_t *src, uint32_t p );
+
+	//! Private function
+	/*! Find the longest match for input offset p, limited to maxlen bytes. */
+	void HashFindMatch( struct hash_state *hp, uint8_t *src, uint32_t p, uint32_t maxlen );
+
+	//! Private function
+	/*! Parse a block by always taking the longest match. */
+	uint32_t ParseGreedy( struct hash_state *hp, uint8_t *src, uint32_t p, uint32_t end, uint32_t limit, struct lzss_token *out, uint32_t *count );
+
+	//! Private function
+	/*! Parse a block, deferring each match by one byte when a longer one follows. */
+	uint32_t ParseLazy( struct hash_state *hp, uint8_t *src, uint32_t p, uint32_t end, uint32_t limit, struct lzss_token *out, uint32_t *count );
+
+	//! Private function
+	/*! Parse a block into the smallest possible encoding. */
+	uint32_t ParseOptimal( struct hash_state *hp, struct optimal_state *op, uint8_t *src, uint32_t p, uint32_t end, struct lzss_token *out, uint32_t *count );
+
+	//! Private function
+	/*! Prepare a token emitter writing to dst. */
+	void InitEmitState( struct lzss_emit_state *ep, uint8_t *dst, uint32_t dstlen, uint32_t pos );
+
+	//! Private function
+	/*! Encode parsed tokens into flag-byte groups. */
+	int32_t EmitTokens( struct lzss_emit_state *ep, uint8_t *src, struct lzss_token *in, uint32_t count );
+
+	//! Private function
+	/*! Write out the last, partially filled group of tokens. */
+	int32_t FlushEmitState( struct lzss_emit_state *ep );
+
+	//! Private function
+	/*! Append an already encoded token stream to an emitter in any group phase. */
+	int32_t AppendStream( struct lzss_emit_state *ep, uint8_t *stream, uint32_t length );
+
+	//! Private function
+	/*! Allocate the tables of a compression context on first use. */
+	void InitContext( struct lzss_context *cp );
+
+	//! Private function
+	/*! Release the tables of a compression context. */
+	void FreeContext( struct lzss_context *cp );
+
+	//! Private function
+	/*! Compress one range of the input with the hash-chain engine. */
+	int32_t CompressRange( struct lzss_context *cp, struct lzss_emit_state *ep, uint8_t *src, uint32_t start, uint32_t end, int32_t align, uint32_t *pad );
+
+	//! Private function
+	/*! Number of hash chain entries the compression level may examine. */
+	uint32_t ChainLimit( void );
+
+	//! Private function
+	/*! Split matches so a block gains the given number of tokens. */
+	int32_t AlignTokens( struct lzss_token *in, uint32_t *count, uint32_t end, uint32_t extra );
+
+	//! Private function
+	/*! Split matches of an aligned block so its encoding grows by the given number of bytes. */
+	int32_t PadTokens( struct lzss_token *in, uint32_t *count, uint32_t end, uint32_t bytes );
+
+	//! Private function
+	/*! Validate a recompression request and return its non-empty ranges sorted by offset. */
+	IMG3_LzssInterface_Patch * SortPatches( uint8_t *inbuff, size_t insize, uint8_t *plaintext, size_t plainsize,
+											IMG3_LzssInterface_Patch *patches, uint32_t *count );
+
+	//! Private function
+	/*! Largest output RecompressStream can produce for the given ranges. */
+	size_t RecompressBound( uint8_t *inbuff, size_t plainsize, IMG3_LzssInterface_Patch *ranges, uint32_t count, uint32_t reach );
+
+	//! Private function
+	/*! Splice recompressed ranges into the original token stream. */
+	int32_t RecompressStream( uint8_t *inbuff, uint8_t *plaintext, size_t plainsize, IMG3_LzssInterface_Patch *ranges, uint32_t count,
+							  uint32_t reach, uint32_t *pad, uint8_t *outbuff, size_t outlen, size_t *length );
+
+	//! Private function
+	/*! Checksum of modified data, updated from the original's checksum where possible. */
+	uint32_t PatchChecksum( uint32_t checksum, uint8_t *plaintext, size_t plainsize, IMG3_LzssInterface_Patch *ranges, uint32_t count );
+
+	//! Private function
+	/*! Compress data in blocks on several threads. */
+	uint8_t * CompressParallel( uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen, uint32_t *checksum );
+
+	//! Private function
+	/*! Thread routine compressing blocks for CompressParallel. */
+	static void * CompressThread( void *arg );
+
+	//! Private function
+	/*! Append whole groups of an encoded token stream, copying them as is when the emitter is on a group boundary. */
+	int32_t CopyStream( struct lzss_emit_state *ep, uint8_t *stream, uint32_t length );
+
+	//! Private function
+	/*! Combine the adler32 checksums of two consecutive blocks. */
+	uint32_t lzadler32_combine( uint32_t adler1, uint32_t adler2, uint32_t len2 );
 	
+	//! Private function
+	/*! Continue an adler32 checksum over more data using the fastest available kernel. */
+	uint32_t lzadler32_update( uint32_t adler, uint8_t *buf, uint32_t len );
+
 	//! Private function
 	/*! Generate adler32 checksum for the given data. */
 	uint32_t lzadler32( uint8_t *buf, int32_t len );
@@ -90,10 +448,54 @@ private:
 	/*! Decompress data using LZSS decompression. */
 	uint32_t Decompress( uint8_t *dst, uint8_t *src, uint32_t srclen );
 	
+	//! Private function
+	/*! Decode tokens straight into the output buffer, using it as the history window. */
+	int32_t DecodeTokens( struct lzss_decode_state *dp );
+
+	//! Private function
+	/*! Prepare a decoder at the start of a stream. */
+	void InitDecodeState( struct lzss_decode_state *dp, uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen );
+
+	//! Private function
+	/*! Validate the compression header and the compressed length against the input size. */
+	int32_t CheckHeader( uint8_t *inbuff, size_t insize );
+
+	//! Private function
+	/*! Decompress a stream with a validated header into a buffer of the decompressed length. */
+	int32_t DecompressInto( uint8_t *inbuff, uint8_t *outbuff );
+
+	//! Private function
+	/*! Check that an index was built for the stream behind the given header. */
+	int32_t IndexMatches( IMG3_LzssInterface_CompressionHeader *header, IMG3_LzssInterface_Index *index );
+
+	//! Private function
+	/*! Decompress a whole stream on several threads, one checkpoint segment at a time. */
+	int32_t DecompressParallel( uint8_t *inbuff, uint8_t *outbuff, uint32_t *checksum );
+
+	//! Private function
+	/*! Thread routine decoding segments for DecompressParallel. */
+	static void * DecompressThread( void *arg );
+
+	//! Private function
+	/*! Decode the segment starting at one checkpoint straight into the output buffer. */
+	int32_t DecodeSegment( IMG3_LzssInterface_Index *index, uint32_t k, uint8_t *src, uint8_t *dst );
+
+	//! Private function
+	/*! Decompress a whole stream into a buffer of the given size. */
+	uint32_t DecompressFast( uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen );
+
+	//! Private function
+	/*! Decompress a whole stream, checksumming the output as it is produced. */
+	uint32_t DecompressVerify( uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen, uint32_t *checksum );
+
 	//! Private function
 	/*! Compress data using LZSS compression. */
 	uint8_t * Compress( uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen );
 
+	//! Private function
+	/*! Compress data using LZSS compression with the hash-chain match finder. */
+	uint8_t * CompressHashChain( uint8_t *dst, uint32_t dstlen, uint8_t *src, uint32_t srclen );
+
 public:
 	//! IMG3_LzssInterface constructor.
 	IMG3_LzssInterface();
@@ -111,6 +513,32 @@ public:
 					decompressed data
 	*/
 	int32_t LzssDecompress( uint8_t *inbuff, size_t insize, uint8_t **outbuff, size_t *outsize );
+
+	//! LzssDecompress public function.
+	/*! This function may be called to decompress a block of LZSS compressed data into a buffer
+		owned by the caller, which must hold at least the decompressed length given by the header.
+		The function returns zero on success; otherwise, it returns -1.
+		\param inbuff a pointer to the LZSS compressed data
+		\param insize the length of the LZSS compressed data
+		\param outbuff a pointer to the buffer to store the decompressed data
+		\param outsize the length of outbuff
+		\param written a pointer to a variable that will be used to store the length of the
+					decompressed data
+	*/
+	int32_t LzssDecompress( uint8_t *inbuff, size_t insize, uint8_t *outbuff, size_t outsize, size_t *written );
+
+	//! LzssDecompressToFile public function.
+	/*! This function may be called to decompress a block of LZSS compressed data straight into
+		a file.  The file is resized to the decompressed length and memory mapped, so the data is
+		decoded directly into the page cache.  The descriptor must be open for reading and writing
+		and is not closed.  The function returns zero on success; otherwise, it returns -1.
+		\param inbuff a pointer to the LZSS compressed data
+		\param insize the length of the LZSS compressed data
+		\param fd the file descriptor to decompress into
+		\param outsize a pointer to a variable that will be used to store the length of the
+					decompressed data
+	*/
+	int32_t LzssDecompressToFile( uint8_t *inbuff, size_t insize, int fd, size_t *outsize );
 	
 	//! LzssCompress public function.
 	/*! This function may be called to compress a block of data using LZSS compression.
@@ -123,6 +551,119 @@ public:
 	*/
 	int32_t LzssCompress( uint8_t *inbuff, size_t insize, uint8_t **outbuff, size_t *outsize );
 	
+	//! LzssRecompress public function.
+	/*! This function compresses data that differs from the decompressed contents of an existing
+		stream only in the given ranges.  The original tokens are kept up to the token covering
+		the first modified byte, the data is recompressed from there with the hash-chain engine,
+		and the original tokens are taken back once they are on a flag byte boundary at least N
+		bytes past the modified range, where nothing they refer to has changed.  The work done
+		therefore depends on the number of modified ranges rather than the size of the data.  If
+		every range supplies its original bytes and no two ranges overlap, the checksum is updated
+		from the differences alone.  The compression statistics describe the recompressed part.
+		The function returns zero on success; otherwise, it returns -1.
+		\param inbuff a pointer to the original compressed data, including the compression header
+		\param insize the length of the original compressed data
+		\param plaintext a pointer to the modified data, the same length as the original
+		\param plainsize the length of the modified data
+		\param patches the modified ranges, in any order
+		\param count the number of modified ranges
+		\param outbuff a double pointer that will be allocated automatically to store the
+					compressed data
+		\param outsize a pointer to a variable that will be used to store the length of the
+					compressed data
+	*/
+	int32_t LzssRecompress( uint8_t *inbuff, size_t insize, uint8_t *plaintext, size_t plainsize,
+							IMG3_LzssInterface_Patch *patches, uint32_t count, uint8_t **outbuff, size_t *outsize );
+
+	//! LzssRecompressToSize public function.
+	/*! This function recompresses modified data like LzssRecompress, but produces a stream of
+		exactly insize bytes that can replace the original in place.  If the recompressed ranges
+		come out larger than before, progressively more of the data around them is recompressed
+		with the current compression level until the stream fits; if they come out smaller,
+		matches are split until the stream is back to the original compressed length.  Any
+		difference left over, which can only be a few bytes, is taken up by the zero padding
+		after the stream.  The function returns zero on success; otherwise, it returns -1.
+		\param inbuff a pointer to the original compressed data, including the compression header
+		\param insize the length of the original compressed data and of the result
+		\param plaintext a pointer to the modified data, the same length as the original
+		\param plainsize the length of the modified data
+		\param patches the modified ranges, in any order
+		\param count the number of modified ranges
+		\param outbuff a double pointer that will be allocated automatically to store the
+					compressed data
+		\param outsize a pointer to a variable that will be used to store the length of the
+					compressed data
+	*/
+	int32_t LzssRecompressToSize( uint8_t *inbuff, size_t insize, uint8_t *plaintext, size_t plainsize,
+								  IMG3_LzssInterface_Patch *patches, uint32_t count, uint8_t **outbuff, size_t *outsize );
+
+	//! LzssBuildIndex public function.
+	/*! This function decompresses a stream once, with memory bounded by the spacing, and records
+		a checkpoint every spacing bytes of output: the input and output offsets, the flag phase
+		and the 4 KB window behind it.  With the index, LzssDecompressRange can decode any part of
+		the stream from the nearest checkpoint.  The checksum is checked according to the
+		verification policy.  The function returns zero on success; otherwise, it returns -1.
+		\param inbuff a pointer to the compressed data, including the compression header
+		\param insize the length of the compressed data
+		\param spacing the number of decompressed bytes between checkpoints, at least 4 KB; zero
+					selects IMG3_LZSSINTERFACE_INDEX_SPACING
+		\param index a double pointer that will be allocated automatically to store the index;
+					release it with LzssFreeIndex
+	*/
+	int32_t LzssBuildIndex( uint8_t *inbuff, size_t insize, uint32_t spacing, IMG3_LzssInterface_Index **index );
+
+	//! LzssBuildIndex public function.
+	/*! This function builds the same kind of index from a stream and the data it decompresses to,
+		as is at hand right after compressing or after a first decode.  The tokens are only walked,
+		not decoded, and the windows are copied out of the data, so the index costs a small
+		fraction of a decode.  The function returns zero on success; otherwise, it returns -1.
+		\param inbuff a pointer to the compressed data, including the compression header
+		\param insize the length of the compressed data
+		\param plaintext a pointer to the decompressed data
+		\param plainsize the length of the decompressed data
+		\param spacing the number of decompressed bytes between checkpoints, at least 4 KB; zero
+					selects IMG3_LZSSINTERFACE_INDEX_SPACING
+		\param index a double pointer that will be allocated automatically to store the index;
+					release it with LzssFreeIndex
+	*/
+	int32_t LzssBuildIndex( uint8_t *inbuff, size_t insize, uint8_t *plaintext, size_t plainsize, uint32_t spacing, IMG3_LzssInterface_Index **index );
+
+	//! LzssDecompressRange public function.
+	/*! This function decompresses length bytes starting at offset of the decompressed data,
+		decoding at most spacing bytes more than requested.  The function returns zero on
+		success; otherwise, it returns -1.
+		\param inbuff a pointer to the compressed data, including the compression header
+		\param insize the length of the compressed data
+		\param index the index built for this stream
+		\param offset the offset of the first decompressed byte to return
+		\param length the number of decompressed bytes to return
+		\param outbuff a pointer to a buffer of at least length bytes
+	*/
+	int32_t LzssDecompressRange( uint8_t *inbuff, size_t insize, IMG3_LzssInterface_Index *index, size_t offset, size_t length, uint8_t *outbuff );
+
+	//! LzssSaveIndex public function.
+	/*! This function writes an index to a sidecar file so later runs can skip LzssBuildIndex.
+		The function returns zero on success; otherwise, it returns -1.
+		\param index the index to write
+		\param fileName the name of the sidecar file
+	*/
+	int32_t LzssSaveIndex( IMG3_LzssInterface_Index *index, const char *fileName );
+
+	//! LzssLoadIndex public function.
+	/*! This function reads an index written by LzssSaveIndex.  LzssDecompressRange refuses an
+		index whose header fields don't match the stream.  The function returns zero on success;
+		otherwise, it returns -1.
+		\param fileName the name of the sidecar file
+		\param index a double pointer that will be allocated automatically to store the index
+	*/
+	int32_t LzssLoadIndex( const char *fileName, IMG3_LzssInterface_Index **index );
+
+	//! LzssFreeIndex public function.
+	/*! This function releases an index returned by LzssBuildIndex or LzssLoadIndex.
+		\param index the index to release
+	*/
+	void LzssFreeIndex( IMG3_LzssInterface_Index *index );
+
 	//! IsFileCompressed public function.
 	/*! This function may be called to determine if a given block of data is compressed with 
 		LZSS compression.  The function returns zero if it is a valid LZSS compressed block; 
@@ -130,6 +671,90 @@ public:
 		\param inbuff a pointer to the block of data to evaluate
 	*/
 	int32_t IsFileCompressed( uint8_t *inbuff );
+
+	//! SetMatchFinder public function.
+	/*! This function selects the match finder used by LzssCompress.  Both engines produce a
+		valid stream for the 4096/18/2 parameters used by Apple; the hash-chain engine is
+		considerably faster on large inputs.  The function returns zero on success; otherwise,
+		it returns -1.
+		\param newEngine IMG3_LZSS_ENGINE_BINARY_TREE or IMG3_LZSS_ENGINE_HASH_CHAIN
+	*/
+	int32_t SetMatchFinder( int32_t newEngine );
+
+	//! GetMatchFinder public function.
+	/*! This function returns the match finder currently used by LzssCompress. */
+	int32_t GetMatchFinder( void ) { return engine; }
+
+	//! SetCompressionLevel public function.
+	/*! This function selects the parser used by the hash-chain engine.  IMG3_LZSS_LEVEL_FAST
+		always takes the longest match, IMG3_LZSS_LEVEL_LAZY (the default) defers a match when
+		the next byte starts a longer one, and IMG3_LZSS_LEVEL_OPTIMAL finds the smallest
+		encoding of each block.  The binary tree engine is always greedy.  The function returns
+		zero on success; otherwise, it returns -1.
+		\param newLevel the compression level to use
+	*/
+	int32_t SetCompressionLevel( int32_t newLevel );
+
+	//! GetCompressionLevel public function.
+	/*! This function returns the compression level currently used by the hash-chain engine. */
+	int32_t GetCompressionLevel( void ) { return level; }
+
+	//! SetThreadCount public function.
+	/*! This function selects the number of threads used by the hash-chain engine.  With more than
+		one thread, inputs larger than one block are split into 1 MB blocks that are compressed
+		concurrently and stitched into a single standard stream.  The same number of threads
+		decodes streams covered by the index given to SetDecompressIndex.  Zero selects one thread
+		per online processor.  The function returns zero on success.
+		\param threads the number of threads to use
+	*/
+	int32_t SetThreadCount( uint32_t threads );
+
+	//! GetThreadCount public function.
+	/*! This function returns the number of threads used by the hash-chain engine. */
+	uint32_t GetThreadCount( void ) { return threadCount; }
+
+	//! SetVerifyPolicy public function.
+	/*! This function selects what LzssDecompress does when the decompressed data doesn't match
+		the checksum or length in the header.  IMG3_LZSS_VERIFY_IGNORE (the default) skips the
+		checksum altogether, IMG3_LZSS_VERIFY_WARN reports the mismatch and still returns the
+		data, and IMG3_LZSS_VERIFY_FAIL frees the data and fails.  The checksum is computed while
+		decoding, so verifying costs no extra pass over the output.  The function returns zero on
+		success; otherwise, it returns -1.
+		\param newPolicy the verification policy to use
+	*/
+	int32_t SetVerifyPolicy( int32_t newPolicy );
+
+	//! GetVerifyPolicy public function.
+	/*! This function returns the verification policy used by LzssDecompress. */
+	int32_t GetVerifyPolicy( void ) { return verifyPolicy; }
+
+	//! SetDecompressIndex public function.
+	/*! This function gives LzssDecompress and LzssDecompressToFile a checkpoint index to split
+		streams across the threads selected by SetThreadCount.  Every segment between two
+		checkpoints is decoded on its own, starting from the window saved in the checkpoint, into
+		its place in the output, and the segment checksums are combined for verification.  The
+		index is only used for the stream it was built for; other streams, and a stream whose
+		segments don't line up with the index, are decoded serially.  The index remains owned by
+		the caller and must outlive its use; NULL stops using it.
+		\param index the index to use, or NULL
+	*/
+	void SetDecompressIndex( IMG3_LzssInterface_Index *index ) { decodeIndex = index; }
+
+	//! DecompressIndexUsed public function.
+	/*! This function returns whether the last decompression was decoded from the checkpoints of
+		the index given to SetDecompressIndex, rather than falling back to a serial decode because
+		the index didn't describe the stream. */
+	bool DecompressIndexUsed( void ) { return decodeIndexUsed != 0; }
+
+	//! GetCompressionStats public function.
+	/*! This function returns the size and throughput of the last compression. */
+	IMG3_LzssInterface_CompressionStats GetCompressionStats( void ) { return stats; }
+
+	//! PrintCompressionStats public function.
+	/*! This function prints the size and throughput of the last compression.
+		\param stream the stream to print the report to
+	*/
+	void PrintCompressionStats( FILE *stream );
 	
 	//! GetError public function.
 	/*! This function simply returns the last known error. */
@@ -0,0 +1,140 @@
+/*! \file IMG3_LzssStreamDecoder.h
+	\version 1.0
+
+	This is a C++ class for decompressing an LZSS stream, header included, from input that arrives
+	in pieces.  Input and output are pushed through in caller sized chunks and memory use does not
+	depend on the size of the stream.
+ */
+
+#ifndef IMG3_LZSSSTREAMDECODER_H_
+#define IMG3_LZSSSTREAMDECODER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "IMG3_LzssInterface.h"
+
+#define IMG3_LZSSSTREAMDECODER_CHUNK	0x10000
+#define IMG3_LZSSSTREAMDECODER_CARRY	( 2 * 8 + 4 )
+
+#define IMG3_LZSS_STREAM_OK		0
+#define IMG3_LZSS_STREAM_END	1
+
+#define IMG3_LZSSSTREAMDECODER_STATE_HEADER	0
+#define IMG3_LZSSSTREAMDECODER_STATE_BODY	1
+#define IMG3_LZSSSTREAMDECODER_STATE_DONE	2
+
+class IMG3_LzssStreamDecoder {
+private:
+	//! Private int32_t variable
+	/*! Last known error; one of the IMG3_LZSS_ERROR_* values or an errno value. */
+	int32_t errorCode;
+
+	//! Private int32_t variable
+	/*! What Decode does about a checksum mismatch; one of the IMG3_LZSS_VERIFY_* values. */
+	int32_t verifyPolicy;
+
+	//! Private int32_t variable
+	/*! Whether the decoder is reading the header, the tokens, or has finished. */
+	int32_t state;
+
+	//! Private IMG3_LzssInterface variable
+	/*! Provides the token decoder and the checksum kernels. */
+	IMG3_LzssInterface lzss;
+
+	//! Private IMG3_LzssInterface_CompressionHeader variable
+	/*! The compression header, gathered across calls. */
+	IMG3_LzssInterface_CompressionHeader header;
+
+	//! Private uint32_t variable
+	/*! Number of header bytes gathered so far. */
+	uint32_t headerLength;
+
+	//! Private uint32_t variable
+	/*! Number of token bytes of the stream not yet accepted from the caller. */
+	uint32_t remaining;
+
+	//! Private struct lzss_decode_state variable
+	/*! Decoder position; its output buffer is window, behind which the last N bytes are kept. */
+	struct lzss_decode_state decode;
+
+	//! Private uint8_t pointer
+	/*! N bytes of history followed by room for one chunk of output. */
+	uint8_t *window;
+
+	//! Private uint8_t pointer
+	/*! First decoded byte not yet handed to the caller. */
+	uint8_t *pending;
+
+	//! Private uint8_t array
+	/*! Input bytes of a token that was split across calls, followed by the start of the next input. */
+	uint8_t carry[ IMG3_LZSSSTREAMDECODER_CARRY ];
+
+	//! Private uint32_t variable
+	/*! Number of bytes held in carry. */
+	uint32_t carryLength;
+
+	//! Private uint32_t variable
+	/*! Running adler32 checksum of the decoded data. */
+	uint32_t checksum;
+
+	//! Private uint32_t variable
+	/*! Number of bytes decoded so far. */
+	uint32_t total;
+
+	//! Private function
+	/*! Decode as much as the input and the window allow; returns the number of input bytes used. */
+	int32_t DecodeInput( uint8_t *inbuff, size_t insize, size_t *consumed );
+
+	//! Private function
+	/*! Check the decoded data against the header once the stream is exhausted. */
+	int32_t Finish( void );
+
+public:
+	//! IMG3_LzssStreamDecoder constructor.
+	IMG3_LzssStreamDecoder();
+
+	//! IMG3_LzssStreamDecoder destructor.
+	virtual ~IMG3_LzssStreamDecoder();
+
+	//! Reset public function.
+	/*! This function prepares the decoder for a new stream.  The verification policy is kept.
+		The function returns zero on success; otherwise, it returns -1.
+	*/
+	int32_t Reset( void );
+
+	//! Decode public function.
+	/*! This function accepts the next piece of the compressed stream, starting with the
+		compression header, and writes as much decompressed data as is available into outbuff.
+		Input is consumed only while there is room to decode it, so the caller should present
+		the unconsumed part again, along with any new input, on the next call.  Tokens split
+		between calls are carried over.  The function returns IMG3_LZSS_STREAM_END once the whole
+		stream has been decoded and handed out, IMG3_LZSS_STREAM_OK if more input or more output
+		space is needed, and -1 on error.
+		\param inbuff a pointer to the next piece of the compressed stream; may be NULL if insize is zero
+		\param insize the length of the piece
+		\param consumed a pointer to a variable in which to store the number of input bytes used
+		\param outbuff a pointer to a buffer to receive decompressed data
+		\param outsize the length of outbuff
+		\param produced a pointer to a variable in which to store the number of bytes written to outbuff
+	*/
+	int32_t Decode( uint8_t *inbuff, size_t insize, size_t *consumed, uint8_t *outbuff, size_t outsize, size_t *produced );
+
+	//! SetVerifyPolicy public function.
+	/*! This function selects what happens when the decoded data doesn't match the checksum or
+		length in the header, as for IMG3_LzssInterface::SetVerifyPolicy.  The function returns
+		zero on success; otherwise, it returns -1.
+		\param newPolicy the verification policy to use
+	*/
+	int32_t SetVerifyPolicy( int32_t newPolicy );
+
+	//! GetUncompressedLength public function.
+	/*! This function returns the decompressed length from the header, or zero before the header
+		has been read. */
+	uint32_t GetUncompressedLength( void );
+
+	//! GetError public function.
+	/*! This function simply returns the last known error. */
+	int32_t GetError( void ) { return errorCode; }
+};
+
+#endif /* IMG3_LZSSSTREAMDECODER_H_ */
@@ -0,0 +1,188 @@
+/*! \file IMG3_LzssStreamEncoder.h
+	\version 1.0
+
+	This is a C++ class for compressing data into an LZSS stream, header included, as it arrives.
+	The compressed stream is written to a sink in fixed-size chunks, so neither the whole input nor
+	a worst case output buffer has to be held in memory.
+ */
+
+#ifndef IMG3_LZSSSTREAMENCODER_H_
+#define IMG3_LZSSSTREAMENCODER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "IMG3_LzssInterface.h"
+
+#define IMG3_LZSSSTREAMENCODER_CHUNK	0x10000
+#define IMG3_LZSSSTREAMENCODER_INPUT	( 2 * IMG3_LZSSINTERFACE_N + 2 * IMG3_LZSSINTERFACE_BLOCK_SIZE )
+#define IMG3_LZSSSTREAMENCODER_OUTPUT	( IMG3_LZSSSTREAMENCODER_CHUNK + IMG3_LZSSINTERFACE_BLOCK_SIZE + \
+										  IMG3_LZSSINTERFACE_BLOCK_SIZE / 8 + IMG3_LZSSINTERFACE_BLOCK_SLACK )
+#define IMG3_LZSSSTREAMENCODER_LOOKAHEAD	( 2 * IMG3_LZSSINTERFACE_F )
+
+#define IMG3_LZSSSTREAMENCODER_SINK_NONE		0
+#define IMG3_LZSSSTREAMENCODER_SINK_MEMORY		1
+#define IMG3_LZSSSTREAMENCODER_SINK_FILE		2
+#define IMG3_LZSSSTREAMENCODER_SINK_CALLBACK	3
+
+//! IMG3_LzssStreamSink
+/*! Callback receiving compressed data.  Data arrives in increasing offset order, except for the
+	compression header, which is written once as zeroes at offset zero and written again with the
+	final lengths and checksum when the stream is finished.  Returns zero on success; otherwise -1. */
+
+typedef int32_t (*IMG3_LzssStreamSink)( void *opaque, uint64_t offset, uint8_t *data, size_t length );
+
+class IMG3_LzssStreamEncoder {
+private:
+	//! Private int32_t variable
+	/*! Last known error; one of the IMG3_LZSS_ERROR_* values or an errno value. */
+	int32_t errorCode;
+
+	//! Private IMG3_LzssInterface variable
+	/*! Provides the hash-chain parsers, the token emitter and the checksum kernels. */
+	IMG3_LzssInterface lzss;
+
+	//! Private int32_t variable
+	/*! Where the compressed data goes; one of the IMG3_LZSSSTREAMENCODER_SINK_* values. */
+	int32_t sinkType;
+
+	//! Private int variable
+	/*! File descriptor of a file sink. */
+	int sinkFd;
+
+	//! Private int64_t variable
+	/*! File offset of the compression header in a file sink. */
+	int64_t sinkStart;
+
+	//! Private IMG3_LzssStreamSink variable
+	/*! Callback of a callback sink. */
+	IMG3_LzssStreamSink sinkCallback;
+
+	//! Private void pointer
+	/*! Argument passed to the callback. */
+	void *sinkOpaque;
+
+	//! Private uint8_t pointer
+	/*! Buffer collecting a memory sink's output. */
+	uint8_t *memoryBuffer;
+
+	//! Private size_t variable
+	/*! Allocated size of memoryBuffer. */
+	size_t memorySize;
+
+	//! Private uint64_t variable
+	/*! Number of bytes sent to the sink, header included. */
+	uint64_t written;
+
+	//! Private uint8_t pointer
+	/*! Input window: at least the N-F bytes before position, then input not yet compressed. */
+	uint8_t *input;
+
+	//! Private uint32_t variable
+	/*! Offset in input of the next byte to compress. */
+	uint32_t position;
+
+	//! Private uint32_t variable
+	/*! Number of bytes held in input. */
+	uint32_t inputLength;
+
+	//! Private uint8_t pointer
+	/*! Encoded groups waiting to be sent to the sink. */
+	uint8_t *output;
+
+	//! Private struct lzss_emit_state variable
+	/*! Token emitter writing into output; its input offsets are relative to input. */
+	struct lzss_emit_state emit;
+
+	//! Private uint32_t variable
+	/*! Running adler32 checksum of the input. */
+	uint32_t checksum;
+
+	//! Private uint32_t variable
+	/*! Number of input bytes accepted. */
+	uint32_t total;
+
+	//! Private function
+	/*! Send data to the sink at the given offset. */
+	int32_t Output( uint64_t offset, uint8_t *data, size_t length );
+
+	//! Private function
+	/*! Prepare the compressor and reserve room for the header in a freshly opened sink. */
+	int32_t Start( void );
+
+	//! Private function
+	/*! Compress one block ending at end, with no match extending past limit. */
+	int32_t CompressBlock( uint32_t end, uint32_t limit );
+
+	//! Private function
+	/*! Send full chunks of encoded data to the sink; everything if all is set. */
+	int32_t Drain( int32_t all );
+
+public:
+	//! IMG3_LzssStreamEncoder constructor.
+	IMG3_LzssStreamEncoder();
+
+	//! IMG3_LzssStreamEncoder destructor.
+	virtual ~IMG3_LzssStreamEncoder();
+
+	//! SetCompressionLevel public function.
+	/*! This function selects the parser, as for IMG3_LzssInterface::SetCompressionLevel.  The
+		stream encoder always uses the hash-chain engine and produces the same stream as
+		LzssCompress does with that engine and one thread.  It must be called before a sink is
+		opened.  The function returns zero on success; otherwise, it returns -1.
+		\param newLevel the compression level to use
+	*/
+	int32_t SetCompressionLevel( int32_t newLevel );
+
+	//! OpenMemory public function.
+	/*! This function starts a stream collected in memory; retrieve it with TakeBuffer once
+		Finish has been called.  The function returns zero on success; otherwise, it returns -1.
+	*/
+	int32_t OpenMemory( void );
+
+	//! OpenFile public function.
+	/*! This function starts a stream written to a file descriptor at its current offset.  The
+		descriptor must be seekable, since the header is rewritten once the stream is finished.
+		The descriptor is not closed.  The function returns zero on success; otherwise, it
+		returns -1.
+		\param fd the file descriptor to write to
+	*/
+	int32_t OpenFile( int fd );
+
+	//! OpenCallback public function.
+	/*! This function starts a stream handed to a callback.  The function returns zero on
+		success; otherwise, it returns -1.
+		\param sink the function receiving the compressed data
+		\param opaque a pointer passed to every call of sink
+	*/
+	int32_t OpenCallback( IMG3_LzssStreamSink sink, void *opaque );
+
+	//! Write public function.
+	/*! This function compresses the next piece of input.  Input is compressed one block at a
+		time, as soon as enough of it has arrived.  The function returns zero on success;
+		otherwise, it returns -1.
+		\param inbuff a pointer to the data to compress
+		\param insize the length of the data
+	*/
+	int32_t Write( uint8_t *inbuff, size_t insize );
+
+	//! Finish public function.
+	/*! This function compresses the remaining input, pads the stream to 16 bytes like
+		LzssCompress and writes the final header.  The function returns zero on success;
+		otherwise, it returns -1.
+	*/
+	int32_t Finish( void );
+
+	//! TakeBuffer public function.
+	/*! This function hands a finished memory stream to the caller, who must delete[] it.  The
+		function returns zero on success; otherwise, it returns -1.
+		\param outbuff address of a pointer in which to store the stream
+		\param outsize address of a variable in which to store the length of the stream
+	*/
+	int32_t TakeBuffer( uint8_t **outbuff, size_t *outsize );
+
+	//! GetError public function.
+	/*! This function simply returns the last known error. */
+	int32_t GetError( void ) { return errorCode; }
+};
+
+#endif /* IMG3_LZSSSTREAMENCODER_H_ */
@@ -5,16 +5,24 @@
 
 	This is a C++ class for interacting with the ZIP compressed files.  It does not support a full implementation 
 	of the ZIP compression specification, but is rather used to extract information about a ZIP compressed file.
-	All calls to decompression methods simply wrap to a system call to the program 'zip'.
+	Stored and deflated members are extracted in-process with zlib, straight from the offsets recorded in the
+	central directory.  Stored members can also be viewed in place through a read-only mapping of the archive.
+	The parsed central directory can be cached in a small binary sidecar, so later runs against the same archive
+	skip the scan.  Members are kept in one contiguous table, with their names in a single arena and a hash index
+	on lowercased names and section stems.  ZIP64 archives, with members or offsets past 4 GB or more than 65535 entries, are supported.
 */
 
 #ifndef IMG3_ZIPINTERFACE_H_
 #define IMG3_ZIPINTERFACE_H_
 
 #include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
 #include <list>
 #include "IMG3_defines.h"
 #include "IMG3_typedefs.h"
+#include "IMG3_ZipSelector.h"
 
 #if defined(MSDOS) || defined(OS2) || defined(WIN32) || defined(__CYGWIN__)
 #  include <fcntl.h>
@@ -29,6 +37,8 @@ using namespace std;
 #define LOCAL_FILE_HEADER_MARKER		0x04034b50
 #define CENTRAL_DIRECTORY_HEADER_MARKER	0x02014b50
 #define CENTRAL_DIRECTORY_END_MARKER	0x06054b50
+#define ZIP64_CENTRAL_DIRECTORY_END_MARKER	0x06064b50
+#define ZIP64_END_LOCATOR_MARKER		0x07064b50
 
 // These represent the number of possible extra pointers for each structure.  For instance,
 // a central directory end structure doesn't have to have any comments, so that extra
@@ -37,7 +47,8 @@ using namespace std;
 #define LOCAL_FILE_HEADER_EXTRA			(2*sizeof(uint8_t*))
 #define CENTRAL_DIRECTORY_HEADER_EXTRA	(3*sizeof(uint8_t*))
 #define CENTRAL_DIRECTORY_END_EXTRA		(1*sizeof(uint8_t*))
-#define ZIP_BUFFER_SIZE 1024
+// The central directory end is followed by a comment of at most 65535 bytes, so it lies within this many bytes of the end.
+#define ZIP_END_SEARCH_SIZE	(sizeof(ZIP_CentralDirectoryEnd) - CENTRAL_DIRECTORY_END_EXTRA + 0xFFFF)
 
 #define ZIP_ERROR_NONE											0x0000
 #define ZIP_ERROR_SYSTEM										0x0001
@@ -46,19 +57,66 @@ using namespace std;
 #define ZIP_ERROR_NO_CENTRAL_DIRECTORY_FOUND					0x0004
 #define ZIP_ERROR_EXTRACTING_CENTRAL_DIRECTORY_LISTINGS_FAILED	0x0005
 #define ZIP_ERROR_NOT_A_ZIP_FILE								0x0006
+#define ZIP_ERROR_UNSUPPORTED_METHOD							0x0007
+#define ZIP_ERROR_CORRUPT_MEMBER								0x0008
+#define ZIP_ERROR_MEMBER_NOT_FOUND								0x0009
+#define ZIP_ERROR_OUTPUT_TOO_SMALL								0x000A
+#define ZIP_ERROR_UNSAFE_PATH									0x000B
+#define ZIP_ERROR_NOT_STORED									0x000C
+#define ZIP_ERROR_CRC_MISMATCH									0x000D
+
+#define ZIP_METHOD_STORED		0
+#define ZIP_METHOD_DEFLATED		8
+#define ZIP_FLAG_ENCRYPTED		0x0001
+#define ZIP_FLAG_DATA_DESCRIPTOR	0x0008
+#define ZIP_CRC32_POLYNOMIAL	0xEDB88320
+
+// Fields of a classic record holding these values are stored in the ZIP64 records or extra field instead.
+#define ZIP64_SENTINEL_16		0xFFFF
+#define ZIP64_SENTINEL_32		0xFFFFFFFF
+#define ZIP64_EXTRA_TAG			0x0001
+#define ZIP64_VERSION_NEEDED	45
+// A ZIP64 extra field holding an uncompressed size, a compressed size and an offset.
+#define ZIP64_EXTRA_MAX_SIZE	(2*sizeof(uint16_t) + 3*sizeof(uint64_t))
+
+// The fixed part of a local file header, in front of the file name and extra field.
+#define ZIP_LOCAL_HEADER_SIZE	(sizeof(ZIP_LocalHeader) - LOCAL_FILE_HEADER_EXTRA)
+#define ZIP_EXTRACT_CHUNK		0x40000
+#define ZIP_MAX_THREADS			64
+// Bytes of zeroed slack kept past the end of a member extracted to memory, so a trailing partial AES block can be read.
+#define ZIP_MEMORY_SLACK		16
 
 #define CHUNK 16384
 
+#define ZIP_NO_NODE				0xFFFFFFFF
+
+#define ZIP_INDEX_MAGIC			0x5844495A	// "ZIDX"
+#define ZIP_INDEX_VERSION		2
+#define ZIP_INDEX_EXTENSION		".zidx"
+
+// Inflate checkpoints are recorded about every ZIP_CHECKPOINT_SPAN bytes of output, each holding the 32 KB deflate window.
+#define ZIP_CHECKPOINT_MAGIC		0x504B435A	// "ZCKP"
+#define ZIP_CHECKPOINT_VERSION		1
+#define ZIP_CHECKPOINT_EXTENSION	".zckp"
+#define ZIP_CHECKPOINT_SPAN			0x100000
+#define ZIP_WINDOW_SIZE				0x8000
+
 /**
  * A structure representing individual file nodes inside of a ZIP archive.
  */
 
 typedef struct ZIP_FileNode {
-	uint16_t	startingDisk;
-	uint32_t	offset;
-	uint32_t	compressedSize;
-	uint32_t	uncompressedSize;
+	uint32_t	startingDisk;
+	uint64_t	offset;
+	uint64_t	compressedSize;
+	uint64_t	uncompressedSize;
+	uint16_t	compressionMethod;
+	uint16_t	flags;
+	uint32_t	crc32;
 	char 		*fileName;
+	uint32_t	nameHash;		//!< Hash of the lowercased name, or zero for a member without one.
+	uint32_t	nextInSection;	//!< Index of the next member with the same section stem, or ZIP_NO_NODE.
+	struct ZIP_CheckpointIndex	*checkpoints;	//!< The member's inflate checkpoints, or NULL until a range read needs them.
 } ZIP_FileNode;
 
 /**
@@ -124,24 +182,228 @@ typedef struct ZIP_CentralDirectoryEnd {
 	uint8_t		*comment;
 }__attribute__((__packed__)) ZIP_CentralDirectoryEnd;
 
+/**
+ * A structure representing the ZIP64 central directory end record, which holds the 64-bit counts, size and offset of
+ * the central directory when they don't fit in ZIP_CentralDirectoryEnd.  For classic archives it is filled in from
+ * ZIP_CentralDirectoryEnd instead.
+ */
+
+typedef struct ZIP64_CentralDirectoryEnd {
+	uint32_t	sig;
+	uint64_t	recordSize;
+	uint16_t	versionMade;
+	uint16_t	versionNeeded;
+	uint32_t	numberOnDisk;
+	uint32_t	centralDirectoryDisk;
+	uint64_t	centralDirectoryNumOnDisk;
+	uint64_t	centralDirectoryTotalNum;
+	uint64_t	centralDirectorySize;
+	uint64_t	centralDirectoryOffset;
+}__attribute__((__packed__)) ZIP64_CentralDirectoryEnd;
+
+/**
+ * A structure representing the ZIP64 central directory end locator, found right in front of the central directory end.
+ */
+
+typedef struct ZIP64_EndLocator {
+	uint32_t	sig;
+	uint32_t	endDisk;
+	uint64_t	endOffset;
+	uint32_t	totalDisks;
+}__attribute__((__packed__)) ZIP64_EndLocator;
+
+/**
+ * The header of a central directory index sidecar.  It is followed by the archive's absolute path, count
+ * ZIP_IndexEntry records and the member names, each terminated by a NUL.  The index is only used while the
+ * archive's path, size, modification time and central directory end still match the ones recorded here.
+ */
+
+typedef struct ZIP_IndexHeader {
+	uint32_t	magic;
+	uint32_t	version;
+	uint64_t	archiveSize;
+	int64_t		mtimeSeconds;
+	int64_t		mtimeNanoseconds;
+	uint64_t	endOffset;			//!< Offset of the central directory end structure.
+	uint8_t		endRecord[sizeof(ZIP_CentralDirectoryEnd) - CENTRAL_DIRECTORY_END_EXTRA];	//!< The central directory end structure, without its comment.
+	uint32_t	count;				//!< Number of ZIP_IndexEntry records.
+	uint32_t	pathLength;			//!< Length of the archive path, without a terminator.
+	uint32_t	namesLength;		//!< Length of the member names, terminators included.
+}__attribute__((__packed__)) ZIP_IndexHeader;
+
+/**
+ * One member as recorded in a central directory index sidecar.
+ */
+
+typedef struct ZIP_IndexEntry {
+	uint64_t	offset;
+	uint64_t	compressedSize;
+	uint64_t	uncompressedSize;
+	uint32_t	crc32;
+	uint32_t	nameOffset;			//!< Offset of the member's name among the names, or 0xFFFFFFFF for none.
+	uint16_t	nameLength;
+	uint16_t	compressionMethod;
+	uint16_t	flags;
+	uint32_t	startingDisk;
+}__attribute__((__packed__)) ZIP_IndexEntry;
+
+/**
+ * A point inside a deflated member from which inflating can resume: the output offset it produces, the input
+ * offset of the first whole byte after it, and how many bits of the byte before that are still unread.
+ */
+
+typedef struct ZIP_Checkpoint {
+	uint64_t	uncompressedOffset;
+	uint64_t	compressedOffset;	//!< Relative to the start of the member's data.
+	uint8_t		bits;
+	uint8_t		reserved[7];
+}__attribute__((__packed__)) ZIP_Checkpoint;
+
+/**
+ * The header of a checkpoint sidecar, followed by count ZIP_Checkpoint records and count windows of
+ * ZIP_WINDOW_SIZE bytes.  It is only used while the archive's size and modification time, and the member's
+ * offset, sizes and CRC-32, still match the ones recorded here.
+ */
+
+typedef struct ZIP_CheckpointHeader {
+	uint32_t	magic;
+	uint32_t	version;
+	uint64_t	archiveSize;
+	int64_t		mtimeSeconds;
+	int64_t		mtimeNanoseconds;
+	uint64_t	offset;				//!< Offset of the member's local header.
+	uint64_t	compressedSize;
+	uint64_t	uncompressedSize;
+	uint32_t	crc32;
+	uint32_t	span;				//!< Output bytes between checkpoints when the index was built.
+	uint32_t	count;
+}__attribute__((__packed__)) ZIP_CheckpointHeader;
+
+/**
+ * The inflate checkpoints of one member, held in one block: either a mapping of its sidecar or an allocation.
+ */
+
+typedef struct ZIP_CheckpointIndex {
+	uint32_t		count;
+	ZIP_Checkpoint	*points;		//!< The checkpoints, in increasing output order.
+	uint8_t			*windows;		//!< The window in front of each checkpoint, ZIP_WINDOW_SIZE bytes apiece.
+	uint8_t			*block;
+	size_t			blockSize;
+	bool			mapped;			//!< Whether block is a sidecar mapping rather than an allocation.
+} ZIP_CheckpointIndex;
+
+/**
+ * New contents for one member of an archive being rewritten.
+ */
+
+typedef struct ZIP_Replacement {
+	const char		*fileName;		//!< The exact name of the member to replace.
+	const uint8_t	*data;			//!< The member's new, uncompressed contents.
+	size_t			length;
+} ZIP_Replacement;
+
+/**
+ * One member as it is laid out in a rewritten archive.
+ */
+
+typedef struct ZIP_RewriteEntry {
+	const uint8_t	*record;		//!< The member's central directory header in the original archive.
+	ZIP_FileNode	*node;
+	bool			replaced;		//!< Whether data is written instead of copying the original contents.
+	const uint8_t	*data;			//!< The replacement contents, as stored in the new archive.
+	uint8_t			*buffer;		//!< The allocation holding data when it was compressed, or NULL.
+	uint64_t		offset;			//!< Offset of the member's local header in the new archive.
+	uint64_t		compressedSize;
+	uint64_t		uncompressedSize;
+	uint32_t		crc32;
+	uint16_t		compressionMethod;
+} ZIP_RewriteEntry;
+
+class IMG3_ZipInterface;
+
+/**
+ * A structure describing the work handed to one extraction thread.  Members are handed out in archive order.
+ */
+
+typedef struct ZIP_ExtractJob {
+	IMG3_ZipInterface	*zip;		//!< Instance whose extraction routines are used.
+	int					archiveFd;	//!< Descriptor of the archive, shared by all threads and read with pread.
+	ZIP_FileNode		**members;	//!< Members to extract, sorted by archive offset.
+	uint32_t			count;		//!< Number of members.
+	volatile uint32_t	*next;		//!< Index of the next member to hand out, shared by all threads.
+	volatile int32_t	*failed;	//!< Set by the first thread whose member didn't extract cleanly.
+	int32_t				error;		//!< The error code of the failed member, if this thread was the first to fail.
+} ZIP_ExtractJob;
+
 /*! IMG3_ZipInterface class */
 
 class IMG3_ZipInterface {
 private:
 	FILE *fd;						//!< File descriptor representing the archive.
-	char buffer[ZIP_BUFFER_SIZE+1];	//!< A temporary buffer for storing file data.
-	list<ZIP_FileNode *> nodes;		//!< A list of all file nodes contained within the archive.
-	list<char *> files;				//!< A list of all files contained within the archive.
+	ZIP_FileNode *nodes;			//!< The file nodes of all members, in central directory order.
+	uint32_t nodeCount;				//!< The number of file nodes.
+	uint8_t *nodeBlock;				//!< The single allocation holding nodes, the hash slots and the name arena.
+	uint32_t *nameSlots;			//!< Open-addressed hash slots on lowercased names, holding node index + 1 or zero.
+	uint32_t *sectionSlots;			//!< Open-addressed hash slots on section stems, holding the first node index + 1 or zero.
+	uint32_t slotMask;				//!< The number of slots in each table, minus one.
+	char *nameArena;				//!< The NUL-terminated names of all members, or NULL when they live in indexMap.
+	uint8_t *indexMap;				//!< A mapping of the index sidecar the nodes were loaded from, or NULL.
+	size_t indexMapSize;			//!< The length of indexMap in bytes.
+	list<char *> files;				//!< A list of all files contained within the archive, pointing into the names.
 	int32_t errorCode;				//!< An error code value representing any error that might occur.
+	uint32_t threadCount;			//!< The number of threads used to extract several members at once.
+	uint8_t *archiveMap;			//!< A read-only mapping of the analyzed archive, or NULL until one is needed.
+	size_t archiveMapSize;			//!< The length of archiveMap in bytes.
+	uint64_t endOffset;				//!< The offset of the central directory end structure in the analyzed archive.
+	uint8_t indexCacheEnabled;		//!< Whether central directory index sidecars are used.
+	char *indexCacheDirectory;		//!< The directory holding index sidecars, or NULL to keep them next to the archive.
+	uint32_t checkpointSpan;		//!< The output bytes between inflate checkpoints of newly indexed members.
 
 	char * FindCentralDirectoryEnd(FILE *,long);  //!< A private function for determining the location of the central directory end.
-	int32_t ExtractCentralDirectoryListings(FILE *fd, ZIP_CentralDirectoryEnd *);  //!< A private function used to extract all central directory information.
+	int32_t FindZip64End(int archiveFd, ZIP_CentralDirectoryEnd *end, ZIP64_CentralDirectoryEnd *end64); //!< A private function for reading the ZIP64 central directory end, if the archive has one.
+	int32_t ExtractCentralDirectoryListings(FILE *fd, ZIP64_CentralDirectoryEnd *);  //!< A private function used to extract all central directory information.
+	int32_t ReadZip64Extra(ZIP_FileNode *node, ZIP_CentralDirectoryHeader *dirHeader, const uint8_t *extra); //!< A private function for taking 64-bit sizes and offsets from a ZIP64 extra field.
+
+	char * IndexCachePath(const char *archiveName); //!< A private function for naming the index sidecar of an archive.
+	int32_t LoadIndexCache(const char *archiveName, FILE *fd, long fileSize); //!< A private function for rebuilding the file nodes from a matching index sidecar.
+	int32_t SaveIndexCache(const char *archiveName, FILE *fd, long fileSize, ZIP_CentralDirectoryEnd *end); //!< A private function for writing the index sidecar of the analyzed archive.
+	char * CheckpointCachePath(const char *archiveName, ZIP_FileNode *node); //!< A private function for naming the checkpoint sidecar of a member.
+	int32_t LoadCheckpoints(const char *archiveName, int archiveFd, ZIP_FileNode *node); //!< A private function for mapping a member's matching checkpoint sidecar.
+	int32_t SaveCheckpoints(const char *archiveName, int archiveFd, ZIP_FileNode *node); //!< A private function for writing a member's checkpoint sidecar.
+	int32_t BuildCheckpoints(int archiveFd, ZIP_FileNode *node); //!< A private function for inflating a whole member once to record its checkpoints.
+	int32_t InflateRange(int archiveFd, ZIP_FileNode *node, ZIP_Checkpoint *start, const uint8_t *window, uint64_t offset, uint8_t *buffer, size_t length); //!< A private function for inflating part of a member from a checkpoint.
+	void ReleaseCheckpoints(); //!< A private function for freeing the checkpoints of all nodes.
 
 #ifdef IMG3_DEBUG
 	void PrintCentralDirectoryListing(ZIP_CentralDirectoryHeader *hdr); //!< A private debug function for printing out central directory listings.
 	void PrintCentralDirectoryEnd(ZIP_CentralDirectoryEnd *ptr);	//!< A private debug function for printing out central directory end information.
 #endif
 	void ResetData(); //!< A private function for resetting all private variable in the class.
+	void ReleaseNodes(); //!< A private function for freeing the node table, hash slots and name arena.
+	int32_t AllocateNodes(uint64_t count, uint64_t namesLength); //!< A private function for allocating the node table and name arena in one block.
+	void IndexNodes(); //!< A private function for hashing the names and section stems of all nodes.
+	uint32_t FindSection(const char *section); //!< A private function for finding the first member whose section stem is section.
+	uint32_t SelectSection(const char *section, ZIP_FileNode **selected); //!< A private function for collecting the members a section string selects.
+	uint32_t SelectMembers(IMG3_ZipSelector *selector, const char *section, ZIP_FileNode **selected); //!< A private function for collecting the members a selector and section select in one pass.
+	list<char *> * ExtractSelection(int archiveFd, const char *archiveName, ZIP_FileNode **members, uint32_t count); //!< A private function for extracting selected members and listing their names.
+
+	ZIP_FileNode * FindNode(const char *fileName); //!< A private function for looking up the node of a file by name.
+	int OpenArchive(const char *archiveName); //!< A private function for opening an archive for extraction, analyzing it first if needed.
+	int32_t ReadArchive(int archiveFd, uint8_t *data, size_t length, off_t offset); //!< A private function for reading an exact range of the archive.
+	int32_t WriteOutput(int outFd, uint8_t *data, size_t length); //!< A private function for writing all of a buffer to a file.
+	int32_t MapArchive(int archiveFd); //!< A private function for mapping the analyzed archive read-only.
+	int32_t CopyRange(int archiveFd, off_t offset, int outFd, size_t length); //!< A private function for copying a range of the archive into a file inside the kernel.
+	int32_t LocateData(int archiveFd, ZIP_FileNode *node, off_t *dataOffset); //!< A private function for finding a member's data behind its local header.
+	int32_t ExtractNode(int archiveFd, ZIP_FileNode *node, uint8_t *outbuff, size_t outsize, int outFd); //!< A private function for inflating or copying one member into a buffer or a file.
+	int32_t ExtractNodeToPath(int archiveFd, ZIP_FileNode *node); //!< A private function for extracting one member to its path under the current directory.
+	int32_t ExtractMembers(int archiveFd, ZIP_FileNode **members, uint32_t count); //!< A private function for extracting a set of members, in parallel when several threads are selected.
+	static void * ExtractThread(void *arg); //!< A private thread routine extracting members until none are left.
+
+	uint8_t * ReadCentralDirectory(int archiveFd, ZIP_CentralDirectoryEnd *end, ZIP64_CentralDirectoryEnd *end64, uint8_t **comment); //!< A private function for reading the raw central directory and end structure of the analyzed archive.
+	int32_t CompressReplacement(ZIP_Replacement *replacement, ZIP_RewriteEntry *entry); //!< A private function for compressing a member's new contents.
+	int32_t WriteLocalHeader(int outFd, ZIP_RewriteEntry *entry); //!< A private function for writing a member's regenerated local header.
+	size_t BuildCentralHeader(uint8_t *out, ZIP_RewriteEntry *entry); //!< A private function for regenerating a member's central directory header.
+	int32_t WriteDirectoryEnd(int outFd, uint64_t directoryOffset, uint64_t directorySize, ZIP_CentralDirectoryEnd *end, uint8_t *comment); //!< A private function for writing the central directory end structures.
 
 public:
 	IMG3_ZipInterface();	//!< A public constructor for the IMG3_ZipInterface class.
@@ -149,7 +411,21 @@ public:
 
 	list<char *> * AnalyzeFile(const char *fileName);	// A public method for analyzing ZIP archives to determine files contained therein.
 	list<char *> * ExtractFiles(const char *archiveName, char *section); // A public method for extracting single files from a ZIP archive.
+	list<char *> * ExtractFiles(const char *archiveName, IMG3_ZipSelector *selector, const char *section = NULL); // A public method for extracting every file a selector and section select from a ZIP archive.
 	int32_t ExtractAllFiles(const char *archiveName); // A public method for extracting all files contained in the specified ZIP archive.
+	int32_t ExtractFile(const char *archiveName, const char *fileName, uint8_t *outbuff, size_t outsize, size_t *written); // A public method for extracting one file into a caller-supplied buffer.
+	int32_t ExtractFile(const char *archiveName, const char *fileName, int outFd); // A public method for extracting one file into an open file descriptor.
+	int32_t ExtractFileToMemory(const char *archiveName, const char *fileName, uint8_t **data, size_t *length, size_t *mapSize); // A public method for extracting one file into an anonymous mapping.
+	static void ReleaseFileMemory(uint8_t *data, size_t mapSize); // A public method for releasing a mapping returned by ExtractFileToMemory.
+	list<char *> * MatchFiles(const char *section); // A public method for listing the analyzed files whose name includes the section string.
+	list<char *> * MatchFiles(IMG3_ZipSelector *selector, const char *section = NULL); // A public method for listing the analyzed files a selector and section select.
+	int32_t MapFile(const char *archiveName, const char *fileName, const uint8_t **data, size_t *length); // A public method for viewing a stored file in place through a mapping of the archive.
+	int32_t ReadFileRange(const char *archiveName, const char *fileName, uint64_t offset, uint8_t *buffer, size_t length, size_t *bytesRead); // A public method for reading part of a file without extracting the rest of it.
+	int32_t RewriteArchive(const char *archiveName, const char *outputName, ZIP_Replacement *replacements, uint32_t count); // A public method for writing a copy of an archive with some files replaced, without recompressing the others.
+	int32_t SetCheckpointSpan(uint32_t span); // A public method for selecting how many output bytes lie between inflate checkpoints.
+	int32_t SetIndexCache(uint8_t enabled, const char *directory); // A public method for caching parsed central directories in sidecars, next to the archive or in directory.
+	int32_t SetThreadCount(uint32_t threads); // A public method for selecting the number of threads used to extract several members; zero selects one per online processor.
+	uint32_t GetThreadCount( void ) { return threadCount; } // A public method for retrieving the number of extraction threads.
 	int32_t GetError( void ) { return errorCode; }	// A public method for retrieving the last error message the class instance encountered.
 };
 
@@ -0,0 +1,73 @@
+/*! \file IMG3_ZipSelector.h
+	\version 1.0
+
+	This is a C++ class for selecting members of a ZIP archive by name.  Any number of include and
+	exclude patterns are compiled once when they are added, then every member name is tested against
+	all of them in a single pass over the archive's member table.
+ */
+
+#ifndef IMG3_ZIPSELECTOR_H_
+#define IMG3_ZIPSELECTOR_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <regex.h>
+#include <list>
+
+using namespace std;
+
+#define ZIP_SELECTOR_ERROR_NONE				0x0000
+#define ZIP_SELECTOR_ERROR_INVALID_PATTERN	0x0001
+
+#define ZIP_PATTERN_PREFIX_GLOB		"glob:"
+#define ZIP_PATTERN_PREFIX_REGEX	"re:"
+#define ZIP_PATTERN_PREFIX_SECTION	"section:"
+
+/**
+ * The kinds of pattern a selector understands.  All of them ignore case.
+ */
+
+typedef enum ZIP_PatternType {
+	ZIP_PATTERN_AUTO		= 0,	//!< Chosen from a "glob:", "re:" or "section:" prefix; otherwise a glob if it holds *, ? or [, else a section.
+	ZIP_PATTERN_SECTION		= 1,	//!< Matches members whose section stem, their base name up to the first dot, is the pattern.
+	ZIP_PATTERN_GLOB		= 2,	//!< Shell glob over the whole name, or over the base name when it has no slash; ** also crosses slashes, and **/ matches zero or more directories.
+	ZIP_PATTERN_REGEX		= 3,	//!< POSIX extended regular expression, found anywhere in the name unless anchored.
+} ZIP_PatternType;
+
+/**
+ * A structure holding one compiled pattern.
+ */
+
+typedef struct ZIP_Pattern {
+	ZIP_PatternType	type;
+	char			*text;			//!< The section name, for section patterns.
+	size_t			length;			//!< The length of text.
+	uint8_t			baseName;		//!< Whether a glob is matched against the base name only.
+	regex_t			regex;			//!< The compiled form of glob and regex patterns.
+} ZIP_Pattern;
+
+/*! IMG3_ZipSelector class */
+
+class IMG3_ZipSelector {
+private:
+	list<ZIP_Pattern *> includes;	//!< Patterns of which a member must match at least one, unless there are none.
+	list<ZIP_Pattern *> excludes;	//!< Patterns of which a member must match none.
+	int32_t errorCode;				//!< An error code value representing any error that might occur.
+
+	ZIP_Pattern * Compile(const char *pattern, ZIP_PatternType type); //!< A private function for compiling one pattern.
+	static bool MatchPattern(ZIP_Pattern *pattern, const char *name, const char *baseName, size_t stemLength); //!< A private function for testing one name against one pattern.
+
+public:
+	IMG3_ZipSelector();				//!< A public constructor for the IMG3_ZipSelector class.
+	virtual ~IMG3_ZipSelector();	//!< A public deconstructor for the IMG3_ZipSelector class.
+
+	int32_t Include(const char *pattern, ZIP_PatternType type = ZIP_PATTERN_AUTO); // A public method for adding a pattern members may match to be selected.
+	int32_t Exclude(const char *pattern, ZIP_PatternType type = ZIP_PATTERN_AUTO); // A public method for adding a pattern that keeps matching members out.
+	bool Matches(const char *name); // A public method for testing whether a member name is selected.
+	bool Included(const char *name); // A public method for testing whether a member name matches an include pattern, or there are none.
+	bool Excluded(const char *name); // A public method for testing whether a member name matches an exclude pattern.
+	bool HasIncludes( void ) { return !includes.empty(); }	// A public method for telling whether any include patterns were added.
+	int32_t GetError( void ) { return errorCode; }	// A public method for retrieving the last error the class instance encountered.
+};
+
+#endif /* IMG3_ZIPSELECTOR_H_ */
@@ -11,6 +11,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <arpa/inet.h>
 #include <list>
 
 #include "IMG3_defines.h"
@@ -21,10 +22,10 @@ using namespace std;
 
 extern char img3SupportedFiles[][30];
 
-int32_t PatchKernelFile( char *archiveFileName, char *outputFileName, char *patchFileName, char *deviceName, char *deviceVersion );
+int32_t PatchKernelFile( char *archiveFileName, char *outputFileName, char *patchFileName, char *deviceName, char *deviceVersion, uint8_t repack );
 int32_t DecryptIMG3File( char *archiveFileName, char *outputFileName, char *deviceName, char *deviceVersion, char *section );
 int32_t ListArchiveFiles( char *archiveFileName );
-int32_t ExtractFileFromArchive( char *archiveFileName, char *section );
+int32_t ExtractFileFromArchive( char *archiveFileName, char *section, list< char * > *includes, list< char * > *excludes );
 int32_t UpdateIMG3Database( char *archiveFileName, char *deviceName, char *deviceVersion, char *deviceBuild );
 void ParseIMG3File( char *fileName );
 int32_t DecompressLZSSFile( char *fileName );